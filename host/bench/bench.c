@@ -0,0 +1,375 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Benchmark runner. Every benchmark is calibrated to --min-time per
+ * repetition and run --repetitions times; the median and the minimum time
+ * per iteration are reported. With --baseline, the minimum is compared to
+ * the stored value and the run fails when it is more than --tolerance
+ * percent slower. --save writes the current numbers as the new baseline.
+ *
+ * Times are compared as multiples of a fixed calibration loop, run before
+ * every repetition, so a baseline from one machine can be checked on
+ * another and a host whose speed drifts during the run does not fail it.
+ * The baseline stores the median repetition and a run is judged by its best
+ * one, and a benchmark found slower is run again before it counts as a
+ * regression: shared hosts slow down single repetitions and single runs.
+ * No calibration makes up for different optimization levels, a baseline is
+ * only compared by a build of the same CMAKE_BUILD_TYPE. */
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "esp_log.h"
+#include "bench.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define BENCH_CALIBRATION   "calibration"
+#define BENCH_CALIB_ENTRIES (64)
+#define BENCH_RETRIES       (2)     /* runs of a benchmark found slower, before it counts */
+#define BENCH_BUILD_LINE    "# build "
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE    "unknown"
+#endif
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    bench_fn_t fn;
+    const char *name;
+    int64_t arg;
+    double median_ns;
+    double min_ns;
+    double best_ratio;      /* to the calibration loop run just before, 0 if not run */
+    double median_ratio;
+    uint64_t iterations;
+} bench_t;
+
+typedef struct {
+    char name[64];
+    double ns;
+} bench_baseline_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static bench_t s_benches[BENCH_MAX];
+static int s_bench_count = 0;
+static int64_t s_start_ns;
+static int64_t s_elapsed_ns;
+
+static bench_baseline_t s_baseline[BENCH_MAX];
+static int s_baseline_count = 0;
+
+static const char *s_filter = NULL;
+static const char *s_save_path = NULL;
+static const char *s_baseline_path = NULL;
+static double s_min_time_s = 0.1;
+static int s_repetitions = 5;
+static double s_tolerance_pct = 20;
+static double s_baseline_calib_ns = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_register(bench_fn_t fn, const char *name, int64_t arg)
+{
+    if (s_bench_count == BENCH_MAX) {
+        fprintf(stderr, "bench: too many benchmarks, raise BENCH_MAX\n");
+        exit(1);
+    }
+    s_benches[s_bench_count++] = (bench_t) { .fn = fn, .name = name, .arg = arg };
+}
+
+void bench_timer_start(bench_state_t *state)
+{
+    s_start_ns = now_ns();
+}
+
+void bench_timer_stop(bench_state_t *state)
+{
+    s_elapsed_ns = now_ns() - s_start_ns;
+}
+
+/* Table scans and byte arithmetic in cache, no library calls whose speed depends on the heap */
+static void bench_calibration(bench_state_t *state)
+{
+    static uint8_t table[BENCH_CALIB_ENTRIES][6];
+    uint8_t key[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x00 };
+    uint32_t x = 1;
+
+    for (int i = 0; i < BENCH_CALIB_ENTRIES; ++i) {
+        memcpy(table[i], key, 6);
+        table[i][5] = i * 2;
+    }
+    BENCH_LOOP(state) {
+        x = x * 1103515245 + 12345;
+        key[5] = (x >> 16) & 0x7f;
+        int found = -1;
+        for (int i = 0; i < BENCH_CALIB_ENTRIES && found < 0; ++i) {
+            if (memcmp(table[i], key, 6) == 0) {
+                found = i;
+            }
+        }
+        uint32_t crc = ~0u;
+        for (int i = 0; i < BENCH_CALIB_ENTRIES; ++i) {
+            crc ^= table[i][5];
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = crc >> 1 ^ (0xedb88320 & -(crc & 1));
+            }
+        }
+        bench_do_not_optimize(found);
+        bench_do_not_optimize(crc);
+        bench_clobber();
+    }
+}
+
+static bench_t s_calibration = { .fn = bench_calibration, .name = BENCH_CALIBRATION };
+
+static int64_t run_once(const bench_t *bench, uint64_t iterations)
+{
+    bench_state_t state = { .iterations = iterations, .arg = bench->arg };
+    s_elapsed_ns = 0;
+    bench->fn(&state);
+    return s_elapsed_ns;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_bench(bench_t *bench)
+{
+    const int64_t target_ns = (int64_t) (s_min_time_s * 1e9);
+    uint64_t iterations = 1;
+    int64_t t;
+    double per_iter[s_repetitions];
+    double ratio[s_repetitions];
+
+    // grow until the loop is long enough to scale from
+    while ((t = run_once(bench, iterations)) < target_ns / 10 && iterations < (1ULL << 40)) {
+        iterations *= 10;
+    }
+    if (t > 0) {
+        iterations = iterations * (double) target_ns / t + 1;
+    }
+    for (int i = 0; i < s_repetitions; ++i) {
+        double calib_ns = 0;
+        if (s_calibration.iterations && bench != &s_calibration) {
+            calib_ns = (double) run_once(&s_calibration, s_calibration.iterations) / s_calibration.iterations;
+        }
+        per_iter[i] = (double) run_once(bench, iterations) / iterations;
+        ratio[i] = calib_ns ? per_iter[i] / calib_ns : 0;
+    }
+    qsort(per_iter, s_repetitions, sizeof(double), cmp_double);
+    qsort(ratio, s_repetitions, sizeof(double), cmp_double);
+    bench->iterations = iterations;
+    bench->min_ns = per_iter[0];
+    bench->median_ns = per_iter[s_repetitions / 2];
+    bench->best_ratio = ratio[0];
+    bench->median_ratio = ratio[s_repetitions / 2];
+}
+
+static void baseline_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    char build[64] = "unknown";
+
+    if (f == NULL) {
+        perror(path);
+        exit(2);
+    }
+    while (fgets(line, sizeof(line), f) && s_baseline_count < BENCH_MAX) {
+        bench_baseline_t *b = &s_baseline[s_baseline_count];
+        if (strncmp(line, BENCH_BUILD_LINE, strlen(BENCH_BUILD_LINE)) == 0) {
+            sscanf(line + strlen(BENCH_BUILD_LINE), "%63s", build);
+        } else if (line[0] != '#' && sscanf(line, "%63s %lf", b->name, &b->ns) == 2) {
+            s_baseline_count++;
+        }
+    }
+    fclose(f);
+    if (strcmp(build, BENCH_BUILD_TYPE) != 0) {
+        fprintf(stderr, "%s: recorded by a %s build, this is a %s build. Configure with "
+                "-DCMAKE_BUILD_TYPE=%s to compare.\n", path, build, BENCH_BUILD_TYPE, build);
+        exit(2);
+    }
+}
+
+static const bench_baseline_t *baseline_find(const char *name)
+{
+    for (int i = 0; i < s_baseline_count; ++i) {
+        if (strcmp(s_baseline[i].name, name) == 0) {
+            return &s_baseline[i];
+        }
+    }
+    return NULL;
+}
+
+/* Percent slower than the baseline, expected_ns is the baseline at this run's calibration time */
+static double baseline_change(const bench_t *bench, const bench_baseline_t *base, double *expected_ns)
+{
+    if (s_baseline_calib_ns == 0) {
+        *expected_ns = base->ns;
+        return 100.0 * (bench->min_ns - base->ns) / base->ns;
+    }
+    double base_ratio = base->ns / s_baseline_calib_ns;
+    *expected_ns = base_ratio * bench->min_ns / bench->best_ratio;
+    return 100.0 * (bench->best_ratio - base_ratio) / base_ratio;
+}
+
+static void baseline_save(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    struct utsname host;
+
+    if (f == NULL) {
+        perror(path);
+        exit(2);
+    }
+    uname(&host);
+    fprintf(f, "# Median ns per iteration of host/bench at the calibration time below, compared\n");
+    fprintf(f, "# by 'bench --baseline'. Recorded on %s, gcc %s.\n", host.machine, __VERSION__);
+    fprintf(f, "# Regenerate with 'bench --save' after an intended change.\n");
+    fprintf(f, BENCH_BUILD_LINE "%s\n", BENCH_BUILD_TYPE);
+    fprintf(f, "%-40s %10.1f\n", s_calibration.name, s_calibration.min_ns);
+    for (int i = 0; i < s_bench_count; ++i) {
+        if (s_benches[i].iterations) {
+            fprintf(f, "%-40s %10.1f\n", s_benches[i].name, s_benches[i].median_ratio * s_calibration.min_ns);
+        }
+    }
+    fclose(f);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -f, --filter TEXT      only benchmarks whose name contains TEXT\n"
+            "  -t, --min-time S       time per repetition (default %.2f)\n"
+            "  -r, --repetitions N    repetitions per benchmark (default %d)\n"
+            "  -b, --baseline FILE    compare to FILE, fail on regressions\n"
+            "  -T, --tolerance PCT    allowed slowdown against the baseline (default %.0f)\n"
+            "  -s, --save FILE        write the results as a new baseline\n"
+            "  -l, --list             list the benchmarks\n",
+            prog, s_min_time_s, s_repetitions, s_tolerance_pct);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "filter", required_argument, NULL, 'f' },
+        { "min-time", required_argument, NULL, 't' },
+        { "repetitions", required_argument, NULL, 'r' },
+        { "baseline", required_argument, NULL, 'b' },
+        { "tolerance", required_argument, NULL, 'T' },
+        { "save", required_argument, NULL, 's' },
+        { "list", no_argument, NULL, 'l' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "f:t:r:b:T:s:lh", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'f': s_filter = optarg; break;
+        case 't': s_min_time_s = atof(optarg); break;
+        case 'r': s_repetitions = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'b': s_baseline_path = optarg; break;
+        case 'T': s_tolerance_pct = atof(optarg); break;
+        case 's': s_save_path = optarg; break;
+        case 'l':
+            for (int i = 0; i < s_bench_count; ++i) {
+                printf("%s\n", s_benches[i].name);
+            }
+            return 0;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    if (s_baseline_path) {
+        baseline_load(s_baseline_path);
+    }
+    // the code under test logs, the benchmarks measure it with logging filtered out
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    if (s_baseline_path || s_save_path) {
+        run_bench(&s_calibration);
+        const bench_baseline_t *base = s_baseline_path ? baseline_find(BENCH_CALIBRATION) : NULL;
+        if (base) {
+            s_baseline_calib_ns = base->ns;
+            printf("Calibration loop: %.1f ns, %.1f ns in %s\n\n", s_calibration.min_ns, base->ns, s_baseline_path);
+        } else if (s_baseline_path) {
+            printf("No calibration in %s, baseline compared as recorded\n\n", s_baseline_path);
+        }
+    }
+
+    int regressions = 0;
+    printf("%-40s %10s %10s %12s %10s %8s\n", "Benchmark", "Time(ns)", "Min(ns)", "Iterations", "Base(ns)", "Change");
+    for (int i = 0; i < s_bench_count; ++i) {
+        bench_t *bench = &s_benches[i];
+        if (s_filter && strstr(bench->name, s_filter) == NULL) {
+            continue;
+        }
+        const bench_baseline_t *base = s_baseline_path ? baseline_find(bench->name) : NULL;
+        double change = 0, expected_ns = 0;
+        int runs = 0;
+        run_bench(bench);
+        if (base) {
+            change = baseline_change(bench, base, &expected_ns);
+        }
+        while (change > s_tolerance_pct && runs++ < BENCH_RETRIES) {
+            bench_t again = *bench;
+            double again_expected_ns;
+            run_bench(&again);
+            double again_change = baseline_change(&again, base, &again_expected_ns);
+            if (again_change < change) {
+                *bench = again;
+                change = again_change;
+                expected_ns = again_expected_ns;
+            }
+        }
+        printf("%-40s %10.1f %10.1f %12llu", bench->name, bench->median_ns, bench->min_ns,
+               (unsigned long long) bench->iterations);
+        if (base) {
+            bool regressed = change > s_tolerance_pct;
+            regressions += regressed;
+            printf(" %10.1f %+7.1f%%%s", expected_ns, change, regressed ? "  REGRESSION" : runs ? "  (rerun)" : "");
+        } else if (s_baseline_path) {
+            printf(" %10s %8s", "-", "new");
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (s_save_path) {
+        baseline_save(s_save_path);
+    }
+    if (regressions) {
+        printf("%d benchmark(s) more than %.0f%% slower than %s\n", regressions, s_tolerance_pct, s_baseline_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Minimal micro-benchmark harness in the style of Google Benchmark:
+ *
+ *   static void bench_foo(bench_state_t *state)
+ *   {
+ *       setup();
+ *       BENCH_LOOP(state) {
+ *           bench_do_not_optimize(foo(state->arg));
+ *       }
+ *   }
+ *   BENCH_REGISTER(bench_foo, "foo", 50);
+ *
+ * The runner picks the iteration count, times only the loop and reports
+ * nanoseconds per iteration. */
+#pragma once
+
+#include <stdint.h>
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define BENCH_MAX   (64)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    uint64_t iterations;    /* set by the runner */
+    int64_t arg;            /* BENCH_REGISTER argument */
+} bench_state_t;
+
+typedef void (*bench_fn_t)(bench_state_t *state);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+void bench_register(bench_fn_t fn, const char *name, int64_t arg);
+void bench_timer_start(bench_state_t *state);
+void bench_timer_stop(bench_state_t *state);
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define BENCH_CAT_(a, b)    a##b
+#define BENCH_CAT(a, b)     BENCH_CAT_(a, b)
+
+#define BENCH_REGISTER(fn, name, arg)                                   \
+    __attribute__((constructor)) static void BENCH_CAT(fn##_reg_, __LINE__)(void) \
+    {                                                                   \
+        bench_register(fn, name, arg);                                  \
+    }
+
+/* Timed loop, setup before it and teardown after it are not measured */
+#define BENCH_LOOP(state)                                               \
+    for (uint64_t _i = (bench_timer_start(state), 0); _i < (state)->iterations || \
+         (bench_timer_stop(state), 0); ++_i)
+
+/* Keep a value alive without emitting any code for it */
+#define bench_do_not_optimize(value)                                    \
+    do {                                                                \
+        __typeof__(value) _v = (value);                                 \
+        __asm__ volatile("" : : "g"(_v) : "memory");                    \
+    } while (0)
+
+/* Make the compiler assume all memory was read and written */
+#define bench_clobber() __asm__ volatile("" : : : "memory")
@@ -0,0 +1,330 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+
+#include "esp_netif.h"
+#include "esp_mesh.h"
+#include "cJSON.h"
+
+#include "mesh_netif.h"
+#include "traffic_light.h"
+#include "rpc.h"
+#include "occupancy.h"
+#include "mqtt_pub.h"
+#include "mqtt_app.h"
+#include "signal_table.h"
+#include "bench.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void route_table_fill(mesh_addr_t *table, int size)
+{
+    for (int i = 0; i < size; ++i) {
+        const uint8_t mac[6] = { 0x24, 0x0a, 0xc4, 0x00, (i * 2) >> 8, (i * 2) & 0xff };
+        memcpy(table[i].addr, mac, 6);
+    }
+}
+
+static void bench_traffic_light_process(bench_state_t *state)
+{
+    mesh_traffic_light_ctl_t ctl = { .cmd = CMD_TRAFFIC_LIGHT, .set = state->arg, .state = TRAFFIC_LIGHT_GREEN };
+    mesh_addr_t from = { 0 };
+
+    traffic_light_init();
+    BENCH_LOOP(state) {
+        bench_do_not_optimize(traffic_light_process(&from, (uint8_t *) &ctl, sizeof(ctl)));
+    }
+}
+BENCH_REGISTER(bench_traffic_light_process, "traffic_light_process/set", 1);
+BENCH_REGISTER(bench_traffic_light_process, "traffic_light_process/clear", 0);
+
+static void bench_telemetry_build(bench_state_t *state)
+{
+    // the phase change telemetry of traffic_light_control()
+    BENCH_LOOP(state) {
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddNumberToObject(root, "semaforo_coches", 2);
+        cJSON_AddNumberToObject(root, "semaforo_peaton", 0);
+        bench_do_not_optimize(root);
+        cJSON_Delete(root);
+    }
+}
+BENCH_REGISTER(bench_telemetry_build, "telemetry/build", 0);
+
+static void bench_telemetry_print(bench_state_t *state)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "semaforo_coches", 2);
+    cJSON_AddNumberToObject(root, "semaforo_peaton", 0);
+
+    BENCH_LOOP(state) {
+        char *json = cJSON_PrintUnformatted(root);
+        bench_do_not_optimize(json);
+        cJSON_free(json);
+    }
+    cJSON_Delete(root);
+}
+BENCH_REGISTER(bench_telemetry_print, "telemetry/print", 0);
+
+static void bench_rpc_parse(bench_state_t *state)
+{
+    static const char topic[] = RPC_REQUEST_TOPIC "1234";
+    static const char data[] = "{\"method\":\"preempt\",\"params\":"
+                               "{\"node\":\"24:0a:c4:00:00:02\",\"group\":0,\"active\":true}}";
+    rpc_msg_t msg;
+    uint8_t node[6];
+    bool has_node;
+
+    BENCH_LOOP(state) {
+        bench_do_not_optimize(rpc_parse(topic, sizeof(topic) - 1, data, sizeof(data) - 1, &msg, node, &has_node));
+    }
+}
+BENCH_REGISTER(bench_rpc_parse, "rpc/parse", 0);
+
+static void bench_rpc_reply(bench_state_t *state)
+{
+    rpc_msg_t msg = { .method = RPC_METHOD_PREEMPT, .id = 1234, .phase = 1, .vehicles = 2, .actuation_us = 180 };
+    char reply[RPC_REPLY_MAX];
+
+    BENCH_LOOP(state) {
+        bench_do_not_optimize(rpc_format_reply(reply, sizeof(reply), &msg, 24300));
+    }
+}
+BENCH_REGISTER(bench_rpc_reply, "rpc/reply", 0);
+
+static void bench_occupancy_edges(bench_state_t *state)
+{
+    // one PIR pulse per iteration, merged into intervals by the hold-off
+    occupancy_t occ;
+    occupancy_interval_t interval;
+    occupancy_window_t window;
+    int64_t t_us = 0;
+
+    occupancy_init(&occ, OCCUPANCY_HOLD_OFF_MS_DEFAULT, OCCUPANCY_WINDOW_S_DEFAULT, t_us);
+    BENCH_LOOP(state) {
+        occupancy_input(&occ, true, t_us);
+        occupancy_input(&occ, false, t_us + 1000000);
+        t_us += 1000000 + (t_us & 0x100000 ? 500000 : 3000000);
+        bench_do_not_optimize(occupancy_interval(&occ, t_us, &interval));
+        bench_do_not_optimize(occupancy_window(&occ, t_us, &window));
+    }
+}
+BENCH_REGISTER(bench_occupancy_edges, "occupancy/edges", 0);
+
+static void bench_mqtt_pub_record(bench_state_t *state)
+{
+    // what a producer pays for the phase change telemetry; runs before the
+    // publisher task is started, so the bench drains the queue itself
+    static mqtt_pub_queue_t *queue = NULL;
+
+    if (queue == NULL) {
+        queue = mqtt_pub_queue_create("bench", 8);
+    }
+    BENCH_LOOP(state) {
+        mqtt_pub_record_t *rec = mqtt_pub_begin(queue, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_CONTROL);
+        mqtt_pub_add(rec, "semaforo_coches", 2);
+        mqtt_pub_add(rec, "semaforo_peaton", 0);
+        mqtt_pub_commit(queue);
+        queue->tail = queue->head;
+    }
+}
+BENCH_REGISTER(bench_mqtt_pub_record, "mqtt_pub/record", 0);
+
+static void bench_mqtt_pub_format(bench_state_t *state)
+{
+    mqtt_pub_record_t rec = { .topic = MQTT_PUB_TELEMETRY };
+    char topic[MQTT_PUB_TOPIC_MAX];
+    char json[MQTT_PUB_JSON_MAX];
+
+    mqtt_pub_add(&rec, "semaforo_coches", 2);
+    mqtt_pub_add(&rec, "semaforo_peaton", 0);
+    BENCH_LOOP(state) {
+        bench_do_not_optimize(mqtt_pub_format(&rec, topic, json, sizeof(json)));
+    }
+}
+BENCH_REGISTER(bench_mqtt_pub_format, "mqtt_pub/format", 0);
+
+static esp_err_t sink_transmit(void *h, void *buffer, size_t len)
+{
+    bench_do_not_optimize(buffer);
+    return ESP_OK;
+}
+
+static void bench_mqtt_app_publish(bench_state_t *state)
+{
+    static bool started = false;
+
+    // station netif whose driver drops the frame: serialization and framing only
+    if (!started) {
+        esp_netif_driver_ifconfig_t driver = { .transmit = sink_transmit };
+        esp_netif_config_t cfg = {
+            .base = &ESP_NETIF_INHERENT_DEFAULT_WIFI_STA(),
+            .driver = &driver,
+        };
+        esp_netif_new(&cfg);
+        mqtt_app_start();
+        started = true;
+    }
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "semaforo_coches", 2);
+    cJSON_AddNumberToObject(root, "semaforo_peaton", 0);
+
+    BENCH_LOOP(state) {
+        mqtt_app_publish("v1/devices/me/telemetry", root);
+    }
+    cJSON_Delete(root);
+}
+BENCH_REGISTER(bench_mqtt_app_publish, "mqtt_app_publish/telemetry", 0);
+
+static void bench_route_table_lookup(bench_state_t *state)
+{
+    static mesh_addr_t table[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    int size = state->arg;
+    mesh_addr_t key;
+
+    // worst case, the address is the last entry
+    route_table_fill(table, size);
+    key = table[size - 1];
+    BENCH_LOOP(state) {
+        int found = -1;
+        for (int i = 0; i < size; ++i) {
+            if (MAC_ADDR_EQUAL(table[i].addr, key.addr)) {
+                found = i;
+                break;
+            }
+        }
+        bench_do_not_optimize(found);
+        bench_clobber();
+    }
+}
+BENCH_REGISTER(bench_route_table_lookup, "route_table/lookup/50", 50);
+BENCH_REGISTER(bench_route_table_lookup, "route_table/lookup/245", (MESH_MPS - 1) / 6);
+
+static void bench_broadcast_skip_self(bench_state_t *state)
+{
+    static mesh_addr_t table[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    int size = state->arg;
+    uint8_t self[6];
+
+    // the per-destination test of mesh_netif_transmit_from_root_ap(), without the send
+    route_table_fill(table, size);
+    memcpy(self, table[0].addr, 6);
+    BENCH_LOOP(state) {
+        int sent = 0;
+        for (int i = 0; i < size; ++i) {
+            if (MAC_ADDR_EQUAL(table[i].addr, self)) {
+                continue;
+            }
+            sent++;
+        }
+        bench_do_not_optimize(sent);
+        bench_clobber();
+    }
+}
+BENCH_REGISTER(bench_broadcast_skip_self, "broadcast/skip_self/50", 50);
+BENCH_REGISTER(bench_broadcast_skip_self, "broadcast/skip_self/245", (MESH_MPS - 1) / 6);
+
+static void signal_table_fill(signal_table_t *t, signal_table_entry_t *entries, const mesh_addr_t *route, int size)
+{
+    // the root's table, numbered in report order
+    signal_table_init(t, entries, CONFIG_MESH_ROUTE_TABLE_SIZE);
+    signal_table_renumber(t, 1);
+    for (int i = size - 1; i >= 0; --i) {
+        signal_packed_t head = { .flags = i & SIGNAL_PACKED_PHASE, .remaining = i & 0x3f };
+        signal_table_update(t, route[i].addr, head, 0);
+    }
+}
+
+static void bench_signal_table_encode(bench_state_t *state)
+{
+    static mesh_addr_t route[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static signal_table_entry_t entries[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static uint8_t frame[SIGNAL_DIGEST_SIZE(CONFIG_MESH_ROUTE_TABLE_SIZE)];
+    signal_table_t t;
+
+    // the full digest of the root, every head known
+    route_table_fill(route, state->arg);
+    signal_table_fill(&t, entries, route, state->arg);
+    BENCH_LOOP(state) {
+        bench_do_not_optimize(signal_table_encode(&t, true, 0, frame, sizeof(frame)));
+        bench_clobber();
+    }
+}
+BENCH_REGISTER(bench_signal_table_encode, "signal_table/encode/50", 50);
+BENCH_REGISTER(bench_signal_table_encode, "signal_table/encode/300", CONFIG_MESH_ROUTE_TABLE_SIZE);
+
+static void bench_signal_table_delta(bench_state_t *state)
+{
+    static mesh_addr_t route[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static signal_table_entry_t entries[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static uint8_t frame[SIGNAL_DIGEST_SIZE(CONFIG_MESH_ROUTE_TABLE_SIZE)];
+    signal_table_t t;
+    uint8_t flags = 0;
+
+    // a round of the root: a few heads changed since the last one
+    route_table_fill(route, state->arg);
+    signal_table_fill(&t, entries, route, state->arg);
+    signal_table_encode(&t, true, 0, frame, sizeof(frame));
+    BENCH_LOOP(state) {
+        flags ^= SIGNAL_PACKED_WALK;
+        for (int i = 0; i < 4; ++i) {
+            signal_packed_t head = { .flags = flags, .remaining = 10 };
+            signal_table_update(&t, route[i * state->arg / 4].addr, head, 0);
+        }
+        bench_do_not_optimize(signal_table_encode(&t, false, 0, frame, sizeof(frame)));
+        bench_clobber();
+    }
+}
+BENCH_REGISTER(bench_signal_table_delta, "signal_table/delta/300", CONFIG_MESH_ROUTE_TABLE_SIZE);
+
+static void bench_signal_table_decode(bench_state_t *state)
+{
+    static mesh_addr_t route[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static signal_table_entry_t entries[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static signal_table_entry_t node_entries[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static uint8_t frame[SIGNAL_DIGEST_SIZE(CONFIG_MESH_ROUTE_TABLE_SIZE)];
+    static uint8_t map[MESH_MPS];
+    signal_table_t t, node;
+
+    // a node holding the root's numbering
+    route_table_fill(route, state->arg);
+    signal_table_fill(&t, entries, route, state->arg);
+    signal_table_init(&node, node_entries, CONFIG_MESH_ROUTE_TABLE_SIZE);
+    for (uint16_t first = 0; first < t.count; first += SIGNAL_MAP_PAGE) {
+        size_t map_len = signal_table_map_encode(&t, first, map, sizeof(map));
+        signal_table_map_decode(&node, map, map_len, 0);
+    }
+    size_t len = signal_table_encode(&t, true, 0, frame, sizeof(frame));
+    BENCH_LOOP(state) {
+        bench_do_not_optimize(signal_table_decode(&node, NULL, frame, len, 0));
+        bench_clobber();
+    }
+}
+BENCH_REGISTER(bench_signal_table_decode, "signal_table/decode/50", 50);
+BENCH_REGISTER(bench_signal_table_decode, "signal_table/decode/300", CONFIG_MESH_ROUTE_TABLE_SIZE);
+
+static void bench_signal_table_page(bench_state_t *state)
+{
+    static mesh_addr_t route[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    static signal_table_entry_t entries[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    char text[MQTT_PUB_TEXT_MAX];
+    signal_table_t t;
+
+    // every telemetry page of a digest period
+    route_table_fill(route, state->arg);
+    signal_table_fill(&t, entries, route, state->arg);
+    BENCH_LOOP(state) {
+        uint16_t slot = 0;
+        while (signal_table_page(&t, &slot, 0, text, sizeof(text)) > 0) {
+            bench_clobber();
+        }
+    }
+}
+BENCH_REGISTER(bench_signal_table_page, "signal_table/page/300", CONFIG_MESH_ROUTE_TABLE_SIZE);
@@ -0,0 +1,34 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* recv_cb() is static, so mesh_main.c is built into this translation unit
+ * instead of being linked from the application library. */
+#include "../../main/mesh_main.c"
+#include "bench.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void bench_recv_cb_button(bench_state_t *state)
+{
+    // latency trace id 0: tracing off on the sender, the common case
+    uint8_t frame[6+1+1+sizeof(latency_trace_hdr_t)] = { CMD_BUTTON_PRESSED, 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x02, 1 };
+    mesh_addr_t from = { 0 };
+    mesh_data_t data = {
+        .data = frame,
+        .size = sizeof(frame),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+
+    BENCH_LOOP(state) {
+        recv_cb(&from, &data);
+        bench_clobber();
+    }
+}
+BENCH_REGISTER(bench_recv_cb_button, "recv_cb/button", 0);
@@ -0,0 +1,1222 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Multi-node mesh simulator. Every node is a forked process running the real
+ * app_main() on the host shims; this process is the medium between them: it
+ * builds the tree, plays the join sequence, routes frames with per-hop
+ * latency and loss, drives the inputs and acts as router and MQTT broker.
+ *
+ *   mesh_sim --nodes 100 --duration 60 --hop-latency 5 --loss 1 --seed 7
+ *
+ * With --preempts the detector input of random nodes is driven too, and the
+ * detector-to-lamps delay every node reports is collected. With --walkers the
+ * movement sensor of every node sees pedestrians, as a PIR retriggering a few
+ * times on each. With --parent-losses random nodes lose their parent and
+ * join it again a moment later, and the time until the broker hears from
+ * them again is collected.
+ *
+ * The run ends with one "RESULT key=value ..." line for scripts. */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_netif.h"
+#include "driver/gpio.h"
+#include "sim_link.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_MAX_NODES       (CONFIG_MESH_ROUTE_TABLE_SIZE)
+#define SIM_CLASS_IP_UP     (256)
+#define SIM_CLASS_IP_DOWN   (257)
+#define SIM_CLASS_OTHER     (258)
+#define SIM_CLASSES         (259)
+#define SIM_PRESS_HOLD_US   (300 * 1000)
+#define SIM_BCAST_ORIGIN    (0xffff)
+#define SIM_DRAIN_US        (1000 * 1000)
+#define SIM_PREEMPT_HOLD_US (8 * 1000 * 1000)
+#define SIM_PREEMPT_GRACE_US (5000 * 1000)  /* past the root giving up on the acks */
+#define SIM_TCP_RTO_US      (200 * 1000)    /* first retransmission of a lost MQTT segment */
+#define SIM_TCP_RTO_MAX_US  (6400 * 1000)   /* the connection is given up after this one */
+#define SIM_WALK_PULSES     (3)
+#define SIM_WALK_HIGH_US    (1000 * 1000)
+#define SIM_WALK_LOW_US     (500 * 1000)
+#define SIM_REJOIN_US       (2000 * 1000)   /* scan, association and DHCP again */
+
+// same values as main/mesh_main.c and main/traffic_light.h
+#define CMD_BUTTON_PRESSED  (0x55)
+#define CMD_MOVEMENT        (0x57)
+#define CMD_PREEMPT         (0x58)
+#define CMD_RELIABLE        (0x5e)
+#define CMD_RELIABLE_ACK    (0x5f)
+#define SIM_RELIABLE_HDR    (4)             /* mesh_reliable_hdr_t */
+#define SIM_PRESS_MAX       (4096)
+#define SIM_PRESS_GRACE_US  (7000 * 1000)   /* past the reliable layer giving up */
+#define SIM_BUTTON_PIN      GPIO_NUM_18
+#define SIM_INFRA_PIN       GPIO_NUM_5
+#define SIM_MOVEMENT_PIN    GPIO_NUM_22
+#define SIM_PREEMPT_PIN     CONFIG_APP_PREEMPT_GPIO
+
+void app_main(void);
+
+static const uint8_t s_router_bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    pid_t pid;
+    int fd;
+    int parent;
+    int depth;
+    int children;
+    bool hello;
+    bool joined;
+    bool alive;
+    bool preempt_held;      /* detector input driven high */
+    int walk_pulses;        /* movement sensor pulses left for the current pedestrian */
+    int aid;
+    int64_t lost_us;        /* parent lost, until the broker hears from the node again */
+    int64_t rejoin_us;
+    int64_t last_rx_us;     /* frames to one node leave its parent in order */
+} sim_node_t;
+
+typedef enum {
+    EV_DELIVER,
+    EV_PRESS,
+    EV_RELEASE,
+    EV_BCAST,
+    EV_PREEMPT,
+    EV_PREEMPT_END,
+    EV_WALK,
+    EV_WALK_PULSE,
+    EV_PARENT_LOSS,
+    EV_REJOIN,
+} sim_ev_kind_t;
+
+typedef struct {
+    int64_t t_us;
+    uint64_t order;
+    sim_ev_kind_t kind;
+    int node;
+    int cls;
+    int hops;
+    sim_msg_t *msg;
+} sim_ev_t;
+
+typedef struct {
+    int64_t *v;
+    size_t n;
+    size_t cap;
+} sim_samples_t;
+
+/* A button frame, however many copies of it the reliable layer sends */
+typedef struct {
+    uint8_t src[6];
+    uint16_t seq;
+    bool delivered;
+    int64_t first_us;
+} sim_press_t;
+
+typedef struct {
+    uint64_t sent;
+    uint64_t delivered;
+    uint64_t lost;
+    uint64_t unroutable;
+    uint64_t bytes;
+    uint64_t hops;
+    sim_samples_t latency;
+} sim_class_stats_t;
+
+typedef struct {
+    int nodes;
+    int duration_s;
+    int fanout;
+    double hop_latency_ms;
+    double jitter_ms;
+    double loss_pct;
+    double byte_us;
+    int join_ms;
+    double press_per_min;
+    int bcast_ms;
+    double preempt_per_min;
+    double walk_per_min;
+    double loss_per_min;
+    int max_missed;
+    uint64_t seed;
+    int log_level;
+} sim_options_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static sim_options_t s_opt = {
+    .nodes = 20,
+    .duration_s = 60,
+    .fanout = CONFIG_MESH_AP_CONNECTIONS,
+    .hop_latency_ms = 5,
+    .jitter_ms = 2,
+    .loss_pct = 0,
+    .byte_us = 1,
+    .join_ms = 100,
+    .press_per_min = 1,
+    .bcast_ms = 0,
+    .preempt_per_min = 0,
+    .walk_per_min = 0,
+    .loss_per_min = 0,
+    .max_missed = -1,
+    .seed = 1,
+    .log_level = ESP_LOG_WARN,
+};
+
+static sim_node_t *s_nodes;
+static int s_joined = 0;
+static uint64_t s_rng;
+
+static sim_ev_t *s_heap;
+static size_t s_heap_len = 0;
+static size_t s_heap_cap = 0;
+static uint64_t s_ev_order = 0;
+
+static sim_class_stats_t s_stats[SIM_CLASSES];
+static uint64_t s_airtime_hop_bytes = 0;
+static uint64_t s_presses = 0;
+static sim_press_t s_press[SIM_PRESS_MAX];
+static size_t s_press_n = 0;
+static sim_samples_t s_button_latency;
+
+static uint64_t s_uplink_msgs = 0;
+static uint64_t s_uplink_bytes = 0;
+static sim_samples_t s_uplink_latency;
+
+static uint16_t s_bcast_seq = 0;
+static int64_t *s_bcast_sent_us;
+static int *s_bcast_reached;
+static sim_samples_t s_bcast_fanout;
+static int64_t *s_bcast_last_us;
+static int s_bcast_max = 0;
+
+static uint64_t s_preempts = 0;
+static uint64_t s_walks = 0;
+static uint64_t s_preempt_expected = 0;
+static sim_samples_t s_preempt_latency;
+static int s_signal_heads = -1;             /* in the last page the root published */
+static uint64_t s_signal_pages = 0;
+
+static uint64_t s_parent_losses = 0;
+static sim_samples_t s_resume_latency;      /* link back to the first publish */
+static sim_samples_t s_outage;              /* parent lost to the first publish */
+
+static int64_t s_all_joined_us = 0;
+static int64_t s_end_us = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double rng_uniform(void)
+{
+    // xorshift64*, reproducible for a given --seed
+    s_rng ^= s_rng >> 12;
+    s_rng ^= s_rng << 25;
+    s_rng ^= s_rng >> 27;
+    return ((s_rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void samples_add(sim_samples_t *s, int64_t value)
+{
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->v = realloc(s->v, s->cap * sizeof(*s->v));
+    }
+    s->v[s->n++] = value;
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double samples_pct_ms(sim_samples_t *s, double pct)
+{
+    if (s->n == 0) {
+        return 0;
+    }
+    qsort(s->v, s->n, sizeof(*s->v), cmp_i64);
+    size_t i = (size_t) ceil(pct / 100.0 * s->n);
+    return s->v[i ? i - 1 : 0] / 1000.0;
+}
+
+/* ---- event heap, ordered by time then insertion ---- */
+
+static bool ev_before(const sim_ev_t *a, const sim_ev_t *b)
+{
+    return a->t_us < b->t_us || (a->t_us == b->t_us && a->order < b->order);
+}
+
+static void ev_push(sim_ev_t ev)
+{
+    if (s_heap_len == s_heap_cap) {
+        s_heap_cap = s_heap_cap ? s_heap_cap * 2 : 1024;
+        s_heap = realloc(s_heap, s_heap_cap * sizeof(*s_heap));
+    }
+    ev.order = s_ev_order++;
+    size_t i = s_heap_len++;
+    while (i > 0 && ev_before(&ev, &s_heap[(i - 1) / 2])) {
+        s_heap[i] = s_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s_heap[i] = ev;
+}
+
+static sim_ev_t ev_pop(void)
+{
+    sim_ev_t top = s_heap[0];
+    sim_ev_t last = s_heap[--s_heap_len];
+    size_t i = 0;
+    while (true) {
+        size_t c = 2 * i + 1;
+        if (c >= s_heap_len) {
+            break;
+        }
+        if (c + 1 < s_heap_len && ev_before(&s_heap[c + 1], &s_heap[c])) {
+            c++;
+        }
+        if (!ev_before(&s_heap[c], &last)) {
+            break;
+        }
+        s_heap[i] = s_heap[c];
+        i = c;
+    }
+    s_heap[i] = last;
+    return top;
+}
+
+/* ---- links ---- */
+
+static void node_send(int index, sim_msg_t *msg)
+{
+    sim_node_t *node = &s_nodes[index];
+    if (node->alive && sim_link_send(node->fd, msg) < 0) {
+        node->alive = false;
+    }
+}
+
+static void node_event(int index, uint8_t base, int32_t id, const void *data, size_t len)
+{
+    sim_msg_t msg = { .type = SIM_MSG_EVENT, .base = base, .id = id, .len = len, .t_us = now_us() };
+    memcpy(msg.payload, data, len);
+    node_send(index, &msg);
+}
+
+static bool in_subtree(int root, int index)
+{
+    while (index > root) {
+        index = s_nodes[index].parent;
+    }
+    return index == root;
+}
+
+static int send_routes(int index)
+{
+    // the subtree of a node in index order starts with the node itself
+    sim_msg_t msg = { .type = SIM_MSG_ROUTES, .id = s_joined, .t_us = now_us() };
+    int count = 0;
+    for (int i = index; i < s_opt.nodes && (count + 1) * 6 <= SIM_LINK_MTU; ++i) {
+        if (s_nodes[i].joined && in_subtree(index, i)) {
+            sim_node_mac(i, false, msg.payload + 6 * count++);
+        }
+    }
+    msg.len = count * 6;
+    node_send(index, &msg);
+    return count;
+}
+
+/* Parent association and DHCP, on the first join and after a parent loss */
+static void attach(int index)
+{
+    sim_node_t *node = &s_nodes[index];
+    int parent = node->parent;
+
+    mesh_event_connected_t connected = { .self_layer = node->depth + 1 };
+    if (parent < 0) {
+        memcpy(connected.connected.bssid, s_router_bssid, 6);
+    } else {
+        sim_node_mac(parent, true, connected.connected.bssid);
+        connected.connected.aid = node->aid;
+    }
+    connected.connected.channel = 1;
+    connected.connected.authmode = WIFI_AUTH_WPA2_PSK;
+    send_routes(index);
+    node_event(index, SIM_BASE_MESH, MESH_EVENT_PARENT_CONNECTED, &connected, sizeof(connected));
+    if (parent < 0) {
+        mesh_event_toDS_state_t state = MESH_TODS_REACHABLE;
+        node_event(index, SIM_BASE_MESH, MESH_EVENT_TODS_STATE, &state, sizeof(state));
+    }
+
+    // DHCP: the root from the router, nodes from the root's mesh subnet
+    esp_netif_ip_info_t ip = { 0 };
+    if (parent < 0) {
+        ip.ip.addr = ESP_IP4TOADDR(192, 168, 1, 100);
+        ip.gw.addr = ESP_IP4TOADDR(192, 168, 1, 1);
+        ip.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+    } else {
+        ip.ip.addr = ESP_IP4TOADDR(10, 0, (index + 1) >> 8, (index + 1) & 0xff);
+        ip.gw.addr = ESP_IP4TOADDR(10, 0, 0, 1);
+        ip.netmask.addr = ESP_IP4TOADDR(255, 255, 0, 0);
+    }
+    node_event(index, SIM_BASE_IP, IP_EVENT_STA_GOT_IP, &ip, sizeof(ip));
+}
+
+static void join(int index)
+{
+    sim_node_t *node = &s_nodes[index];
+    int parent = node->parent;
+
+    node->joined = true;
+    s_joined++;
+    node_event(index, SIM_BASE_MESH, MESH_EVENT_STARTED, NULL, 0);
+    if (parent >= 0) {
+        node->aid = ++s_nodes[parent].children;
+    }
+    attach(index);
+
+    // every ancestor learns the new entry of its routing table
+    for (int a = parent; a >= 0; a = s_nodes[a].parent) {
+        mesh_event_routing_table_change_t change = { .rt_size_change = 1 };
+        change.rt_size_new = send_routes(a);
+        node_event(a, SIM_BASE_MESH, MESH_EVENT_ROUTING_TABLE_ADD, &change, sizeof(change));
+    }
+    if (parent >= 0) {
+        mesh_event_child_connected_t child = { .aid = node->aid, .is_mesh_child = true };
+        sim_node_mac(index, false, child.mac);
+        node_event(parent, SIM_BASE_MESH, MESH_EVENT_CHILD_CONNECTED, &child, sizeof(child));
+    }
+
+    if (s_opt.press_per_min > 0) {
+        double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.press_per_min;
+        ev_push((sim_ev_t) { .t_us = now_us() + (int64_t) (gap_s * 1e6), .kind = EV_PRESS, .node = index });
+    }
+    if (s_opt.walk_per_min > 0) {
+        double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.walk_per_min;
+        ev_push((sim_ev_t) { .t_us = now_us() + (int64_t) (gap_s * 1e6), .kind = EV_WALK, .node = index });
+    }
+}
+
+static int hops_between(int a, int b)
+{
+    int hops = 0;
+    while (a != b) {
+        if (s_nodes[a].depth >= s_nodes[b].depth) {
+            a = s_nodes[a].parent;
+        } else {
+            b = s_nodes[b].parent;
+        }
+        hops++;
+    }
+    return hops;
+}
+
+static int classify(const sim_msg_t *msg)
+{
+    switch (msg->proto) {
+    case MESH_PROTO_BIN:
+        // reliable frames count as the frame they carry
+        if (msg->len > SIM_RELIABLE_HDR && msg->payload[0] == CMD_RELIABLE) {
+            return msg->payload[SIM_RELIABLE_HDR];
+        }
+        return msg->len ? msg->payload[0] : SIM_CLASS_OTHER;
+    case MESH_PROTO_AP:
+        return SIM_CLASS_IP_UP;
+    case MESH_PROTO_STA:
+        return SIM_CLASS_IP_DOWN;
+    default:
+        return SIM_CLASS_OTHER;
+    }
+}
+
+static sim_press_t *press_find(const sim_msg_t *msg, bool add)
+{
+    uint16_t seq;
+
+    if (msg->payload[0] != CMD_RELIABLE) {
+        return NULL;
+    }
+    memcpy(&seq, msg->payload + 2, sizeof(seq));
+    for (size_t i = s_press_n; i-- > 0;) {
+        if (s_press[i].seq == seq && memcmp(s_press[i].src, msg->src, 6) == 0) {
+            return &s_press[i];
+        }
+    }
+    if (!add || s_press_n == SIM_PRESS_MAX) {
+        return NULL;
+    }
+    sim_press_t *press = &s_press[s_press_n++];
+    memcpy(press->src, msg->src, 6);
+    press->seq = seq;
+    press->first_us = msg->t_us;
+    return press;
+}
+
+static int64_t hop_us(const sim_msg_t *msg)
+{
+    return (int64_t) ((s_opt.hop_latency_ms + rng_uniform() * s_opt.jitter_ms) * 1000 + msg->len * s_opt.byte_us);
+}
+
+static void deliver_at(int dst, int64_t t, int cls, int hops, const sim_msg_t *msg)
+{
+    if (t < s_nodes[dst].last_rx_us) {
+        t = s_nodes[dst].last_rx_us;
+    }
+    s_nodes[dst].last_rx_us = t;
+    size_t size = offsetof(sim_msg_t, payload) + msg->len;
+    sim_msg_t *copy = malloc(size);
+    memcpy(copy, msg, size);
+    ev_push((sim_ev_t) { .t_us = t, .kind = EV_DELIVER, .node = dst, .cls = cls, .hops = hops, .msg = copy });
+}
+
+/* A group frame goes up to the root and is flooded down the tree, one transmission
+ * per link; a copy lost on a link misses the whole subtree below it. Stats count one
+ * frame per node it was meant for. */
+static void route_group(int src, sim_msg_t *msg, int cls)
+{
+    sim_class_stats_t *st = &s_stats[cls];
+    int64_t *arrive = calloc(s_opt.nodes, sizeof(*arrive));
+    int64_t delay = 0;
+    int up = s_nodes[src].depth;
+
+    for (int i = 0; i < s_opt.nodes; ++i) {
+        if (i != src && s_nodes[i].joined) {
+            st->sent++;
+            st->bytes += msg->len;
+        }
+    }
+    for (int h = 0; h < up; ++h) {
+        s_airtime_hop_bytes += msg->len;
+        if (rng_uniform() * 100.0 < s_opt.loss_pct) {
+            delay = -1;
+            break;
+        }
+        delay += hop_us(msg);
+    }
+    // breadth-first numbering: every parent comes before its children
+    arrive[0] = delay < 0 ? -1 : now_us() + delay;
+    for (int i = 0; i < s_opt.nodes; ++i) {
+        if (i > 0) {
+            int parent = s_nodes[i].parent;
+            arrive[i] = -1;
+            if (!s_nodes[i].joined || arrive[parent] < 0) {
+                st->lost += i != src && s_nodes[i].joined;
+                continue;
+            }
+            s_airtime_hop_bytes += msg->len;
+            if (rng_uniform() * 100.0 < s_opt.loss_pct) {
+                st->lost += i != src;
+                continue;
+            }
+            arrive[i] = arrive[parent] + hop_us(msg);
+        } else if (arrive[0] < 0) {
+            st->lost += src != 0;
+            continue;
+        }
+        if (i != src) {
+            deliver_at(i, arrive[i], cls, up + s_nodes[i].depth, msg);
+        }
+    }
+    free(arrive);
+}
+
+static void route(int src, sim_msg_t *msg)
+{
+    static const uint8_t zero[6] = { 0 };
+    int cls = classify(msg);
+    sim_class_stats_t *st = &s_stats[cls];
+    int dst;
+
+    if (msg->flag & MESH_DATA_GROUP) {
+        route_group(src, msg, cls);
+        return;
+    }
+    st->sent++;
+    st->bytes += msg->len;
+    if (cls == CMD_BUTTON_PRESSED) {
+        press_find(msg, true);
+    }
+    if ((msg->flag & MESH_DATA_TODS) || memcmp(msg->dst, zero, 6) == 0) {
+        dst = 0;
+    } else {
+        dst = sim_node_index_of(msg->dst);
+    }
+    if (dst < 0 || dst >= s_opt.nodes || !s_nodes[dst].joined) {
+        st->unroutable++;
+        return;
+    }
+
+    int hops = hops_between(src, dst);
+    int64_t delay = 0;
+    int64_t rto = SIM_TCP_RTO_US;
+    for (int h = 0; h < hops; ++h) {
+        s_airtime_hop_bytes += msg->len;
+        if (rng_uniform() * 100.0 >= s_opt.loss_pct) {
+            delay += hop_us(msg);
+        } else if (cls == SIM_CLASS_IP_UP && rto <= SIM_TCP_RTO_MAX_US) {
+            // publishes ride on TCP: the segment comes again after the timeout, doubling
+            delay += rto;
+            rto *= 2;
+            h--;
+        } else {
+            st->lost++;
+            return;
+        }
+    }
+    deliver_at(dst, now_us() + delay, cls, hops, msg);
+}
+
+static void track_delivery(const sim_ev_t *ev)
+{
+    const sim_msg_t *msg = ev->msg;
+    int64_t now = now_us();
+
+    if (ev->cls == SIM_CLASS_IP_DOWN && msg->len >= sizeof(sim_ip_hdr_t)) {
+        const sim_ip_hdr_t *hdr = (const sim_ip_hdr_t *) msg->payload;
+        if (hdr->magic == SIM_IP_MAGIC && hdr->origin == SIM_BCAST_ORIGIN && hdr->seq < s_bcast_max) {
+            s_bcast_reached[hdr->seq]++;
+            s_bcast_last_us[hdr->seq] = now;
+        }
+    }
+}
+
+static void deliver(sim_ev_t *ev)
+{
+    sim_class_stats_t *st = &s_stats[ev->cls];
+
+    if (s_nodes[ev->node].alive) {
+        st->delivered++;
+        st->hops += ev->hops;
+        samples_add(&st->latency, now_us() - ev->msg->t_us);
+        if (ev->cls == CMD_BUTTON_PRESSED) {
+            sim_press_t *press = press_find(ev->msg, false);
+            if (press && !press->delivered) {
+                press->delivered = true;
+                samples_add(&s_button_latency, now_us() - press->first_us);
+            }
+        }
+        track_delivery(ev);
+        node_send(ev->node, ev->msg);
+    } else {
+        st->lost++;
+    }
+    free(ev->msg);
+}
+
+/* Number after a JSON key in a publish, false if the key is not there */
+static bool uplink_number(const sim_msg_t *msg, const char *key, double *value)
+{
+    const sim_ip_hdr_t *hdr = (const sim_ip_hdr_t *) msg->payload;
+    const size_t head = 14 + SIM_IP_OVERHEAD;
+    char json[SIM_LINK_MTU];
+
+    if (msg->len < head + hdr->topic_len + hdr->data_len || hdr->data_len >= sizeof(json)) {
+        return false;
+    }
+    memcpy(json, msg->payload + head + hdr->topic_len, hdr->data_len);
+    json[hdr->data_len] = '\0';
+    const char *p = strstr(json, key);
+    if (p && (p = strchr(p + strlen(key), ':'))) {
+        *value = strtod(p + 1, NULL);
+        return true;
+    }
+    return false;
+}
+
+static void track_preempt(const sim_msg_t *msg)
+{
+    // nodes publish the detector-to-lamps delay in their telemetry
+    double ms;
+
+    if (uplink_number(msg, "\"preferencia_ms\"", &ms)) {
+        samples_add(&s_preempt_latency, (int64_t) (ms * 1000));
+    }
+}
+
+static void track_signals(const sim_msg_t *msg)
+{
+    // the root publishes its signal table in pages, each with the heads it holds
+    const sim_ip_hdr_t *hdr = (const sim_ip_hdr_t *) msg->payload;
+    double heads;
+
+    if (hdr->origin == 0 && uplink_number(msg, "\"signal_heads\"", &heads)) {
+        s_signal_heads = (int) heads;
+        s_signal_pages++;
+    }
+}
+
+static void track_resume(const sim_ip_hdr_t *hdr)
+{
+    // the first publish the node sent after joining again
+    if (hdr->origin >= s_opt.nodes) {
+        return;
+    }
+    sim_node_t *node = &s_nodes[hdr->origin];
+    if (node->rejoin_us && hdr->t_us >= node->rejoin_us) {
+        samples_add(&s_resume_latency, now_us() - node->rejoin_us);
+        samples_add(&s_outage, now_us() - node->lost_us);
+        node->lost_us = 0;
+        node->rejoin_us = 0;
+    }
+}
+
+static void uplink(const sim_msg_t *msg)
+{
+    const sim_ip_hdr_t *hdr = (const sim_ip_hdr_t *) msg->payload;
+
+    s_uplink_msgs++;
+    s_uplink_bytes += msg->len;
+    if (msg->len >= sizeof(*hdr) && hdr->magic == SIM_IP_MAGIC) {
+        samples_add(&s_uplink_latency, now_us() - hdr->t_us);
+        track_preempt(msg);
+        track_signals(msg);
+        track_resume(hdr);
+    }
+}
+
+static void broadcast(void)
+{
+    // a broadcast from the router side (ARP, DHCP) reaching the root's mesh AP
+    sim_msg_t msg = { .type = SIM_MSG_DOWNLINK, .t_us = now_us() };
+    sim_ip_hdr_t *hdr = (sim_ip_hdr_t *) msg.payload;
+
+    if (s_bcast_seq >= s_bcast_max) {
+        return;
+    }
+    memset(hdr->eth_dst, 0xff, 6);
+    memcpy(hdr->eth_src, s_router_bssid, 6);
+    hdr->eth_type = 0x0608;     // ARP, network order
+    hdr->magic = SIM_IP_MAGIC;
+    hdr->origin = SIM_BCAST_ORIGIN;
+    hdr->seq = s_bcast_seq;
+    hdr->t_us = msg.t_us;
+    msg.len = 14 + SIM_IP_OVERHEAD;
+    s_bcast_sent_us[s_bcast_seq++] = msg.t_us;
+    node_send(0, &msg);
+}
+
+static void handle_event(sim_ev_t *ev)
+{
+    switch (ev->kind) {
+    case EV_DELIVER:
+        deliver(ev);
+        break;
+    case EV_PRESS: {
+        if (s_end_us && ev->t_us >= s_end_us) {
+            break;
+        }
+        sim_msg_t msg = { .type = SIM_MSG_GPIO, .id = SIM_BUTTON_PIN, .flag = 1, .t_us = now_us() };
+        node_send(ev->node, &msg);
+        if (ev->node != 0) {
+            s_presses++;
+        }
+        ev_push((sim_ev_t) { .t_us = ev->t_us + SIM_PRESS_HOLD_US, .kind = EV_RELEASE, .node = ev->node });
+        double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.press_per_min;
+        ev_push((sim_ev_t) { .t_us = ev->t_us + (int64_t) (gap_s * 1e6), .kind = EV_PRESS, .node = ev->node });
+        break;
+    }
+    case EV_RELEASE: {
+        sim_msg_t msg = { .type = SIM_MSG_GPIO, .id = SIM_BUTTON_PIN, .flag = 0, .t_us = now_us() };
+        node_send(ev->node, &msg);
+        break;
+    }
+    case EV_BCAST:
+        if (ev->t_us >= s_end_us) {
+            break;
+        }
+        broadcast();
+        ev_push((sim_ev_t) { .t_us = ev->t_us + s_opt.bcast_ms * 1000LL, .kind = EV_BCAST });
+        break;
+    case EV_PREEMPT: {
+        // late detections could not be acked by every node before the end
+        if (ev->t_us >= s_end_us - SIM_PREEMPT_GRACE_US) {
+            break;
+        }
+        // a vehicle passes the detector of a random node, every live node has to react
+        int node = (int) (rng_uniform() * s_opt.nodes);
+        if (s_nodes[node].alive && !s_nodes[node].preempt_held) {
+            sim_msg_t msg = { .type = SIM_MSG_GPIO, .id = SIM_PREEMPT_PIN, .flag = 1, .t_us = now_us() };
+            node_send(node, &msg);
+            s_nodes[node].preempt_held = true;
+            s_preempts++;
+            for (int i = 0; i < s_opt.nodes; ++i) {
+                s_preempt_expected += s_nodes[i].alive;
+            }
+            ev_push((sim_ev_t) { .t_us = ev->t_us + SIM_PREEMPT_HOLD_US, .kind = EV_PREEMPT_END, .node = node });
+        }
+        double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.preempt_per_min;
+        ev_push((sim_ev_t) { .t_us = ev->t_us + (int64_t) (gap_s * 1e6), .kind = EV_PREEMPT });
+        break;
+    }
+    case EV_PREEMPT_END: {
+        sim_msg_t msg = { .type = SIM_MSG_GPIO, .id = SIM_PREEMPT_PIN, .flag = 0, .t_us = now_us() };
+        node_send(ev->node, &msg);
+        s_nodes[ev->node].preempt_held = false;
+        break;
+    }
+    case EV_WALK: {
+        if (s_end_us && ev->t_us >= s_end_us) {
+            break;
+        }
+        if (s_nodes[ev->node].walk_pulses == 0) {
+            s_nodes[ev->node].walk_pulses = SIM_WALK_PULSES;
+            s_walks++;
+            ev_push((sim_ev_t) { .t_us = ev->t_us, .kind = EV_WALK_PULSE, .node = ev->node });
+        }
+        double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.walk_per_min;
+        ev_push((sim_ev_t) { .t_us = ev->t_us + (int64_t) (gap_s * 1e6), .kind = EV_WALK, .node = ev->node });
+        break;
+    }
+    case EV_WALK_PULSE: {
+        // high for a while, then low, until the pedestrian has left
+        sim_node_t *node = &s_nodes[ev->node];
+        sim_msg_t msg = { .type = SIM_MSG_GPIO, .id = SIM_MOVEMENT_PIN, .flag = ev->cls == 0, .t_us = now_us() };
+        node_send(ev->node, &msg);
+        if (ev->cls == 0) {
+            ev_push((sim_ev_t) { .t_us = ev->t_us + SIM_WALK_HIGH_US, .kind = EV_WALK_PULSE, .node = ev->node, .cls = 1 });
+        } else if (--node->walk_pulses > 0) {
+            ev_push((sim_ev_t) { .t_us = ev->t_us + SIM_WALK_LOW_US, .kind = EV_WALK_PULSE, .node = ev->node });
+        }
+        break;
+    }
+    case EV_PARENT_LOSS: {
+        if (ev->t_us >= s_end_us) {
+            break;
+        }
+        // a random node below the root loses its parent and joins it again
+        int index = 1 + (int) (rng_uniform() * (s_opt.nodes - 1));
+        sim_node_t *node = &s_nodes[index];
+        if (node->alive && node->joined && !node->lost_us) {
+            mesh_event_disconnected_t disconnected = { .reason = WIFI_REASON_BEACON_TIMEOUT };
+            sim_node_mac(node->parent, true, disconnected.bssid);
+            node->joined = false;
+            node->lost_us = now_us();
+            s_parent_losses++;
+            node_event(index, SIM_BASE_MESH, MESH_EVENT_PARENT_DISCONNECTED, &disconnected, sizeof(disconnected));
+            ev_push((sim_ev_t) { .t_us = ev->t_us + SIM_REJOIN_US, .kind = EV_REJOIN, .node = index });
+        }
+        double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.loss_per_min;
+        ev_push((sim_ev_t) { .t_us = ev->t_us + (int64_t) (gap_s * 1e6), .kind = EV_PARENT_LOSS });
+        break;
+    }
+    case EV_REJOIN:
+        s_nodes[ev->node].joined = true;
+        s_nodes[ev->node].rejoin_us = now_us();
+        attach(ev->node);
+        break;
+    }
+}
+
+static void handle_link(int index)
+{
+    static sim_msg_t msg;
+
+    ssize_t n = recv(s_nodes[index].fd, &msg, sizeof(msg), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        s_nodes[index].alive = false;
+        printf("mesh_sim: node %d left the mesh\n", index);
+        return;
+    }
+    if (n < 0) {
+        return;
+    }
+    switch (msg.type) {
+    case SIM_MSG_HELLO:
+        s_nodes[index].hello = true;
+        break;
+    case SIM_MSG_DATA:
+        if (s_nodes[index].joined) {
+            route(index, &msg);
+        }
+        break;
+    case SIM_MSG_UPLINK:
+        uplink(&msg);
+        break;
+    default:
+        break;
+    }
+}
+
+static void run_node(int index, int fd)
+{
+    sim_node_attach(fd, index);
+    esp_log_level_set("*", s_opt.log_level);
+    // idle inputs: button released, infrared beam not cut (active low), no movement
+    sim_gpio_drive(SIM_BUTTON_PIN, 0);
+    sim_gpio_drive(SIM_INFRA_PIN, 1);
+    sim_gpio_drive(SIM_MOVEMENT_PIN, 0);
+    sim_gpio_drive(SIM_PREEMPT_PIN, 0);
+    app_main();
+    while (true) {
+        pause();
+    }
+}
+
+static void spawn_nodes(void)
+{
+    for (int i = 0; i < s_opt.nodes; ++i) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        int bufsize = 1 << 20;
+        setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+        setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            for (int j = 0; j < i; ++j) {
+                close(s_nodes[j].fd);
+            }
+            close(sv[0]);
+            run_node(i, sv[1]);
+        }
+        close(sv[1]);
+        s_nodes[i].pid = pid;
+        s_nodes[i].fd = sv[0];
+        s_nodes[i].alive = true;
+        // breadth-first tree: node i hangs off node (i - 1) / fanout
+        s_nodes[i].parent = i == 0 ? -1 : (i - 1) / s_opt.fanout;
+        s_nodes[i].depth = i == 0 ? 0 : s_nodes[s_nodes[i].parent].depth + 1;
+    }
+}
+
+static void stop_nodes(void)
+{
+    for (int i = 0; i < s_opt.nodes; ++i) {
+        close(s_nodes[i].fd);
+    }
+    int64_t deadline = now_us() + 2000000;
+    for (int i = 0; i < s_opt.nodes; ++i) {
+        while (waitpid(s_nodes[i].pid, NULL, WNOHANG) == 0) {
+            if (now_us() > deadline) {
+                kill(s_nodes[i].pid, SIGKILL);
+                waitpid(s_nodes[i].pid, NULL, 0);
+                break;
+            }
+            usleep(1000);
+        }
+    }
+}
+
+/* @return nodes that never reacted to a preemption */
+static uint64_t report(int64_t run_us)
+{
+    static const char *names[SIM_CLASSES] = {
+        [CMD_BUTTON_PRESSED] = "button",
+        [CMD_MOVEMENT] = "movement",
+        [CMD_PREEMPT] = "preempt",
+        [0x59] = "timing_plan",
+        [0x5a] = "rpc",
+        [0x5b] = "rpc_result",
+        [0x5c] = "root_score",
+        [0x5d] = "topology",
+        [CMD_RELIABLE_ACK] = "reliable_ack",
+        [0x60] = "signal_report",
+        [0x61] = "signal_digest",
+        [0x62] = "traffic_light",
+        [0x63] = "signal_map",
+        [SIM_CLASS_IP_UP] = "ip_up",
+        [SIM_CLASS_IP_DOWN] = "ip_down",
+        [SIM_CLASS_OTHER] = "other",
+    };
+    int max_depth = 0;
+    for (int i = 0; i < s_opt.nodes; ++i) {
+        max_depth = s_nodes[i].depth > max_depth ? s_nodes[i].depth : max_depth;
+    }
+
+    printf("\n==== mesh_sim: %d nodes, fanout %d, %d layers, hop %.1f+%.1f ms, loss %.1f%%, seed %llu\n",
+           s_opt.nodes, s_opt.fanout, max_depth + 1, s_opt.hop_latency_ms, s_opt.jitter_ms, s_opt.loss_pct,
+           (unsigned long long) s_opt.seed);
+    printf("%-14s %8s %8s %6s %6s %10s %5s %8s %8s %8s\n",
+           "frames", "sent", "deliv", "lost", "noroute", "bytes", "hops", "p50_ms", "p99_ms", "max_ms");
+    for (int c = 0; c < SIM_CLASSES; ++c) {
+        sim_class_stats_t *st = &s_stats[c];
+        char name[16];
+        if (st->sent == 0) {
+            continue;
+        }
+        if (names[c]) {
+            snprintf(name, sizeof(name), "%s", names[c]);
+        } else {
+            snprintf(name, sizeof(name), "cmd_0x%02x", c);
+        }
+        printf("%-14s %8llu %8llu %6llu %6llu %10llu %5.2f %8.1f %8.1f %8.1f\n", name,
+               (unsigned long long) st->sent, (unsigned long long) st->delivered,
+               (unsigned long long) st->lost, (unsigned long long) st->unroutable,
+               (unsigned long long) st->bytes, st->delivered ? (double) st->hops / st->delivered : 0,
+               samples_pct_ms(&st->latency, 50), samples_pct_ms(&st->latency, 99),
+               samples_pct_ms(&st->latency, 100));
+    }
+
+    uint64_t bcast_reached = 0;
+    for (int i = 0; i < s_bcast_seq; ++i) {
+        bcast_reached += s_bcast_reached[i];
+        if (s_bcast_reached[i]) {
+            samples_add(&s_bcast_fanout, s_bcast_last_us[i] - s_bcast_sent_us[i]);
+        }
+    }
+    double coverage = s_bcast_seq && s_opt.nodes > 1 ?
+                      100.0 * bcast_reached / ((double) s_bcast_seq * (s_opt.nodes - 1)) : 0;
+    if (s_bcast_seq) {
+        printf("broadcast fan-out: %d rounds, coverage %.1f%%, last node p50 %.1f ms, p99 %.1f ms\n",
+               s_bcast_seq, coverage, samples_pct_ms(&s_bcast_fanout, 50), samples_pct_ms(&s_bcast_fanout, 99));
+    }
+
+    double run_s = run_us / 1e6;
+    printf("telemetry: %llu publishes (%.1f/s), %llu bytes (%.1f kB/s), publish to broker p50 %.1f ms, p99 %.1f ms\n",
+           (unsigned long long) s_uplink_msgs, s_uplink_msgs / run_s, (unsigned long long) s_uplink_bytes,
+           s_uplink_bytes / run_s / 1000.0, samples_pct_ms(&s_uplink_latency, 50),
+           samples_pct_ms(&s_uplink_latency, 99));
+    printf("airtime: %llu hop-bytes (%.1f kB/s), button presses: %llu\n",
+           (unsigned long long) s_airtime_hop_bytes, s_airtime_hop_bytes / run_s / 1000.0,
+           (unsigned long long) s_presses);
+
+    uint64_t preempt_missed = s_preempt_expected > s_preempt_latency.n ?
+                              s_preempt_expected - s_preempt_latency.n : 0;
+    if (s_preempts) {
+        printf("preemption: %llu detections, %zu of %llu nodes reacted, detector to lamps p50 %.1f ms, "
+               "p99 %.1f ms, max %.1f ms\n",
+               (unsigned long long) s_preempts, s_preempt_latency.n, (unsigned long long) s_preempt_expected,
+               samples_pct_ms(&s_preempt_latency, 50), samples_pct_ms(&s_preempt_latency, 99),
+               samples_pct_ms(&s_preempt_latency, 100));
+    }
+
+    if (s_signal_pages) {
+        printf("signal table: %d heads of %d nodes at the root, %llu pages published\n",
+               s_signal_heads, s_opt.nodes, (unsigned long long) s_signal_pages);
+    }
+
+    if (s_walks) {
+        printf("movement: %llu pedestrians, %llu mesh records\n",
+               (unsigned long long) s_walks, (unsigned long long) s_stats[CMD_MOVEMENT].sent);
+    }
+
+    if (s_parent_losses) {
+        printf("parent loss: %llu outages, %zu resumed, link back to first publish p50 %.1f ms, max %.1f ms, "
+               "parent lost to first publish p50 %.1f ms, max %.1f ms\n",
+               (unsigned long long) s_parent_losses, s_resume_latency.n, samples_pct_ms(&s_resume_latency, 50),
+               samples_pct_ms(&s_resume_latency, 100), samples_pct_ms(&s_outage, 50),
+               samples_pct_ms(&s_outage, 100));
+    }
+
+    // a press is lost when no copy arrived, those still in flight at the end are left out
+    uint64_t button_lost = 0;
+    for (size_t i = 0; i < s_press_n; ++i) {
+        button_lost += !s_press[i].delivered && s_press[i].first_us < s_end_us - SIM_PRESS_GRACE_US;
+    }
+    printf("RESULT nodes=%d layers=%d seed=%llu bcast_coverage=%.1f bcast_p99_ms=%.1f "
+           "button_p50_ms=%.1f button_p99_ms=%.1f button_lost=%llu telemetry_per_s=%.1f telemetry_p99_ms=%.1f "
+           "airtime_kBps=%.1f preempt_p50_ms=%.1f preempt_p99_ms=%.1f preempt_missed=%llu resume_p50_ms=%.1f "
+           "resume_max_ms=%.1f signal_heads=%d\n",
+           s_opt.nodes, max_depth + 1, (unsigned long long) s_opt.seed, coverage,
+           samples_pct_ms(&s_bcast_fanout, 99), samples_pct_ms(&s_button_latency, 50),
+           samples_pct_ms(&s_button_latency, 99), (unsigned long long) button_lost, s_uplink_msgs / run_s,
+           samples_pct_ms(&s_uplink_latency, 99), s_airtime_hop_bytes / run_s / 1000.0,
+           samples_pct_ms(&s_preempt_latency, 50), samples_pct_ms(&s_preempt_latency, 99),
+           (unsigned long long) preempt_missed, samples_pct_ms(&s_resume_latency, 50),
+           samples_pct_ms(&s_resume_latency, 100), s_signal_heads);
+    fflush(stdout);
+    return preempt_missed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --nodes N          nodes in the mesh, node 0 is root (default %d, max %d)\n"
+            "  -t, --duration S       seconds to run after the last node joined (default %d)\n"
+            "  -f, --fanout N         children per node (default %d)\n"
+            "  -l, --hop-latency MS   latency per hop (default %.1f)\n"
+            "  -j, --jitter MS        extra uniform random latency per hop (default %.1f)\n"
+            "  -p, --loss PCT         loss probability per hop (default %.1f)\n"
+            "  -b, --byte-us US       airtime per byte and hop (default %.1f)\n"
+            "  -J, --join-ms MS       interval between node joins (default %d)\n"
+            "  -B, --presses N        button presses per node and minute (default %.1f)\n"
+            "  -c, --bcast-ms MS      router broadcast period, 0 to disable (default %d)\n"
+            "  -E, --preempts N       emergency vehicle detections per minute in the mesh (default %.1f)\n"
+            "  -W, --walkers N        pedestrians at the movement sensor per node and minute (default %.1f)\n"
+            "  -L, --parent-losses N  parent losses per minute in the mesh, rejoined after %d ms (default %.1f)\n"
+            "  -M, --max-missed N     exit status 1 when more than N nodes missed a preemption\n"
+            "  -s, --seed N           random seed (default %llu)\n"
+            "  -v, --log-level N      node log level, 0 none .. 5 verbose (default %d)\n",
+            prog, s_opt.nodes, SIM_MAX_NODES, s_opt.duration_s, s_opt.fanout, s_opt.hop_latency_ms,
+            s_opt.jitter_ms, s_opt.loss_pct, s_opt.byte_us, s_opt.join_ms, s_opt.press_per_min,
+            s_opt.bcast_ms, s_opt.preempt_per_min, s_opt.walk_per_min, SIM_REJOIN_US / 1000, s_opt.loss_per_min,
+            (unsigned long long) s_opt.seed, s_opt.log_level);
+}
+
+static void parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "nodes", required_argument, NULL, 'n' },
+        { "duration", required_argument, NULL, 't' },
+        { "fanout", required_argument, NULL, 'f' },
+        { "hop-latency", required_argument, NULL, 'l' },
+        { "jitter", required_argument, NULL, 'j' },
+        { "loss", required_argument, NULL, 'p' },
+        { "byte-us", required_argument, NULL, 'b' },
+        { "join-ms", required_argument, NULL, 'J' },
+        { "presses", required_argument, NULL, 'B' },
+        { "bcast-ms", required_argument, NULL, 'c' },
+        { "preempts", required_argument, NULL, 'E' },
+        { "walkers", required_argument, NULL, 'W' },
+        { "parent-losses", required_argument, NULL, 'L' },
+        { "max-missed", required_argument, NULL, 'M' },
+        { "seed", required_argument, NULL, 's' },
+        { "log-level", required_argument, NULL, 'v' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "n:t:f:l:j:p:b:J:B:c:E:W:L:M:s:v:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'n': s_opt.nodes = atoi(optarg); break;
+        case 't': s_opt.duration_s = atoi(optarg); break;
+        case 'f': s_opt.fanout = atoi(optarg); break;
+        case 'l': s_opt.hop_latency_ms = atof(optarg); break;
+        case 'j': s_opt.jitter_ms = atof(optarg); break;
+        case 'p': s_opt.loss_pct = atof(optarg); break;
+        case 'b': s_opt.byte_us = atof(optarg); break;
+        case 'J': s_opt.join_ms = atoi(optarg); break;
+        case 'B': s_opt.press_per_min = atof(optarg); break;
+        case 'c': s_opt.bcast_ms = atoi(optarg); break;
+        case 'E': s_opt.preempt_per_min = atof(optarg); break;
+        case 'W': s_opt.walk_per_min = atof(optarg); break;
+        case 'L': s_opt.loss_per_min = atof(optarg); break;
+        case 'M': s_opt.max_missed = atoi(optarg); break;
+        case 's': s_opt.seed = strtoull(optarg, NULL, 0); break;
+        case 'v': s_opt.log_level = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            exit(c == 'h' ? 0 : 2);
+        }
+    }
+    if (s_opt.nodes < 1 || s_opt.nodes > SIM_MAX_NODES || s_opt.fanout < 1 || s_opt.duration_s < 1) {
+        usage(argv[0]);
+        exit(2);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    parse_options(argc, argv);
+    s_rng = s_opt.seed ? s_opt.seed : 1;
+    s_nodes = calloc(s_opt.nodes, sizeof(*s_nodes));
+    s_bcast_max = s_opt.bcast_ms > 0 ? s_opt.duration_s * 1000 / s_opt.bcast_ms + 1 : 0;
+    s_bcast_sent_us = calloc(s_bcast_max + 1, sizeof(int64_t));
+    s_bcast_last_us = calloc(s_bcast_max + 1, sizeof(int64_t));
+    s_bcast_reached = calloc(s_bcast_max + 1, sizeof(int));
+    struct pollfd *pfds = calloc(s_opt.nodes, sizeof(*pfds));
+
+    spawn_nodes();
+
+    int64_t start_us = now_us();
+    int next_join = 0;
+    while (true) {
+        int64_t now = now_us();
+        while (next_join < s_opt.nodes && s_nodes[next_join].hello &&
+               now >= start_us + (int64_t) next_join * s_opt.join_ms * 1000) {
+            join(next_join++);
+            if (next_join == s_opt.nodes) {
+                s_all_joined_us = now;
+                s_end_us = now + (int64_t) s_opt.duration_s * 1000000;
+                if (s_opt.bcast_ms > 0) {
+                    ev_push((sim_ev_t) { .t_us = now + s_opt.bcast_ms * 1000LL, .kind = EV_BCAST });
+                }
+                if (s_opt.preempt_per_min > 0) {
+                    double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.preempt_per_min;
+                    ev_push((sim_ev_t) { .t_us = now + (int64_t) (gap_s * 1e6), .kind = EV_PREEMPT });
+                }
+                if (s_opt.loss_per_min > 0 && s_opt.nodes > 1) {
+                    double gap_s = -log(1.0 - rng_uniform()) * 60.0 / s_opt.loss_per_min;
+                    ev_push((sim_ev_t) { .t_us = now + (int64_t) (gap_s * 1e6), .kind = EV_PARENT_LOSS });
+                }
+            }
+        }
+        while (s_heap_len && s_heap[0].t_us <= now) {
+            sim_ev_t ev = ev_pop();
+            handle_event(&ev);
+        }
+        // no new inputs after the end, frames in flight still land
+        if (s_end_us && now >= s_end_us + SIM_DRAIN_US) {
+            break;
+        }
+
+        int64_t wake = now + 100000;
+        if (s_heap_len && s_heap[0].t_us < wake) {
+            wake = s_heap[0].t_us;
+        }
+        if (next_join < s_opt.nodes) {
+            int64_t t = start_us + (int64_t) next_join * s_opt.join_ms * 1000;
+            wake = t > now && t < wake ? t : wake;
+        }
+        if (s_end_us && s_end_us + SIM_DRAIN_US < wake) {
+            wake = s_end_us + SIM_DRAIN_US;
+        }
+        int64_t wait = wake > now ? wake - now : 0;
+        struct timespec timeout = { .tv_sec = wait / 1000000, .tv_nsec = (wait % 1000000) * 1000 };
+
+        int count = 0;
+        for (int i = 0; i < s_opt.nodes; ++i) {
+            if (s_nodes[i].alive) {
+                pfds[count].fd = s_nodes[i].fd;
+                pfds[count].events = POLLIN;
+                pfds[count].revents = 0;
+                count++;
+            }
+        }
+        if (ppoll(pfds, count, &timeout, NULL) <= 0) {
+            continue;
+        }
+        for (int i = 0, k = 0; i < s_opt.nodes; ++i) {
+            if (!s_nodes[i].alive) {
+                continue;
+            }
+            if (pfds[k++].revents & (POLLIN | POLLHUP | POLLERR)) {
+                handle_link(i);
+            }
+        }
+    }
+
+    stop_nodes();
+    uint64_t preempt_missed = report(s_end_us - s_all_joined_us);
+    return s_opt.max_missed >= 0 && preempt_missed > (uint64_t) s_opt.max_missed ? 1 : 0;
+}
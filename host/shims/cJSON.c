@@ -0,0 +1,774 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    char *buffer;
+    size_t length;
+    size_t offset;
+    bool prealloc;
+    bool failed;
+} printbuffer_t;
+
+typedef struct {
+    const char *content;
+    size_t length;
+    size_t offset;
+    int depth;
+} parsebuffer_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+static bool print_value(const cJSON *item, printbuffer_t *p, bool format, int depth);
+static bool parse_value(cJSON *item, parsebuffer_t *p);
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void *cJSON_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void cJSON_free(void *object)
+{
+    free(object);
+}
+
+static cJSON *new_item(int type)
+{
+    cJSON *item = calloc(1, sizeof(cJSON));
+    if (item) {
+        item->type = type;
+    }
+    return item;
+}
+
+static char *dup_string(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = malloc(len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+void cJSON_Delete(cJSON *item)
+{
+    while (item) {
+        cJSON *next = item->next;
+        if (!(item->type & cJSON_IsReference) && item->child) {
+            cJSON_Delete(item->child);
+        }
+        if (!(item->type & cJSON_IsReference) && item->valuestring) {
+            free(item->valuestring);
+        }
+        if (!(item->type & cJSON_StringIsConst) && item->string) {
+            free(item->string);
+        }
+        free(item);
+        item = next;
+    }
+}
+
+/* ---- creation ---- */
+
+cJSON *cJSON_CreateNull(void)
+{
+    return new_item(cJSON_NULL);
+}
+
+cJSON *cJSON_CreateTrue(void)
+{
+    return new_item(cJSON_True);
+}
+
+cJSON *cJSON_CreateFalse(void)
+{
+    return new_item(cJSON_False);
+}
+
+cJSON *cJSON_CreateBool(cJSON_bool boolean)
+{
+    return new_item(boolean ? cJSON_True : cJSON_False);
+}
+
+double cJSON_SetNumberHelper(cJSON *object, double number)
+{
+    if (number >= INT_MAX) {
+        object->valueint = INT_MAX;
+    } else if (number <= (double) INT_MIN) {
+        object->valueint = INT_MIN;
+    } else {
+        object->valueint = (int) number;
+    }
+    return object->valuedouble = number;
+}
+
+cJSON *cJSON_CreateNumber(double num)
+{
+    cJSON *item = new_item(cJSON_Number);
+    if (item) {
+        cJSON_SetNumberHelper(item, num);
+    }
+    return item;
+}
+
+cJSON *cJSON_CreateString(const char *string)
+{
+    cJSON *item = new_item(cJSON_String);
+    if (item) {
+        item->valuestring = dup_string(string);
+        if (item->valuestring == NULL) {
+            cJSON_Delete(item);
+            return NULL;
+        }
+    }
+    return item;
+}
+
+cJSON *cJSON_CreateArray(void)
+{
+    return new_item(cJSON_Array);
+}
+
+cJSON *cJSON_CreateObject(void)
+{
+    return new_item(cJSON_Object);
+}
+
+/* ---- tree manipulation ---- */
+
+cJSON_bool cJSON_AddItemToArray(cJSON *array, cJSON *item)
+{
+    if (array == NULL || item == NULL || array == item) {
+        return false;
+    }
+    cJSON *child = array->child;
+    if (child == NULL) {
+        array->child = item;
+        item->prev = item;
+        item->next = NULL;
+    } else {
+        // the head's prev points at the tail, as in upstream cJSON
+        child->prev->next = item;
+        item->prev = child->prev;
+        child->prev = item;
+    }
+    return true;
+}
+
+cJSON_bool cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item)
+{
+    if (object == NULL || string == NULL || item == NULL) {
+        return false;
+    }
+    char *key = dup_string(string);
+    if (key == NULL) {
+        return false;
+    }
+    if (!(item->type & cJSON_StringIsConst) && item->string) {
+        free(item->string);
+    }
+    item->string = key;
+    item->type &= ~cJSON_StringIsConst;
+    return cJSON_AddItemToArray(object, item);
+}
+
+static cJSON *add_to_object(cJSON *object, const char *name, cJSON *item)
+{
+    if (cJSON_AddItemToObject(object, name, item)) {
+        return item;
+    }
+    cJSON_Delete(item);
+    return NULL;
+}
+
+cJSON *cJSON_AddNullToObject(cJSON *const object, const char *const name)
+{
+    return add_to_object(object, name, cJSON_CreateNull());
+}
+
+cJSON *cJSON_AddTrueToObject(cJSON *const object, const char *const name)
+{
+    return add_to_object(object, name, cJSON_CreateTrue());
+}
+
+cJSON *cJSON_AddFalseToObject(cJSON *const object, const char *const name)
+{
+    return add_to_object(object, name, cJSON_CreateFalse());
+}
+
+cJSON *cJSON_AddBoolToObject(cJSON *const object, const char *const name, const cJSON_bool boolean)
+{
+    return add_to_object(object, name, cJSON_CreateBool(boolean));
+}
+
+cJSON *cJSON_AddNumberToObject(cJSON *const object, const char *const name, const double number)
+{
+    return add_to_object(object, name, cJSON_CreateNumber(number));
+}
+
+cJSON *cJSON_AddStringToObject(cJSON *const object, const char *const name, const char *const string)
+{
+    return add_to_object(object, name, cJSON_CreateString(string));
+}
+
+cJSON *cJSON_AddObjectToObject(cJSON *const object, const char *const name)
+{
+    return add_to_object(object, name, cJSON_CreateObject());
+}
+
+cJSON *cJSON_AddArrayToObject(cJSON *const object, const char *const name)
+{
+    return add_to_object(object, name, cJSON_CreateArray());
+}
+
+/* ---- queries ---- */
+
+int cJSON_GetArraySize(const cJSON *array)
+{
+    int size = 0;
+    for (const cJSON *c = array ? array->child : NULL; c; c = c->next) {
+        size++;
+    }
+    return size;
+}
+
+cJSON *cJSON_GetArrayItem(const cJSON *array, int index)
+{
+    cJSON *c = array ? array->child : NULL;
+    while (c && index-- > 0) {
+        c = c->next;
+    }
+    return c;
+}
+
+static cJSON *get_object_item(const cJSON *object, const char *name, bool case_sensitive)
+{
+    if (object == NULL || name == NULL) {
+        return NULL;
+    }
+    for (cJSON *c = object->child; c; c = c->next) {
+        if (c->string && (case_sensitive ? strcmp(c->string, name) : strcasecmp(c->string, name)) == 0) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+cJSON *cJSON_GetObjectItem(const cJSON *const object, const char *const string)
+{
+    return get_object_item(object, string, false);
+}
+
+cJSON *cJSON_GetObjectItemCaseSensitive(const cJSON *const object, const char *const string)
+{
+    return get_object_item(object, string, true);
+}
+
+cJSON_bool cJSON_HasObjectItem(const cJSON *object, const char *string)
+{
+    return cJSON_GetObjectItem(object, string) != NULL;
+}
+
+cJSON *cJSON_DetachItemFromObject(cJSON *object, const char *string)
+{
+    cJSON *item = cJSON_GetObjectItem(object, string);
+    if (item == NULL) {
+        return NULL;
+    }
+    if (item != object->child) {
+        item->prev->next = item->next;
+    }
+    if (item->next) {
+        item->next->prev = item->prev;
+    }
+    if (item == object->child) {
+        object->child = item->next;
+    } else if (item->next == NULL) {
+        object->child->prev = item->prev;
+    }
+    item->prev = item->next = NULL;
+    return item;
+}
+
+void cJSON_DeleteItemFromObject(cJSON *object, const char *string)
+{
+    cJSON_Delete(cJSON_DetachItemFromObject(object, string));
+}
+
+char *cJSON_GetStringValue(const cJSON *const item)
+{
+    return cJSON_IsString(item) ? item->valuestring : NULL;
+}
+
+double cJSON_GetNumberValue(const cJSON *const item)
+{
+    return cJSON_IsNumber(item) ? item->valuedouble : NAN;
+}
+
+cJSON_bool cJSON_IsInvalid(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_Invalid;
+}
+
+cJSON_bool cJSON_IsFalse(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_False;
+}
+
+cJSON_bool cJSON_IsTrue(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_True;
+}
+
+cJSON_bool cJSON_IsBool(const cJSON *const item)
+{
+    return item && (item->type & (cJSON_True | cJSON_False)) != 0;
+}
+
+cJSON_bool cJSON_IsNull(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_NULL;
+}
+
+cJSON_bool cJSON_IsNumber(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_Number;
+}
+
+cJSON_bool cJSON_IsString(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_String;
+}
+
+cJSON_bool cJSON_IsArray(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_Array;
+}
+
+cJSON_bool cJSON_IsObject(const cJSON *const item)
+{
+    return item && (item->type & 0xff) == cJSON_Object;
+}
+
+/* ---- printing ---- */
+
+static char *ensure(printbuffer_t *p, size_t needed)
+{
+    if (p->failed) {
+        return NULL;
+    }
+    needed += p->offset + 1;
+    if (needed <= p->length) {
+        return p->buffer + p->offset;
+    }
+    if (p->prealloc) {
+        p->failed = true;
+        return NULL;
+    }
+    size_t length = p->length * 2 > needed ? p->length * 2 : needed;
+    char *grown = realloc(p->buffer, length);
+    if (grown == NULL) {
+        p->failed = true;
+        return NULL;
+    }
+    p->buffer = grown;
+    p->length = length;
+    return p->buffer + p->offset;
+}
+
+static bool print_number(const cJSON *item, printbuffer_t *p)
+{
+    char number[26];
+    double d = item->valuedouble;
+    int len;
+
+    if (isnan(d) || isinf(d)) {
+        len = snprintf(number, sizeof(number), "null");
+    } else if (d == (double) item->valueint) {
+        len = snprintf(number, sizeof(number), "%d", item->valueint);
+    } else {
+        // shortest representation that reads back the same, as upstream does
+        len = snprintf(number, sizeof(number), "%1.15g", d);
+        if (strtod(number, NULL) != d) {
+            len = snprintf(number, sizeof(number), "%1.17g", d);
+        }
+    }
+    char *out = ensure(p, len);
+    if (out == NULL) {
+        return false;
+    }
+    memcpy(out, number, len + 1);
+    p->offset += len;
+    return true;
+}
+
+static bool print_string(const char *s, printbuffer_t *p)
+{
+    size_t extra = 0;
+    if (s == NULL) {
+        s = "";
+    }
+    for (const unsigned char *c = (const unsigned char *) s; *c; ++c) {
+        if (*c == '"' || *c == '\\' || *c == '\b' || *c == '\f' || *c == '\n' || *c == '\r' || *c == '\t') {
+            extra += 1;
+        } else if (*c < 32) {
+            extra += 5;
+        }
+    }
+    size_t len = strlen(s);
+    char *out = ensure(p, len + extra + 2);
+    if (out == NULL) {
+        return false;
+    }
+    *out++ = '"';
+    for (const unsigned char *c = (const unsigned char *) s; *c; ++c) {
+        if (*c >= 32 && *c != '"' && *c != '\\') {
+            *out++ = *c;
+            continue;
+        }
+        *out++ = '\\';
+        switch (*c) {
+        case '\\': *out++ = '\\'; break;
+        case '"':  *out++ = '"'; break;
+        case '\b': *out++ = 'b'; break;
+        case '\f': *out++ = 'f'; break;
+        case '\n': *out++ = 'n'; break;
+        case '\r': *out++ = 'r'; break;
+        case '\t': *out++ = 't'; break;
+        default:
+            sprintf(out, "u%04x", *c);
+            out += 5;
+            break;
+        }
+    }
+    *out++ = '"';
+    *out = '\0';
+    p->offset += len + extra + 2;
+    return true;
+}
+
+static bool print_literal(const char *s, printbuffer_t *p)
+{
+    size_t len = strlen(s);
+    char *out = ensure(p, len);
+    if (out == NULL) {
+        return false;
+    }
+    memcpy(out, s, len + 1);
+    p->offset += len;
+    return true;
+}
+
+static bool print_indent(printbuffer_t *p, int depth)
+{
+    char *out = ensure(p, depth);
+    if (out == NULL) {
+        return false;
+    }
+    memset(out, '\t', depth);
+    p->offset += depth;
+    return true;
+}
+
+static bool print_container(const cJSON *item, printbuffer_t *p, bool format, int depth, bool object)
+{
+    if (!print_literal(object ? "{" : "[", p)) {
+        return false;
+    }
+    if (format && object && !print_literal("\n", p)) {
+        return false;
+    }
+    for (const cJSON *c = item->child; c; c = c->next) {
+        if (format && object && !print_indent(p, depth + 1)) {
+            return false;
+        }
+        if (object) {
+            if (!print_string(c->string, p) || !print_literal(format ? ":\t" : ":", p)) {
+                return false;
+            }
+        }
+        if (!print_value(c, p, format, depth + 1)) {
+            return false;
+        }
+        if (c->next && !print_literal(format && !object ? ", " : ",", p)) {
+            return false;
+        }
+        if (format && object && !print_literal("\n", p)) {
+            return false;
+        }
+    }
+    if (format && object && !print_indent(p, depth)) {
+        return false;
+    }
+    return print_literal(object ? "}" : "]", p);
+}
+
+static bool print_value(const cJSON *item, printbuffer_t *p, bool format, int depth)
+{
+    switch (item->type & 0xff) {
+    case cJSON_NULL:   return print_literal("null", p);
+    case cJSON_False:  return print_literal("false", p);
+    case cJSON_True:   return print_literal("true", p);
+    case cJSON_Number: return print_number(item, p);
+    case cJSON_String: return print_string(item->valuestring, p);
+    case cJSON_Raw:    return print_literal(item->valuestring ? item->valuestring : "", p);
+    case cJSON_Array:  return print_container(item, p, format, depth, false);
+    case cJSON_Object: return print_container(item, p, format, depth, true);
+    default:           return false;
+    }
+}
+
+static char *print(const cJSON *item, bool format)
+{
+    printbuffer_t p = { .buffer = malloc(256), .length = 256 };
+    if (p.buffer == NULL || item == NULL) {
+        free(p.buffer);
+        return NULL;
+    }
+    p.buffer[0] = '\0';
+    if (!print_value(item, &p, format, 0)) {
+        free(p.buffer);
+        return NULL;
+    }
+    char *out = realloc(p.buffer, p.offset + 1);
+    return out ? out : p.buffer;
+}
+
+char *cJSON_Print(const cJSON *item)
+{
+    return print(item, true);
+}
+
+char *cJSON_PrintUnformatted(const cJSON *item)
+{
+    return print(item, false);
+}
+
+cJSON_bool cJSON_PrintPreallocated(cJSON *item, char *buffer, const int length, const cJSON_bool format)
+{
+    if (buffer == NULL || length <= 0) {
+        return false;
+    }
+    printbuffer_t p = { .buffer = buffer, .length = (size_t) length, .prealloc = true };
+    buffer[0] = '\0';
+    return print_value(item, &p, format, 0);
+}
+
+/* ---- parsing ---- */
+
+static void skip_ws(parsebuffer_t *p)
+{
+    while (p->offset < p->length && isspace((unsigned char) p->content[p->offset])) {
+        p->offset++;
+    }
+}
+
+static bool match(parsebuffer_t *p, const char *literal)
+{
+    size_t len = strlen(literal);
+    if (p->length - p->offset < len || strncmp(p->content + p->offset, literal, len) != 0) {
+        return false;
+    }
+    p->offset += len;
+    return true;
+}
+
+static bool parse_number(cJSON *item, parsebuffer_t *p)
+{
+    char number[64];
+    size_t len = 0;
+    while (p->offset + len < p->length && len < sizeof(number) - 1 &&
+           strchr("0123456789+-eE.", p->content[p->offset + len])) {
+        number[len] = p->content[p->offset + len];
+        len++;
+    }
+    number[len] = '\0';
+    char *end;
+    double d = strtod(number, &end);
+    if (end == number) {
+        return false;
+    }
+    item->type = cJSON_Number;
+    cJSON_SetNumberHelper(item, d);
+    p->offset += end - number;
+    return true;
+}
+
+static bool parse_string_raw(char **out, parsebuffer_t *p)
+{
+    if (p->offset >= p->length || p->content[p->offset] != '"') {
+        return false;
+    }
+    size_t start = ++p->offset;
+    size_t len = 0;
+    while (p->offset < p->length && p->content[p->offset] != '"') {
+        if (p->content[p->offset] == '\\') {
+            p->offset++;
+        }
+        p->offset++;
+        len++;
+    }
+    if (p->offset >= p->length) {
+        return false;
+    }
+    char *s = malloc(len + 1);
+    if (s == NULL) {
+        return false;
+    }
+    char *o = s;
+    for (size_t i = start; i < p->offset; ++i) {
+        char c = p->content[i];
+        if (c == '\\') {
+            c = p->content[++i];
+            switch (c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                // only the basic latin range is decoded, others become '?'
+                c = (i + 4 < p->offset) ? (char) strtol((char[]) { p->content[i + 1], p->content[i + 2],
+                                                                   p->content[i + 3], p->content[i + 4], 0 },
+                                                        NULL, 16) : '?';
+                i += 4;
+                break;
+            default:
+                break;
+            }
+        }
+        *o++ = c;
+    }
+    *o = '\0';
+    p->offset++;
+    *out = s;
+    return true;
+}
+
+static bool parse_container(cJSON *item, parsebuffer_t *p, bool object)
+{
+    if (++p->depth > CJSON_NESTING_LIMIT) {
+        return false;
+    }
+    item->type = object ? cJSON_Object : cJSON_Array;
+    p->offset++;
+    skip_ws(p);
+    if (p->offset < p->length && p->content[p->offset] == (object ? '}' : ']')) {
+        p->offset++;
+        p->depth--;
+        return true;
+    }
+    while (true) {
+        cJSON *child = new_item(cJSON_Invalid);
+        if (child == NULL) {
+            return false;
+        }
+        cJSON_AddItemToArray(item, child);
+        skip_ws(p);
+        if (object) {
+            if (!parse_string_raw(&child->string, p)) {
+                return false;
+            }
+            skip_ws(p);
+            if (p->offset >= p->length || p->content[p->offset] != ':') {
+                return false;
+            }
+            p->offset++;
+            skip_ws(p);
+        }
+        if (!parse_value(child, p)) {
+            return false;
+        }
+        skip_ws(p);
+        if (p->offset >= p->length) {
+            return false;
+        }
+        if (p->content[p->offset] == ',') {
+            p->offset++;
+            continue;
+        }
+        if (p->content[p->offset] == (object ? '}' : ']')) {
+            p->offset++;
+            p->depth--;
+            return true;
+        }
+        return false;
+    }
+}
+
+static bool parse_value(cJSON *item, parsebuffer_t *p)
+{
+    skip_ws(p);
+    if (p->offset >= p->length) {
+        return false;
+    }
+    char c = p->content[p->offset];
+    if (match(p, "null")) {
+        item->type = cJSON_NULL;
+        return true;
+    }
+    if (match(p, "false")) {
+        item->type = cJSON_False;
+        return true;
+    }
+    if (match(p, "true")) {
+        item->type = cJSON_True;
+        item->valueint = 1;
+        return true;
+    }
+    if (c == '"') {
+        item->type = cJSON_String;
+        return parse_string_raw(&item->valuestring, p);
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        return parse_number(item, p);
+    }
+    if (c == '[' || c == '{') {
+        return parse_container(item, p, c == '{');
+    }
+    return false;
+}
+
+cJSON *cJSON_ParseWithLength(const char *value, size_t buffer_length)
+{
+    if (value == NULL || buffer_length == 0) {
+        return NULL;
+    }
+    parsebuffer_t p = { .content = value, .length = buffer_length };
+    cJSON *item = new_item(cJSON_Invalid);
+    if (item == NULL) {
+        return NULL;
+    }
+    if (!parse_value(item, &p)) {
+        cJSON_Delete(item);
+        return NULL;
+    }
+    return item;
+}
+
+cJSON *cJSON_Parse(const char *value)
+{
+    return value ? cJSON_ParseWithLength(value, strlen(value) + 1) : NULL;
+}
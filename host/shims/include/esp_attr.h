@@ -0,0 +1,18 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim: there is no IRAM or RTC memory, all sections map to plain RAM */
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define EXT_RAM_BSS_ATTR
+#define NOINLINE_ATTR __attribute__((noinline))
+#define FORCE_INLINE_ATTR static inline __attribute__((always_inline))
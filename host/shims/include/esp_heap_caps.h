@@ -0,0 +1,21 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim of the heap capabilities API, a fixed nominal heap */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+esp_err_t heap_caps_monitor_local_minimum_free_size_start(void);
+esp_err_t heap_caps_monitor_local_minimum_free_size_stop(void);
@@ -0,0 +1,43 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim of esp_log: same line format, one level threshold per process */
+#pragma once
+
+#include <stdint.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+esp_log_level_t esp_log_level_get(const char *tag);
+uint32_t esp_log_timestamp(void);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOG_LEVEL(level, tag, letter, format, ...) do {                            \
+        if ((level) <= CONFIG_LOG_MAXIMUM_LEVEL && (level) <= esp_log_level_get(tag)) { \
+            esp_log_write(level, tag, letter " (%" PRIu32 ") %s: " format "\n",         \
+                          esp_log_timestamp(), tag, ##__VA_ARGS__);                    \
+        }                                                                              \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_ERROR, tag, "E", format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_WARN, tag, "W", format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_INFO, tag, "I", format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_DEBUG, tag, "D", format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_VERBOSE, tag, "V", format, ##__VA_ARGS__)
@@ -0,0 +1,367 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim of ESP-WIFI-MESH: frames and events go through the simulated medium (sim_link.h) */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_ROOT_LAYER             (1)
+#define MESH_MTU                    (1500)
+#define MESH_MPS                    (1472)
+
+#define ESP_ERR_MESH_WIFI_NOT_START (ESP_ERR_MESH_BASE + 1)
+#define ESP_ERR_MESH_NOT_INIT       (ESP_ERR_MESH_BASE + 2)
+#define ESP_ERR_MESH_NOT_CONFIG     (ESP_ERR_MESH_BASE + 3)
+#define ESP_ERR_MESH_NOT_START      (ESP_ERR_MESH_BASE + 4)
+#define ESP_ERR_MESH_NOT_SUPPORT    (ESP_ERR_MESH_BASE + 5)
+#define ESP_ERR_MESH_NOT_ALLOWED    (ESP_ERR_MESH_BASE + 6)
+#define ESP_ERR_MESH_NO_MEMORY      (ESP_ERR_MESH_BASE + 7)
+#define ESP_ERR_MESH_ARGUMENT       (ESP_ERR_MESH_BASE + 8)
+#define ESP_ERR_MESH_EXCEED_MTU     (ESP_ERR_MESH_BASE + 9)
+#define ESP_ERR_MESH_TIMEOUT        (ESP_ERR_MESH_BASE + 10)
+#define ESP_ERR_MESH_DISCONNECTED   (ESP_ERR_MESH_BASE + 11)
+#define ESP_ERR_MESH_QUEUE_FAIL     (ESP_ERR_MESH_BASE + 12)
+#define ESP_ERR_MESH_QUEUE_FULL     (ESP_ERR_MESH_BASE + 13)
+#define ESP_ERR_MESH_NO_PARENT_FOUND (ESP_ERR_MESH_BASE + 14)
+#define ESP_ERR_MESH_NO_ROUTE_FOUND (ESP_ERR_MESH_BASE + 15)
+#define ESP_ERR_MESH_OPTION_NULL    (ESP_ERR_MESH_BASE + 16)
+#define ESP_ERR_MESH_OPTION_UNKNOWN (ESP_ERR_MESH_BASE + 17)
+#define ESP_ERR_MESH_XON_NO_WINDOW  (ESP_ERR_MESH_BASE + 18)
+#define ESP_ERR_MESH_INTERFACE      (ESP_ERR_MESH_BASE + 19)
+#define ESP_ERR_MESH_DISCARD_DUPLICATE (ESP_ERR_MESH_BASE + 20)
+#define ESP_ERR_MESH_DISCARD        (ESP_ERR_MESH_BASE + 21)
+#define ESP_ERR_MESH_VOTING         (ESP_ERR_MESH_BASE + 22)
+#define ESP_ERR_MESH_XMIT           (ESP_ERR_MESH_BASE + 23)
+#define ESP_ERR_MESH_QUEUE_READ     (ESP_ERR_MESH_BASE + 24)
+#define ESP_ERR_MESH_PS             (ESP_ERR_MESH_BASE + 25)
+#define ESP_ERR_MESH_RECV_RELEASE   (ESP_ERR_MESH_BASE + 26)
+
+#define MESH_DATA_ENC           (0x01)
+#define MESH_DATA_P2P           (0x02)
+#define MESH_DATA_FROMDS        (0x04)
+#define MESH_DATA_TODS          (0x08)
+#define MESH_DATA_NONBLOCK      (0x10)
+#define MESH_DATA_DROP          (0x20)
+#define MESH_DATA_GROUP         (0x40)
+
+#define MESH_OPT_SEND_GROUP     (7)
+#define MESH_OPT_RECV_DS_ADDR   (8)
+
+#define MESH_ASSOC_FLAG_VOTE_IN_PROGRESS    (0x02)
+#define MESH_ASSOC_FLAG_NETWORK_FREE        (0x08)
+#define MESH_ASSOC_FLAG_ROOTS_FOUND         (0x20)
+#define MESH_ASSOC_FLAG_ROOT_FIXED          (0x40)
+
+#define MESH_PS_DEVICE_DUTY_REQUEST         (0x01)
+#define MESH_PS_DEVICE_DUTY_DEMAND          (0x04)
+#define MESH_PS_NETWORK_DUTY_MASTER         (0x80)
+#define MESH_PS_NETWORK_DUTY_APPLIED_ENTIRE (0)
+#define MESH_PS_NETWORK_DUTY_APPLIED_UPLINK (1)
+
+/*******************************************************
+ *                Enumerations
+ *******************************************************/
+typedef enum {
+    MESH_EVENT_STARTED,
+    MESH_EVENT_STOPPED,
+    MESH_EVENT_CHANNEL_SWITCH,
+    MESH_EVENT_CHILD_CONNECTED,
+    MESH_EVENT_CHILD_DISCONNECTED,
+    MESH_EVENT_ROUTING_TABLE_ADD,
+    MESH_EVENT_ROUTING_TABLE_REMOVE,
+    MESH_EVENT_PARENT_CONNECTED,
+    MESH_EVENT_PARENT_DISCONNECTED,
+    MESH_EVENT_NO_PARENT_FOUND,
+    MESH_EVENT_LAYER_CHANGE,
+    MESH_EVENT_TODS_STATE,
+    MESH_EVENT_VOTE_STARTED,
+    MESH_EVENT_VOTE_STOPPED,
+    MESH_EVENT_ROOT_ADDRESS,
+    MESH_EVENT_ROOT_SWITCH_REQ,
+    MESH_EVENT_ROOT_SWITCH_ACK,
+    MESH_EVENT_ROOT_ASKED_YIELD,
+    MESH_EVENT_ROOT_FIXED,
+    MESH_EVENT_SCAN_DONE,
+    MESH_EVENT_NETWORK_STATE,
+    MESH_EVENT_STOP_RECONNECTION,
+    MESH_EVENT_FIND_NETWORK,
+    MESH_EVENT_ROUTER_SWITCH,
+    MESH_EVENT_PS_PARENT_DUTY,
+    MESH_EVENT_PS_CHILD_DUTY,
+    MESH_EVENT_PS_DEVICE_DUTY,
+    MESH_EVENT_MAX,
+} mesh_event_id_t;
+
+ESP_EVENT_DECLARE_BASE(MESH_EVENT);
+
+typedef enum {
+    MESH_IDLE,
+    MESH_ROOT,
+    MESH_NODE,
+    MESH_LEAF,
+    MESH_STA,
+} mesh_type_t;
+
+typedef enum {
+    MESH_PROTO_BIN,
+    MESH_PROTO_HTTP,
+    MESH_PROTO_JSON,
+    MESH_PROTO_MQTT,
+    MESH_PROTO_AP,
+    MESH_PROTO_STA,
+} mesh_proto_t;
+
+typedef enum {
+    MESH_TOS_P2P,
+    MESH_TOS_E2E,
+    MESH_TOS_DEF,
+} mesh_tos_t;
+
+typedef enum {
+    MESH_VOTE_REASON_ROOT_INITIATED = 1,
+    MESH_VOTE_REASON_CHILD_INITIATED,
+} mesh_vote_reason_t;
+
+typedef enum {
+    MESH_REASON_CYCLIC = 100,
+    MESH_REASON_PARENT_IDLE,
+    MESH_REASON_LEAF,
+    MESH_REASON_DIFF_ID,
+    MESH_REASON_ROOTS,
+    MESH_REASON_PARENT_STOPPED,
+    MESH_REASON_SCAN_FAIL,
+    MESH_REASON_IE_UNKNOWN,
+    MESH_REASON_WAIVE_ROOT,
+    MESH_REASON_PARENT_WORSE,
+    MESH_REASON_EMPTY_PASSWORD,
+    MESH_REASON_PARENT_UNENCRYPTED,
+} mesh_disconnect_reason_t;
+
+typedef enum {
+    MESH_TODS_UNREACHABLE,
+    MESH_TODS_REACHABLE,
+} mesh_event_toDS_state_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef union {
+    uint8_t addr[6];
+    struct {
+        uint16_t port;
+        esp_ip4_addr_t ip4;
+    } __attribute__((packed)) mip;
+} mesh_addr_t;
+
+typedef struct {
+    uint8_t *data;
+    uint16_t size;
+    mesh_proto_t proto;
+    mesh_tos_t tos;
+} mesh_data_t;
+
+typedef struct {
+    uint8_t type;
+    uint16_t len;
+    uint8_t *val;
+} __attribute__((packed)) mesh_opt_t;
+
+typedef struct {
+    int scan_times;
+} mesh_event_no_parent_found_t;
+
+typedef struct {
+    wifi_event_sta_connected_t connected;
+    uint16_t self_layer;
+    uint8_t duty;
+} mesh_event_connected_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+    int8_t rssi;
+} mesh_event_disconnected_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t aid;
+    bool is_mesh_child;
+} mesh_event_child_connected_t;
+
+typedef mesh_event_child_connected_t mesh_event_child_disconnected_t;
+
+typedef struct {
+    uint16_t rt_size_new;
+    uint16_t rt_size_change;
+} mesh_event_routing_table_change_t;
+
+typedef mesh_addr_t mesh_event_root_address_t;
+
+typedef struct {
+    uint16_t new_layer;
+} mesh_event_layer_change_t;
+
+typedef struct {
+    int reason;
+    int attempts;
+    mesh_addr_t rc_addr;
+} mesh_event_vote_started_t;
+
+typedef struct {
+    int reason;
+    mesh_addr_t rc_addr;
+} mesh_event_root_switch_req_t;
+
+typedef struct {
+    bool is_fixed;
+} mesh_event_root_fixed_t;
+
+typedef struct {
+    int8_t rssi;
+    uint16_t capacity;
+    uint8_t addr[6];
+} mesh_event_root_conflict_t;
+
+typedef struct {
+    uint8_t channel;
+} mesh_event_channel_switch_t;
+
+typedef struct {
+    uint8_t number;
+} mesh_event_scan_done_t;
+
+typedef struct {
+    bool is_rootless;
+} mesh_event_network_state_t;
+
+typedef struct {
+    uint8_t channel;
+    uint8_t router_bssid[6];
+} mesh_event_find_network_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t channel;
+} mesh_event_router_switch_t;
+
+typedef struct {
+    uint8_t duty;
+    mesh_event_child_connected_t child_connected;
+} mesh_event_ps_duty_changed_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t password[64];
+    bool allow_router_switch;
+} mesh_router_t;
+
+typedef struct {
+    uint8_t password[64];
+    uint8_t max_connection;
+    uint8_t nonmesh_max_connection;
+} mesh_ap_cfg_t;
+
+typedef struct {
+    uint8_t channel;
+    bool allow_channel_switch;
+    mesh_addr_t mesh_id;
+    mesh_router_t router;
+    mesh_ap_cfg_t mesh_ap;
+    const void *crypto_funcs;
+} mesh_cfg_t;
+
+typedef struct {
+    float percentage;
+    bool is_rc_specified;
+    union {
+        int attempts;
+        mesh_addr_t rc_addr;
+    } config;
+} mesh_vote_t;
+
+typedef struct {
+    int to_parent;
+    int to_parent_p2p;
+    int to_child;
+    int to_child_p2p;
+    int mgmt;
+    int broadcast;
+} mesh_tx_pending_t;
+
+typedef struct {
+    int toDS;
+    int toSelf;
+} mesh_rx_pending_t;
+
+#define MESH_INIT_CONFIG_DEFAULT() { 0 }
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+esp_err_t esp_mesh_init(void);
+esp_err_t esp_mesh_deinit(void);
+esp_err_t esp_mesh_start(void);
+esp_err_t esp_mesh_stop(void);
+esp_err_t esp_mesh_send(const mesh_addr_t *to, const mesh_data_t *data, int flag,
+                        const mesh_opt_t opt[], int opt_count);
+esp_err_t esp_mesh_recv(mesh_addr_t *from, mesh_data_t *data, int timeout_ms, int *flag,
+                        mesh_opt_t opt[], int opt_count);
+esp_err_t esp_mesh_set_config(const mesh_cfg_t *config);
+esp_err_t esp_mesh_get_config(mesh_cfg_t *config);
+esp_err_t esp_mesh_set_id(const mesh_addr_t *id);
+esp_err_t esp_mesh_get_id(mesh_addr_t *id);
+esp_err_t esp_mesh_set_type(mesh_type_t type);
+mesh_type_t esp_mesh_get_type(void);
+esp_err_t esp_mesh_set_max_layer(int max_layer);
+int esp_mesh_get_max_layer(void);
+esp_err_t esp_mesh_set_ap_authmode(wifi_auth_mode_t authmode);
+esp_err_t esp_mesh_set_vote_percentage(float percentage);
+float esp_mesh_get_vote_percentage(void);
+esp_err_t esp_mesh_set_ap_assoc_expire(int seconds);
+esp_err_t esp_mesh_set_announce_interval(int short_ms, int long_ms);
+esp_err_t esp_mesh_set_beacon_interval(int interval_ms);
+esp_err_t esp_mesh_get_beacon_interval(int *interval_ms);
+int esp_mesh_get_layer(void);
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid);
+bool esp_mesh_is_root(void);
+bool esp_mesh_is_root_fixed(void);
+esp_err_t esp_mesh_fix_root(bool enable);
+esp_err_t esp_mesh_set_self_organized(bool enable, bool select_parent);
+esp_err_t esp_mesh_set_router(const mesh_router_t *router);
+esp_err_t esp_mesh_set_parent(const wifi_config_t *parent, const mesh_addr_t *parent_mesh_id,
+                              mesh_type_t my_type, int my_layer);
+esp_err_t esp_mesh_get_routing_table(mesh_addr_t *mac, int len, int *size);
+int esp_mesh_get_routing_table_size(void);
+int esp_mesh_get_total_node_num(void);
+esp_err_t esp_mesh_set_group_id(const mesh_addr_t *addr, int num);
+esp_err_t esp_mesh_delete_group_id(const mesh_addr_t *addr, int num);
+bool esp_mesh_is_my_group(const mesh_addr_t *addr);
+esp_err_t esp_mesh_get_tx_pending(mesh_tx_pending_t *pending);
+esp_err_t esp_mesh_get_rx_pending(mesh_rx_pending_t *pending);
+esp_err_t esp_mesh_get_router_bssid(uint8_t *router_bssid);
+esp_err_t esp_mesh_enable_ps(void);
+esp_err_t esp_mesh_disable_ps(void);
+bool esp_mesh_is_ps_enabled(void);
+esp_err_t esp_mesh_set_active_duty_cycle(int dev_duty, int dev_duty_type);
+esp_err_t esp_mesh_get_active_duty_cycle(int *dev_duty, int *dev_duty_type);
+esp_err_t esp_mesh_set_network_duty_cycle(int nwk_duty, int duration_mins, int applied_rule);
+esp_err_t esp_mesh_get_running_active_duty_cycle(int *dev_duty, int *nwk_duty);
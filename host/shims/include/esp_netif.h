@@ -0,0 +1,175 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim of esp_netif: interfaces keep their driver binding, there is no IP stack */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define ESP_ERR_ESP_NETIF_BASE  0x5000
+
+#define ESP_IP4TOADDR(a, b, c, d) esp_netif_htonl(((uint32_t) (a) << 24) | ((uint32_t) (b) << 16) | \
+                                                  ((uint32_t) (c) << 8) | (uint32_t) (d))
+#define esp_netif_htonl(x) ((uint32_t) ((((x) & 0xffu) << 24) | (((x) & 0xff00u) << 8) | \
+                                        (((x) & 0xff0000u) >> 8) | (((x) & 0xff000000u) >> 24)))
+#define esp_ip4_addr1(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[0])
+#define esp_ip4_addr2(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[1])
+#define esp_ip4_addr3(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[2])
+#define esp_ip4_addr4(ipaddr) (((const uint8_t *) (&(ipaddr)->addr))[3])
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) esp_ip4_addr1(ipaddr), esp_ip4_addr2(ipaddr), esp_ip4_addr3(ipaddr), esp_ip4_addr4(ipaddr)
+
+#define IPADDR_TYPE_V4 0U
+#define IPADDR_TYPE_V6 6U
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct esp_netif_obj esp_netif_t;
+typedef void *esp_netif_iodriver_handle;
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+    struct {
+        esp_ip4_addr_t ip4;
+    } u_addr;
+    uint8_t type;
+} esp_ip_addr_t;
+
+typedef enum {
+    ESP_NETIF_DNS_MAIN = 0,
+    ESP_NETIF_DNS_BACKUP,
+    ESP_NETIF_DNS_FALLBACK,
+    ESP_NETIF_DNS_MAX
+} esp_netif_dns_type_t;
+
+typedef struct {
+    esp_ip_addr_t ip;
+} esp_netif_dns_info_t;
+
+typedef enum {
+    ESP_NETIF_OP_START = 0,
+    ESP_NETIF_OP_SET,
+    ESP_NETIF_OP_GET,
+    ESP_NETIF_OP_MAX
+} esp_netif_dhcp_option_mode_t;
+
+typedef enum {
+    ESP_NETIF_SUBNET_MASK = 1,
+    ESP_NETIF_DOMAIN_NAME_SERVER = 6,
+    ESP_NETIF_ROUTER_SOLICITATION_ADDRESS = 32,
+    ESP_NETIF_REQUESTED_IP_ADDRESS = 50,
+    ESP_NETIF_IP_ADDRESS_LEASE_TIME = 51,
+    ESP_NETIF_IP_REQUEST_RETRY_TIME = 52,
+} esp_netif_dhcp_option_id_t;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+    IP_EVENT_AP_STAIPASSIGNED,
+} ip_event_t;
+
+ESP_EVENT_DECLARE_BASE(IP_EVENT);
+
+typedef struct {
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+typedef struct esp_netif_driver_base_s {
+    esp_err_t (*post_attach)(esp_netif_t *netif, esp_netif_iodriver_handle h);
+    esp_netif_t *netif;
+} esp_netif_driver_base_t;
+
+typedef struct esp_netif_driver_ifconfig {
+    esp_netif_iodriver_handle handle;
+    esp_err_t (*transmit)(void *h, void *buffer, size_t len);
+    esp_err_t (*transmit_wrap)(void *h, void *buffer, size_t len, void *netstack_buffer);
+    void (*driver_free_rx_buffer)(void *h, void *buffer);
+} esp_netif_driver_ifconfig_t;
+
+typedef struct esp_netif_inherent_config {
+    int flags;
+    uint8_t mac[6];
+    const esp_netif_ip_info_t *ip_info;
+    uint32_t get_ip_event;
+    uint32_t lost_ip_event;
+    const char *if_key;
+    const char *if_desc;
+    int route_prio;
+} esp_netif_inherent_config_t;
+
+typedef struct esp_netif_netstack_config esp_netif_netstack_config_t;
+
+typedef struct {
+    const esp_netif_inherent_config_t *base;
+    const esp_netif_driver_ifconfig_t *driver;
+    const esp_netif_netstack_config_t *stack;
+} esp_netif_config_t;
+
+extern const esp_netif_inherent_config_t _g_esp_netif_inherent_sta_config;
+extern const esp_netif_inherent_config_t _g_esp_netif_inherent_ap_config;
+extern const esp_netif_netstack_config_t *_g_esp_netif_netstack_default_wifi_sta;
+extern const esp_netif_netstack_config_t *_g_esp_netif_netstack_default_wifi_ap;
+
+#define ESP_NETIF_INHERENT_DEFAULT_WIFI_STA() _g_esp_netif_inherent_sta_config
+#define ESP_NETIF_INHERENT_DEFAULT_WIFI_AP()  _g_esp_netif_inherent_ap_config
+#define ESP_NETIF_NETSTACK_DEFAULT_WIFI_STA   _g_esp_netif_netstack_default_wifi_sta
+#define ESP_NETIF_NETSTACK_DEFAULT_WIFI_AP    _g_esp_netif_netstack_default_wifi_ap
+#define ESP_NETIF_DEFAULT_WIFI_STA()                            \
+    {                                                           \
+        .base = &_g_esp_netif_inherent_sta_config,              \
+        .driver = NULL,                                         \
+        .stack = ESP_NETIF_NETSTACK_DEFAULT_WIFI_STA,           \
+    }
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_new(const esp_netif_config_t *config);
+void esp_netif_destroy(esp_netif_t *netif);
+esp_err_t esp_netif_attach(esp_netif_t *netif, esp_netif_iodriver_handle driver_handle);
+esp_err_t esp_netif_set_driver_config(esp_netif_t *netif, const esp_netif_driver_ifconfig_t *driver_config);
+esp_netif_iodriver_handle esp_netif_get_io_driver(esp_netif_t *netif);
+const char *esp_netif_get_desc(esp_netif_t *netif);
+esp_err_t esp_netif_set_mac(esp_netif_t *netif, uint8_t mac[]);
+esp_err_t esp_netif_get_mac(esp_netif_t *netif, uint8_t mac[]);
+esp_err_t esp_netif_receive(esp_netif_t *netif, void *buffer, size_t len, void *eb);
+esp_err_t esp_netif_transmit(esp_netif_t *netif, void *data, size_t len);
+esp_err_t esp_netif_get_ip_info(esp_netif_t *netif, esp_netif_ip_info_t *ip_info);
+esp_err_t esp_netif_get_dns_info(esp_netif_t *netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+esp_err_t esp_netif_set_dns_info(esp_netif_t *netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+esp_err_t esp_netif_dhcps_start(esp_netif_t *netif);
+esp_err_t esp_netif_dhcps_stop(esp_netif_t *netif);
+esp_err_t esp_netif_dhcps_option(esp_netif_t *netif, esp_netif_dhcp_option_mode_t opt_op,
+                                 esp_netif_dhcp_option_id_t opt_id, void *opt_val, uint32_t opt_len);
+void esp_netif_action_start(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+void esp_netif_action_stop(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+void esp_netif_action_connected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+void esp_netif_action_disconnected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data);
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key);
+esp_netif_t *esp_netif_find_desc(const char *if_desc);
@@ -0,0 +1,21 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef struct {
+    int max_freq_mhz;
+    int min_freq_mhz;
+    bool light_sleep_enable;
+} esp_pm_config_t;
+
+esp_err_t esp_pm_configure(const void *config);
@@ -0,0 +1,15 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
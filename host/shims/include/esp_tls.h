@@ -0,0 +1,42 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim of esp-tls on OpenSSL (shims/sim_tls.c), TLS 1.2 client over a real socket */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+#define ESP_TLS_ERR_SSL_WANT_READ   (-0x6900)
+#define ESP_TLS_ERR_SSL_WANT_WRITE  (-0x6880)
+#define ESP_TLS_ERR_SSL_TIMEOUT     (-0x6800)
+
+typedef struct esp_tls esp_tls_t;
+typedef struct esp_tls_client_session esp_tls_client_session_t;
+
+typedef struct {
+    const unsigned char *cacert_buf;
+    unsigned int cacert_bytes;
+    int timeout_ms;
+    esp_tls_client_session_t *client_session;
+} esp_tls_cfg_t;
+
+esp_tls_t *esp_tls_init(void);
+int esp_tls_conn_new_sync(const char *hostname, int hostlen, int port, const esp_tls_cfg_t *cfg, esp_tls_t *tls);
+int esp_tls_conn_destroy(esp_tls_t *tls);
+ssize_t esp_tls_conn_read(esp_tls_t *tls, void *data, size_t datalen);
+ssize_t esp_tls_conn_write(esp_tls_t *tls, const void *data, size_t datalen);
+ssize_t esp_tls_get_bytes_avail(esp_tls_t *tls);
+esp_err_t esp_tls_get_conn_sockfd(esp_tls_t *tls, int *sockfd);
+esp_tls_client_session_t *esp_tls_get_client_session(esp_tls_t *tls);
+void esp_tls_free_client_session(esp_tls_client_session_t *client_session);
+
+/* Host only: the last handshake resumed the offered session */
+bool sim_tls_session_reused(esp_tls_t *tls);
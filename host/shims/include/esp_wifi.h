@@ -0,0 +1,122 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim of the WiFi driver: nothing is transmitted, only the addresses exist */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    WIFI_IF_STA = 0,
+    WIFI_IF_AP,
+    WIFI_IF_MAX
+} wifi_interface_t;
+
+typedef enum {
+    WIFI_PS_NONE,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+typedef enum {
+    WIFI_STORAGE_FLASH,
+    WIFI_STORAGE_RAM,
+} wifi_storage_t;
+
+typedef enum {
+    WIFI_AUTH_OPEN = 0,
+    WIFI_AUTH_WEP,
+    WIFI_AUTH_WPA_PSK,
+    WIFI_AUTH_WPA2_PSK,
+    WIFI_AUTH_WPA_WPA2_PSK,
+    WIFI_AUTH_ENTERPRISE,
+    WIFI_AUTH_WPA3_PSK,
+    WIFI_AUTH_WPA2_WPA3_PSK,
+    WIFI_AUTH_MAX
+} wifi_auth_mode_t;
+
+typedef enum {
+    WIFI_REASON_BEACON_TIMEOUT = 200,
+    WIFI_REASON_NO_AP_FOUND = 201,
+} wifi_err_reason_t;
+
+typedef enum {
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef struct {
+    int magic;
+} wifi_init_config_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    int8_t rssi;
+    wifi_auth_mode_t authmode;
+} wifi_ap_record_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    bool bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+    uint8_t *ssid;
+    uint8_t *bssid;
+    uint8_t channel;
+    bool show_hidden;
+} wifi_scan_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t channel;
+    wifi_auth_mode_t authmode;
+    uint16_t aid;
+} wifi_event_sta_connected_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() { .magic = 0x1f2f3f4f }
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_deinit(void);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type);
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type);
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6]);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block);
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records);
+esp_err_t esp_wifi_set_default_wifi_sta_handlers(void);
+esp_err_t esp_wifi_clear_default_wifi_driver_and_handlers(void *esp_netif);
+esp_err_t esp_netif_attach_wifi_station(esp_netif_t *esp_netif);
+esp_err_t esp_netif_attach_wifi_ap(esp_netif_t *esp_netif);
@@ -0,0 +1,66 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host shim of FreeRTOS (SMP, ESP-IDF flavour) on top of POSIX threads */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+} portMUX_TYPE;
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+#define configTICK_RATE_HZ          CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES        25
+#define configMAX_TASK_NAME_LEN     16
+#define configNUMBER_OF_CORES       CONFIG_FREERTOS_NUMBER_OF_CORES
+
+#define pdFALSE                     ((BaseType_t) 0)
+#define pdTRUE                      ((BaseType_t) 1)
+#define pdFAIL                      pdFALSE
+#define pdPASS                      pdTRUE
+#define errQUEUE_FULL               ((BaseType_t) 0)
+#define errQUEUE_EMPTY              ((BaseType_t) 0)
+
+#define portMAX_DELAY               ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS          ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)           ((TickType_t) (((uint64_t) (ms) * configTICK_RATE_HZ) / 1000U))
+#define pdTICKS_TO_MS(ticks)        ((TickType_t) (((uint64_t) (ticks) * 1000U) / configTICK_RATE_HZ))
+#define tskNO_AFFINITY              ((BaseType_t) 0x7FFFFFFF)
+
+#define portMUX_INITIALIZER_UNLOCKED { .lock = PTHREAD_MUTEX_INITIALIZER }
+#define portMUX_INITIALIZE(mux)     pthread_mutex_init(&(mux)->lock, NULL)
+#define portENTER_CRITICAL(mux)     pthread_mutex_lock(&(mux)->lock)
+#define portEXIT_CRITICAL(mux)      pthread_mutex_unlock(&(mux)->lock)
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)  portEXIT_CRITICAL(mux)
+#define taskENTER_CRITICAL(mux)     portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL(mux)      portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR(...)     ((void) 0)
+#define portYIELD()                 sched_yield()
+#define portNUM_PROCESSORS          configNUMBER_OF_CORES
+
+#define configASSERT(x)             do { if (!(x)) { abort(); } } while (0)
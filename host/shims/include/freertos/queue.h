@@ -0,0 +1,30 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef struct sim_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+#define xQueueSend(queue, item, ticks) xQueueSendToBack(queue, item, ticks)
+#define xQueueSendFromISR(queue, item, woken) xQueueSendToBack(queue, item, 0)
+#define xQueueSendToBackFromISR(queue, item, woken) xQueueSendToBack(queue, item, 0)
+#define xQueueReceiveFromISR(queue, item, woken) xQueueReceive(queue, item, 0)
@@ -0,0 +1,28 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Semaphores and mutexes of the host shim are counting semaphores */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef struct sim_sem *SemaphoreHandle_t;
+
+SemaphoreHandle_t sim_sem_create(UBaseType_t max, UBaseType_t initial);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem);
+
+#define xSemaphoreCreateMutex()                 sim_sem_create(1, 1)
+#define xSemaphoreCreateRecursiveMutex()        sim_sem_create(1, 1)
+#define xSemaphoreCreateBinary()                sim_sem_create(1, 0)
+#define xSemaphoreCreateCounting(max, initial)  sim_sem_create(max, initial)
+#define xSemaphoreGiveFromISR(sem, woken)       xSemaphoreGive(sem)
+#define xSemaphoreTakeFromISR(sem, woken)       xSemaphoreTake(sem, 0)
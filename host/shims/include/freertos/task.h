@@ -0,0 +1,65 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct sim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef enum {
+    eRunning = 0,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted,
+    eInvalid
+} eTaskState;
+
+typedef struct {
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    uint32_t ulRunTimeCounter;
+    StackType_t *pxStackBase;
+    uint32_t usStackHighWaterMark;
+    BaseType_t xCoreID;
+} TaskStatus_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *created_task,
+                                   BaseType_t core_id);
+#define xTaskCreate(fn, name, stack, arg, prio, handle) \
+    xTaskCreatePinnedToCore(fn, name, stack, arg, prio, handle, tskNO_AFFINITY)
+
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskDelayUntil(TickType_t *previous_wake, TickType_t increment);
+#define vTaskDelayUntil(prev, inc) ((void) xTaskDelayUntil(prev, inc))
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char *pcTaskGetName(TaskHandle_t task);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t max, uint32_t *total_run_time);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_woken);
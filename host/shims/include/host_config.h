@@ -0,0 +1,68 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Included at the end of the generated sdkconfig.h: defaults of the options
+ * a stale sdkconfig may lack, and the ones the host build has to override */
+#pragma once
+
+#ifndef CONFIG_APP_METRICS_ENABLE
+#define CONFIG_APP_METRICS_ENABLE 1
+#endif
+#ifndef CONFIG_APP_METRICS_INTERVAL_S
+#define CONFIG_APP_METRICS_INTERVAL_S 60
+#endif
+#ifndef CONFIG_APP_LATENCY_TRACE_ENABLE
+#define CONFIG_APP_LATENCY_TRACE_ENABLE 1
+#endif
+#ifndef CONFIG_APP_PREEMPT_ENABLE
+#define CONFIG_APP_PREEMPT_ENABLE 1
+#endif
+#ifndef CONFIG_APP_PREEMPT_GROUP
+#define CONFIG_APP_PREEMPT_GROUP 0
+#endif
+#ifndef CONFIG_APP_PREEMPT_MAX_S
+#define CONFIG_APP_PREEMPT_MAX_S 60
+#endif
+#ifndef CONFIG_MESH_FAST_REJOIN
+#define CONFIG_MESH_FAST_REJOIN 1
+#endif
+#ifndef CONFIG_MESH_ROOT_HANDOVER
+#define CONFIG_MESH_ROOT_HANDOVER 1
+#endif
+#ifndef CONFIG_MESH_TOPOLOGY_ENABLE
+#define CONFIG_MESH_TOPOLOGY_ENABLE 1
+#endif
+#ifndef CONFIG_MESH_SIGNAL_TABLE_ENABLE
+#define CONFIG_MESH_SIGNAL_TABLE_ENABLE 1
+#endif
+
+// binlog stores arguments as 32-bit words, pointers do not fit on a 64-bit host
+#undef CONFIG_APP_BINLOG_ENABLE
+// no FreeRTOS run-time stats on POSIX threads
+#undef CONFIG_APP_TASK_STATS_ENABLE
+// no TLS stack, the simulated broker speaks plain MQTT
+#undef CONFIG_APP_MQTT_TLS
+#undef CONFIG_APP_MQTT_TLS_SESSION_REUSE
+// every simulated node is mains powered
+#undef CONFIG_MESH_ENABLE_PS
+// every simulated node has a detector, mesh_sim drives it
+#undef CONFIG_APP_PREEMPT_GPIO
+#define CONFIG_APP_PREEMPT_GPIO 25
+
+// scaling runs need the largest routing table the mesh stack allows
+#ifdef MESH_SIM_ROUTE_TABLE_SIZE
+#undef CONFIG_MESH_ROUTE_TABLE_SIZE
+#define CONFIG_MESH_ROUTE_TABLE_SIZE MESH_SIM_ROUTE_TABLE_SIZE
+#endif
+
+#ifndef CONFIG_MESH_ROUTER_SSID
+#define CONFIG_MESH_ROUTER_SSID "ROUTER_SSID"
+#endif
+#ifndef CONFIG_MESH_ROUTER_PASSWD
+#define CONFIG_MESH_ROUTER_PASSWD "ROUTER_PASSWD"
+#endif
@@ -0,0 +1,122 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Link between a simulated node process and the medium (mesh_sim). One
+ * SOCK_SEQPACKET socket per node, one message per packet. */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_LINK_MTU        (2048)
+#define SIM_BASE_MESH       (0)
+#define SIM_BASE_IP         (1)
+// Marks the simulated IP packets carried by the mesh_link netifs
+#define SIM_IP_MAGIC        (0x53494d31)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    SIM_MSG_HELLO = 1,  /* node -> medium: esp_mesh_start() was called */
+    SIM_MSG_DATA,       /* both ways: one mesh frame, src/dst are station addresses */
+    SIM_MSG_EVENT,      /* medium -> node: post a MESH_EVENT / IP_EVENT */
+    SIM_MSG_ROUTES,     /* medium -> node: routing table, payload is a list of addresses */
+    SIM_MSG_GPIO,       /* medium -> node: drive input id to level flag */
+    SIM_MSG_UPLINK,     /* root -> medium: IP packet handed to the router */
+    SIM_MSG_DOWNLINK,   /* medium -> root: IP packet from the router for the mesh AP netif */
+} sim_msg_type_t;
+
+typedef struct {
+    uint16_t type;
+    uint16_t len;       /* payload bytes */
+    int32_t id;         /* event id, gpio number */
+    uint8_t base;       /* SIM_BASE_x of an event */
+    uint8_t proto;      /* mesh_proto_t of a frame */
+    uint8_t tos;
+    uint8_t flag;       /* MESH_DATA_x of a frame, gpio level */
+    uint8_t src[6];
+    uint8_t dst[6];
+    int64_t t_us;       /* CLOCK_MONOTONIC at the sender */
+    uint8_t payload[SIM_LINK_MTU];
+} sim_msg_t;
+
+/* Simulated IP packet: ethernet header followed by this in place of the
+ * IP/TCP/MQTT headers, so frame sizes stay close to the real ones */
+typedef struct __attribute__((packed)) {
+    uint8_t eth_dst[6];
+    uint8_t eth_src[6];
+    uint16_t eth_type;
+    uint32_t magic;
+    uint16_t origin;    /* node index */
+    uint16_t seq;
+    int64_t t_us;       /* CLOCK_MONOTONIC when handed to the MQTT client */
+    uint16_t topic_len;
+    uint16_t data_len;
+} sim_ip_hdr_t;
+
+// IPv4 + TCP + MQTT PUBLISH fixed header, topic length and packet id
+#define SIM_IP_OVERHEAD     (20 + 20 + 2 + 2 + 2)
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static inline int sim_link_send(int fd, const sim_msg_t *msg)
+{
+    return send(fd, msg, offsetof(sim_msg_t, payload) + msg->len, MSG_NOSIGNAL);
+}
+
+static inline void sim_node_mac(int index, bool ap, uint8_t mac[6])
+{
+    // softAP address is the station one + 1, like on the ESP32
+    mac[0] = 0x24;
+    mac[1] = 0x0a;
+    mac[2] = 0xc4;
+    mac[3] = 0x00;
+    mac[4] = (index * 2) >> 8;
+    mac[5] = ((index * 2) & 0xff) + (ap ? 1 : 0);
+}
+
+static inline int sim_node_index_of(const uint8_t mac[6])
+{
+    if (mac[0] != 0x24 || mac[1] != 0x0a || mac[2] != 0xc4 || mac[3] != 0x00) {
+        return -1;
+    }
+    return ((mac[4] << 8) | mac[5]) / 2;
+}
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Node side: bind this process to its link and node index, starts the radio thread
+ */
+void sim_node_attach(int fd, int index);
+
+/**
+ * @brief Node side: index of this node
+ */
+int sim_node_index(void);
+
+/**
+ * @brief Node side: send a message to the medium
+ *
+ * @return bytes sent, negative on error
+ */
+int sim_link_send_msg(const sim_msg_t *msg);
+
+/**
+ * @brief Node side: handle a message from the medium addressed to the network shims
+ */
+void sim_net_handle(const sim_msg_t *msg);
@@ -0,0 +1,35 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Host stand-in for main/ota_app.c: the host clock is already in sync and
+ * there is no firmware image to update */
+#include <time.h>
+#include "esp_log.h"
+
+static const char *TAG = "ota";
+
+void ota_update(void)
+{
+    ESP_LOGI(TAG, "OTA is not simulated");
+}
+
+void obtain_time(void)
+{
+}
+
+void print_current_time(void)
+{
+    time_t now;
+    struct tm timeinfo;
+    char strftime_buf[64];
+
+    time(&now);
+    localtime_r(&now, &timeinfo);
+    strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
+    ESP_LOGI(TAG, "Current time: %s", strftime_buf);
+}
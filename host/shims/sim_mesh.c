@@ -0,0 +1,548 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* ESP-WIFI-MESH on top of the simulator link. The medium owns the topology:
+ * it routes frames, applies per-hop latency and loss, and tells every node
+ * about its parent, layer and routing table through the usual mesh events. */
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "sim_link.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_RX_QUEUE_LEN    (128)
+#define SIM_TCP_RTO_MS      (200)
+#define SIM_ROUTES_MAX      (SIM_LINK_MTU / 6)
+#define SIM_GROUPS_MAX      (4)
+
+static const char *TAG = "sim_mesh";
+
+ESP_EVENT_DEFINE_BASE(MESH_EVENT);
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    mesh_addr_t from;
+    int flag;
+    mesh_proto_t proto;
+    mesh_tos_t tos;
+    uint16_t size;
+    uint8_t data[];
+} sim_rx_frame_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static int s_fd = -1;
+static int s_index = 0;
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static QueueHandle_t s_rx_queue = NULL;
+static uint32_t s_rx_dropped = 0;
+
+static mesh_cfg_t s_cfg;
+static bool s_inited = false;
+static bool s_started = false;
+static int s_layer = 0;
+static int s_max_layer = CONFIG_MESH_MAX_LAYER;
+static mesh_addr_t s_parent;
+static mesh_type_t s_type = MESH_IDLE;
+static bool s_root_fixed = false;
+static float s_vote_percentage = 0.9f;
+static int s_beacon_ms = 100;
+static bool s_ps_enabled = false;
+static int s_dev_duty = 10, s_dev_duty_type = MESH_PS_DEVICE_DUTY_REQUEST;
+static int s_nwk_duty = 10;
+
+static mesh_addr_t s_routes[SIM_ROUTES_MAX];
+static int s_route_count = 0;
+static int s_total_nodes = 0;
+static mesh_addr_t s_groups[SIM_GROUPS_MAX];
+static int s_group_count = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+int sim_node_index(void)
+{
+    return s_index;
+}
+
+int sim_link_send_msg(const sim_msg_t *msg)
+{
+    return sim_link_send(s_fd, msg);
+}
+
+static void handle_mesh_event(const sim_msg_t *msg)
+{
+    pthread_mutex_lock(&s_lock);
+    switch (msg->id) {
+    case MESH_EVENT_PARENT_CONNECTED: {
+        const mesh_event_connected_t *connected = (const mesh_event_connected_t *) msg->payload;
+        s_layer = connected->self_layer;
+        memcpy(s_parent.addr, connected->connected.bssid, 6);
+        s_type = s_layer == MESH_ROOT_LAYER ? MESH_ROOT : (s_type == MESH_LEAF ? MESH_LEAF : MESH_NODE);
+        break;
+    }
+    case MESH_EVENT_PARENT_DISCONNECTED:
+        s_layer = 0;
+        s_type = MESH_IDLE;
+        break;
+    case MESH_EVENT_LAYER_CHANGE:
+        s_layer = ((const mesh_event_layer_change_t *) msg->payload)->new_layer;
+        break;
+    default:
+        break;
+    }
+    pthread_mutex_unlock(&s_lock);
+    esp_event_post(MESH_EVENT, msg->id, msg->len ? msg->payload : NULL, msg->len, portMAX_DELAY);
+}
+
+static void handle_data(const sim_msg_t *msg)
+{
+    // the medium floods group frames down the whole tree, only members take them
+    if ((msg->flag & MESH_DATA_GROUP) && !esp_mesh_is_my_group((const mesh_addr_t *) msg->dst)) {
+        return;
+    }
+    sim_rx_frame_t *frame = malloc(sizeof(*frame) + msg->len);
+    if (frame == NULL) {
+        return;
+    }
+    memcpy(frame->from.addr, msg->src, 6);
+    frame->flag = msg->flag;
+    frame->proto = msg->proto;
+    frame->tos = msg->tos;
+    frame->size = msg->len;
+    memcpy(frame->data, msg->payload, msg->len);
+    // IP frames ride on TCP, which would send them again: waiting for room stands in for that
+    bool ip = msg->proto == MESH_PROTO_AP || msg->proto == MESH_PROTO_STA;
+    if (xQueueSend(s_rx_queue, &frame, ip ? pdMS_TO_TICKS(SIM_TCP_RTO_MS) : 0) != pdPASS) {
+        // the firmware's RX queue overflows the same way when the application lags
+        if ((s_rx_dropped++ % 100) == 0) {
+            ESP_LOGW(TAG, "RX queue full, %" PRIu32 " frames dropped", s_rx_dropped);
+        }
+        free(frame);
+    }
+}
+
+static void radio_task(void *arg)
+{
+    static sim_msg_t msg;
+
+    while (true) {
+        ssize_t n = recv(s_fd, &msg, sizeof(msg), 0);
+        if (n <= 0) {
+            // medium gone: simulation over
+            _exit(0);
+        }
+        switch (msg.type) {
+        case SIM_MSG_DATA:
+            handle_data(&msg);
+            break;
+        case SIM_MSG_EVENT:
+            if (msg.base == SIM_BASE_MESH) {
+                handle_mesh_event(&msg);
+            } else {
+                sim_net_handle(&msg);
+            }
+            break;
+        case SIM_MSG_ROUTES:
+            pthread_mutex_lock(&s_lock);
+            s_route_count = msg.len / 6 < SIM_ROUTES_MAX ? msg.len / 6 : SIM_ROUTES_MAX;
+            memcpy(s_routes, msg.payload, s_route_count * 6);
+            s_total_nodes = msg.id;
+            pthread_mutex_unlock(&s_lock);
+            break;
+        case SIM_MSG_GPIO:
+            sim_gpio_drive(msg.id, msg.flag);
+            break;
+        default:
+            sim_net_handle(&msg);
+            break;
+        }
+    }
+}
+
+void sim_node_attach(int fd, int index)
+{
+    s_fd = fd;
+    s_index = index;
+    s_rx_queue = xQueueCreate(SIM_RX_QUEUE_LEN, sizeof(sim_rx_frame_t *));
+    xTaskCreate(radio_task, "wifi", 4096, NULL, 23, NULL);
+}
+
+esp_err_t esp_mesh_init(void)
+{
+    s_inited = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_deinit(void)
+{
+    s_inited = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_start(void)
+{
+    if (!s_inited) {
+        return ESP_ERR_MESH_NOT_INIT;
+    }
+    s_started = true;
+    // the medium answers with the join sequence when this node's turn comes
+    sim_msg_t msg = { .type = SIM_MSG_HELLO, .t_us = esp_timer_get_time() };
+    esp_wifi_get_mac(WIFI_IF_STA, msg.src);
+    sim_link_send_msg(&msg);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_stop(void)
+{
+    s_started = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_send(const mesh_addr_t *to, const mesh_data_t *data, int flag,
+                        const mesh_opt_t opt[], int opt_count)
+{
+    if (!s_started) {
+        return ESP_ERR_MESH_NOT_START;
+    }
+    if (data == NULL || data->data == NULL) {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    if (data->size > MESH_MPS) {
+        return ESP_ERR_MESH_EXCEED_MTU;
+    }
+    if (s_layer <= 0) {
+        return ESP_ERR_MESH_DISCONNECTED;
+    }
+    sim_msg_t msg = {
+        .type = SIM_MSG_DATA,
+        .len = data->size,
+        .proto = data->proto,
+        .tos = data->tos,
+        .flag = flag | (to == NULL ? MESH_DATA_TODS : 0),
+        .t_us = esp_timer_get_time(),
+    };
+    esp_wifi_get_mac(WIFI_IF_STA, msg.src);
+    if (to) {
+        memcpy(msg.dst, to->addr, 6);
+    }
+    memcpy(msg.payload, data->data, data->size);
+    return sim_link_send_msg(&msg) < 0 ? ESP_ERR_MESH_XMIT : ESP_OK;
+}
+
+esp_err_t esp_mesh_recv(mesh_addr_t *from, mesh_data_t *data, int timeout_ms, int *flag,
+                        mesh_opt_t opt[], int opt_count)
+{
+    sim_rx_frame_t *frame;
+
+    if (s_rx_queue == NULL) {
+        return ESP_ERR_MESH_NOT_INIT;
+    }
+    TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    if (xQueueReceive(s_rx_queue, &frame, ticks) != pdPASS) {
+        return ESP_ERR_MESH_TIMEOUT;
+    }
+    if (frame->size > data->size) {
+        free(frame);
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    *from = frame->from;
+    memcpy(data->data, frame->data, frame->size);
+    data->size = frame->size;
+    data->proto = frame->proto;
+    data->tos = frame->tos;
+    if (flag) {
+        *flag = frame->flag;
+    }
+    free(frame);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_config(const mesh_cfg_t *config)
+{
+    s_cfg = *config;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_config(mesh_cfg_t *config)
+{
+    *config = s_cfg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_id(const mesh_addr_t *id)
+{
+    s_cfg.mesh_id = *id;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_id(mesh_addr_t *id)
+{
+    *id = s_cfg.mesh_id;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_type(mesh_type_t type)
+{
+    s_type = type;
+    return ESP_OK;
+}
+
+mesh_type_t esp_mesh_get_type(void)
+{
+    return s_type;
+}
+
+esp_err_t esp_mesh_set_max_layer(int max_layer)
+{
+    s_max_layer = max_layer;
+    return ESP_OK;
+}
+
+int esp_mesh_get_max_layer(void)
+{
+    return s_max_layer;
+}
+
+esp_err_t esp_mesh_set_ap_authmode(wifi_auth_mode_t authmode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_vote_percentage(float percentage)
+{
+    s_vote_percentage = percentage;
+    return ESP_OK;
+}
+
+float esp_mesh_get_vote_percentage(void)
+{
+    return s_vote_percentage;
+}
+
+esp_err_t esp_mesh_set_ap_assoc_expire(int seconds)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_announce_interval(int short_ms, int long_ms)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_beacon_interval(int interval_ms)
+{
+    s_beacon_ms = interval_ms;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_beacon_interval(int *interval_ms)
+{
+    *interval_ms = s_beacon_ms;
+    return ESP_OK;
+}
+
+int esp_mesh_get_layer(void)
+{
+    return s_layer;
+}
+
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid)
+{
+    pthread_mutex_lock(&s_lock);
+    *bssid = s_parent;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+bool esp_mesh_is_root(void)
+{
+    return s_layer == MESH_ROOT_LAYER;
+}
+
+bool esp_mesh_is_root_fixed(void)
+{
+    return s_root_fixed;
+}
+
+esp_err_t esp_mesh_fix_root(bool enable)
+{
+    s_root_fixed = enable;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_self_organized(bool enable, bool select_parent)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_router(const mesh_router_t *router)
+{
+    pthread_mutex_lock(&s_lock);
+    s_cfg.router = *router;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_parent(const wifi_config_t *parent, const mesh_addr_t *parent_mesh_id,
+                              mesh_type_t my_type, int my_layer)
+{
+    // root election is not simulated, the medium always roots the tree at node 0
+    return ESP_ERR_MESH_NOT_ALLOWED;
+}
+
+esp_err_t esp_mesh_get_routing_table(mesh_addr_t *mac, int len, int *size)
+{
+    if (mac == NULL || size == NULL) {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    pthread_mutex_lock(&s_lock);
+    int count = s_route_count < len / 6 ? s_route_count : len / 6;
+    memcpy(mac, s_routes, count * 6);
+    pthread_mutex_unlock(&s_lock);
+    *size = count;
+    return ESP_OK;
+}
+
+int esp_mesh_get_routing_table_size(void)
+{
+    return s_route_count;
+}
+
+int esp_mesh_get_total_node_num(void)
+{
+    return s_total_nodes;
+}
+
+esp_err_t esp_mesh_set_group_id(const mesh_addr_t *addr, int num)
+{
+    if (addr == NULL || num <= 0) {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < num; ++i) {
+        bool known = false;
+        for (int j = 0; j < s_group_count && !known; ++j) {
+            known = memcmp(s_groups[j].addr, addr[i].addr, 6) == 0;
+        }
+        if (!known && s_group_count < SIM_GROUPS_MAX) {
+            s_groups[s_group_count++] = addr[i];
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_delete_group_id(const mesh_addr_t *addr, int num)
+{
+    if (addr == NULL || num <= 0) {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < num; ++i) {
+        for (int j = 0; j < s_group_count; ++j) {
+            if (memcmp(s_groups[j].addr, addr[i].addr, 6) == 0) {
+                s_groups[j] = s_groups[--s_group_count];
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+bool esp_mesh_is_my_group(const mesh_addr_t *addr)
+{
+    bool mine = false;
+
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < s_group_count && !mine; ++i) {
+        mine = memcmp(s_groups[i].addr, addr->addr, 6) == 0;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return mine;
+}
+
+esp_err_t esp_mesh_get_tx_pending(mesh_tx_pending_t *pending)
+{
+    // frames leave the node immediately, queueing happens in the medium
+    memset(pending, 0, sizeof(*pending));
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_rx_pending(mesh_rx_pending_t *pending)
+{
+    pending->toDS = 0;
+    pending->toSelf = s_rx_queue ? uxQueueMessagesWaiting(s_rx_queue) : 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_router_bssid(uint8_t *router_bssid)
+{
+    static const uint8_t router[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    memcpy(router_bssid, router, 6);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_enable_ps(void)
+{
+    s_ps_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_disable_ps(void)
+{
+    s_ps_enabled = false;
+    return ESP_OK;
+}
+
+bool esp_mesh_is_ps_enabled(void)
+{
+    return s_ps_enabled;
+}
+
+esp_err_t esp_mesh_set_active_duty_cycle(int dev_duty, int dev_duty_type)
+{
+    s_dev_duty = dev_duty;
+    s_dev_duty_type = dev_duty_type;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_active_duty_cycle(int *dev_duty, int *dev_duty_type)
+{
+    *dev_duty = s_dev_duty;
+    *dev_duty_type = s_dev_duty_type;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_network_duty_cycle(int nwk_duty, int duration_mins, int applied_rule)
+{
+    s_nwk_duty = nwk_duty;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_running_active_duty_cycle(int *dev_duty, int *nwk_duty)
+{
+    // power save is not simulated, the radio is always on
+    *dev_duty = s_ps_enabled ? s_dev_duty : 100;
+    *nwk_duty = s_ps_enabled ? s_nwk_duty : 100;
+    return ESP_OK;
+}
@@ -0,0 +1,281 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* ESP-MQTT client shim. A publish becomes one simulated IP packet sent
+ * through the station netif: over the mesh link on nodes, straight to the
+ * router on the root. The broker is the simulator, it does not ack.
+ *
+ * Like ESP-MQTT, a disconnect or a failed send leaves the client waiting
+ * for the reconnect timeout, which esp_mqtt_client_reconnect() cuts short,
+ * and a client without clean session finds its session on the broker. */
+#include <string.h>
+#include <pthread.h>
+
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_mesh.h"
+#include "mqtt_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "sim_link.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_MQTT_EVENT_QUEUE_LEN (16)
+#define SIM_MQTT_RECONNECT_MS    (10000)    /* ESP-MQTT default */
+
+static const char *TAG = "sim_mqtt";
+static esp_event_base_t const MQTT_EVENTS = "MQTT_EVENTS";
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    esp_mqtt_event_id_t id;
+    int msg_id;
+    int session_present;
+} sim_mqtt_event_t;
+
+struct esp_mqtt_client {
+    esp_event_handler_t handler;
+    void *handler_arg;
+    QueueHandle_t events;
+    pthread_mutex_t lock;
+    bool started;
+    bool connected;
+    bool persistent;        /* clean session disabled */
+    bool session;           /* the broker holds a session of this client */
+    int reconnect_ms;
+    int64_t reconnect_at_us;    /* 0: not waiting to reconnect */
+    int msg_id;
+    uint16_t seq;
+};
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void mqtt_post(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id)
+{
+    sim_mqtt_event_t event = { .id = id, .msg_id = msg_id };
+    xQueueSend(client->events, &event, 0);
+}
+
+/* The broker is reachable as long as there is a station netif */
+static bool mqtt_connect(esp_mqtt_client_handle_t client)
+{
+    if (esp_netif_get_handle_from_ifkey("WIFI_STA_DEF") == NULL) {
+        return false;
+    }
+    sim_mqtt_event_t event = { .id = MQTT_EVENT_CONNECTED, .session_present = client->persistent && client->session };
+    client->session = true;
+    client->reconnect_at_us = 0;
+    client->connected = true;
+    xQueueSend(client->events, &event, 0);
+    return true;
+}
+
+static void mqtt_lost(esp_mqtt_client_handle_t client)
+{
+    client->connected = false;
+    client->reconnect_at_us = esp_timer_get_time() + client->reconnect_ms * 1000LL;
+    mqtt_post(client, MQTT_EVENT_DISCONNECTED, 0);
+}
+
+static void mqtt_task(void *arg)
+{
+    esp_mqtt_client_handle_t client = arg;
+    sim_mqtt_event_t queued;
+
+    // like ESP-MQTT, handlers run in the client task
+    while (true) {
+        TickType_t wait = portMAX_DELAY;
+        if (client->reconnect_at_us) {
+            int64_t left_us = client->reconnect_at_us - esp_timer_get_time();
+            wait = left_us > 0 ? pdMS_TO_TICKS(left_us / 1000) + 1 : 0;
+        }
+        if (xQueueReceive(client->events, &queued, wait) != pdTRUE) {
+            if (client->reconnect_at_us && esp_timer_get_time() >= client->reconnect_at_us && !mqtt_connect(client)) {
+                client->reconnect_at_us = esp_timer_get_time() + client->reconnect_ms * 1000LL;
+            }
+            continue;
+        }
+        esp_mqtt_event_t event = {
+            .event_id = queued.id,
+            .client = client,
+            .msg_id = queued.msg_id,
+            .session_present = queued.session_present,
+            .protocol_ver = MQTT_PROTOCOL_V_3_1_1,
+        };
+        if (client->handler) {
+            client->handler(client->handler_arg, MQTT_EVENTS, event.event_id, &event);
+        }
+    }
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    esp_mqtt_client_handle_t client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->events = xQueueCreate(SIM_MQTT_EVENT_QUEUE_LEN, sizeof(sim_mqtt_event_t));
+    client->persistent = config->session.disable_clean_session;
+    client->reconnect_ms = config->network.reconnect_timeout_ms ?
+                           config->network.reconnect_timeout_ms : SIM_MQTT_RECONNECT_MS;
+    pthread_mutex_init(&client->lock, NULL);
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    client->handler = event_handler;
+    client->handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if (client->started) {
+        return ESP_FAIL;
+    }
+    client->started = true;
+    xTaskCreate(mqtt_task, "mqtt_task", 6144, client, 5, NULL);
+    if (!mqtt_connect(client)) {
+        mqtt_lost(client);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    client->connected = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    // the client task may still be draining events, keep the memory
+    client->connected = false;
+    client->handler = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client)
+{
+    // only a client waiting to reconnect takes it
+    if (!client->started || client->connected) {
+        return ESP_FAIL;
+    }
+    if (!mqtt_connect(client)) {
+        client->reconnect_at_us = esp_timer_get_time() + client->reconnect_ms * 1000LL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client)
+{
+    if (client->connected) {
+        mqtt_lost(client);
+    }
+    return ESP_OK;
+}
+
+static int next_msg_id(esp_mqtt_client_handle_t client)
+{
+    pthread_mutex_lock(&client->lock);
+    int msg_id = ++client->msg_id;
+    pthread_mutex_unlock(&client->lock);
+    return msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                            int len, int qos, int retain)
+{
+    uint8_t frame[MESH_MPS];
+    sim_ip_hdr_t *hdr = (sim_ip_hdr_t *) frame;
+    size_t topic_len = strlen(topic);
+    const size_t head = 14 + SIM_IP_OVERHEAD;
+
+    if (client == NULL || !client->connected) {
+        return -1;
+    }
+    if (len <= 0) {
+        len = data ? strlen(data) : 0;
+    }
+    // no TCP segmentation: a publish has to fit in one mesh frame
+    if (head + topic_len + len > sizeof(frame)) {
+        ESP_LOGE(TAG, "Publish of %d bytes does not fit in a mesh frame", len);
+        return -1;
+    }
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (netif == NULL) {
+        // the socket went with the netif
+        mqtt_lost(client);
+        return -1;
+    }
+
+    memset(frame, 0, head);
+    esp_mesh_get_router_bssid(hdr->eth_dst);
+    esp_wifi_get_mac(WIFI_IF_STA, hdr->eth_src);
+    hdr->eth_type = 0x0008;     // IPv4, network order
+    hdr->magic = SIM_IP_MAGIC;
+    hdr->origin = sim_node_index();
+    pthread_mutex_lock(&client->lock);
+    hdr->seq = client->seq++;
+    pthread_mutex_unlock(&client->lock);
+    hdr->t_us = esp_timer_get_time();
+    hdr->topic_len = topic_len;
+    hdr->data_len = len;
+    memcpy(frame + head, topic, topic_len);
+    memcpy(frame + head + topic_len, data, len);
+
+    if (esp_netif_transmit(netif, frame, head + topic_len + len) != ESP_OK) {
+        return -1;
+    }
+    int msg_id = qos ? next_msg_id(client) : 0;
+    if (qos) {
+        mqtt_post(client, MQTT_EVENT_PUBLISHED, msg_id);
+    }
+    return msg_id;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                            int len, int qos, int retain, bool store)
+{
+    return esp_mqtt_client_publish(client, topic, data, len, qos, retain);
+}
+
+int esp_mqtt_client_subscribe_single(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    if (!client->connected) {
+        return -1;
+    }
+    int msg_id = next_msg_id(client);
+    mqtt_post(client, MQTT_EVENT_SUBSCRIBED, msg_id);
+    return msg_id;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    if (!client->connected) {
+        return -1;
+    }
+    int msg_id = next_msg_id(client);
+    mqtt_post(client, MQTT_EVENT_UNSUBSCRIBED, msg_id);
+    return msg_id;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client)
+{
+    return 0;
+}
@@ -0,0 +1,563 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Default event loop, esp_netif and WiFi driver shims. There is no IP stack:
+ * a netif hands frames between its driver and the simulated router. */
+#include <string.h>
+#include <pthread.h>
+
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "esp_wifi_netif.h"
+#include "esp_mesh.h"
+#include "lwip/lwip_napt.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "sim_link.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_EVENT_QUEUE_LEN (64)
+#define SIM_NETIF_MAX       (4)
+
+static const char *TAG = "sim_net";
+
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+struct sim_event_handler {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+    struct sim_event_handler *next;
+};
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    void *data;
+} sim_event_t;
+
+struct esp_netif_obj {
+    char desc[24];
+    char key[24];
+    uint8_t mac[6];
+    bool is_ap;
+    bool is_up;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns;
+    esp_netif_driver_ifconfig_t driver;
+    esp_netif_iodriver_handle io_driver;
+};
+
+/* Same layout as the mesh_netif driver, the application reads the station
+ * address of whichever driver is attached to the station netif */
+typedef struct {
+    esp_netif_driver_base_t base;
+    uint8_t sta_mac_addr[6];
+} sim_wifi_driver_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+const esp_netif_inherent_config_t _g_esp_netif_inherent_sta_config = {
+    .if_key = "WIFI_STA_DEF",
+    .if_desc = "sta",
+    .get_ip_event = IP_EVENT_STA_GOT_IP,
+    .lost_ip_event = IP_EVENT_STA_LOST_IP,
+    .route_prio = 100,
+};
+
+const esp_netif_inherent_config_t _g_esp_netif_inherent_ap_config = {
+    .if_key = "WIFI_AP_DEF",
+    .if_desc = "ap",
+    .route_prio = 10,
+};
+
+const esp_netif_netstack_config_t *_g_esp_netif_netstack_default_wifi_sta = NULL;
+const esp_netif_netstack_config_t *_g_esp_netif_netstack_default_wifi_ap = NULL;
+
+static pthread_mutex_t s_event_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_event_handler *s_handlers = NULL;
+static QueueHandle_t s_event_queue = NULL;
+
+static pthread_mutex_t s_netif_lock = PTHREAD_MUTEX_INITIALIZER;
+static esp_netif_t *s_netifs[SIM_NETIF_MAX];
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* ---- default event loop ---- */
+
+static void event_task(void *arg)
+{
+    sim_event_t event;
+
+    while (true) {
+        xQueueReceive(s_event_queue, &event, portMAX_DELAY);
+        pthread_mutex_lock(&s_event_lock);
+        struct sim_event_handler *list = s_handlers;
+        pthread_mutex_unlock(&s_event_lock);
+        // handlers are only ever prepended, the snapshot stays valid
+        for (struct sim_event_handler *h = list; h; h = h->next) {
+            if ((h->base == ESP_EVENT_ANY_BASE || h->base == event.base) &&
+                (h->id == ESP_EVENT_ANY_ID || h->id == event.id)) {
+                h->handler(h->arg, event.base, event.id, event.data);
+            }
+        }
+        free(event.data);
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    if (s_event_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_event_queue = xQueueCreate(SIM_EVENT_QUEUE_LEN, sizeof(sim_event_t));
+    if (s_event_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskCreate(event_task, "sys_evt", 2304, NULL, 20, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+                                     esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    return esp_event_handler_instance_register(event_base, event_id, event_handler, event_handler_arg, NULL);
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+                                              esp_event_handler_t event_handler, void *event_handler_arg,
+                                              esp_event_handler_instance_t *instance)
+{
+    struct sim_event_handler *h = calloc(1, sizeof(*h));
+    if (h == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    h->base = event_base;
+    h->id = event_id;
+    h->handler = event_handler;
+    h->arg = event_handler_arg;
+    pthread_mutex_lock(&s_event_lock);
+    h->next = s_handlers;
+    s_handlers = h;
+    pthread_mutex_unlock(&s_event_lock);
+    if (instance) {
+        *instance = h;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t event_base, int32_t event_id,
+                                       esp_event_handler_t event_handler)
+{
+    // keeps the entry allocated for a dispatch in progress
+    pthread_mutex_lock(&s_event_lock);
+    for (struct sim_event_handler *h = s_handlers; h; h = h->next) {
+        if (h->base == event_base && h->id == event_id && h->handler == event_handler) {
+            h->id = INT32_MIN;
+        }
+    }
+    pthread_mutex_unlock(&s_event_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data,
+                         size_t event_data_size, TickType_t ticks_to_wait)
+{
+    if (s_event_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_event_t event = { .base = event_base, .id = event_id };
+    if (event_data_size) {
+        event.data = malloc(event_data_size);
+        if (event.data == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(event.data, event_data, event_data_size);
+    }
+    if (xQueueSend(s_event_queue, &event, ticks_to_wait) != pdPASS) {
+        free(event.data);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+/* ---- esp_netif ---- */
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_new(const esp_netif_config_t *config)
+{
+    esp_netif_t *netif = calloc(1, sizeof(*netif));
+    if (netif == NULL) {
+        return NULL;
+    }
+    strncpy(netif->desc, config->base->if_desc, sizeof(netif->desc) - 1);
+    strncpy(netif->key, config->base->if_key, sizeof(netif->key) - 1);
+    netif->is_ap = strcmp(config->base->if_key, "WIFI_AP_DEF") == 0;
+    if (config->base->ip_info) {
+        netif->ip_info = *config->base->ip_info;
+    }
+    if (config->driver) {
+        netif->driver = *config->driver;
+    }
+
+    pthread_mutex_lock(&s_netif_lock);
+    for (int i = 0; i < SIM_NETIF_MAX; ++i) {
+        if (s_netifs[i] == NULL) {
+            s_netifs[i] = netif;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_netif_lock);
+    return netif;
+}
+
+void esp_netif_destroy(esp_netif_t *netif)
+{
+    if (netif == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&s_netif_lock);
+    for (int i = 0; i < SIM_NETIF_MAX; ++i) {
+        if (s_netifs[i] == netif) {
+            s_netifs[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&s_netif_lock);
+    free(netif);
+}
+
+esp_err_t esp_netif_attach(esp_netif_t *netif, esp_netif_iodriver_handle driver_handle)
+{
+    esp_netif_driver_base_t *base = driver_handle;
+    netif->io_driver = driver_handle;
+    if (base->post_attach) {
+        return base->post_attach(netif, driver_handle);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_driver_config(esp_netif_t *netif, const esp_netif_driver_ifconfig_t *driver_config)
+{
+    netif->driver = *driver_config;
+    return ESP_OK;
+}
+
+esp_netif_iodriver_handle esp_netif_get_io_driver(esp_netif_t *netif)
+{
+    return netif->io_driver;
+}
+
+const char *esp_netif_get_desc(esp_netif_t *netif)
+{
+    return netif->desc;
+}
+
+esp_err_t esp_netif_set_mac(esp_netif_t *netif, uint8_t mac[])
+{
+    memcpy(netif->mac, mac, 6);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_mac(esp_netif_t *netif, uint8_t mac[])
+{
+    memcpy(mac, netif->mac, 6);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_receive(esp_netif_t *netif, void *buffer, size_t len, void *eb)
+{
+    if (netif->is_ap) {
+        // root AP: a node's packet, NAPT forwards it to the router
+        sim_msg_t msg = { .type = SIM_MSG_UPLINK, .len = len, .t_us = esp_timer_get_time() };
+        if (len > sizeof(msg.payload)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(msg.payload, buffer, len);
+        sim_link_send_msg(&msg);
+    }
+    // downlink packets reach the node's stack here, no socket consumes them yet
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_transmit(esp_netif_t *netif, void *data, size_t len)
+{
+    if (netif->driver.transmit == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return netif->driver.transmit(netif->driver.handle, data, len);
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *netif, esp_netif_ip_info_t *ip_info)
+{
+    *ip_info = netif->ip_info;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t *netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+{
+    if (netif == NULL || dns == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *dns = netif->dns;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_dns_info(esp_netif_t *netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+{
+    netif->dns = *dns;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_start(esp_netif_t *netif)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_stop(esp_netif_t *netif)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_option(esp_netif_t *netif, esp_netif_dhcp_option_mode_t opt_op,
+                                 esp_netif_dhcp_option_id_t opt_id, void *opt_val, uint32_t opt_len)
+{
+    return ESP_OK;
+}
+
+void esp_netif_action_start(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+    ((esp_netif_t *) esp_netif)->is_up = true;
+}
+
+void esp_netif_action_stop(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+    ((esp_netif_t *) esp_netif)->is_up = false;
+}
+
+void esp_netif_action_connected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+}
+
+void esp_netif_action_disconnected(void *esp_netif, esp_event_base_t base, int32_t event_id, void *data)
+{
+}
+
+static esp_netif_t *netif_find(const char *key, const char *desc)
+{
+    esp_netif_t *found = NULL;
+
+    pthread_mutex_lock(&s_netif_lock);
+    for (int i = 0; i < SIM_NETIF_MAX && found == NULL; ++i) {
+        if (s_netifs[i] && ((key && strcmp(s_netifs[i]->key, key) == 0) ||
+                            (desc && strcmp(s_netifs[i]->desc, desc) == 0))) {
+            found = s_netifs[i];
+        }
+    }
+    pthread_mutex_unlock(&s_netif_lock);
+    return found;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    return netif_find(if_key, NULL);
+}
+
+esp_netif_t *esp_netif_find_desc(const char *if_desc)
+{
+    return netif_find(NULL, if_desc);
+}
+
+void ip_napt_enable(uint32_t addr, int enable)
+{
+}
+
+/* ---- WiFi driver ---- */
+
+static esp_err_t wifi_sta_transmit(void *h, void *buffer, size_t len)
+{
+    // root station: straight to the router
+    sim_msg_t msg = { .type = SIM_MSG_UPLINK, .len = len, .t_us = esp_timer_get_time() };
+    if (len > sizeof(msg.payload)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(msg.payload, buffer, len);
+    return sim_link_send_msg(&msg) < 0 ? ESP_FAIL : ESP_OK;
+}
+
+static esp_err_t wifi_sta_post_attach(esp_netif_t *netif, esp_netif_iodriver_handle h)
+{
+    esp_netif_driver_ifconfig_t driver_ifconfig = {
+        .handle = h,
+        .transmit = wifi_sta_transmit,
+    };
+    return esp_netif_set_driver_config(netif, &driver_ifconfig);
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_deinit(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type)
+{
+    *type = WIFI_PS_NONE;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6])
+{
+    sim_node_mac(sim_node_index(), ifx == WIFI_IF_AP, mac);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    mesh_addr_t parent;
+
+    if (esp_mesh_get_parent_bssid(&parent) != ESP_OK || esp_mesh_get_layer() <= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(ap_info, 0, sizeof(*ap_info));
+    memcpy(ap_info->bssid, parent.addr, 6);
+    ap_info->rssi = -50;
+    ap_info->authmode = WIFI_AUTH_WPA2_PSK;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records)
+{
+    // the router alone, a few dB weaker or stronger from node to node
+    if (*number == 0) {
+        return ESP_OK;
+    }
+    memset(ap_records, 0, sizeof(*ap_records));
+    esp_mesh_get_router_bssid(ap_records->bssid);
+    ap_records->rssi = -55 - 2 * (sim_node_index() % 8);
+    ap_records->authmode = WIFI_AUTH_WPA2_PSK;
+    *number = 1;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_default_wifi_sta_handlers(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_clear_default_wifi_driver_and_handlers(void *esp_netif)
+{
+    esp_netif_t *netif = esp_netif;
+    free(netif->io_driver);
+    netif->io_driver = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_attach_wifi_station(esp_netif_t *esp_netif)
+{
+    sim_wifi_driver_t *driver = calloc(1, sizeof(*driver));
+    if (driver == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    driver->base.post_attach = wifi_sta_post_attach;
+    esp_wifi_get_mac(WIFI_IF_STA, driver->sta_mac_addr);
+    return esp_netif_attach(esp_netif, driver);
+}
+
+esp_err_t esp_netif_attach_wifi_ap(esp_netif_t *esp_netif)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_wifi_register_if_rxcb(void *driver, esp_netif_receive_t fn, void *arg)
+{
+    return driver ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+/* ---- messages from the medium ---- */
+
+static void post_got_ip(const sim_msg_t *msg)
+{
+    // the station netif is the wifi one on the root, the mesh link one on nodes
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (netif == NULL) {
+        ESP_LOGW(TAG, "Got IP without a station netif");
+        return;
+    }
+    ip_event_got_ip_t event = { .esp_netif = netif, .ip_changed = true };
+    memcpy(&event.ip_info, msg->payload, sizeof(event.ip_info));
+    netif->ip_info = event.ip_info;
+    netif->dns.ip.type = IPADDR_TYPE_V4;
+    netif->dns.ip.u_addr.ip4 = event.ip_info.gw;
+    esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event), portMAX_DELAY);
+}
+
+void sim_net_handle(const sim_msg_t *msg)
+{
+    switch (msg->type) {
+    case SIM_MSG_EVENT:
+        if (msg->base == SIM_BASE_IP && msg->id == IP_EVENT_STA_GOT_IP) {
+            post_got_ip(msg);
+        }
+        break;
+    case SIM_MSG_DOWNLINK: {
+        // router to root: NAPT hands it to the mesh AP netif, which forwards it to the node
+        esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+        if (netif) {
+            esp_netif_transmit(netif, (void *) msg->payload, msg->len);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
@@ -0,0 +1,665 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* FreeRTOS tasks, queues, semaphores, event groups and esp_timer on POSIX threads.
+ * Priorities are recorded but not enforced: the host scheduler decides. */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_MIN_STACK   (64 * 1024)
+#define SIM_MAX_TASKS   (64)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+struct sim_task {
+    pthread_t thread;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+    bool deleted;
+};
+
+struct sim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *storage;
+};
+
+struct sim_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t max;
+    UBaseType_t count;
+};
+
+struct sim_event_group {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    int64_t alarm_us;
+    uint64_t period_us;
+    bool armed;
+    struct esp_timer *next;
+};
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static __thread struct sim_task *s_current = NULL;
+static pthread_mutex_t s_tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_task *s_tasks[SIM_MAX_TASKS];
+static UBaseType_t s_task_count = 0;
+
+static pthread_mutex_t s_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_timer_cond;
+static struct esp_timer *s_timers = NULL;
+static bool s_timer_task_started = false;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline_after_ticks(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t) pdTICKS_TO_MS(ticks) * 1000000ULL;
+    ts.tv_sec += ns / 1000000000ULL;
+    ts.tv_nsec += ns % 1000000000ULL;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// Wait on cond until pred() holds or the ticks elapse, lock held; false on timeout
+#define WAIT_UNTIL(cond, lock, ticks, pred) ({                                  \
+        bool ok_ = true;                                                        \
+        if (!(pred)) {                                                          \
+            if ((ticks) == 0) {                                                 \
+                ok_ = false;                                                    \
+            } else if ((ticks) == portMAX_DELAY) {                              \
+                while (!(pred)) {                                               \
+                    pthread_cond_wait(cond, lock);                              \
+                }                                                               \
+            } else {                                                            \
+                struct timespec dl_ = deadline_after_ticks(ticks);              \
+                while (!(pred)) {                                               \
+                    if (pthread_cond_timedwait(cond, lock, &dl_) == ETIMEDOUT) { \
+                        ok_ = (pred);                                           \
+                        break;                                                  \
+                    }                                                           \
+                }                                                               \
+            }                                                                   \
+        }                                                                       \
+        ok_;                                                                    \
+    })
+
+static struct sim_task *task_new(const char *name, UBaseType_t priority)
+{
+    struct sim_task *task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return NULL;
+    }
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->priority = priority;
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->cond);
+
+    pthread_mutex_lock(&s_tasks_lock);
+    if (s_task_count < SIM_MAX_TASKS) {
+        s_tasks[s_task_count++] = task;
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+    return task;
+}
+
+static struct sim_task *current_task(void)
+{
+    if (s_current == NULL) {
+        // threads not created through xTaskCreate (main, simulator threads)
+        s_current = task_new("main", 1);
+    }
+    return s_current;
+}
+
+static void *task_entry(void *arg)
+{
+    struct sim_task *task = arg;
+    s_current = task;
+    task->fn(task->arg);
+    // FreeRTOS tasks must not return, treat it like vTaskDelete(NULL)
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *created_task,
+                                   BaseType_t core_id)
+{
+    struct sim_task *task = task_new(name ? name : "", priority);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    // ESP-IDF stack sizes are in bytes, host frames are bigger
+    pthread_attr_setstacksize(&attr, stack_depth * 4 > SIM_MIN_STACK ? stack_depth * 4 : SIM_MIN_STACK);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (created_task) {
+        *created_task = task;
+    }
+    int rc = pthread_create(&task->thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+    return rc == 0 ? pdPASS : pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == s_current) {
+        current_task()->deleted = true;
+        pthread_exit(NULL);
+    }
+    task->deleted = true;
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = deadline_after_ticks(ticks);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t) (esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *previous_wake, TickType_t increment)
+{
+    TickType_t wake = *previous_wake + increment;
+    TickType_t now = xTaskGetTickCount();
+    *previous_wake = wake;
+    if ((int32_t) (wake - now) <= 0) {
+        return pdFALSE;
+    }
+    vTaskDelay(wake - now);
+    return pdTRUE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task();
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+    return (task ? task : current_task())->name;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    return (task ? task : current_task())->priority;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return SIM_MIN_STACK;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    return s_task_count;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t max, uint32_t *total_run_time)
+{
+    UBaseType_t n = 0;
+
+    pthread_mutex_lock(&s_tasks_lock);
+    for (UBaseType_t i = 0; i < s_task_count && n < max; ++i) {
+        if (s_tasks[i]->deleted) {
+            continue;
+        }
+        // no run time accounting on the host
+        status[n++] = (TaskStatus_t) {
+            .xHandle = s_tasks[i],
+            .pcTaskName = s_tasks[i]->name,
+            .xTaskNumber = i,
+            .eCurrentState = eReady,
+            .uxCurrentPriority = s_tasks[i]->priority,
+            .uxBasePriority = s_tasks[i]->priority,
+            .usStackHighWaterMark = SIM_MIN_STACK,
+            .xCoreID = tskNO_AFFINITY,
+        };
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+    if (total_run_time) {
+        *total_run_time = 0;
+    }
+    return n;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct sim_task *task = current_task();
+
+    pthread_mutex_lock(&task->lock);
+    WAIT_UNTIL(&task->cond, &task->lock, ticks, task->notify != 0);
+    uint32_t value = task->notify;
+    if (value) {
+        task->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_woken)
+{
+    xTaskNotifyGive(task);
+    if (higher_priority_woken) {
+        *higher_priority_woken = pdFALSE;
+    }
+}
+
+/* ---- queues ---- */
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct sim_queue *q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->storage = calloc(length, item_size ? item_size : 1);
+    if (q->storage == NULL) {
+        free(q);
+        return NULL;
+    }
+    q->length = length;
+    q->item_size = item_size;
+    pthread_mutex_init(&q->lock, NULL);
+    cond_init(&q->not_empty);
+    cond_init(&q->not_full);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (q) {
+        free(q->storage);
+        free(q);
+    }
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void *item, TickType_t ticks, bool front)
+{
+    pthread_mutex_lock(&q->lock);
+    if (!WAIT_UNTIL(&q->not_full, &q->lock, ticks, q->count < q->length)) {
+        pthread_mutex_unlock(&q->lock);
+        return errQUEUE_FULL;
+    }
+    UBaseType_t slot;
+    if (front) {
+        q->head = (q->head + q->length - 1) % q->length;
+        slot = q->head;
+    } else {
+        slot = (q->head + q->count) % q->length;
+    }
+    memcpy(q->storage + slot * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    return queue_send(q, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    return queue_send(q, item, ticks, true);
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void *item, TickType_t ticks, bool peek)
+{
+    pthread_mutex_lock(&q->lock);
+    if (!WAIT_UNTIL(&q->not_empty, &q->lock, ticks, q->count > 0)) {
+        pthread_mutex_unlock(&q->lock);
+        return errQUEUE_EMPTY;
+    }
+    memcpy(item, q->storage + q->head * q->item_size, q->item_size);
+    if (!peek) {
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    return queue_receive(q, item, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    return queue_receive(q, item, ticks, true);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    q->head = 0;
+    q->count = 1;
+    memcpy(q->storage, item, q->item_size);
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->head = 0;
+    q->count = 0;
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q)
+{
+    return q->length - uxQueueMessagesWaiting(q);
+}
+
+/* ---- semaphores ---- */
+
+SemaphoreHandle_t sim_sem_create(UBaseType_t max, UBaseType_t initial)
+{
+    struct sim_sem *sem = calloc(1, sizeof(*sem));
+    if (sem == NULL) {
+        return NULL;
+    }
+    sem->max = max;
+    sem->count = initial;
+    pthread_mutex_init(&sem->lock, NULL);
+    cond_init(&sem->cond);
+    return sem;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool ok = WAIT_UNTIL(&sem->cond, &sem->lock, ticks, sem->count > 0);
+    if (ok) {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    BaseType_t ret = pdFALSE;
+
+    pthread_mutex_lock(&sem->lock);
+    if (sem->count < sem->max) {
+        sem->count++;
+        pthread_cond_signal(&sem->cond);
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return ret;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem)
+{
+    return sem->count;
+}
+
+/* ---- event groups ---- */
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct sim_event_group *group = calloc(1, sizeof(*group));
+    if (group) {
+        pthread_mutex_init(&group->lock, NULL);
+        cond_init(&group->cond);
+    }
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t now = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks)
+{
+    pthread_mutex_lock(&group->lock);
+    bool ok = WAIT_UNTIL(&group->cond, &group->lock, ticks,
+                         wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0);
+    EventBits_t value = group->bits;
+    if (ok && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+/* ---- esp_timer ---- */
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void timer_task(void *arg)
+{
+    pthread_mutex_lock(&s_timer_lock);
+    while (true) {
+        struct esp_timer *next = NULL;
+        for (struct esp_timer *t = s_timers; t; t = t->next) {
+            if (t->armed && (next == NULL || t->alarm_us < next->alarm_us)) {
+                next = t;
+            }
+        }
+        if (next == NULL) {
+            pthread_cond_wait(&s_timer_cond, &s_timer_lock);
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+        if (next->alarm_us > now) {
+            struct timespec ts;
+            ts.tv_sec = next->alarm_us / 1000000;
+            ts.tv_nsec = (next->alarm_us % 1000000) * 1000;
+            pthread_cond_timedwait(&s_timer_cond, &s_timer_lock, &ts);
+            continue;
+        }
+        if (next->period_us) {
+            next->alarm_us += next->period_us;
+        } else {
+            next->armed = false;
+        }
+        // callbacks may start/stop timers
+        pthread_mutex_unlock(&s_timer_lock);
+        next->callback(next->arg);
+        pthread_mutex_lock(&s_timer_lock);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->name = create_args->name;
+
+    pthread_mutex_lock(&s_timer_lock);
+    if (!s_timer_task_started) {
+        cond_init(&s_timer_cond);
+        xTaskCreate(timer_task, "esp_timer", 4096, NULL, 22, NULL);
+        s_timer_task_started = true;
+    }
+    timer->next = s_timers;
+    s_timers = timer;
+    pthread_mutex_unlock(&s_timer_lock);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_arm(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    pthread_mutex_lock(&s_timer_lock);
+    if (timer->armed) {
+        pthread_mutex_unlock(&s_timer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->alarm_us = esp_timer_get_time() + timeout_us;
+    timer->period_us = period_us;
+    timer->armed = true;
+    pthread_cond_signal(&s_timer_cond);
+    pthread_mutex_unlock(&s_timer_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_arm(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return timer_arm(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_timer_lock);
+    bool was_armed = timer->armed;
+    timer->armed = false;
+    pthread_mutex_unlock(&s_timer_lock);
+    return was_armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_timer_lock);
+    for (struct esp_timer **p = &s_timers; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_timer_lock);
+    free(timer);
+    return ESP_OK;
+}
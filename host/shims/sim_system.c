@@ -0,0 +1,645 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Chip level shims: errors, logging, heap, reset, NVS, GPIO, LEDC, CRC, power management */
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "esp_pm.h"
+#include "esp_mesh.h"
+#include "esp_sleep.h"
+#include "nvs_flash.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "sim_link.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_LOG_LINE        (512)
+#define SIM_LOG_TAGS        (32)
+#define SIM_NVS_ENTRIES     (64)
+#define SIM_NVS_NAMESPACES  (16)
+#define SIM_NVS_KEY_LEN     (16)
+#define SIM_NVS_MAX_BLOB    (4000)
+// Nominal free heap reported to the application
+#define SIM_HEAP_SIZE       (200 * 1024)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    NVS_TYPE_U8,
+    NVS_TYPE_U16,
+    NVS_TYPE_U32,
+    NVS_TYPE_I32,
+    NVS_TYPE_STR,
+    NVS_TYPE_BLOB,
+} nvs_type_t;
+
+typedef struct {
+    bool used;
+    uint8_t ns;
+    nvs_type_t type;
+    char key[SIM_NVS_KEY_LEN];
+    size_t length;
+    void *value;
+} nvs_entry_t;
+
+typedef struct {
+    char tag[24];
+    esp_log_level_t level;
+} log_tag_level_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static pthread_mutex_t s_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static esp_log_level_t s_log_default = CONFIG_LOG_DEFAULT_LEVEL;
+static log_tag_level_t s_log_tags[SIM_LOG_TAGS];
+static int s_log_tag_count = 0;
+static __thread char s_log_line[SIM_LOG_LINE];
+static __thread size_t s_log_len = 0;
+
+static pthread_mutex_t s_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char s_nvs_namespaces[SIM_NVS_NAMESPACES][SIM_NVS_KEY_LEN];
+static nvs_entry_t s_nvs[SIM_NVS_ENTRIES];
+static bool s_nvs_ready = false;
+
+static pthread_mutex_t s_gpio_lock = PTHREAD_MUTEX_INITIALIZER;
+static int s_gpio_level[GPIO_NUM_MAX];
+static bool s_gpio_driven[GPIO_NUM_MAX];
+static gpio_int_type_t s_gpio_intr[GPIO_NUM_MAX];
+static gpio_isr_t s_gpio_isr[GPIO_NUM_MAX];
+static void *s_gpio_isr_arg[GPIO_NUM_MAX];
+static bool s_gpio_isr_service = false;
+
+static uint32_t s_ledc_duty[LEDC_CHANNEL_MAX];
+static uint32_t s_ledc_freq[LEDC_TIMER_MAX];
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:                        return "ESP_OK";
+    case ESP_FAIL:                      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:                return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:           return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:         return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:          return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:             return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:         return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:               return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC:           return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_NVS_NOT_FOUND:         return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_LENGTH:    return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NOT_INITIALIZED:   return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_TYPE_MISMATCH:     return "ESP_ERR_NVS_TYPE_MISMATCH";
+    case ESP_ERR_MESH_NOT_START:        return "ESP_ERR_MESH_NOT_START";
+    case ESP_ERR_MESH_ARGUMENT:         return "ESP_ERR_MESH_ARGUMENT";
+    case ESP_ERR_MESH_DISCONNECTED:     return "ESP_ERR_MESH_DISCONNECTED";
+    case ESP_ERR_MESH_QUEUE_FULL:       return "ESP_ERR_MESH_QUEUE_FULL";
+    case ESP_ERR_MESH_NO_ROUTE_FOUND:   return "ESP_ERR_MESH_NO_ROUTE_FOUND";
+    default:                            return "UNKNOWN ERROR";
+    }
+}
+
+/* ---- log ---- */
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    pthread_mutex_lock(&s_log_lock);
+    if (strcmp(tag, "*") == 0) {
+        s_log_default = level;
+        s_log_tag_count = 0;
+    } else {
+        int i;
+        for (i = 0; i < s_log_tag_count && strcmp(s_log_tags[i].tag, tag) != 0; ++i) {
+        }
+        if (i < SIM_LOG_TAGS) {
+            strncpy(s_log_tags[i].tag, tag, sizeof(s_log_tags[i].tag) - 1);
+            s_log_tags[i].level = level;
+            s_log_tag_count = i == s_log_tag_count ? i + 1 : s_log_tag_count;
+        }
+    }
+    pthread_mutex_unlock(&s_log_lock);
+}
+
+esp_log_level_t esp_log_level_get(const char *tag)
+{
+    for (int i = 0; i < s_log_tag_count; ++i) {
+        if (strcmp(s_log_tags[i].tag, tag) == 0) {
+            return s_log_tags[i].level;
+        }
+    }
+    return s_log_default;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    va_list args;
+
+    // line buffered per thread, every node shares the simulator's stdout
+    if (s_log_len == 0) {
+        s_log_len = snprintf(s_log_line, sizeof(s_log_line), "[n%03d] ", sim_node_index());
+    }
+    va_start(args, format);
+    int n = vsnprintf(s_log_line + s_log_len, sizeof(s_log_line) - s_log_len, format, args);
+    va_end(args);
+    if (n > 0) {
+        s_log_len += n;
+    }
+    if (s_log_len >= sizeof(s_log_line) - 1) {
+        s_log_len = sizeof(s_log_line) - 1;
+        s_log_line[s_log_len - 1] = '\n';
+    }
+    if (s_log_line[s_log_len - 1] == '\n') {
+        ssize_t written = write(STDOUT_FILENO, s_log_line, s_log_len);
+        (void) written;
+        s_log_len = 0;
+    }
+}
+
+/* ---- system ---- */
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return SIM_HEAP_SIZE;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return SIM_HEAP_SIZE;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return SIM_HEAP_SIZE;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return SIM_HEAP_SIZE;
+}
+
+esp_err_t heap_caps_monitor_local_minimum_free_size_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t heap_caps_monitor_local_minimum_free_size_stop(void)
+{
+    return ESP_OK;
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+
+void esp_restart(void)
+{
+    // the medium sees the link close, like a node dropping off the mesh
+    fflush(stdout);
+    _exit(0);
+}
+
+uint32_t esp_random(void)
+{
+    // differs between runs and between the node processes, like the hardware RNG
+    static uint64_t state = 0;
+    if (state == 0) {
+        state = (uint64_t) esp_timer_get_time() ^ ((uint64_t) getpid() << 32) ^ 0x9e3779b97f4a7c15ull;
+    }
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t) (state >> 32);
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    sim_node_mac(sim_node_index(), type == ESP_MAC_WIFI_SOFTAP, mac);
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    return ESP_OK;
+}
+
+/* ---- NVS ---- */
+
+esp_err_t nvs_flash_init(void)
+{
+    s_nvs_ready = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    for (int i = 0; i < SIM_NVS_ENTRIES; ++i) {
+        free(s_nvs[i].value);
+        s_nvs[i] = (nvs_entry_t) { 0 };
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (!s_nvs_ready) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    pthread_mutex_lock(&s_nvs_lock);
+    for (int i = 0; i < SIM_NVS_NAMESPACES; ++i) {
+        if (s_nvs_namespaces[i][0] == '\0') {
+            strncpy(s_nvs_namespaces[i], name, SIM_NVS_KEY_LEN - 1);
+        }
+        if (strcmp(s_nvs_namespaces[i], name) == 0) {
+            *out_handle = i + 1;
+            pthread_mutex_unlock(&s_nvs_lock);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return handle ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+static nvs_entry_t *nvs_find(nvs_handle_t handle, const char *key)
+{
+    for (int i = 0; i < SIM_NVS_ENTRIES; ++i) {
+        if (s_nvs[i].used && s_nvs[i].ns == handle && strcmp(s_nvs[i].key, key) == 0) {
+            return &s_nvs[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t nvs_set(nvs_handle_t handle, const char *key, nvs_type_t type, const void *value, size_t length)
+{
+    if (handle == 0 || handle > SIM_NVS_NAMESPACES) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (length > SIM_NVS_MAX_BLOB) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    void *copy = malloc(length ? length : 1);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, value, length);
+
+    pthread_mutex_lock(&s_nvs_lock);
+    nvs_entry_t *entry = nvs_find(handle, key);
+    for (int i = 0; entry == NULL && i < SIM_NVS_ENTRIES; ++i) {
+        if (!s_nvs[i].used) {
+            entry = &s_nvs[i];
+        }
+    }
+    if (entry == NULL) {
+        pthread_mutex_unlock(&s_nvs_lock);
+        free(copy);
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    free(entry->value);
+    *entry = (nvs_entry_t) { .used = true, .ns = handle, .type = type, .length = length, .value = copy };
+    strncpy(entry->key, key, SIM_NVS_KEY_LEN - 1);
+    pthread_mutex_unlock(&s_nvs_lock);
+    return ESP_OK;
+}
+
+static esp_err_t nvs_get(nvs_handle_t handle, const char *key, nvs_type_t type, void *out_value, size_t *length)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&s_nvs_lock);
+    nvs_entry_t *entry = nvs_find(handle, key);
+    if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (entry->type != type) {
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else if (out_value == NULL) {
+        *length = entry->length;
+    } else if (*length < entry->length) {
+        *length = entry->length;
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, entry->value, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    nvs_entry_t *entry = nvs_find(handle, key);
+    if (entry) {
+        free(entry->value);
+        *entry = (nvs_entry_t) { 0 };
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return entry ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    for (int i = 0; i < SIM_NVS_ENTRIES; ++i) {
+        if (s_nvs[i].used && s_nvs[i].ns == handle) {
+            free(s_nvs[i].value);
+            s_nvs[i] = (nvs_entry_t) { 0 };
+        }
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return nvs_get(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return nvs_set(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return nvs_get(handle, key, NVS_TYPE_STR, out_value, length);
+}
+
+#define NVS_SCALAR(suffix, ctype, type)                                                 \
+    esp_err_t nvs_set_##suffix(nvs_handle_t handle, const char *key, ctype value)       \
+    {                                                                                   \
+        return nvs_set(handle, key, type, &value, sizeof(value));                       \
+    }                                                                                   \
+    esp_err_t nvs_get_##suffix(nvs_handle_t handle, const char *key, ctype *out_value)  \
+    {                                                                                   \
+        size_t length = sizeof(*out_value);                                             \
+        return nvs_get(handle, key, type, out_value, &length);                          \
+    }
+
+NVS_SCALAR(u8, uint8_t, NVS_TYPE_U8)
+NVS_SCALAR(u16, uint16_t, NVS_TYPE_U16)
+NVS_SCALAR(u32, uint32_t, NVS_TYPE_U32)
+NVS_SCALAR(i32, int32_t, NVS_TYPE_I32)
+
+/* ---- GPIO ---- */
+
+static bool gpio_valid(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    pthread_mutex_lock(&s_gpio_lock);
+    for (int pin = 0; pin < GPIO_NUM_MAX; ++pin) {
+        if (!(config->pin_bit_mask & BIT64(pin))) {
+            continue;
+        }
+        s_gpio_intr[pin] = config->intr_type;
+        if (!s_gpio_driven[pin]) {
+            s_gpio_level[pin] = config->pull_up_en ? 1 : 0;
+        }
+    }
+    pthread_mutex_unlock(&s_gpio_lock);
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    return gpio_valid(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return gpio_valid(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!gpio_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_gpio_level[gpio_num] = level ? 1 : 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return gpio_valid(gpio_num) ? s_gpio_level[gpio_num] : 0;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (!gpio_valid(gpio_num)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_gpio_intr[gpio_num] = intr_type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if (s_gpio_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_gpio_isr_service = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (!s_gpio_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pthread_mutex_lock(&s_gpio_lock);
+    s_gpio_isr[gpio_num] = isr_handler;
+    s_gpio_isr_arg[gpio_num] = args;
+    pthread_mutex_unlock(&s_gpio_lock);
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    pthread_mutex_lock(&s_gpio_lock);
+    s_gpio_isr[gpio_num] = NULL;
+    pthread_mutex_unlock(&s_gpio_lock);
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+void sim_gpio_drive(gpio_num_t gpio_num, int level)
+{
+    if (!gpio_valid(gpio_num)) {
+        return;
+    }
+    pthread_mutex_lock(&s_gpio_lock);
+    int old = s_gpio_level[gpio_num];
+    s_gpio_level[gpio_num] = level ? 1 : 0;
+    s_gpio_driven[gpio_num] = true;
+    gpio_int_type_t intr = s_gpio_intr[gpio_num];
+    gpio_isr_t isr = s_gpio_isr[gpio_num];
+    void *arg = s_gpio_isr_arg[gpio_num];
+    pthread_mutex_unlock(&s_gpio_lock);
+
+    bool rising = !old && level;
+    bool falling = old && !level;
+    if (isr && ((rising && (intr == GPIO_INTR_POSEDGE || intr == GPIO_INTR_ANYEDGE)) ||
+                (falling && (intr == GPIO_INTR_NEGEDGE || intr == GPIO_INTR_ANYEDGE)) ||
+                (level && intr == GPIO_INTR_HIGH_LEVEL) || (!level && intr == GPIO_INTR_LOW_LEVEL))) {
+        isr(arg);
+    }
+}
+
+/* ---- LEDC ---- */
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    s_ledc_freq[timer_conf->timer_num] = timer_conf->freq_hz;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    s_ledc_duty[ledc_conf->channel] = ledc_conf->duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    s_ledc_duty[channel] = duty;
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return s_ledc_duty[channel];
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_freq(ledc_mode_t speed_mode, ledc_timer_t timer_num, uint32_t freq_hz)
+{
+    s_ledc_freq[timer_num] = freq_hz;
+    return ESP_OK;
+}
+
+uint32_t ledc_get_freq(ledc_mode_t speed_mode, ledc_timer_t timer_num)
+{
+    return s_ledc_freq[timer_num];
+}
+
+esp_err_t ledc_stop(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t idle_level)
+{
+    s_ledc_duty[channel] = 0;
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms)
+{
+    // fades complete immediately
+    s_ledc_duty[channel] = target_duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty_and_update(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty, uint32_t hpoint)
+{
+    s_ledc_duty[channel] = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_bind_channel_timer(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_timer_t timer_sel)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_timer_rst(ledc_mode_t speed_mode, ledc_timer_t timer_sel)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+    return ESP_OK;
+}
@@ -0,0 +1,312 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* esp-tls and tcp_transport shims on OpenSSL and a real socket, for the
+ * transport in main/mqtt_tls.c. Not part of idf_shim: only the targets that
+ * link OpenSSL build it. */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+
+#include "esp_log.h"
+#include "esp_tls.h"
+#include "esp_transport.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+struct esp_tls {
+    SSL_CTX *ctx;
+    SSL *ssl;
+    int fd;
+};
+
+struct esp_tls_client_session {
+    SSL_SESSION *session;
+};
+
+struct esp_transport_item_t {
+    void *data;
+    int default_port;
+    connect_func connect;
+    io_read_func read;
+    io_func write;
+    trans_func close;
+    poll_func poll_read;
+    poll_func poll_write;
+    trans_func destroy;
+};
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *TAG = "sim_tls";
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_tls_t *esp_tls_init(void)
+{
+    esp_tls_t *tls = calloc(1, sizeof(*tls));
+
+    if (tls) {
+        tls->fd = -1;
+    }
+    return tls;
+}
+
+static int tcp_connect(const char *host, int port, int timeout_ms)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res, *ai;
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    char service[8];
+    int fd = -1;
+
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        // the handshake blocks at most timeout_ms per read or write, like esp-tls
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int ca_load(SSL_CTX *ctx, const unsigned char *pem, unsigned int len)
+{
+    BIO *bio = BIO_new_mem_buf(pem, len);
+    X509_STORE *store = SSL_CTX_get_cert_store(ctx);
+    X509 *cert;
+    int loaded = 0;
+
+    if (bio == NULL) {
+        return 0;
+    }
+    while ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+        loaded += X509_STORE_add_cert(store, cert) == 1;
+        X509_free(cert);
+    }
+    ERR_clear_error();
+    BIO_free(bio);
+    return loaded;
+}
+
+int esp_tls_conn_new_sync(const char *hostname, int hostlen, int port, const esp_tls_cfg_t *cfg, esp_tls_t *tls)
+{
+    char host[256];
+
+    if (hostlen >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, hostname, hostlen);
+    host[hostlen] = '\0';
+    tls->ctx = SSL_CTX_new(TLS_client_method());
+    if (tls->ctx == NULL) {
+        return -1;
+    }
+    // TLS 1.2 as esp-tls on mbedTLS: the session holds its ticket once the handshake is over
+    SSL_CTX_set_max_proto_version(tls->ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(tls->ctx, SSL_VERIFY_PEER, NULL);
+    if (cfg->cacert_buf && ca_load(tls->ctx, cfg->cacert_buf, cfg->cacert_bytes) == 0) {
+        ESP_LOGE(TAG, "No CA certificate in the buffer");
+        return -1;
+    }
+    tls->fd = tcp_connect(host, port, cfg->timeout_ms > 0 ? cfg->timeout_ms : 10000);
+    if (tls->fd < 0) {
+        ESP_LOGE(TAG, "TCP connection to %s:%d failed", host, port);
+        return -1;
+    }
+    tls->ssl = SSL_new(tls->ctx);
+    if (tls->ssl == NULL) {
+        return -1;
+    }
+    SSL_set_fd(tls->ssl, tls->fd);
+    SSL_set_tlsext_host_name(tls->ssl, host);
+    SSL_set1_host(tls->ssl, host);
+    if (cfg->client_session) {
+        SSL_set_session(tls->ssl, cfg->client_session->session);
+    }
+    if (SSL_connect(tls->ssl) != 1) {
+        ESP_LOGE(TAG, "Handshake with %s failed: %s", host, ERR_reason_error_string(ERR_get_error()));
+        return -1;
+    }
+    return 1;
+}
+
+int esp_tls_conn_destroy(esp_tls_t *tls)
+{
+    if (tls == NULL) {
+        return -1;
+    }
+    if (tls->ssl) {
+        SSL_shutdown(tls->ssl);
+        SSL_free(tls->ssl);
+    }
+    SSL_CTX_free(tls->ctx);
+    if (tls->fd >= 0) {
+        close(tls->fd);
+    }
+    free(tls);
+    return 0;
+}
+
+static ssize_t ssl_result(esp_tls_t *tls, int ret)
+{
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(tls->ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return ESP_TLS_ERR_SSL_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return ESP_TLS_ERR_SSL_WANT_WRITE;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+ssize_t esp_tls_conn_read(esp_tls_t *tls, void *data, size_t datalen)
+{
+    return ssl_result(tls, SSL_read(tls->ssl, data, datalen));
+}
+
+ssize_t esp_tls_conn_write(esp_tls_t *tls, const void *data, size_t datalen)
+{
+    return ssl_result(tls, SSL_write(tls->ssl, data, datalen));
+}
+
+ssize_t esp_tls_get_bytes_avail(esp_tls_t *tls)
+{
+    return tls && tls->ssl ? SSL_pending(tls->ssl) : -1;
+}
+
+esp_err_t esp_tls_get_conn_sockfd(esp_tls_t *tls, int *sockfd)
+{
+    if (tls == NULL || sockfd == NULL || tls->fd < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *sockfd = tls->fd;
+    return ESP_OK;
+}
+
+esp_tls_client_session_t *esp_tls_get_client_session(esp_tls_t *tls)
+{
+    esp_tls_client_session_t *s;
+
+    if (tls == NULL || tls->ssl == NULL || (s = calloc(1, sizeof(*s))) == NULL) {
+        return NULL;
+    }
+    s->session = SSL_get1_session(tls->ssl);
+    if (s->session == NULL) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void esp_tls_free_client_session(esp_tls_client_session_t *client_session)
+{
+    if (client_session) {
+        SSL_SESSION_free(client_session->session);
+        free(client_session);
+    }
+}
+
+bool sim_tls_session_reused(esp_tls_t *tls)
+{
+    return tls && tls->ssl && SSL_session_reused(tls->ssl);
+}
+
+esp_transport_handle_t esp_transport_init(void)
+{
+    return calloc(1, sizeof(struct esp_transport_item_t));
+}
+
+esp_err_t esp_transport_destroy(esp_transport_handle_t t)
+{
+    if (t == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (t->destroy) {
+        t->destroy(t);
+    }
+    free(t);
+    return ESP_OK;
+}
+
+int esp_transport_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    return t->connect(t, host, port > 0 ? port : t->default_port, timeout_ms);
+}
+
+int esp_transport_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    return t->read(t, buffer, len, timeout_ms);
+}
+
+int esp_transport_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    return t->write(t, buffer, len, timeout_ms);
+}
+
+int esp_transport_close(esp_transport_handle_t t)
+{
+    return t->close(t);
+}
+
+void *esp_transport_get_context_data(esp_transport_handle_t t)
+{
+    return t->data;
+}
+
+esp_err_t esp_transport_set_context_data(esp_transport_handle_t t, void *data)
+{
+    t->data = data;
+    return ESP_OK;
+}
+
+esp_err_t esp_transport_set_func(esp_transport_handle_t t, connect_func _connect, io_read_func _read,
+                                 io_func _write, trans_func _close, poll_func _poll_read,
+                                 poll_func _poll_write, trans_func _destroy)
+{
+    t->connect = _connect;
+    t->read = _read;
+    t->write = _write;
+    t->close = _close;
+    t->poll_read = _poll_read;
+    t->poll_write = _poll_write;
+    t->destroy = _destroy;
+    return ESP_OK;
+}
+
+esp_err_t esp_transport_set_default_port(esp_transport_handle_t t, int port)
+{
+    t->default_port = port;
+    return ESP_OK;
+}
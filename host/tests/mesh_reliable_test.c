@@ -0,0 +1,78 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* mesh_reliable.c is built into this translation unit with esp_mesh_send()
+ * replaced, so the test decides how long each transmission blocks. The
+ * medium stalls on the first retransmission for longer than the timeout of
+ * the next one: the task must retransmit again as soon as it is back. */
+#include <stdio.h>
+#include <unistd.h>
+#include "esp_mesh.h"
+
+static esp_err_t stalled_mesh_send(const mesh_addr_t *to, const mesh_data_t *data, int flag,
+                                   const mesh_opt_t opt[], int opt_count);
+#define esp_mesh_send stalled_mesh_send
+#include "../../main/mesh_reliable.c"
+#undef esp_mesh_send
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TEST_STALL_MS       (3 * MESH_RELIABLE_RTO_INIT_MS)    /* past the deadline of the next retransmission */
+#define TEST_LATE_MS        (200)
+#define TEST_TIMEOUT_MS     (4000)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static int64_t s_done_us[MESH_RELIABLE_TRIES];
+static int s_count = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static esp_err_t stalled_mesh_send(const mesh_addr_t *to, const mesh_data_t *data, int flag,
+                                   const mesh_opt_t opt[], int opt_count)
+{
+    int n = __atomic_load_n(&s_count, __ATOMIC_ACQUIRE);
+
+    if (n == 1) {
+        usleep(TEST_STALL_MS * 1000);
+    }
+    if (n < MESH_RELIABLE_TRIES) {
+        s_done_us[n] = esp_timer_get_time();
+        __atomic_store_n(&s_count, n + 1, __ATOMIC_RELEASE);
+    }
+    return ESP_OK;
+}
+
+int main(void)
+{
+    mesh_addr_t to = { .addr = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x02 } };
+    uint8_t frame[] = { 0x55 };
+
+    ESP_ERROR_CHECK(mesh_reliable_init(NULL));
+    ESP_ERROR_CHECK(mesh_reliable_send(&to, frame, sizeof(frame)));
+
+    int64_t end = esp_timer_get_time() + TEST_TIMEOUT_MS * 1000;
+    while (__atomic_load_n(&s_count, __ATOMIC_ACQUIRE) < 3 && esp_timer_get_time() < end) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    int count = __atomic_load_n(&s_count, __ATOMIC_ACQUIRE);
+    if (count < 3) {
+        printf("FAIL: %d transmissions in %d ms, none after the stall\n", count, TEST_TIMEOUT_MS);
+        return 1;
+    }
+    int64_t late_ms = (s_done_us[2] - s_done_us[1]) / 1000;
+    if (late_ms > TEST_LATE_MS) {
+        printf("FAIL: retransmitted %" PRId64 " ms after the stall\n", late_ms);
+        return 1;
+    }
+    printf("ok: retransmitted %" PRId64 " ms after a %d ms stall\n", late_ms, TEST_STALL_MS);
+    return 0;
+}
@@ -0,0 +1,190 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* mqtt_pub.c is built into this translation unit without its publisher
+ * task: the test moves records into the outboxes and sends them itself,
+ * the way the task does, and checks the class policies on what reaches
+ * the client. */
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#undef xTaskCreate
+#define xTaskCreate(fn, name, stack, arg, prio, handle) ((void) (fn))
+#include "../../main/mqtt_pub.c"
+#undef xTaskCreate
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TEST_SENT_MAX       (32)
+#define TEST_QUEUE_DEPTH    (16)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static char s_sent[TEST_SENT_MAX][MQTT_PUB_JSON_MAX];
+static int s_sent_count = 0;
+static mqtt_pub_queue_t *s_queue = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int capture_send(const char *topic, const char *data, int len, int qos, int retain)
+{
+    if (s_sent_count < TEST_SENT_MAX) {
+        snprintf(s_sent[s_sent_count], sizeof(s_sent[0]), "%s %.*s", topic, len, data);
+    }
+    return ++s_sent_count;
+}
+
+/* One round of the publisher task, until nothing moves */
+static void pump(bool connected)
+{
+    bool more;
+
+    do {
+        more = outbox_fill();
+        if (connected) {
+            more |= outbox_send() > 0;
+        }
+    } while (more);
+}
+
+static void put(mqtt_pub_class_t cls, const char *key, double value)
+{
+    mqtt_pub_record_t *rec = mqtt_pub_begin(s_queue, MQTT_PUB_TELEMETRY, cls);
+
+    if (rec) {
+        mqtt_pub_add(rec, key, value);
+        mqtt_pub_commit(s_queue);
+    }
+}
+
+static bool expect_sent(const char *name, const char *const *expected, int count)
+{
+    bool ok = s_sent_count == count;
+
+    for (int i = 0; ok && i < count; ++i) {
+        ok = strcmp(s_sent[i], expected[i]) == 0;
+    }
+    if (!ok) {
+        printf("FAIL: %s, %d records sent:\n", name, s_sent_count);
+        for (int i = 0; i < s_sent_count && i < TEST_SENT_MAX; ++i) {
+            printf("  %s\n", s_sent[i]);
+        }
+    }
+    s_sent_count = 0;
+    return ok;
+}
+
+/* A newer state replaces the held one in its place, ahead of later records */
+static bool test_coalesce(void)
+{
+    static const char *const expected[] = {
+        "v1/devices/me/telemetry {\"phase\":3}",
+        "v1/devices/me/telemetry {\"preempt\":1}",
+    };
+
+    put(MQTT_PUB_CLASS_CONTROL, "phase", 1);
+    put(MQTT_PUB_CLASS_CONTROL, "preempt", 1);
+    put(MQTT_PUB_CLASS_CONTROL, "phase", 2);
+    put(MQTT_PUB_CLASS_CONTROL, "phase", 3);
+    pump(false);
+    pump(true);
+    return expect_sent("coalesced record out of place", expected, 2);
+}
+
+/* A full EVENT outbox makes room by dropping its oldest record */
+static bool test_drop_oldest(void)
+{
+    static const char *const expected[] = {
+        "v1/devices/me/telemetry {\"press\":2}",
+        "v1/devices/me/telemetry {\"press\":3}",
+        "v1/devices/me/telemetry {\"press\":4}",
+        "v1/devices/me/telemetry {\"press\":5}",
+        "v1/devices/me/telemetry {\"press\":6}",
+        "v1/devices/me/telemetry {\"press\":7}",
+        "v1/devices/me/telemetry {\"press\":8}",
+        "v1/devices/me/telemetry {\"press\":9}",
+    };
+
+    for (int i = 0; i < MQTT_PUB_EVENT_BUDGET + 2; ++i) {
+        put(MQTT_PUB_CLASS_EVENT, "press", i);
+        pump(false);
+    }
+    pump(true);
+    return expect_sent("full EVENT outbox", expected, MQTT_PUB_EVENT_BUDGET);
+}
+
+/* A REPLY that finds its outbox full waits in the producer queue, none is lost */
+static bool test_never_drop(void)
+{
+    static const char *const expected[] = {
+        "v1/devices/me/rpc/response/1 {\"r\":1}",
+        "v1/devices/me/rpc/response/2 {\"r\":2}",
+        "v1/devices/me/rpc/response/3 {\"r\":3}",
+        "v1/devices/me/rpc/response/4 {\"r\":4}",
+        "v1/devices/me/rpc/response/5 {\"r\":5}",
+    };
+    char reply[16];
+
+    for (uint32_t id = 1; id <= MQTT_PUB_REPLY_BUDGET + 1; ++id) {
+        int len = snprintf(reply, sizeof(reply), "{\"r\":%" PRIu32 "}", id);
+        mqtt_pub_text(s_queue, MQTT_PUB_RPC_RESPONSE, MQTT_PUB_CLASS_REPLY, id, reply, len);
+    }
+    pump(false);
+    uint32_t waiting = s_queue->head - s_queue->tail;
+    if (s_outbox[MQTT_PUB_CLASS_REPLY].count != MQTT_PUB_REPLY_BUDGET || waiting != 1) {
+        printf("FAIL: full REPLY outbox, %d held and %" PRIu32 " waiting in the queue\n",
+               s_outbox[MQTT_PUB_CLASS_REPLY].count, waiting);
+        return false;
+    }
+    pump(true);
+    return expect_sent("full REPLY outbox", expected, MQTT_PUB_REPLY_BUDGET + 1);
+}
+
+/* Held while the broker is away, then sent REPLY first and SAMPLE last */
+static bool test_priority(void)
+{
+    static const char *const expected[] = {
+        "v1/devices/me/rpc/response/7 {}",
+        "v1/devices/me/telemetry {\"control\":1}",
+        "v1/devices/me/telemetry {\"event\":1}",
+        "v1/devices/me/telemetry {\"sample\":1}",
+    };
+
+    put(MQTT_PUB_CLASS_SAMPLE, "sample", 1);
+    put(MQTT_PUB_CLASS_EVENT, "event", 1);
+    put(MQTT_PUB_CLASS_CONTROL, "control", 1);
+    mqtt_pub_text(s_queue, MQTT_PUB_RPC_RESPONSE, MQTT_PUB_CLASS_REPLY, 7, "{}", 2);
+    pump(false);
+    if (s_sent_count != 0) {
+        printf("FAIL: %d records sent while disconnected\n", s_sent_count);
+        return false;
+    }
+    pump(true);
+    return expect_sent("class order after reconnect", expected, 4);
+}
+
+int main(void)
+{
+    s_queue = mqtt_pub_queue_create("test", TEST_QUEUE_DEPTH);
+    mqtt_pub_start(capture_send);
+
+    bool ok = test_coalesce();
+    ok &= test_drop_oldest();
+    ok &= test_never_drop();
+    ok &= test_priority();
+    if (!ok) {
+        return 1;
+    }
+    printf("ok: coalesce in place, drop oldest, never drop, class priority\n");
+    return 0;
+}
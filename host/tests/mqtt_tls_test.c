@@ -0,0 +1,176 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* mqtt_tls.c is built into this translation unit with session reuse on and
+ * esp-tls on OpenSSL (shims/sim_tls.c). The broker is 'openssl s_server' on
+ * a loopback port, which sends every line back reversed: the first
+ * connection must do a full handshake, the second one must resume the
+ * session the first one left. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include "sdkconfig.h"
+#define CONFIG_APP_MQTT_TLS_SESSION_REUSE 1
+#include "../../main/mqtt_tls.c"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TEST_HOST           "localhost"
+#define TEST_LINE           "hello\n"
+#define TEST_REPLY          "olleh\n"
+#define TEST_IO_MS          (2000)
+#define TEST_START_MS       (5000)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static char s_dir[] = "/tmp/mqtt_tls_test.XXXXXX";
+static char s_ca[4096];
+static size_t s_ca_len = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int free_port(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int port = -1;
+
+    if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0
+            && getsockname(fd, (struct sockaddr *) &addr, &len) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return port;
+}
+
+// self-signed P-256 certificate for localhost, also the CA the client trusts
+static bool cert_create(const char *openssl)
+{
+    char cmd[1024];
+
+    if (mkdtemp(s_dir) == NULL) {
+        return false;
+    }
+    snprintf(cmd, sizeof(cmd), "'%s' req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes "
+             "-keyout %s/key.pem -out %s/cert.pem -days 1 -subj /CN=" TEST_HOST
+             " -addext subjectAltName=DNS:" TEST_HOST " 2>/dev/null", openssl, s_dir, s_dir);
+    if (system(cmd) != 0) {
+        return false;
+    }
+    snprintf(cmd, sizeof(cmd), "%s/cert.pem", s_dir);
+    FILE *f = fopen(cmd, "r");
+    if (f == NULL) {
+        return false;
+    }
+    s_ca_len = fread(s_ca, 1, sizeof(s_ca) - 1, f);
+    fclose(f);
+    // PEM buffers are passed to esp-tls with their terminating NUL
+    s_ca[s_ca_len++] = '\0';
+    return true;
+}
+
+static pid_t server_start(const char *openssl, int port)
+{
+    char accept[8], cert[300], key[300];
+    pid_t pid = fork();
+
+    if (pid != 0) {
+        return pid;
+    }
+    snprintf(accept, sizeof(accept), "%d", port);
+    snprintf(cert, sizeof(cert), "%s/cert.pem", s_dir);
+    snprintf(key, sizeof(key), "%s/key.pem", s_dir);
+    freopen("/dev/null", "w", stdout);
+    freopen("/dev/null", "w", stderr);
+    execl(openssl, openssl, "s_server", "-accept", accept, "-cert", cert, "-key", key,
+          "-rev", "-naccept", "2", "-quiet", (char *) NULL);
+    _exit(127);
+}
+
+// one connection: a line out and its reversal back, reports whether the session was resumed
+static bool exchange(int port, int tries, bool *reused)
+{
+    esp_transport_handle_t t = mqtt_tls_transport(s_ca, s_ca_len);
+    char reply[16] = { 0 };
+    int len = 0;
+
+    if (t == NULL) {
+        return false;
+    }
+    // the first connection also waits for s_server to listen
+    while (esp_transport_connect(t, TEST_HOST, port, TEST_IO_MS) < 0) {
+        if (--tries <= 0) {
+            esp_transport_destroy(t);
+            return false;
+        }
+        usleep(100 * 1000);
+    }
+    *reused = sim_tls_session_reused(((mqtt_tls_t *) esp_transport_get_context_data(t))->tls);
+    bool ok = esp_transport_write(t, TEST_LINE, strlen(TEST_LINE), TEST_IO_MS) == strlen(TEST_LINE);
+    while (ok && len < strlen(TEST_REPLY)) {
+        int ret = esp_transport_read(t, reply + len, sizeof(reply) - 1 - len, TEST_IO_MS);
+        ok = ret > 0;
+        len += ok ? ret : 0;
+    }
+    esp_transport_close(t);
+    esp_transport_destroy(t);
+    if (ok && strcmp(reply, TEST_REPLY) != 0) {
+        printf("FAIL: got '%s' back for '%s'\n", reply, TEST_LINE);
+        return false;
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *openssl = argc > 1 ? argv[1] : "openssl";
+    int port = free_port();
+    bool full_reused = true, resumed = false;
+    int ret = 1;
+
+    if (port < 0 || !cert_create(openssl)) {
+        printf("FAIL: no certificate from %s\n", openssl);
+        return 1;
+    }
+    pid_t server = server_start(openssl, port);
+    if (server < 0) {
+        printf("FAIL: s_server not started\n");
+        return 1;
+    }
+    if (!exchange(port, TEST_START_MS / 100, &full_reused)) {
+        printf("FAIL: first connection to s_server on port %d\n", port);
+    } else if (full_reused) {
+        printf("FAIL: first handshake resumed a session it never had\n");
+    } else if (s_session == NULL) {
+        printf("FAIL: no session kept after the full handshake\n");
+    } else if (!exchange(port, 1, &resumed)) {
+        printf("FAIL: second connection to s_server on port %d\n", port);
+    } else if (!resumed) {
+        printf("FAIL: second handshake was a full one, the session was not resumed\n");
+    } else if (METRIC_COUNTER(METRIC_TLS_RESUME_OFFER) != 1) {
+        printf("FAIL: %" PRIu32 " sessions offered, expected 1\n", METRIC_COUNTER(METRIC_TLS_RESUME_OFFER));
+    } else {
+        printf("ok: full handshake, then the session resumed\n");
+        ret = 0;
+    }
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", s_dir);
+    system(cmd);
+    return ret;
+}
@@ -0,0 +1,120 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* rpc_parse() takes the topic and payload of a cloud RPC as they come off
+ * the MQTT client. Every request below is decoded and compared with what
+ * the parser has to make of it: malformed input must never turn into a
+ * command. */
+#include <stdio.h>
+#include <string.h>
+#include "rpc.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TEST_TOPIC          RPC_REQUEST_TOPIC "42"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    const char *name;
+    const char *topic;
+    const char *data;
+    esp_err_t err;
+    /* checked on ESP_OK only */
+    rpc_method_t method;
+    uint8_t group;
+    uint8_t active;
+    bool has_node;
+} rpc_case_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const uint8_t s_node[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x02 };
+
+static const rpc_case_t s_cases[] = {
+    { "preempt", TEST_TOPIC, "{\"method\":\"preempt\",\"params\":{\"group\":1,\"active\":true}}",
+      ESP_OK, RPC_METHOD_PREEMPT, 1, 1, false },
+    { "preempt on a node", TEST_TOPIC,
+      "{ \"method\": \"preempt\", \"params\": { \"node\": \"24:0a:c4:00:00:02\", \"group\": 0, \"active\": false } }",
+      ESP_OK, RPC_METHOD_PREEMPT, 0, 0, true },
+    { "getState", TEST_TOPIC, "{\"method\":\"getState\",\"params\":{}}", ESP_OK, RPC_METHOD_GET_STATE },
+    { "truncated string", TEST_TOPIC, "{\"method\":\"getState\",\"params\":{\"x\":\"abc}}", ESP_ERR_INVALID_ARG },
+    { "truncated method", TEST_TOPIC, "{\"method\":\"preem", ESP_ERR_INVALID_ARG },
+    { "unclosed {", TEST_TOPIC, "{\"method\":\"getState\"", ESP_ERR_INVALID_ARG },
+    { "unclosed params", TEST_TOPIC, "{\"method\":\"preempt\",\"params\":{\"group\":1,\"active\":true}",
+      ESP_ERR_INVALID_ARG },
+    { "unclosed [", TEST_TOPIC, "{\"method\":\"getState\",\"params\":[1,2}", ESP_ERR_INVALID_ARG },
+    { "] closing {", TEST_TOPIC, "{\"method\":\"getState\",\"params\":{\"a\":[1]]}", ESP_ERR_INVALID_ARG },
+    { "trailing data", TEST_TOPIC, "{\"method\":\"getState\"}}", ESP_ERR_INVALID_ARG },
+    { "id not a number", RPC_REQUEST_TOPIC "abc", "{\"method\":\"getState\"}", ESP_ERR_NOT_FOUND },
+    { "id with a tail", RPC_REQUEST_TOPIC "12x", "{\"method\":\"getState\"}", ESP_ERR_NOT_FOUND },
+    { "negative id", RPC_REQUEST_TOPIC "-1", "{\"method\":\"getState\"}", ESP_ERR_NOT_FOUND },
+    { "id past 32 bits", RPC_REQUEST_TOPIC "4294967296", "{\"method\":\"getState\"}", ESP_ERR_NOT_FOUND },
+    { "no id", RPC_REQUEST_TOPIC, "{\"method\":\"getState\"}", ESP_ERR_NOT_FOUND },
+    { "missing method", TEST_TOPIC, "{\"params\":{\"group\":1,\"active\":true}}", ESP_ERR_INVALID_ARG },
+    { "method not a string", TEST_TOPIC, "{\"method\":5}", ESP_ERR_INVALID_ARG },
+    { "unknown method", TEST_TOPIC, "{\"method\":\"reboot\"}", ESP_ERR_NOT_SUPPORTED },
+    { "preempt without active", TEST_TOPIC, "{\"method\":\"preempt\",\"params\":{\"group\":1}}",
+      ESP_ERR_INVALID_ARG },
+    { "preempt without params", TEST_TOPIC, "{\"method\":\"preempt\"}", ESP_ERR_INVALID_ARG },
+    { "active out of range", TEST_TOPIC, "{\"method\":\"preempt\",\"params\":{\"group\":1,\"active\":2}}",
+      ESP_ERR_INVALID_ARG },
+    { "group out of range", TEST_TOPIC, "{\"method\":\"preempt\",\"params\":{\"group\":256,\"active\":true}}",
+      ESP_ERR_INVALID_ARG },
+    { "oversized node", TEST_TOPIC,
+      "{\"method\":\"preempt\",\"params\":{\"node\":\"24:0a:c4:00:00:02:24:0a:c4:00:00:02\",\"active\":true}}",
+      ESP_ERR_INVALID_ARG },
+    { "node with a tail", TEST_TOPIC,
+      "{\"method\":\"preempt\",\"params\":{\"node\":\"24:0a:c4:00:00:02x\",\"active\":true}}",
+      ESP_ERR_INVALID_ARG },
+};
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static bool check(const rpc_case_t *c)
+{
+    rpc_msg_t msg;
+    uint8_t node[6] = { 0 };
+    bool has_node;
+
+    esp_err_t err = rpc_parse(c->topic, strlen(c->topic), c->data, strlen(c->data), &msg, node, &has_node);
+    if (err != c->err) {
+        printf("FAIL: %s: %s, expected %s\n", c->name, esp_err_to_name(err), esp_err_to_name(c->err));
+        return false;
+    }
+    if (err != ESP_OK) {
+        return true;
+    }
+    if (msg.id != 42 || msg.method != c->method || msg.group != c->group || msg.active != c->active ||
+        has_node != c->has_node || (has_node && memcmp(node, s_node, sizeof(node)) != 0)) {
+        printf("FAIL: %s: id %u, method %d, group %d, active %d, node %d\n", c->name,
+               (unsigned) msg.id, msg.method, msg.group, msg.active, has_node);
+        return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    int failed = 0;
+    int count = sizeof(s_cases) / sizeof(s_cases[0]);
+
+    for (int i = 0; i < count; ++i) {
+        failed += !check(&s_cases[i]);
+    }
+    if (failed) {
+        printf("%d of %d requests decoded wrong\n", failed, count);
+        return 1;
+    }
+    printf("ok: %d requests\n", count);
+    return 0;
+}
@@ -0,0 +1,454 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* Virtual-time simulator of the traffic controller. Runs the phase logic of
+ * main/traffic_controller.c against a scripted or generated input trace, on
+ * the same schedule as the node: inputs polled every 100 ms like
+ * check_button(), controller stepped every TRAFFIC_CONTROLLER_STEP_MS.
+ *
+ * Trace file, one input change per line, times in seconds from the start:
+ *
+ *   # time  input   level
+ *   12.0    button  1
+ *   12.3    button  0
+ *   40.5    ir      0       (infrared is active low, 0 = beam cut)
+ *   41.0    ir      1
+ *   55.0    pir     1       (vehicle presence)
+ *   56.0    pir     0
+ *
+ * Without --trace, pedestrians and vehicles arrive as Poisson processes.
+ * --layout 4way runs the three-phase plan of the four-way layouts; the
+ * vehicle figures are those of the main street.
+ * A pedestrian whose press is swallowed by the blinking end of a cycle
+ * presses again once the request is cleared. */
+#include <math.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "traffic_controller.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_POLL_MS         (100)
+#define SIM_PRESS_MS        (300)
+#define SIM_VEHICLE_MS      (1000)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    INPUT_BUTTON,
+    INPUT_IR,
+    INPUT_PIR,
+    INPUT_MAX,
+} sim_input_t;
+
+typedef struct {
+    int64_t t_ms;
+    uint32_t order;
+    sim_input_t input;
+    int level;
+} sim_trace_ev_t;
+
+typedef struct {
+    int64_t *v;
+    size_t n;
+    size_t cap;
+} sim_samples_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *s_input_names[INPUT_MAX] = { "button", "ir", "pir" };
+
+static sim_trace_ev_t *s_trace;
+static size_t s_trace_len = 0;
+static size_t s_trace_cap = 0;
+
+static traffic_timing_t s_timing = TRAFFIC_TIMING_DEFAULT();
+static const traffic_plan_t *s_plan = &traffic_plan_single;
+static const char *s_trace_path = NULL;
+static const char *s_timeline_path = NULL;
+static double s_duration_s = 0;
+static double s_ped_per_hour = 30;
+static double s_veh_per_hour = 600;
+static uint64_t s_rng = 1;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static double rng_uniform(void)
+{
+    s_rng ^= s_rng >> 12;
+    s_rng ^= s_rng << 25;
+    s_rng ^= s_rng >> 27;
+    return ((s_rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void samples_add(sim_samples_t *s, int64_t value)
+{
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->v = realloc(s->v, s->cap * sizeof(*s->v));
+    }
+    s->v[s->n++] = value;
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double samples_pct_s(sim_samples_t *s, double pct)
+{
+    if (s->n == 0) {
+        return 0;
+    }
+    qsort(s->v, s->n, sizeof(*s->v), cmp_i64);
+    size_t i = (size_t) ceil(pct / 100.0 * s->n);
+    return s->v[i ? i - 1 : 0] / 1000.0;
+}
+
+static double samples_mean_s(const sim_samples_t *s)
+{
+    double sum = 0;
+    for (size_t i = 0; i < s->n; ++i) {
+        sum += s->v[i];
+    }
+    return s->n ? sum / s->n / 1000.0 : 0;
+}
+
+static void trace_add(int64_t t_ms, sim_input_t input, int level)
+{
+    if (s_trace_len == s_trace_cap) {
+        s_trace_cap = s_trace_cap ? s_trace_cap * 2 : 1024;
+        s_trace = realloc(s_trace, s_trace_cap * sizeof(*s_trace));
+    }
+    s_trace[s_trace_len] = (sim_trace_ev_t) { .t_ms = t_ms, .order = s_trace_len, .input = input, .level = level };
+    s_trace_len++;
+}
+
+static int cmp_trace(const void *a, const void *b)
+{
+    const sim_trace_ev_t *x = a, *y = b;
+    if (x->t_ms != y->t_ms) {
+        return x->t_ms < y->t_ms ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void trace_load(const char *path)
+{
+    FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    char line[256];
+    int lineno = 0;
+
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char name[16];
+        double t;
+        int level;
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        if (sscanf(line, " %lf %15s %d", &t, name, &level) != 3) {
+            if (strspn(line, " \t\r\n") != strlen(line)) {
+                fprintf(stderr, "%s:%d: expected <time> <button|ir|pir> <level>\n", path, lineno);
+                exit(1);
+            }
+            continue;
+        }
+        int input = 0;
+        while (input < INPUT_MAX && strcmp(name, s_input_names[input]) != 0) {
+            input++;
+        }
+        if (input == INPUT_MAX || t < 0) {
+            fprintf(stderr, "%s:%d: unknown input '%s'\n", path, lineno, name);
+            exit(1);
+        }
+        trace_add((int64_t) llround(t * 1000), input, level != 0);
+    }
+    if (f != stdin) {
+        fclose(f);
+    }
+}
+
+static void trace_generate_pulses(sim_input_t input, double per_hour, int64_t pulse_ms,
+                                  int active, int64_t end_ms)
+{
+    // overlapping pulses merge into one, like a queue at the crossing
+    int64_t t_ms = 0;
+    int64_t off_ms = -1;
+    size_t off_index = 0;
+
+    if (per_hour <= 0) {
+        return;
+    }
+    while (true) {
+        t_ms += (int64_t) (-log(1.0 - rng_uniform()) * 3600e3 / per_hour);
+        if (t_ms >= end_ms) {
+            break;
+        }
+        if (t_ms <= off_ms) {
+            off_ms = t_ms + pulse_ms;
+            s_trace[off_index].t_ms = off_ms;
+            continue;
+        }
+        trace_add(t_ms, input, active);
+        off_ms = t_ms + pulse_ms;
+        off_index = s_trace_len;
+        trace_add(off_ms, input, !active);
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i, --trace FILE       input trace, '-' for stdin (default: generated)\n"
+            "  -d, --duration S       virtual seconds to run (default 1 day, or trace end + 60)\n"
+            "  -p, --ped-rate N       generated pedestrian arrivals per hour (default %.0f)\n"
+            "  -v, --veh-rate N       generated vehicle arrivals per hour (default %.0f)\n"
+            "  -s, --seed N           random seed of the generated trace (default 1)\n"
+            "  -g, --green S          minimum vehicle green after a served request (default %d)\n"
+            "  -y, --yellow S         vehicle yellow (default %d)\n"
+            "  -r, --red S            steady pedestrian green (default %d)\n"
+            "  -c, --change-red S     blinking pedestrian green (default %d)\n"
+            "  -a, --all-red S        all-red clearance between phases (default %d)\n"
+            "  -L, --layout NAME      phase plan, single or 4way (default single)\n"
+            "  -o, --timeline FILE    write every phase change as CSV\n",
+            prog, s_ped_per_hour, s_veh_per_hour, s_timing.minimum_green, s_timing.yellow, s_timing.red,
+            s_timing.change_red, s_timing.all_red);
+}
+
+static void parse_options(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "trace", required_argument, NULL, 'i' },
+        { "duration", required_argument, NULL, 'd' },
+        { "ped-rate", required_argument, NULL, 'p' },
+        { "veh-rate", required_argument, NULL, 'v' },
+        { "seed", required_argument, NULL, 's' },
+        { "green", required_argument, NULL, 'g' },
+        { "yellow", required_argument, NULL, 'y' },
+        { "red", required_argument, NULL, 'r' },
+        { "change-red", required_argument, NULL, 'c' },
+        { "all-red", required_argument, NULL, 'a' },
+        { "layout", required_argument, NULL, 'L' },
+        { "timeline", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "i:d:p:v:s:g:y:r:c:a:L:o:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'i': s_trace_path = optarg; break;
+        case 'd': s_duration_s = atof(optarg); break;
+        case 'p': s_ped_per_hour = atof(optarg); break;
+        case 'v': s_veh_per_hour = atof(optarg); break;
+        case 's': s_rng = strtoull(optarg, NULL, 0) ? strtoull(optarg, NULL, 0) : 1; break;
+        case 'g': s_timing.minimum_green = atoi(optarg); break;
+        case 'y': s_timing.yellow = atoi(optarg); break;
+        case 'r': s_timing.red = atoi(optarg); break;
+        case 'c': s_timing.change_red = atoi(optarg); break;
+        case 'a': s_timing.all_red = atoi(optarg); break;
+        case 'L':
+            if (strcmp(optarg, "single") == 0) {
+                s_plan = &traffic_plan_single;
+            } else if (strcmp(optarg, "4way") == 0) {
+                s_plan = &traffic_plan_four_way;
+            } else {
+                fprintf(stderr, "unknown layout '%s'\n", optarg);
+                exit(2);
+            }
+            break;
+        case 'o': s_timeline_path = optarg; break;
+        default:
+            usage(argv[0]);
+            exit(c == 'h' ? 0 : 2);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    parse_options(argc, argv);
+
+    int64_t end_ms;
+    if (s_trace_path) {
+        trace_load(s_trace_path);
+        qsort(s_trace, s_trace_len, sizeof(*s_trace), cmp_trace);
+        int64_t last_ms = s_trace_len ? s_trace[s_trace_len - 1].t_ms : 0;
+        end_ms = s_duration_s > 0 ? (int64_t) (s_duration_s * 1000) : last_ms + 60000;
+    } else {
+        end_ms = (int64_t) ((s_duration_s > 0 ? s_duration_s : 86400) * 1000);
+        trace_generate_pulses(INPUT_BUTTON, s_ped_per_hour, SIM_PRESS_MS, 1, end_ms);
+        trace_generate_pulses(INPUT_PIR, s_veh_per_hour, SIM_VEHICLE_MS, 1, end_ms);
+        qsort(s_trace, s_trace_len, sizeof(*s_trace), cmp_trace);
+    }
+
+    FILE *timeline = NULL;
+    if (s_timeline_path) {
+        timeline = fopen(s_timeline_path, "w");
+        if (timeline == NULL) {
+            perror(s_timeline_path);
+            return 1;
+        }
+        fprintf(timeline, "t_s,semaforo_coches,semaforo_peaton,request\n");
+    }
+
+    traffic_controller_t ctl;
+    traffic_step_t step;
+    traffic_controller_init(&ctl, &s_timing, s_plan);
+
+    int level[INPUT_MAX] = { [INPUT_BUTTON] = 0, [INPUT_IR] = 1, [INPUT_PIR] = 0 };
+    bool demand = false;            /* button || !ir, as check_button() sees it */
+    bool veh_present = false;
+    bool request = false;           /* button_pressed on the node */
+    bool walk = false;              /* steady pedestrian green */
+    bool repress = false;
+    int64_t request_ms = 0;
+    int64_t *waiting = NULL;        /* arrival times of pedestrians not yet walking */
+    size_t waiting_len = 0, waiting_cap = 0;
+
+    sim_samples_t wait = { 0 }, service = { 0 }, cycle = { 0 };
+    uint64_t arrivals = 0, requests = 0, coalesced = 0, swallowed = 0, cycles = 0;
+    uint64_t phase_steps[3] = { 0 }, green_busy_steps = 0, vehicles = 0, vehicles_stopped = 0;
+    bool step_busy = false;
+    size_t next = 0;
+
+    clock_t cpu_start = clock();
+    for (int64_t now = 0; now < end_ms; now += SIM_POLL_MS) {
+        // inputs that changed up to this poll
+        while (next < s_trace_len && s_trace[next].t_ms <= now) {
+            level[s_trace[next].input] = s_trace[next].level;
+            next++;
+        }
+
+        bool pres = level[INPUT_PIR] != 0;
+        if (pres && !veh_present) {
+            vehicles++;
+            if (traffic_controller_group_color(&ctl, TRAFFIC_GROUP_VEHICLE) != 0) {
+                vehicles_stopped++;
+            }
+        }
+        veh_present = pres;
+        step_busy |= pres;
+
+        // one pedestrian per rising edge of the demand
+        bool d = level[INPUT_BUTTON] || !level[INPUT_IR];
+        if (d && !demand) {
+            arrivals++;
+            if (walk) {
+                samples_add(&wait, 0);
+            } else {
+                if (waiting_len == waiting_cap) {
+                    waiting_cap = waiting_cap ? waiting_cap * 2 : 64;
+                    waiting = realloc(waiting, waiting_cap * sizeof(*waiting));
+                }
+                waiting[waiting_len++] = now;
+                if (request && s_plan->phase[ctl.st.phase].walk_groups) {
+                    swallowed++;
+                } else if (request) {
+                    coalesced++;
+                }
+            }
+        }
+        demand = d;
+        if (!request && (d || repress)) {
+            request = true;
+            request_ms = now;
+            requests++;
+            repress = false;
+        }
+
+        if (now % TRAFFIC_CONTROLLER_STEP_MS != 0) {
+            continue;
+        }
+
+        traffic_controller_step(&ctl, request, &step);
+        uint8_t color = traffic_controller_group_color(&ctl, TRAFFIC_GROUP_VEHICLE);
+        phase_steps[color]++;
+        if (color == 0 && step_busy) {
+            green_busy_steps++;
+        }
+        step_busy = veh_present;
+
+        if (!walk && traffic_controller_walk(&ctl)) {
+            // walk starts: everybody waiting crosses
+            walk = true;
+            samples_add(&service, now - request_ms);
+            for (size_t i = 0; i < waiting_len; ++i) {
+                samples_add(&wait, now - waiting[i]);
+            }
+            waiting_len = 0;
+        } else if (walk && !traffic_controller_walk(&ctl)) {
+            walk = false;
+        }
+        if (step.request_served) {
+            request = false;
+            cycles++;
+            samples_add(&cycle, now - request_ms);
+            // the ones who pressed during the blinking press again
+            repress = waiting_len > 0;
+        }
+        if (timeline && step.phase_changed) {
+            fprintf(timeline, "%.1f,%d,%d,%d\n", now / 1000.0, color, ctl.st.ped_color_pos, request);
+        }
+    }
+    double cpu_s = (double) (clock() - cpu_start) / CLOCKS_PER_SEC;
+    if (timeline) {
+        fclose(timeline);
+    }
+
+    uint64_t total_steps = phase_steps[0] + phase_steps[1] + phase_steps[2];
+    double hours = end_ms / 3600e3;
+    double green_util = phase_steps[0] ? 100.0 * green_busy_steps / phase_steps[0] : 0;
+
+    printf("==== traffic_sim: %.0f s virtual in %.2f s, green %d / yellow %d / red %d+%d s, %s%s\n",
+           end_ms / 1000.0, cpu_s, s_timing.minimum_green, s_timing.yellow, s_timing.red, s_timing.change_red,
+           s_trace_path ? s_trace_path : "generated trace", s_plan == &traffic_plan_four_way ? ", 4-way plan" : "");
+    printf("pedestrians: %llu arrivals, %llu requests, %llu joined a pending request, "
+           "%llu pressed during the blinking, %zu still waiting\n",
+           (unsigned long long) arrivals, (unsigned long long) requests, (unsigned long long) coalesced,
+           (unsigned long long) swallowed, waiting_len);
+    printf("  %-26s p50 %6.1f s  p95 %6.1f s  max %6.1f s  mean %6.1f s\n", "wait (arrival to walk)",
+           samples_pct_s(&wait, 50), samples_pct_s(&wait, 95), samples_pct_s(&wait, 100), samples_mean_s(&wait));
+    printf("  %-26s p50 %6.1f s  p95 %6.1f s  max %6.1f s  mean %6.1f s\n", "service (request to walk)",
+           samples_pct_s(&service, 50), samples_pct_s(&service, 95), samples_pct_s(&service, 100),
+           samples_mean_s(&service));
+    printf("  %-26s p50 %6.1f s  p95 %6.1f s  max %6.1f s  mean %6.1f s\n", "cycle (request to green)",
+           samples_pct_s(&cycle, 50), samples_pct_s(&cycle, 95), samples_pct_s(&cycle, 100),
+           samples_mean_s(&cycle));
+    printf("vehicle phases: green %.1f%%, yellow %.1f%%, red %.1f%%, %llu cycles (%.1f/h)\n",
+           total_steps ? 100.0 * phase_steps[0] / total_steps : 0,
+           total_steps ? 100.0 * phase_steps[1] / total_steps : 0,
+           total_steps ? 100.0 * phase_steps[2] / total_steps : 0, (unsigned long long) cycles, cycles / hours);
+    printf("green utilization: %.1f%% of green seconds with vehicles, %llu of %llu vehicles stopped\n",
+           green_util, (unsigned long long) vehicles_stopped, (unsigned long long) vehicles);
+    printf("RESULT virtual_s=%.0f arrivals=%llu wait_p50_s=%.1f wait_p95_s=%.1f wait_max_s=%.1f "
+           "service_p50_s=%.1f service_p95_s=%.1f cycles_per_h=%.1f green_share=%.1f green_util=%.1f "
+           "vehicles_stopped=%llu\n",
+           end_ms / 1000.0, (unsigned long long) arrivals, samples_pct_s(&wait, 50), samples_pct_s(&wait, 95),
+           samples_pct_s(&wait, 100), samples_pct_s(&service, 50), samples_pct_s(&service, 95), cycles / hours,
+           total_steps ? 100.0 * phase_steps[0] / total_steps : 0, green_util,
+           (unsigned long long) vehicles_stopped);
+    return 0;
+}
@@ -0,0 +1,222 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "binlog.h"
+
+#if CONFIG_APP_BINLOG_ENABLE
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_mac.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define BINLOG_RING_SIZE  (1u << CONFIG_APP_BINLOG_RING_ORDER)
+#define BINLOG_RING_MASK  (BINLOG_RING_SIZE - 1)
+#define BINLOG_TAG_SLOTS  (16)
+#define BINLOG_BENCH_RUNS (200)
+
+static const char *TAG = "binlog";
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    uint32_t seq;           // 2*(n+1)-1 while record n is written, 2*(n+1) once complete
+    uint32_t timestamp;     // ms, same clock as esp_log
+    const char *tag;
+    const char *format;     // format ID: address of the string in flash
+    uint8_t level;
+    uint8_t nargs;
+    uint32_t args[BINLOG_MAX_ARGS];
+} binlog_record_t;
+
+typedef struct {
+    const char *tag;
+    uint8_t level;
+} binlog_tag_level_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static binlog_record_t s_ring[BINLOG_RING_SIZE];
+static uint32_t s_head = 0;     // next record number to reserve
+static uint32_t s_tail = 0;     // next record number to print, owned by the drain task
+static uint32_t s_dropped = 0;
+static binlog_tag_level_t s_tag_levels[BINLOG_TAG_SLOTS];
+static uint32_t s_tag_count = 0;
+static uint8_t s_default_level = CONFIG_LOG_DEFAULT_LEVEL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t binlog_level_set(const char *tag, esp_log_level_t level)
+{
+    if (strcmp(tag, "*") == 0) {
+        s_default_level = level;
+        return ESP_OK;
+    }
+    for (uint32_t i = 0; i < s_tag_count; ++i) {
+        if (strcmp(s_tag_levels[i].tag, tag) == 0) {
+            s_tag_levels[i].level = level;
+            return ESP_OK;
+        }
+    }
+    if (s_tag_count == BINLOG_TAG_SLOTS) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_tag_levels[s_tag_count].tag = tag;
+    s_tag_levels[s_tag_count].level = level;
+    // publish the slot only once it is filled in
+    __atomic_store_n(&s_tag_count, s_tag_count + 1, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+bool IRAM_ATTR binlog_level_enabled(const char *tag, esp_log_level_t level)
+{
+    uint32_t count = __atomic_load_n(&s_tag_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; ++i) {
+        // tags are string literals, the pointer compare catches nearly all lookups
+        if (s_tag_levels[i].tag == tag || strcmp(s_tag_levels[i].tag, tag) == 0) {
+            return level <= s_tag_levels[i].level;
+        }
+    }
+    return level <= s_default_level;
+}
+
+void IRAM_ATTR binlog_write(esp_log_level_t level, const char *tag, const char *format,
+                            const uint32_t *args, uint32_t nargs)
+{
+    uint32_t n = __atomic_fetch_add(&s_head, 1, __ATOMIC_RELAXED);
+    binlog_record_t *rec = &s_ring[n & BINLOG_RING_MASK];
+
+    __atomic_store_n(&rec->seq, 2 * (n + 1) - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->timestamp = esp_log_timestamp();
+    rec->tag = tag;
+    rec->format = format;
+    rec->level = level;
+    rec->nargs = nargs > BINLOG_MAX_ARGS ? BINLOG_MAX_ARGS : nargs;
+    memcpy(rec->args, args, rec->nargs * sizeof(uint32_t));
+    __atomic_store_n(&rec->seq, 2 * (n + 1), __ATOMIC_RELEASE);
+}
+
+// Copy record number n out of the ring, false if it is not there (yet or anymore)
+static bool binlog_read(uint32_t n, binlog_record_t *out, bool *lost)
+{
+    const binlog_record_t *rec = &s_ring[n & BINLOG_RING_MASK];
+    uint32_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+    // seq wraps after 2^31 records: a later lap is ahead by less than half the range
+    *lost = (int32_t) (seq - 2 * (n + 1)) > 0;
+    if (seq != 2 * (n + 1)) {
+        return false;
+    }
+    memcpy(out, rec, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // a producer lapping the ring while we copied makes the copy torn
+    if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != seq) {
+        *lost = true;
+        return false;
+    }
+    return true;
+}
+
+static void binlog_print(const binlog_record_t *rec)
+{
+    static const char letters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+    const uint32_t *a = rec->args;
+
+    esp_log_write(rec->level, rec->tag, "%c (%" PRIu32 ") %s: ",
+                  letters[rec->level], rec->timestamp, rec->tag);
+    // unused trailing arguments are ignored by the formatter
+    esp_log_write(rec->level, rec->tag, rec->format,
+                  a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9], a[10], a[11], a[12], a[13]);
+    esp_log_write(rec->level, rec->tag, "\n");
+}
+
+static void binlog_drain(void)
+{
+    binlog_record_t rec;
+    bool lost;
+
+    while (s_tail != __atomic_load_n(&s_head, __ATOMIC_ACQUIRE)) {
+        if (binlog_read(s_tail, &rec, &lost)) {
+            binlog_print(&rec);
+            s_tail++;
+        } else if (lost) {
+            // overwritten: skip to the oldest record still in the ring
+            uint32_t oldest = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE) - BINLOG_RING_SIZE;
+            uint32_t skip = (int32_t) (oldest - s_tail) > 0 ? oldest - s_tail : 1;
+            s_dropped += skip;
+            s_tail += skip;
+        } else {
+            // a producer is still filling this record in
+            break;
+        }
+    }
+}
+
+#if CONFIG_APP_BINLOG_BENCHMARK
+static void binlog_benchmark(void)
+{
+    static const uint8_t mac[6] = { 0x24, 0x0a, 0xc4, 0x09, 0x88, 0x5c };
+    int64_t start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BINLOG_BENCH_RUNS; ++i) {
+        BLOGI(TAG, "Sending to [%d] " MACSTR ": sent with err code: %d", i, MAC2STR(mac), 0);
+    }
+    int64_t binlog_us = esp_timer_get_time() - start;
+    s_tail = s_head;    // discard the benchmark records, nothing is printed
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BINLOG_BENCH_RUNS; ++i) {
+        ESP_LOGI(TAG, "Sending to [%d] " MACSTR ": sent with err code: %d", i, MAC2STR(mac), 0);
+    }
+    int64_t esp_log_us = esp_timer_get_time() - start;
+
+    ESP_LOGW(TAG, "per call: binlog %" PRId64 ".%02" PRId64 " us, esp_log %" PRId64 ".%02" PRId64 " us (%d calls)",
+             binlog_us / BINLOG_BENCH_RUNS, binlog_us * 100 / BINLOG_BENCH_RUNS % 100,
+             esp_log_us / BINLOG_BENCH_RUNS, esp_log_us * 100 / BINLOG_BENCH_RUNS % 100,
+             BINLOG_BENCH_RUNS);
+}
+#endif /* CONFIG_APP_BINLOG_BENCHMARK */
+
+static void binlog_task(void *args)
+{
+    uint32_t reported_drops = 0;
+
+#if CONFIG_APP_BINLOG_BENCHMARK
+    binlog_benchmark();
+#endif
+    while (true) {
+        binlog_drain();
+        if (s_dropped != reported_drops) {
+            ESP_LOGW(TAG, "%" PRIu32 " records dropped, ring too small", s_dropped - reported_drops);
+            reported_drops = s_dropped;
+        }
+        vTaskDelay(CONFIG_APP_BINLOG_DRAIN_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+    vTaskDelete(NULL);
+}
+
+void binlog_start(void)
+{
+    static bool is_binlog_started = false;
+
+    if (!is_binlog_started) {
+        xTaskCreate(binlog_task, "binlog", 3072, NULL, 1, NULL);
+        is_binlog_started = true;
+    }
+}
+
+#endif /* CONFIG_APP_BINLOG_ENABLE */
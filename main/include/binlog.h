@@ -0,0 +1,116 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+/*******************************************************
+ *                Macros
+ *******************************************************/
+/*
+ * Deferred logging: BLOGx() stores the format string address (its ID in the
+ * firmware image) and up to BINLOG_MAX_ARGS raw 32-bit arguments in a RAM
+ * ring, a low priority task formats them later. Only integers and pointers
+ * that stay valid (string literals, esp_err_to_name()) may be passed.
+ */
+#if CONFIG_APP_BINLOG_ENABLE
+
+#define BINLOG_MAX_ARGS (14)
+
+#define BINLOG_ARG(x) ((uint32_t) (uintptr_t) (x))
+#define BINLOG_A0()
+#define BINLOG_A1(a) BINLOG_ARG(a),
+#define BINLOG_A2(a, ...) BINLOG_ARG(a), BINLOG_A1(__VA_ARGS__)
+#define BINLOG_A3(a, ...) BINLOG_ARG(a), BINLOG_A2(__VA_ARGS__)
+#define BINLOG_A4(a, ...) BINLOG_ARG(a), BINLOG_A3(__VA_ARGS__)
+#define BINLOG_A5(a, ...) BINLOG_ARG(a), BINLOG_A4(__VA_ARGS__)
+#define BINLOG_A6(a, ...) BINLOG_ARG(a), BINLOG_A5(__VA_ARGS__)
+#define BINLOG_A7(a, ...) BINLOG_ARG(a), BINLOG_A6(__VA_ARGS__)
+#define BINLOG_A8(a, ...) BINLOG_ARG(a), BINLOG_A7(__VA_ARGS__)
+#define BINLOG_A9(a, ...) BINLOG_ARG(a), BINLOG_A8(__VA_ARGS__)
+#define BINLOG_A10(a, ...) BINLOG_ARG(a), BINLOG_A9(__VA_ARGS__)
+#define BINLOG_A11(a, ...) BINLOG_ARG(a), BINLOG_A10(__VA_ARGS__)
+#define BINLOG_A12(a, ...) BINLOG_ARG(a), BINLOG_A11(__VA_ARGS__)
+#define BINLOG_A13(a, ...) BINLOG_ARG(a), BINLOG_A12(__VA_ARGS__)
+#define BINLOG_A14(a, ...) BINLOG_ARG(a), BINLOG_A13(__VA_ARGS__)
+#define BINLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, N, ...) N
+#define BINLOG_NARGS(...) BINLOG_NARGS_(_0, ##__VA_ARGS__, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define BINLOG_CAT_(a, b) a##b
+#define BINLOG_CAT(a, b) BINLOG_CAT_(a, b)
+// extra level so that MAC2STR() and friends are expanded before counting
+#define BINLOG_MAP_(...) BINLOG_CAT(BINLOG_A, BINLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define BINLOG_MAP(...) BINLOG_MAP_(__VA_ARGS__)
+
+#define BINLOG_WRITE(level, tag, format, ...) do {                                  \
+        if (level <= CONFIG_LOG_MAXIMUM_LEVEL && binlog_level_enabled(tag, level)) { \
+            const uint32_t _binlog_args[] = { BINLOG_MAP(__VA_ARGS__) 0 };          \
+            binlog_write(level, tag, format, _binlog_args,                          \
+                         sizeof(_binlog_args) / sizeof(_binlog_args[0]) - 1);       \
+        }                                                                           \
+    } while (0)
+
+#define BLOGE(tag, format, ...) BINLOG_WRITE(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define BLOGW(tag, format, ...) BINLOG_WRITE(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define BLOGI(tag, format, ...) BINLOG_WRITE(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define BLOGD(tag, format, ...) BINLOG_WRITE(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+#else
+
+#define BLOGE(tag, format, ...) ESP_LOGE(tag, format, ##__VA_ARGS__)
+#define BLOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define BLOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define BLOGD(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
+
+#endif /* CONFIG_APP_BINLOG_ENABLE */
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+#if CONFIG_APP_BINLOG_ENABLE
+
+/**
+ * @brief Start the low priority task that formats and prints the ring
+ */
+void binlog_start(void);
+
+/**
+ * @brief Set the runtime level of one tag ("*" sets the default level)
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM when the tag table is full
+ */
+esp_err_t binlog_level_set(const char *tag, esp_log_level_t level);
+
+/**
+ * @brief Check a tag against its runtime level
+ */
+bool binlog_level_enabled(const char *tag, esp_log_level_t level);
+
+/**
+ * @brief Store one record in the ring, never blocks
+ *
+ * Safe from any task or ISR, on both cores. When the ring is full the
+ * oldest record is overwritten and counted as dropped.
+ */
+void binlog_write(esp_log_level_t level, const char *tag, const char *format,
+                  const uint32_t *args, uint32_t nargs);
+
+#else
+
+static inline void binlog_start(void) { }
+static inline esp_err_t binlog_level_set(const char *tag, esp_log_level_t level)
+{
+    esp_log_level_set(tag, level);
+    return ESP_OK;
+}
+
+#endif /* CONFIG_APP_BINLOG_ENABLE */
@@ -0,0 +1,81 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "mqtt_pub.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    TRACE_STAGE_PRESS,      /* button edge, from the GPIO interrupt */
+    TRACE_STAGE_DETECT,     /* seen by the polling task */
+    TRACE_STAGE_MESH_SEND,  /* esp_mesh_send() returned */
+    TRACE_STAGE_CTRL,       /* picked up by the controller tick */
+    TRACE_STAGE_LAMP,       /* first lamp change serving the request */
+    TRACE_STAGE_MAX
+} latency_trace_stage_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* Appended to CMD_BUTTON_PRESSED frames. Wall clock (SNTP) timestamps, so
+ * the receiver can compute the one-way delay across the mesh. */
+typedef struct __attribute__((packed)) {
+    uint16_t id;
+    int64_t press_us;
+    int64_t send_us;
+} latency_trace_hdr_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Install the button edge interrupt used for the press timestamp
+ */
+void latency_trace_init(void);
+
+/**
+ * @brief Record the button edge time, called from the GPIO interrupt
+ */
+void latency_trace_press_from_isr(void);
+
+/**
+ * @brief Open a trace for a newly detected pedestrian request
+ *
+ * @return trace id carried in the mesh frames
+ */
+uint16_t latency_trace_begin(void);
+
+/**
+ * @brief Stamp a stage of the open trace, only the first stamp counts
+ */
+void latency_trace_stamp(latency_trace_stage_t stage);
+
+/**
+ * @brief Fill the trace header of an outgoing frame
+ */
+void latency_trace_fill(latency_trace_hdr_t *hdr);
+
+/**
+ * @brief Account a trace header received from another node
+ *
+ * Publishes the press-to-receive and mesh one-way delays.
+ *
+ * @param mac station address of the sending node
+ * @param hdr received trace header
+ */
+void latency_trace_remote(mqtt_pub_queue_t *pub, const uint8_t *mac, const latency_trace_hdr_t *hdr);
+
+/**
+ * @brief Close the open trace and publish its per-stage breakdown
+ */
+void latency_trace_finish(void);
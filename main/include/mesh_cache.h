@@ -0,0 +1,49 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* Where the node last joined the mesh, tried first on the next boot */
+typedef struct {
+    uint8_t channel;
+    uint8_t layer;
+    uint8_t root;               /* joined as root, the parent is the router */
+    uint8_t router_bssid[6];    /* all zero if the node did not learn it */
+    uint8_t parent_bssid[6];
+} mesh_cache_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Read the network cached in NVS
+ *
+ * NVS must be initialized before calling this.
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_NOT_FOUND: nothing cached, or the record is corrupt
+ */
+esp_err_t mesh_cache_load(mesh_cache_t *cache);
+
+/**
+ * @brief Cache the network just joined, NVS is only written when it changed
+ */
+esp_err_t mesh_cache_save(const mesh_cache_t *cache);
+
+/**
+ * @brief Forget the cached network, the next boot scans every channel
+ */
+esp_err_t mesh_cache_erase(void);
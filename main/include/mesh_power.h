@@ -0,0 +1,44 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Configure mesh power save, light sleep and GPIO wake-up sources
+ *
+ * Must be called after esp_mesh_init() and before esp_mesh_start().
+ * Does nothing unless CONFIG_MESH_ENABLE_PS is set.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t mesh_power_init(void);
+
+/**
+ * @brief Sleep until the next sensor poll or a button/infrared edge
+ *
+ * Replaces the fixed poll delay of the sensor task. Without power save
+ * this is a plain delay of idle_ms.
+ *
+ * @param idle_ms poll period when power save is disabled
+ */
+void mesh_power_wait_event(uint32_t idle_ms);
+
+/**
+ * @brief Start the periodic duty-cycle/latency report
+ *
+ * Publishes the running device and network duty cycles together with
+ * the expected downlink latency they imply.
+ */
+void mesh_power_report_start(void);
@@ -0,0 +1,85 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*
+ * Exactly-once delivery of small control frames over the raw mesh channel.
+ * The sender numbers each frame and keeps it until the receiver acks it,
+ * retransmitting on a timeout taken from the measured round trip. The
+ * receiver drops duplicates with a per-sender window and acks selectively,
+ * so one ack covers every frame of the window it holds. A frame not acked
+ * after MESH_RELIABLE_TRIES transmissions is given up, which bounds the
+ * delivery time. Frames may arrive out of order.
+ */
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define CMD_RELIABLE            (0x5e)      /* mesh_reliable_hdr_t, then the frame carried */
+#define CMD_RELIABLE_ACK        (0x5f)      /* mesh_reliable_ack_t, receiver to sender */
+
+#define MESH_RELIABLE_PAYLOAD_MAX   (48)
+#define MESH_RELIABLE_WINDOW        (8)         /* frames awaiting their ack */
+#define MESH_RELIABLE_TRIES         (5)         /* transmissions before giving up */
+#define MESH_RELIABLE_RTO_INIT_MS   (300)       /* until the first round trip is measured */
+#define MESH_RELIABLE_RTO_MIN_MS    (40)
+#define MESH_RELIABLE_RTO_MAX_MS    (2000)
+#define MESH_RELIABLE_DEDUP         (32)        /* sequence numbers remembered per sender */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t epoch;          /* random per boot, a new one resets the receiver window */
+    uint16_t seq;
+} mesh_reliable_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t epoch;          /* of the sender being acked */
+    uint16_t top;           /* highest sequence number received */
+    uint32_t bitmap;        /* bit i: top - i received */
+} mesh_reliable_ack_t;
+
+/* Called on the mesh receive task with each frame carried, once */
+typedef void (mesh_reliable_deliver_t)(mesh_addr_t *from, uint8_t *data, uint16_t len);
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Start the retransmit and ack task
+ */
+esp_err_t mesh_reliable_init(mesh_reliable_deliver_t *deliver);
+
+/**
+ * @brief Send a frame with delivery guarantee
+ *
+ * The first transmission happens in the caller, retransmissions on the
+ * task. The frame is copied. A NULL destination is the root, whichever
+ * node holds the role when the frame is (re)transmitted; not for use on
+ * the root itself.
+ *
+ * @return
+ *    - ESP_OK: sent or, if the first transmission failed, queued for retransmission
+ *    - ESP_ERR_INVALID_SIZE: longer than MESH_RELIABLE_PAYLOAD_MAX
+ *    - ESP_ERR_NO_MEM: MESH_RELIABLE_WINDOW frames already awaiting their ack
+ */
+esp_err_t mesh_reliable_send(const mesh_addr_t *to, const uint8_t *data, uint16_t len);
+
+/**
+ * @brief CMD_RELIABLE and CMD_RELIABLE_ACK frames from the mesh receive callback
+ */
+void mesh_reliable_received(mesh_addr_t *from, uint8_t *data, uint16_t len);
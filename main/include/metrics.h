@@ -0,0 +1,113 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+// Histogram bucket i holds samples in [2^(i-1), 2^i), bucket 0 holds zero
+#define METRIC_HIST_BUCKETS (20)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    METRIC_MESH_TX,
+    METRIC_MESH_TX_ERR,
+    METRIC_MESH_RX,
+    METRIC_MESH_RX_ERR,
+    METRIC_MQTT_PUB,
+    METRIC_MQTT_PUB_ERR,
+    METRIC_MQTT_DROP,
+    METRIC_MQTT_COALESCE,
+    METRIC_TLS_RESUME_OFFER,
+    METRIC_MQTT_RECONNECT,
+    METRIC_ROOT_HANDOVER,
+    METRIC_PHASE_CHANGE,
+    METRIC_MESH_RETX,
+    METRIC_MESH_DUP,
+    METRIC_MESH_LOST,
+    METRIC_COUNTER_MAX
+} metric_counter_t;
+
+typedef enum {
+    METRIC_HEAP_FREE,
+    METRIC_HEAP_MIN_FREE,
+    METRIC_GAUGE_MAX
+} metric_gauge_t;
+
+typedef enum {
+    METRIC_MQTT_PUB_US,
+    METRIC_MQTT_QUEUE_US,
+    METRIC_MQTT_QUEUE_DEPTH,
+    METRIC_TLS_HANDSHAKE_MS,
+    METRIC_TLS_HEAP_PEAK,
+    METRIC_MQTT_OUTAGE_MS,
+    METRIC_MESH_JOIN_MS,
+    METRIC_NETIF_SWITCH_US,
+    METRIC_MESH_DELIVERY_MS,
+    METRIC_HIST_MAX
+} metric_hist_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+#if CONFIG_APP_METRICS_ENABLE
+
+extern uint32_t g_metric_counters[METRIC_COUNTER_MAX];
+extern uint32_t g_metric_gauges[METRIC_GAUGE_MAX];
+extern uint32_t g_metric_hists[METRIC_HIST_MAX][METRIC_HIST_BUCKETS];
+
+/**
+ * @brief Start the task publishing a metrics snapshot every CONFIG_APP_METRICS_INTERVAL_S
+ */
+void metrics_start(void);
+
+static inline void metric_counter_add(metric_counter_t id, uint32_t n)
+{
+    __atomic_fetch_add(&g_metric_counters[id], n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_gauge_set(metric_gauge_t id, uint32_t value)
+{
+    __atomic_store_n(&g_metric_gauges[id], value, __ATOMIC_RELAXED);
+}
+
+static inline void metric_hist_record(metric_hist_t id, uint32_t value)
+{
+    int bucket = value ? 32 - __builtin_clz(value) : 0;
+    if (bucket >= METRIC_HIST_BUCKETS) {
+        bucket = METRIC_HIST_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&g_metric_hists[id][bucket], 1, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t metric_counter_get(metric_counter_t id)
+{
+    return __atomic_load_n(&g_metric_counters[id], __ATOMIC_RELAXED);
+}
+
+#define METRIC_INC(id)              metric_counter_add((id), 1)
+#define METRIC_GAUGE_SET(id, value) metric_gauge_set((id), (value))
+#define METRIC_HIST(id, value)      metric_hist_record((id), (value))
+#define METRIC_COUNTER(id)          metric_counter_get(id)
+
+#else
+
+static inline void metrics_start(void) { }
+
+#define METRIC_INC(id)              do { } while (0)
+#define METRIC_GAUGE_SET(id, value) do { (void) (value); } while (0)
+#define METRIC_HIST(id, value)      do { (void) (value); } while (0)
+#define METRIC_COUNTER(id)          ((uint32_t) 0)
+
+#endif /* CONFIG_APP_METRICS_ENABLE */
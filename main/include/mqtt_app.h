@@ -0,0 +1,54 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include "cJSON.h"
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Connect to the broker, called on every IP_EVENT_STA_GOT_IP
+ *
+ * The first call creates the client and starts the mqtt_pub publisher,
+ * later ones reconnect it at once and resume the persistent session.
+ */
+void mqtt_app_start(void);
+
+/**
+ * @brief Disconnect now, the station netif is going away
+ *
+ * The client waits to reconnect until mqtt_app_start() or its reconnect timeout.
+ */
+void mqtt_app_suspend(void);
+
+/**
+ * @brief Publish at QoS 0 and wait for the client, for the periodic reporters only
+ *
+ * Sensor, control and mesh tasks go through mqtt_pub instead.
+ */
+void mqtt_app_publish(char* topic, cJSON *json);
+
+/**
+ * @brief Hand one serialized message to the client, the mqtt_pub_send_t of the publisher
+ *
+ * @return message id, -1 on error or without a client, -2 when the client outbox is full
+ */
+int mqtt_app_send(const char *topic, const char *data, int len, int qos, int retain);
+
+/**
+ * @brief Callback for shared attributes, on connection and on every change
+ */
+void mqtt_app_on_attributes(void (*cb)(const char *data, int len));
+
+/**
+ * @brief Callback for server-side RPC requests
+ */
+void mqtt_app_on_rpc(void (*cb)(const char *topic, int topic_len, const char *data, int len));
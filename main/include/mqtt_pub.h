@@ -0,0 +1,156 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Asynchronous publishing: a task fills a fixed-size record in its own
+ * single-producer queue and goes on, the publisher task serializes it and
+ * calls the MQTT client, whose lock and outbox may block. Keys and object
+ * names are stored as pointers, only string literals may be passed.
+ *
+ * Every record belongs to a class with its own QoS, retain flag, priority
+ * and outbox budget. While the broker is away records wait in the class
+ * outbox, the budget bounds the memory they take and the class drop policy
+ * decides what goes when it is full. Once connected, classes are sent in
+ * priority order, so control telemetry never waits behind sensor samples.
+ */
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MQTT_PUB_QUEUES_MAX     (12)
+#define MQTT_PUB_FIELDS_MAX     (12)
+#define MQTT_PUB_TEXT_MAX       (256)
+#define MQTT_PUB_TOPIC_MAX      (48)
+#define MQTT_PUB_JSON_MAX       (640)   /* longest payload mqtt_pub_format() writes */
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    MQTT_PUB_TELEMETRY,         /* v1/devices/me/telemetry */
+    MQTT_PUB_ATTRIBUTES,        /* v1/devices/me/attributes */
+    MQTT_PUB_RPC_RESPONSE,      /* v1/devices/me/rpc/response/<id> */
+} mqtt_pub_topic_t;
+
+/* Highest priority first */
+typedef enum {
+    MQTT_PUB_CLASS_REPLY,       /* RPC replies, a server call waits for them */
+    MQTT_PUB_CLASS_CONTROL,     /* phase changes, preemption, timing plan in force */
+    MQTT_PUB_CLASS_EVENT,       /* button presses, latency traces */
+    MQTT_PUB_CLASS_SAMPLE,      /* periodic sensor summaries */
+    MQTT_PUB_CLASS_MAX
+} mqtt_pub_class_t;
+
+/* What a full class outbox does with the next record */
+typedef enum {
+    MQTT_PUB_DROP_OLDEST,       /* the oldest record of the class goes */
+    MQTT_PUB_COALESCE_LATEST,   /* replaces the record of the same topic and first key, else drop oldest */
+    MQTT_PUB_NEVER_DROP,        /* stays in the producer queue until there is room */
+} mqtt_pub_policy_t;
+
+/* Sends one serialized record, returns the message id, -1 on error or -2
+ * when the client outbox is full and the record is to be retried */
+typedef int (*mqtt_pub_send_t)(const char *topic, const char *data, int len, int qos, int retain);
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    const char *key;
+    double value;
+} mqtt_pub_field_t;
+
+typedef struct {
+    int64_t enqueue_us;
+    uint8_t topic;          /* mqtt_pub_topic_t */
+    uint8_t cls;            /* mqtt_pub_class_t */
+    uint8_t n_fields;       /* 0: text record */
+    uint16_t text_len;
+    uint32_t id;            /* MQTT_PUB_RPC_RESPONSE */
+    const char *object;     /* fields wrapped in an object of this name, NULL at top level */
+    union {
+        mqtt_pub_field_t field[MQTT_PUB_FIELDS_MAX];
+        char text[MQTT_PUB_TEXT_MAX];   /* JSON already serialized */
+    };
+} mqtt_pub_record_t;
+
+typedef struct {
+    const char *name;
+    uint32_t mask;          /* depth - 1 */
+    uint32_t head;          /* next record to fill, written by the producer only */
+    uint32_t tail;          /* next record to send, written by the publisher only */
+    uint32_t dropped;
+    mqtt_pub_record_t *ring;
+} mqtt_pub_queue_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Queue of one producer task
+ *
+ * Only one task may begin and commit records on it, each producer needs its own.
+ *
+ * @param depth records, rounded up to a power of two
+ *
+ * @return NULL if out of memory or of queue slots
+ */
+mqtt_pub_queue_t *mqtt_pub_queue_create(const char *name, uint32_t depth);
+
+/**
+ * @brief Reserve the next record, to be filled and passed to mqtt_pub_commit()
+ *
+ * Records queued before mqtt_pub_start() are sent once it runs.
+ *
+ * @return NULL if the queue is full, the record is counted as dropped
+ */
+mqtt_pub_record_t *mqtt_pub_begin(mqtt_pub_queue_t *queue, mqtt_pub_topic_t topic, mqtt_pub_class_t cls);
+
+/**
+ * @brief Add a number to the record, ignored past MQTT_PUB_FIELDS_MAX
+ */
+void mqtt_pub_add(mqtt_pub_record_t *rec, const char *key, double value);
+
+/**
+ * @brief Hand the record to the publisher, never blocks
+ */
+void mqtt_pub_commit(mqtt_pub_queue_t *queue);
+
+/**
+ * @brief Queue JSON already serialized, such as an RPC reply
+ *
+ * @return false if dropped
+ */
+bool mqtt_pub_text(mqtt_pub_queue_t *queue, mqtt_pub_topic_t topic, mqtt_pub_class_t cls,
+                   uint32_t id, const char *data, int len);
+
+/**
+ * @brief Topic and JSON payload of a record
+ *
+ * @param[out] topic MQTT_PUB_TOPIC_MAX bytes
+ *
+ * @return payload length, 0 if it does not fit
+ */
+int mqtt_pub_format(const mqtt_pub_record_t *rec, char *topic, char *buf, size_t size);
+
+/**
+ * @brief Start the publisher task, which sends every record with send
+ */
+void mqtt_pub_start(mqtt_pub_send_t send);
+
+/**
+ * @brief Broker connection up or down, records are only sent while it is up
+ */
+void mqtt_pub_set_connected(bool connected);
@@ -0,0 +1,38 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stddef.h>
+#include "esp_transport.h"
+
+/*
+ * TLS transport for the MQTT client that keeps the session of the last
+ * handshake and offers it on the next connection, from this client or from
+ * the one created after a root switch. A broker accepting the ticket skips
+ * the certificate exchange and key agreement.
+ */
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MQTT_TLS_DEFAULT_PORT   (8883)
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Transport for esp_mqtt_client_config_t.network.transport
+ *
+ * @param ca PEM of the CA the broker certificate is verified against, kept by the caller
+ * @param ca_len bytes of ca, terminating NUL included
+ *
+ * @return NULL if out of memory
+ */
+esp_transport_handle_t mqtt_tls_transport(const char *ca, size_t ca_len);
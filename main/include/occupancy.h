@@ -0,0 +1,82 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define OCCUPANCY_HOLD_OFF_MS_DEFAULT   (2000)
+#define OCCUPANCY_WINDOW_S_DEFAULT      (60)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* One presence in front of the sensor. Gaps shorter than the hold-off do
+ * not end it, so a PIR retriggering on the same pedestrian counts once. */
+typedef struct {
+    int64_t start_us;       /* rising edge */
+    int64_t end_us;         /* last falling edge */
+} occupancy_interval_t;
+
+/* Summary of one aggregation window */
+typedef struct {
+    int64_t start_us;
+    uint32_t length_us;
+    uint16_t count;         /* intervals started in the window */
+    uint32_t occupied_us;   /* time inside an interval, clipped to the window */
+    uint32_t longest_us;    /* longest interval closed in the window */
+} occupancy_window_t;
+
+typedef struct {
+    uint32_t hold_off_us;
+    uint32_t window_us;
+    bool high;              /* sensor level after the last edge */
+    bool occupied;          /* interval open, including its hold-off */
+    occupancy_interval_t open;
+    occupancy_window_t window;
+} occupancy_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Start with the sensor low and the first window at now_us
+ */
+void occupancy_init(occupancy_t *occ, uint32_t hold_off_ms, uint32_t window_s, int64_t now_us);
+
+/**
+ * @brief Sensor edge, or a sample of the level; repeated levels are ignored
+ */
+void occupancy_input(occupancy_t *occ, bool level, int64_t at_us);
+
+/**
+ * @brief Close the open interval once the sensor has been low for the hold-off
+ *
+ * @return true with the interval in out when one closed
+ */
+bool occupancy_interval(occupancy_t *occ, int64_t now_us, occupancy_interval_t *out);
+
+/**
+ * @brief Close the current window once it has elapsed and start the next
+ *
+ * An interval still open is split: its part up to now_us counts in the
+ * closing window, the rest in the following ones.
+ *
+ * @return true with the summary in out when the window closed
+ */
+bool occupancy_window(occupancy_t *occ, int64_t now_us, occupancy_window_t *out);
+
+/**
+ * @brief Next time occupancy_interval() or occupancy_window() has something to do
+ */
+int64_t occupancy_next_us(const occupancy_t *occ);
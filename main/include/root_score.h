@@ -0,0 +1,89 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The root carries the NAT, DHCP and MQTT traffic of every node, so it
+ * should be the node with the best uplink that can afford it. Every node
+ * scores itself and reports the score to the root; the root hands its
+ * role over when a candidate stays clearly ahead.
+ */
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define ROOT_SCORE_RSSI_NONE    (-128)          /* router not heard */
+#define ROOT_SCORE_RSSI_FLOOR   (-90)           /* 0 points at or below */
+#define ROOT_SCORE_RSSI_CEIL    (-40)           /* full points at or above */
+#define ROOT_SCORE_HEAP_MIN     (48 * 1024)     /* below it the root services do not fit */
+#define ROOT_SCORE_UPTIME_MAX_S (3600)          /* uptime counts up to an hour */
+#define ROOT_SCORE_HYSTERESIS   (60)            /* lead over the root to count, about 6 dB */
+#define ROOT_SCORE_REPORTS      (3)             /* consecutive reports with that lead */
+#define ROOT_SCORE_STALE        (2)             /* report intervals without news that drop a candidate */
+#define ROOT_SCORE_HOLD_S       (300)           /* a new root keeps the role at least this long */
+#define ROOT_SCORE_CANDIDATES   (8)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    int8_t router_rssi;     /* dBm, ROOT_SCORE_RSSI_NONE if unknown */
+    bool mains;             /* false on batteries */
+    uint32_t free_heap;
+    uint32_t uptime_s;
+} root_score_input_t;
+
+typedef struct {
+    uint8_t addr[6];
+    uint16_t score;
+    uint8_t ahead;          /* consecutive reports ahead of the root by the hysteresis */
+    int64_t seen_us;        /* last report, 0 for a free slot */
+} root_candidate_t;
+
+/* Kept by the root */
+typedef struct {
+    int64_t hold_until_us;
+    int64_t report_us;      /* node report interval */
+    root_candidate_t candidate[ROOT_SCORE_CANDIDATES];
+} root_election_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Root capability of a node, higher is better
+ *
+ * Router RSSI weighs 10 points a dB and uptime a point a minute. A node on
+ * batteries, short of heap or not hearing the router scores 0.
+ */
+uint16_t root_score(const root_score_input_t *in);
+
+/**
+ * @brief Start as root at now_us, no handover before the hold time
+ *
+ * @param report_us interval of the node reports, candidates silent for
+ *        ROOT_SCORE_STALE of them are dropped
+ */
+void root_election_init(root_election_t *el, int64_t now_us, int64_t report_us);
+
+/**
+ * @brief Score reported by a node, compared with the root's own
+ *
+ * @param[out] out address of the node to hand the root over to
+ *
+ * @return true when a candidate heard lately has been ahead of root_score for
+ *         ROOT_SCORE_REPORTS reports and the hold time is over; the election
+ *         starts a new hold
+ */
+bool root_election_report(root_election_t *el, const uint8_t addr[6], uint16_t score,
+                          uint16_t root_score, int64_t now_us, uint8_t out[6]);
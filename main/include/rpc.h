@@ -0,0 +1,97 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define RPC_REQUEST_TOPIC       "v1/devices/me/rpc/request/"
+#define RPC_RESPONSE_TOPIC      "v1/devices/me/rpc/response/"
+
+#define RPC_REPLY_MAX           (256)   /* longest reply rpc_format_reply() writes */
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    RPC_METHOD_NONE,
+    RPC_METHOD_PEDESTRIAN_REQUEST,  /* "pedestrianRequest": same as the button */
+    RPC_METHOD_PREEMPT,             /* "preempt": params group, active */
+    RPC_METHOD_GET_STATE,           /* "getState" */
+} rpc_method_t;
+
+typedef enum {
+    RPC_STATUS_OK,
+    RPC_STATUS_REJECTED,        /* the controller refused it, e.g. not a vehicle group */
+    RPC_STATUS_UNSUPPORTED,     /* feature disabled on the target node */
+} rpc_status_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* One command, from the node holding the MQTT request to the target node
+ * (CMD_RPC) and back with the outcome (CMD_RPC_RESULT) */
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t method;         /* rpc_method_t */
+    uint32_t id;            /* request id of the RPC topic */
+    uint8_t origin[6];      /* node that publishes the reply */
+    uint8_t group;          /* RPC_METHOD_PREEMPT */
+    uint8_t active;         /* RPC_METHOD_PREEMPT */
+    /* filled by the target */
+    uint8_t target[6];
+    uint8_t status;         /* rpc_status_t */
+    uint8_t phase;
+    uint8_t vehicles;       /* 0 green, 1 yellow, 2 red */
+    uint8_t pedestrians;    /* 0 walk, 1 red */
+    uint8_t preempt;        /* traffic_preempt_t */
+    uint32_t actuation_us;  /* command received on the target to controller done */
+} rpc_msg_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Decode a ThingsBoard RPC request without heap allocation
+ *
+ *   topic   v1/devices/me/rpc/request/<id>
+ *   data    {"method": "preempt", "params": {"node": "24:0a:c4:00:00:02", "group": 0, "active": true}}
+ *
+ * @param[out] msg method, id and parameters, the rest zeroed
+ * @param[out] node target node from params.node
+ * @param[out] has_node params.node given, otherwise the command is for the receiving node
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_NOT_FOUND: no request id in the topic, nowhere to reply
+ *    - ESP_ERR_INVALID_ARG: malformed JSON or parameter, msg->id is set
+ *    - ESP_ERR_NOT_SUPPORTED: unknown method, msg->id is set
+ */
+esp_err_t rpc_parse(const char *topic, int topic_len, const char *data, int data_len,
+                    rpc_msg_t *msg, uint8_t node[6], bool *has_node);
+
+/**
+ * @brief Write the reply of an executed command
+ *
+ * @param latency_us MQTT request received to result known on the replying node
+ *
+ * @return length written, at most RPC_REPLY_MAX - 1
+ */
+int rpc_format_reply(char *buf, size_t size, const rpc_msg_t *msg, int64_t latency_us);
+
+/**
+ * @brief Write the reply of a command that could not be run
+ */
+int rpc_format_error(char *buf, size_t size, const char *error);
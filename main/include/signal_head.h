@@ -0,0 +1,110 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "traffic_controller.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIGNAL_LAMP_NONE    (-1)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    SIGNAL_HEAD_VEHICLE,        /* red, yellow, green */
+    SIGNAL_HEAD_PEDESTRIAN,     /* red, green */
+} signal_head_kind_t;
+
+typedef enum {
+    SIGNAL_BUS_GPIO,            /* lamp channel is a GPIO number */
+    SIGNAL_BUS_SHIFT_REG,       /* lamp channel is a bit of a 74HC595 chain */
+    SIGNAL_BUS_I2C_EXP,         /* lamp channel is expander * 8 + bit, PCF8574 */
+} signal_bus_t;
+
+typedef enum {
+    SIGNAL_LAMP_RED,
+    SIGNAL_LAMP_YELLOW,
+    SIGNAL_LAMP_GREEN,
+    SIGNAL_LAMP_MAX,
+} signal_lamp_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    const char *name;
+    signal_head_kind_t kind;
+    uint8_t group;                      /* TRAFFIC_GROUP_* the head belongs to */
+    int8_t lamp[SIGNAL_LAMP_MAX];       /* channel per lamp or SIGNAL_LAMP_NONE */
+} signal_head_t;
+
+typedef struct {
+    const char *name;
+    signal_bus_t bus;
+    bool active_low;
+    uint8_t n_heads;
+    const signal_head_t *heads;
+    const traffic_plan_t *plan;
+} signal_layout_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Layout selected in menuconfig (APP_SIGNAL_LAYOUT)
+ */
+const signal_layout_t *signal_layout(void);
+
+/**
+ * @brief Set up the output bus and show TRAFFIC_LIGHT_INIT on every head
+ *
+ * GPIO lamps get an LEDC channel each (up to 8), so steady, blinking and
+ * dimmed lamps run from hardware timers. Lamps on the other buses, and
+ * GPIO lamps beyond the channel count, blink from an esp_timer.
+ */
+esp_err_t signal_head_init(void);
+
+/**
+ * @brief Show an aspect on every head of a group
+ *
+ * @param group TRAFFIC_GROUP_*
+ * @param color TRAFFIC_LIGHT_*, anything else turns the heads off
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_STATE: signal_head_init() not called
+ */
+esp_err_t signal_group_set(uint8_t group, int color);
+
+/**
+ * @brief Show an aspect on every head of the layout
+ */
+esp_err_t signal_heads_set_all(int color);
+
+/**
+ * @brief Fade the steady lamps to a duty cycle, for night dimming
+ *
+ * GPIO lamps fade on their LEDC channels, a 74HC595 chain through its
+ * OE pin (CONFIG_APP_SIGNAL_SR_OE_GPIO). Blinking lamps keep full
+ * brightness; PCF8574 lamps cannot be dimmed.
+ *
+ * @param duty_pct 100 for full brightness
+ */
+esp_err_t signal_heads_dim(uint8_t duty_pct);
+
+/**
+ * @brief Last aspect set on a group, 0 if never set
+ */
+int signal_group_get(uint8_t group);
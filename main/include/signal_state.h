@@ -0,0 +1,57 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint8_t color_pos;      /* interval of the phase: 0 = green, 1 = yellow, 2 = all-red */
+    uint8_t ped_color_pos;  /* pedestrian phase: 0 = green, 1 = red */
+    uint8_t timer;          /* seconds left in the current phase */
+    uint8_t button_pressed; /* pending pedestrian request */
+    uint8_t phase;          /* phase of the controller plan, 0 = rest phase */
+} signal_state_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Recover the last controller state after a reset
+ *
+ * The RTC retained copy is tried first (survives watchdog, panic and
+ * software resets such as the OTA restart), the NVS copy is used after
+ * a power loss. NVS must be initialized before calling this.
+ *
+ * @param[out] state restored state, untouched unless ESP_OK is returned
+ *
+ * @return
+ *    - ESP_OK: state restored
+ *    - ESP_ERR_NOT_FOUND: nothing stored, cold start
+ *    - ESP_ERR_INVALID_CRC: stored data is corrupt, caller must go to a safe state
+ */
+esp_err_t signal_state_restore(signal_state_t *state);
+
+/**
+ * @brief Record the controller state
+ *
+ * The RTC copy is refreshed on every call. To limit flash wear, the NVS
+ * copy is written when persist is set (the pending pedestrian request
+ * changed) and otherwise at most every 10 minutes, so after a power loss
+ * the request is kept but the cycle may resume from an older phase.
+ *
+ * @param state current controller state
+ * @param persist write the NVS copy now
+ */
+void signal_state_save(const signal_state_t *state, bool persist);
@@ -0,0 +1,205 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_mesh.h"
+#include "traffic_controller.h"
+
+/*
+ * Every node and the root hold the state of every signal head in the mesh.
+ * A node reports its head to the root on every change. The root sends the
+ * heads changed since its last frame to the whole mesh as one group frame,
+ * and all heads at a slower period. The root numbers the heads by their
+ * slot in its table, so a frame carries a bitset of the slots it holds and
+ * two bytes per head instead of their addresses. The addresses of the slots
+ * go out in map frames when the numbering changes. A slot keeps its number
+ * until its head is forgotten, which starts a new generation of the
+ * numbering; frames of another generation are dropped.
+ */
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define CMD_SIGNAL_REPORT           (0x60)      /* signal_report_t, node to root */
+#define CMD_SIGNAL_DIGEST           (0x61)      /* signal_digest_hdr_t and the heads, root to every node */
+#define CMD_SIGNAL_MAP              (0x63)      /* signal_map_hdr_t and the slot addresses, root to every node */
+
+#define SIGNAL_PACKED_PHASE         (0x03)      /* phase of the controller plan */
+#define SIGNAL_PACKED_INTERVAL      (0x0c)      /* 0 green, 1 yellow, 2 all-red */
+#define SIGNAL_INTERVAL_SHIFT       (2)
+#define SIGNAL_PACKED_WALK          (0x10)      /* pedestrians may start crossing */
+#define SIGNAL_PACKED_REQUEST       (0x20)      /* pedestrian request pending */
+#define SIGNAL_PACKED_PREEMPT       (0x40)      /* emergency vehicle preemption running */
+
+/* Bytes of a digest frame over n slots, all of them set */
+#define SIGNAL_DIGEST_SIZE(n)   (sizeof(signal_digest_hdr_t) + ((n) + 7) / 8 + (n) * sizeof(signal_packed_t))
+
+/* Slots per map frame */
+#define SIGNAL_MAP_PAGE         ((MESH_MPS - sizeof(signal_map_hdr_t)) / 6)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t flags;          /* SIGNAL_PACKED_* */
+    uint8_t remaining;      /* seconds left in the interval, 0 while held */
+} signal_packed_t;
+
+/* Mesh frame from a node to the root */
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t src[6];
+    signal_packed_t head;
+    uint32_t gen;           /* numbering the node holds */
+    uint16_t mapped;        /* slots of it the node knows */
+} signal_report_t;
+
+/* Mesh frame from the root to every node, followed by the bitset and one
+ * signal_packed_t per bit set, in slot order */
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t full;           /* every head known, else only those changed */
+    uint32_t gen;           /* numbering the bitset indexes */
+    uint16_t entries;       /* bits in the bitset */
+} signal_digest_hdr_t;
+
+/* Mesh frame from the root, followed by the addresses of count slots from
+ * first on, zero for a free slot */
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint32_t gen;
+    uint16_t slots;         /* slots numbered in all */
+    uint16_t first;
+    uint16_t count;
+} signal_map_hdr_t;
+
+typedef struct {
+    uint8_t addr[6];
+    signal_packed_t head;
+    bool used;              /* else a free slot */
+    bool mapped;            /* slot numbered by the root: always there, from its maps on the nodes */
+    bool dirty;             /* changed since the last frame of the root */
+    int64_t seen_us;        /* head.remaining counts from here */
+} signal_table_entry_t;
+
+/* The storage is the caller's. Entries stay in their slot until forgotten. */
+typedef struct {
+    signal_table_entry_t *entry;
+    uint16_t max;
+    uint16_t count;         /* slots up to the last one used */
+    uint32_t gen;           /* numbering of the slots */
+    bool numbering;         /* this table numbers the slots, the root's */
+} signal_table_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Head state of a controller in two bytes
+ */
+signal_packed_t signal_table_pack(const traffic_controller_t *ctl);
+
+/**
+ * @brief Empty table over max heads of storage
+ */
+void signal_table_init(signal_table_t *t, signal_table_entry_t *entries, uint16_t max);
+
+/**
+ * @brief Latest state of a head
+ *
+ * A new head takes the first free slot. The entry is marked changed when
+ * the flags differ, or the remaining time differs by more than a second
+ * from the one counted down since the previous state.
+ *
+ * @return false if the table is full and the head is not in it
+ */
+bool signal_table_update(signal_table_t *t, const uint8_t addr[6], signal_packed_t head, int64_t now_us);
+
+/**
+ * @brief Entry of a head, NULL if unknown
+ */
+const signal_table_entry_t *signal_table_get(const signal_table_t *t, const uint8_t addr[6]);
+
+/**
+ * @brief Seconds left in the interval of an entry at now_us
+ */
+uint8_t signal_table_remaining(const signal_table_entry_t *e, int64_t now_us);
+
+/**
+ * @brief Forget the heads not heard from in max_age_us
+ *
+ * On the root a head forgotten starts a new generation of the numbering.
+ *
+ * @return heads removed
+ */
+int signal_table_expire(signal_table_t *t, int64_t now_us, int64_t max_age_us);
+
+/**
+ * @brief Number the slots from here on, as the root
+ *
+ * Every head held keeps its slot under the new generation.
+ */
+void signal_table_renumber(signal_table_t *t, uint32_t gen);
+
+/**
+ * @brief Slots whose numbering the table knows
+ */
+uint16_t signal_table_mapped(const signal_table_t *t);
+
+/**
+ * @brief Root: digest frame of the heads, in slot order
+ *
+ * A delta holds the changed heads only; every head encoded is marked
+ * unchanged. Remaining times are counted down to now_us.
+ *
+ * @return frame length, 0 for a delta without changes or if size is short
+ */
+size_t signal_table_encode(signal_table_t *t, bool full, int64_t now_us, uint8_t *out, size_t size);
+
+/**
+ * @brief Node: apply a digest frame to the slots it knows
+ *
+ * @param self head left out, kept up to date by its own node; NULL for none
+ *
+ * @return heads applied, -1 if the frame is malformed or of another generation
+ */
+int signal_table_decode(signal_table_t *t, const uint8_t *self, const uint8_t *data, size_t len, int64_t now_us);
+
+/**
+ * @brief Root: map frame of the slots from first on, at most SIGNAL_MAP_PAGE
+ *
+ * @return frame length, 0 past the last slot or if size is short
+ */
+size_t signal_table_map_encode(const signal_table_t *t, uint16_t first, uint8_t *out, size_t size);
+
+/**
+ * @brief Node: take the numbering of a map frame
+ *
+ * A frame of another generation drops the numbering known so far. A head
+ * taking a slot held by another one starts unknown.
+ *
+ * @return slots applied, -1 if the frame is malformed
+ */
+int signal_table_map_decode(signal_table_t *t, const uint8_t *data, size_t len, int64_t now_us);
+
+/**
+ * @brief Telemetry page of the heads from *slot on
+ *
+ *   {"signal_heads":300,"signals_slot":0,"signals":"240ac40000020105,..."}
+ *
+ * One 16-digit hex string per head: address, SIGNAL_PACKED_* flags and
+ * seconds left. *slot moves past the last head written.
+ *
+ * @return text length, 0 past the last slot or if size is short
+ */
+int signal_table_page(const signal_table_t *t, uint16_t *slot, int64_t now_us, char *out, size_t size);
@@ -0,0 +1,24 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Start the task profiler
+ *
+ * Every CONFIG_APP_TASK_STATS_INTERVAL_S samples the FreeRTOS run-time
+ * counters and stack high-water marks of all tasks, logs them and
+ * publishes per-task CPU load (percent of both cores) and free stack
+ * (bytes) as telemetry. Does nothing unless CONFIG_APP_TASK_STATS_ENABLE
+ * is set.
+ */
+void task_stats_start(void);
@@ -0,0 +1,92 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "mqtt_pub.h"
+#include "traffic_controller.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TIMING_PLAN_KEEP        (0xff)  /* field not set by the plan, the local value stays */
+
+/* Accepted ranges, in seconds. A plan with any field outside is rejected whole. */
+#define TIMING_PLAN_GREEN_MIN       (5)
+#define TIMING_PLAN_GREEN_MAX       (120)
+#define TIMING_PLAN_YELLOW_MIN      (3)
+#define TIMING_PLAN_YELLOW_MAX      (10)
+#define TIMING_PLAN_RED_MIN         (5)
+#define TIMING_PLAN_RED_MAX         (120)
+#define TIMING_PLAN_CHANGE_RED_MIN  (3)
+#define TIMING_PLAN_CHANGE_RED_MAX  (30)
+#define TIMING_PLAN_ALL_RED_MAX     (10)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* Phase lengths pushed from the dashboard, same units as traffic_timing_t.
+ * Also the payload of the mesh command, so it is packed. */
+typedef struct __attribute__((packed)) {
+    uint8_t minimum_green;
+    uint8_t yellow;
+    uint8_t red;
+    uint8_t change_red;
+    uint8_t all_red;        /* TIMING_PLAN_KEEP for the CONFIG_APP_SIGNAL_ALL_RED_S of the node */
+} timing_plan_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Read the plan stored in NVS
+ *
+ * NVS must be initialized before calling this.
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_NOT_FOUND: no plan stored, or the stored one is corrupt or out of range
+ */
+esp_err_t timing_plan_load(timing_plan_t *plan);
+
+/**
+ * @brief Store a plan in NVS, so it survives a power loss
+ */
+esp_err_t timing_plan_save(const timing_plan_t *plan);
+
+/**
+ * @brief Parse the timing_plan shared attribute
+ *
+ * minimum_green, yellow, red and change_red are required, all_red is
+ * optional.
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG: a field is missing, not a number or out of range
+ */
+esp_err_t timing_plan_from_json(const cJSON *json, timing_plan_t *plan);
+
+/**
+ * @brief Plan fields within the accepted ranges
+ */
+bool timing_plan_is_valid(const timing_plan_t *plan);
+
+/**
+ * @brief Overwrite the lengths of a timing with those the plan sets
+ */
+void timing_plan_apply(const timing_plan_t *plan, traffic_timing_t *timing);
+
+/**
+ * @brief Timing in force, as the client attribute reported back to the dashboard
+ */
+void timing_plan_to_record(const traffic_timing_t *timing, mqtt_pub_record_t *rec);
@@ -0,0 +1,102 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every node reports its place in the mesh and the state of its uplink to
+ * the root, which keeps the latest report of each node and publishes a
+ * summary of the tree and its weakest links.
+ */
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TOPOLOGY_RSSI_NONE      (-128)          /* parent not heard */
+#define TOPOLOGY_RSSI_WEAK      (-80)           /* a parent link below it counts as weak */
+#define TOPOLOGY_WORST_MAX      (16)            /* links topology_worst() lists at most */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* Mesh frame from a node to the root, counts are over the last report interval */
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t src[6];
+    uint8_t parent[6];      /* router BSSID on the root */
+    uint8_t layer;
+    int8_t parent_rssi;     /* dBm, TOPOLOGY_RSSI_NONE if unknown */
+    uint8_t children;       /* direct children */
+    uint16_t subtree;       /* nodes below, direct or not */
+    uint16_t tx;            /* mesh sends */
+    uint16_t tx_err;        /* of them failed */
+} topology_report_t;
+
+typedef struct {
+    topology_report_t report;
+    int64_t seen_us;
+} topology_node_t;
+
+typedef struct {
+    uint16_t nodes;
+    uint8_t layers;
+    uint16_t weak_links;    /* parent RSSI below TOPOLOGY_RSSI_WEAK */
+    uint8_t max_children;
+    uint32_t tx_err;
+} topology_summary_t;
+
+/* Kept by the root, the storage is the caller's */
+typedef struct {
+    topology_node_t *node;
+    uint16_t max;
+    uint16_t count;
+} topology_t;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Empty table over max nodes of storage
+ */
+void topology_init(topology_t *t, topology_node_t *nodes, uint16_t max);
+
+/**
+ * @brief Latest report of a node, replaces the previous one
+ *
+ * @return false if the table is full and the node is not in it
+ */
+bool topology_update(topology_t *t, const topology_report_t *report, int64_t now_us);
+
+/**
+ * @brief Forget the nodes not heard from in max_age_us
+ *
+ * @return nodes removed
+ */
+int topology_expire(topology_t *t, int64_t now_us, int64_t max_age_us);
+
+/**
+ * @brief Counts over the whole table
+ */
+void topology_summary(const topology_t *t, topology_summary_t *out);
+
+/**
+ * @brief Telemetry text of the n weakest parent links
+ *
+ *   {"topology_worst":"240ac4000002:-84:3,240ac4000011:-81:0"}
+ *
+ * Node address, parent RSSI and failed sends, weakest first. Nodes with
+ * the parent RSSI unknown are left out.
+ *
+ * @return text length, 0 if no link is known or size is short
+ */
+int topology_worst(const topology_t *t, int n, char *out, size_t size);
@@ -0,0 +1,184 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "signal_state.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TRAFFIC_LAMP_KEEP       (-1)    /* lamp not touched in this step */
+
+#define TRAFFIC_CONTROLLER_STEP_MS  (1000)
+
+#define TRAFFIC_PHASE_MAX       (4)
+#define TRAFFIC_GROUP_MAX       (8)
+
+/* Groups every plan has, so traffic_light_set() and pedestrian_traffic_light_set()
+ * keep addressing the main street and the crosswalks */
+#define TRAFFIC_GROUP_VEHICLE       (0)
+#define TRAFFIC_GROUP_PEDESTRIAN    (1)
+#define TRAFFIC_GROUP_SIDE_STREET   (2)
+
+/* Shortest all-red before and after a preemption green, whatever all_red says */
+#define TRAFFIC_PREEMPT_ALL_RED_MIN (2)
+
+#define TRAFFIC_TIMING_DEFAULT() { \
+    .minimum_green = 10,           \
+    .yellow = 3,                   \
+    .red = 10,                     \
+    .change_red = 5,               \
+    .all_red = 0,                  \
+    .preempt_max = 60,             \
+}
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* Phase lengths in controller steps (seconds) */
+typedef struct {
+    uint8_t minimum_green;  /* rest phase kept after a served request */
+    uint8_t yellow;
+    uint8_t red;            /* served phase, pedestrians steady green */
+    uint8_t change_red;     /* end of a served phase, pedestrian green blinking */
+    uint8_t all_red;        /* clearance between phases, 0 for none */
+    uint8_t preempt_max;    /* longest preemption green, in case the release is lost */
+} traffic_timing_t;
+
+/* Signal groups released together; bit n stands for group n */
+typedef struct {
+    uint8_t green_groups;   /* vehicle groups on green */
+    uint8_t walk_groups;    /* pedestrian groups on walk */
+} traffic_phase_t;
+
+/* Phase 0 is the rest phase, held until a request and without walk groups.
+ * A request runs phases 1..n_phases-1 once and returns to phase 0. */
+typedef struct {
+    uint8_t n_phases;
+    uint8_t vehicle_groups;
+    uint8_t pedestrian_groups;
+    traffic_phase_t phase[TRAFFIC_PHASE_MAX];
+} traffic_plan_t;
+
+/* Emergency vehicle preemption, runs on top of the phase plan */
+typedef enum {
+    TRAFFIC_PREEMPT_NONE,
+    TRAFFIC_PREEMPT_ENTRY_YELLOW,   /* moving groups clear: vehicles yellow, pedestrians blinking */
+    TRAFFIC_PREEMPT_ENTRY_RED,      /* all-red before the preemption green */
+    TRAFFIC_PREEMPT_GREEN,          /* only the preempted group moves */
+    TRAFFIC_PREEMPT_EXIT_YELLOW,
+    TRAFFIC_PREEMPT_EXIT_RED,       /* all-red, then the rest phase */
+} traffic_preempt_t;
+
+typedef struct {
+    signal_state_t st;      /* st.color_pos is the interval of st.phase: 0 green, 1 yellow, 2 all-red */
+    traffic_timing_t timing;
+    const traffic_plan_t *plan;
+    uint8_t safe_hold;      /* all-red steps left before the cycle starts */
+    uint8_t preempt;        /* traffic_preempt_t */
+    uint8_t preempt_group;  /* vehicle group released for the emergency vehicle */
+    uint8_t preempt_clear;  /* groups clearing in TRAFFIC_PREEMPT_ENTRY_YELLOW */
+    uint8_t preempt_timer;  /* steps left in the current preemption interval */
+    uint8_t preempt_hold;   /* preemption green steps left, 0 once released */
+} traffic_controller_t;
+
+/* What one step asks of the lamps and of the caller */
+typedef struct {
+    int lamp[TRAFFIC_GROUP_MAX];    /* per group: TRAFFIC_LIGHT_* or TRAFFIC_LAMP_KEEP */
+    bool phase_changed;             /* publish and persist the state */
+    bool request_served;            /* cycle done, the pending request can be cleared */
+} traffic_step_t;
+
+/*******************************************************
+ *                Variables Declarations
+ *******************************************************/
+/* One vehicle head and one pedestrian head, the original crossing */
+extern const traffic_plan_t traffic_plan_single;
+/* Main street, side street, then all crosswalks at once */
+extern const traffic_plan_t traffic_plan_four_way;
+
+/*******************************************************
+ *                Function Declarations
+ *******************************************************/
+
+/**
+ * @brief Start in the rest phase, no request pending
+ */
+void traffic_controller_init(traffic_controller_t *ctl, const traffic_timing_t *timing,
+                             const traffic_plan_t *plan);
+
+/**
+ * @brief Go all-red for change_red steps, then start the cycle at the rest phase
+ *
+ * Used when the stored state cannot be trusted.
+ */
+void traffic_controller_safe_hold(traffic_controller_t *ctl);
+
+/**
+ * @brief Switch to new phase lengths at the cycle boundary
+ *
+ * Only takes effect in the rest phase on green, outside a preemption or
+ * safe hold, so no interval ever runs with a mix of old and new lengths.
+ * A running minimum green longer than the new one is cut to it.
+ *
+ * @return true if applied, false to retry at a later step
+ */
+bool traffic_controller_retime(traffic_controller_t *ctl, const traffic_timing_t *timing);
+
+/**
+ * @brief Advance the controller by one step (TRAFFIC_CONTROLLER_STEP_MS)
+ *
+ * Pure logic, no lamps, clocks or locks, so the same code runs on the
+ * node and in the host simulator.
+ *
+ * @param ctl controller
+ * @param request a pedestrian request (button or infrared) is pending
+ * @param[out] out lamp commands and events of this step
+ */
+void traffic_controller_step(traffic_controller_t *ctl, bool request, traffic_step_t *out);
+
+/**
+ * @brief Start or end an emergency vehicle preemption
+ *
+ * Takes effect at once instead of at the next step: moving groups get
+ * yellow (pedestrians blinking green), then all heads red for at least
+ * TRAFFIC_PREEMPT_ALL_RED_MIN steps, then only the preempted group green.
+ * The release, or timing.preempt_max steps without one, clears that group
+ * the same way and resumes the cycle at the rest phase, with any pending
+ * request still pending.
+ *
+ * @param ctl controller
+ * @param group vehicle group to release, TRAFFIC_GROUP_*
+ * @param active true when the vehicle approaches, false once it has passed
+ * @param[out] out lamp commands, phase_changed set when the state moved
+ *
+ * @return false if the group is not a vehicle group of the plan, or a
+ *         release does not match the preemption in progress
+ */
+bool traffic_controller_preempt(traffic_controller_t *ctl, uint8_t group, bool active,
+                                traffic_step_t *out);
+
+/**
+ * @brief Lamp commands for every group in the current state
+ *
+ * Used to drive the heads after a restore.
+ */
+void traffic_controller_lamps(const traffic_controller_t *ctl, traffic_step_t *out);
+
+/**
+ * @brief Aspect of a vehicle group: 0 green, 1 yellow, 2 red
+ */
+uint8_t traffic_controller_group_color(const traffic_controller_t *ctl, uint8_t group);
+
+/**
+ * @brief Pedestrians of the current phase may start crossing (steady green)
+ */
+bool traffic_controller_walk(const traffic_controller_t *ctl);
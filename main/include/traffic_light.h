@@ -19,7 +19,8 @@
 #define TRAFFIC_LIGHT_YELLOW    (0xfe)
 #define TRAFFIC_LIGHT_GREEN     (0xfd)
 #define TRAFFIC_LIGHT_INIT      (0xfa)
-#define TRAFFIC_LIGHT_WARNING   (0xf9)
+#define TRAFFIC_LIGHT_WARNING   (0xf9)    /* red and yellow flashing */
+#define TRAFFIC_LIGHT_GREEN_BLINK (0xf8)  /* end of the pedestrian phase */
 
 #define  CMD_TRAFFIC_LIGHT    (0x62)
 
@@ -0,0 +1,205 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <sys/time.h>
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "mqtt_pub.h"
+
+#include "traffic_light.h"
+#include "latency_trace.h"
+
+#if CONFIG_APP_LATENCY_TRACE_ENABLE
+/*******************************************************
+ *                Constants
+ *******************************************************/
+// An edge older than this is not the one that caused the detection
+#define TRACE_PRESS_MAX_AGE_US  (1000 * 1000)
+// Wall clock before 2024 means SNTP has not synced yet
+#define TRACE_WALL_VALID_US     (1704067200LL * 1000 * 1000)
+
+static const char *TAG = "latency_trace";
+
+static const char *const s_stage_keys[TRACE_STAGE_MAX] = {
+    [TRACE_STAGE_DETECT]    = "lat_detect_ms",
+    [TRACE_STAGE_MESH_SEND] = "lat_send_ms",
+    [TRACE_STAGE_CTRL]      = "lat_ctrl_ms",
+    [TRACE_STAGE_LAMP]      = "lat_lamp_ms",
+};
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_last_edge_us = 0;
+static int64_t s_stage_us[TRACE_STAGE_MAX];
+static int64_t s_press_wall_us = 0;
+static uint16_t s_trace_id = 0;
+static bool s_trace_open = false;
+static mqtt_pub_queue_t *s_pub = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int64_t wall_clock_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void IRAM_ATTR button_edge_isr(void *arg)
+{
+    latency_trace_press_from_isr();
+}
+#endif
+
+void latency_trace_init(void)
+{
+#if CONFIG_APP_LATENCY_TRACE_ENABLE && !CONFIG_MESH_ENABLE_PS
+    // With power save the wake-up interrupt of mesh_power.c stamps the edge
+    traffic_button_init();
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "gpio_install_isr_service failed: %s", esp_err_to_name(err));
+        return;
+    }
+    gpio_set_intr_type(BUTTON_PIN, GPIO_INTR_POSEDGE);
+    gpio_isr_handler_add(BUTTON_PIN, button_edge_isr, NULL);
+#endif
+}
+
+void IRAM_ATTR latency_trace_press_from_isr(void)
+{
+#if CONFIG_APP_LATENCY_TRACE_ENABLE
+    portENTER_CRITICAL_ISR(&s_lock);
+    s_last_edge_us = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&s_lock);
+#endif
+}
+
+uint16_t latency_trace_begin(void)
+{
+#if CONFIG_APP_LATENCY_TRACE_ENABLE
+    int64_t now = esp_timer_get_time();
+    int64_t wall = wall_clock_us();
+
+    portENTER_CRITICAL(&s_lock);
+    s_trace_id++;
+    s_trace_open = true;
+    for (int i = 0; i < TRACE_STAGE_MAX; ++i) {
+        s_stage_us[i] = 0;
+    }
+    // the infrared sensor has no edge interrupt: its trace starts at detection
+    bool edge_valid = s_last_edge_us && now - s_last_edge_us < TRACE_PRESS_MAX_AGE_US;
+    s_stage_us[TRACE_STAGE_PRESS] = edge_valid ? s_last_edge_us : now;
+    s_stage_us[TRACE_STAGE_DETECT] = now;
+    s_press_wall_us = wall - (now - s_stage_us[TRACE_STAGE_PRESS]);
+    s_last_edge_us = 0;
+    uint16_t id = s_trace_id;
+    portEXIT_CRITICAL(&s_lock);
+    return id;
+#else
+    return 0;
+#endif
+}
+
+void latency_trace_stamp(latency_trace_stage_t stage)
+{
+#if CONFIG_APP_LATENCY_TRACE_ENABLE
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_trace_open && s_stage_us[stage] == 0) {
+        s_stage_us[stage] = now;
+    }
+    portEXIT_CRITICAL(&s_lock);
+#endif
+}
+
+void latency_trace_fill(latency_trace_hdr_t *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+#if CONFIG_APP_LATENCY_TRACE_ENABLE
+    portENTER_CRITICAL(&s_lock);
+    hdr->id = s_trace_id;
+    hdr->press_us = s_press_wall_us;
+    portEXIT_CRITICAL(&s_lock);
+    hdr->send_us = wall_clock_us();
+#endif
+}
+
+void latency_trace_remote(mqtt_pub_queue_t *pub, const uint8_t *mac, const latency_trace_hdr_t *hdr)
+{
+#if CONFIG_APP_LATENCY_TRACE_ENABLE
+    int64_t now = wall_clock_us();
+    char text[128];
+
+    if (hdr->id == 0 || hdr->send_us < TRACE_WALL_VALID_US || now < TRACE_WALL_VALID_US) {
+        return;     // tracing disabled on the sender or clocks not synced
+    }
+    int32_t mesh_ms = (now - hdr->send_us) / 1000;
+    int32_t press_ms = (now - hdr->press_us) / 1000;
+    ESP_LOGI(TAG, "trace %d from " MACSTR ": mesh %" PRId32 " ms, press to root %" PRId32 " ms",
+             hdr->id, MAC2STR(mac), mesh_ms, press_ms);
+
+    // the node address is a string, the record goes serialized
+    int len = snprintf(text, sizeof(text), "{\"trace_node\":\"" MACSTR "\",\"trace_id\":%d,"
+                       "\"lat_mesh_ms\":%" PRId32 ",\"lat_press_to_root_ms\":%" PRId32 "}",
+                       MAC2STR(mac), hdr->id, mesh_ms, press_ms);
+    if (!mqtt_pub_text(pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_EVENT, 0, text, len)) {
+        ESP_LOGW(TAG, "trace %d from " MACSTR " not published", hdr->id, MAC2STR(mac));
+    }
+#endif
+}
+
+void latency_trace_finish(void)
+{
+#if CONFIG_APP_LATENCY_TRACE_ENABLE
+    int64_t stage_us[TRACE_STAGE_MAX];
+    uint16_t id;
+
+    portENTER_CRITICAL(&s_lock);
+    if (!s_trace_open) {
+        portEXIT_CRITICAL(&s_lock);
+        return;
+    }
+    memcpy(stage_us, s_stage_us, sizeof(stage_us));
+    id = s_trace_id;
+    s_trace_open = false;
+    portEXIT_CRITICAL(&s_lock);
+
+    // finished from the control task, the only producer of this queue
+    if (s_pub == NULL) {
+        s_pub = mqtt_pub_queue_create("trace", 2);
+    }
+    mqtt_pub_record_t *rec = mqtt_pub_begin(s_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_EVENT);
+    if (rec == NULL) {
+        return;
+    }
+    mqtt_pub_add(rec, "trace_id", id);
+    // each stage relative to the previous stamped one, skipped stages (no mesh send on root) are left out
+    int64_t prev = stage_us[TRACE_STAGE_PRESS];
+    for (int i = TRACE_STAGE_DETECT; i < TRACE_STAGE_MAX; ++i) {
+        if (stage_us[i] == 0) {
+            continue;
+        }
+        mqtt_pub_add(rec, s_stage_keys[i], (stage_us[i] - prev) / 1000);
+        prev = stage_us[i];
+    }
+    int32_t total_ms = (prev - stage_us[TRACE_STAGE_PRESS]) / 1000;
+    mqtt_pub_add(rec, "lat_total_ms", total_ms);
+    ESP_LOGI(TAG, "trace %d: press to lamp %" PRId32 " ms", id, total_ms);
+    mqtt_pub_commit(s_pub);
+#endif
+}
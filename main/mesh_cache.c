@@ -0,0 +1,103 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "mesh_cache.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_CACHE_MAGIC        (0x4d534831)   /* bumped with every mesh_cache_t change */
+#define MESH_CACHE_NAMESPACE    "mesh"
+#define MESH_CACHE_KEY          "join"
+#define MESH_CACHE_CHANNEL_MAX  (14)
+
+static const char *TAG = "mesh_cache";
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    uint32_t magic;
+    mesh_cache_t cache;
+    uint32_t crc;
+} mesh_cache_record_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static uint32_t record_crc(const mesh_cache_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *) record, offsetof(mesh_cache_record_t, crc));
+}
+
+esp_err_t mesh_cache_load(mesh_cache_t *cache)
+{
+    mesh_cache_record_t record;
+    size_t len = sizeof(record);
+    nvs_handle_t nvs;
+
+    if (nvs_open(MESH_CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = nvs_get_blob(nvs, MESH_CACHE_KEY, &record, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (len != sizeof(record) || record.magic != MESH_CACHE_MAGIC || record.crc != record_crc(&record) ||
+        record.cache.channel == 0 || record.cache.channel > MESH_CACHE_CHANNEL_MAX) {
+        ESP_LOGW(TAG, "Cached network unusable, scanning every channel");
+        return ESP_ERR_NOT_FOUND;
+    }
+    *cache = record.cache;
+    return ESP_OK;
+}
+
+esp_err_t mesh_cache_save(const mesh_cache_t *cache)
+{
+    mesh_cache_record_t record = { .magic = MESH_CACHE_MAGIC, .cache = *cache };
+    mesh_cache_t stored;
+    nvs_handle_t nvs;
+
+    // every rejoin lands here, spare the flash when nothing moved
+    if (mesh_cache_load(&stored) == ESP_OK && memcmp(&stored, cache, sizeof(stored)) == 0) {
+        return ESP_OK;
+    }
+    record.crc = record_crc(&record);
+    esp_err_t err = nvs_open(MESH_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs, MESH_CACHE_KEY, &record, sizeof(record));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+esp_err_t mesh_cache_erase(void)
+{
+    nvs_handle_t nvs;
+
+    esp_err_t err = nvs_open(MESH_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_erase_key(nvs, MESH_CACHE_KEY);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
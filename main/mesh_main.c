@@ -10,22 +10,42 @@
 #include <inttypes.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/param.h>
 
 #include "esp_wifi.h"
 #include "esp_mac.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_mesh.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "nvs_flash.h"
 
 #include "driver/gpio.h"
 #include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "cJSON.h"
 
 #include "mesh_netif.h"
 #include "traffic_light.h"
-
-#include "esp_sleep.h"
+#include "traffic_controller.h"
+#include "signal_head.h"
+#include "signal_state.h"
+#include "mesh_power.h"
+#include "metrics.h"
+#include "task_stats.h"
+#include "binlog.h"
+#include "latency_trace.h"
+#include "timing_plan.h"
+#include "rpc.h"
+#include "occupancy.h"
+#include "mqtt_pub.h"
+#include "mqtt_app.h"
+#include "mesh_cache.h"
+#include "root_score.h"
+#include "topology.h"
+#include "mesh_reliable.h"
+#include "signal_table.h"
 
 /*******************************************************
  *                Macros
@@ -35,15 +55,175 @@
 // <CMD> <PAYLOAD>, where CMD is one character, payload is variable dep. on command
 #define CMD_BUTTON_PRESSED 0x55
 // CMD_BUTTON_PRESSED: payload is always 6 bytes identifying address of node sending keypress event
-#define CMD_ROUTE_TABLE 0x56
-// CMD_BUTTON_PRESSED: payload is a multiple of 6 listing addresses in a routing table
+// 0x56 carried the routing table from the root to every node; nodes send to the root with a NULL address
 #define CMD_MOVEMENT_DETECTED 0x57
+// CMD_MOVEMENT_DETECTED: movement_msg_t, one per occupancy interval, to the root
+#define CMD_PREEMPT 0x58
+// CMD_PREEMPT: preempt_msg_t, from the detector node to the root, then from the root to the group
+#define CMD_TIMING_PLAN 0x59
+// CMD_TIMING_PLAN: timing_plan_t, from the root to the nodes the timing_plan attribute selects
+#define CMD_RPC 0x5a
+// CMD_RPC: rpc_msg_t, from the root to the node params.node names
+#define CMD_RPC_RESULT 0x5b
+// CMD_RPC_RESULT: rpc_msg_t filled by the target, back to the origin node for the reply
+#define CMD_ROOT_SCORE 0x5c
+// CMD_ROOT_SCORE: root_score_msg_t, every node to the root, which decides on a handover
+#define CMD_TOPOLOGY 0x5d
+// CMD_TOPOLOGY: topology_report_t, every node to the root, which publishes a summary of the tree
+// CMD_RELIABLE (0x5e), CMD_RELIABLE_ACK (0x5f): see mesh_reliable.h, carry the button and
+// movement frames to the root until acked
+// CMD_SIGNAL_REPORT (0x60), CMD_SIGNAL_DIGEST (0x61), CMD_SIGNAL_MAP (0x63): see signal_table.h, the
+// signal head of every node to the root, the heads of the whole mesh and their numbering from the root
+// to every node
+#define CMD_PREEMPT_ACK 0x64
+// CMD_PREEMPT_ACK: preempt_ack_t, every node to the root for each CMD_PREEMPT, duplicates too
+#define CMD_ROOT_YIELD 0x65
+// CMD_ROOT_YIELD: no payload, from the root to the node it hands over to, which connects to the router
+
+// preemption frames leave from their own queue and task, ahead of any other traffic
+#define PREEMPT_QUEUE_LEN           4
+#define PREEMPT_TX_PRIORITY         22
+// root: preemptions being acked, resent to the nodes missing with backoff; a large share missing gets
+// the group again, fewer get unicasts
+#define PREEMPT_FANOUTS             4
+#define PREEMPT_RETRY_MS            300
+#define PREEMPT_TRIES               5
+#define PREEMPT_GROUP_PCT           25
+// nodes: last preemption of each detector, a copy within the window is a duplicate
+#define PREEMPT_SOURCES             8
+#define PREEMPT_DEDUP_MS            10000
+// nodes: acks leave at random within a spread growing with the mesh, all of them at once would
+// overflow the root's receive queue
+#define PREEMPT_ACKS                4
+#define PREEMPT_ACK_US_PER_NODE     2000
+
+// movement sensor edges from the ISR; a lost edge is caught by the level check on timeout
+#define MOVEMENT_QUEUE_LEN          8
+#ifdef CONFIG_APP_MOVEMENT_HOLD_OFF_MS
+#define MOVEMENT_HOLD_OFF_MS        CONFIG_APP_MOVEMENT_HOLD_OFF_MS
+#else
+#define MOVEMENT_HOLD_OFF_MS        OCCUPANCY_HOLD_OFF_MS_DEFAULT
+#endif
+#ifdef CONFIG_APP_MOVEMENT_WINDOW_S
+#define MOVEMENT_WINDOW_S           CONFIG_APP_MOVEMENT_WINDOW_S
+#else
+#define MOVEMENT_WINDOW_S           OCCUPANCY_WINDOW_S_DEFAULT
+#endif
+
+// RPC requests waiting for their result on the root, forgotten after the timeout
+#define RPC_QUEUE_LEN               4
+#define RPC_PENDING_MAX             8
+#define RPC_PENDING_TIMEOUT_MS      10000
+
+// root pushes the timing plan this long after the last routing table change
+#define TIMING_PLAN_SYNC_DELAY_MS   500
+
+// root capability reported by every node, see root_score.h
+#ifdef CONFIG_MESH_ROOT_SCORE_INTERVAL_S
+#define ROOT_SCORE_INTERVAL_S       CONFIG_MESH_ROOT_SCORE_INTERVAL_S
+#else
+#define ROOT_SCORE_INTERVAL_S       60
+#endif
+#define ROUTER_SCAN_RECORDS         4
+// root: gives the role up this long after telling the candidate, time to reach the router
+#define ROOT_YIELD_DELAY_MS         3000
+
+// layer, parent link and load reported by every node, see topology.h
+#ifdef CONFIG_MESH_TOPOLOGY_INTERVAL_S
+#define TOPOLOGY_INTERVAL_S         CONFIG_MESH_TOPOLOGY_INTERVAL_S
+#else
+#define TOPOLOGY_INTERVAL_S         120
+#endif
+// a node missing this many reports leaves the table
+#define TOPOLOGY_MISSED_REPORTS     3
+// weakest parent links published with the summary
+#define TOPOLOGY_WORST              8
+
+// signal heads of the whole mesh, see signal_table.h
+#ifdef CONFIG_MESH_SIGNAL_DIGEST_S
+#define SIGNAL_DIGEST_S             CONFIG_MESH_SIGNAL_DIGEST_S
+#else
+#define SIGNAL_DIGEST_S             10
+#endif
+// root: changes leave at most this often; a head missing this many digest periods leaves the table
+#define SIGNAL_DELTA_MS             500
+#define SIGNAL_MISSED_DIGESTS       3
+// root: telemetry pages queued per delta round, nodes that missed the map waiting for it
+#define SIGNAL_PUBLISH_PAGES        4
+#define SIGNAL_MAP_REQUESTS         8
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t src[6];         /* node whose detector fired, zero for an edge of the own detector */
+    uint8_t seq;            /* detector edges counted by the source */
+    uint8_t active;         /* 1 vehicle approaching, 0 vehicle passed */
+    uint8_t group;          /* TRAFFIC_GROUP_* released for the vehicle */
+    int64_t trigger_us;     /* detector edge, wall clock, 0 if the clock is not set */
+} preempt_msg_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t src[6];         /* of the preemption acked */
+    uint8_t seq;
+} preempt_ack_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t src[6];         /* node whose sensor saw the movement */
+    uint32_t duration_ms;   /* first rising to last falling edge of the interval */
+    uint32_t age_ms;        /* interval end to sending, the hold-off at least */
+} movement_msg_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t src[6];         /* station address, the vote candidate address */
+    uint16_t score;
+    int8_t router_rssi;
+} root_score_msg_t;
+
+typedef struct {
+    uint8_t level;
+    int64_t at_us;
+} movement_edge_t;
+
+typedef struct {
+    rpc_msg_t msg;
+    int64_t rx_us;          /* command received on this node */
+} rpc_job_t;
+
+typedef struct {
+    uint32_t id;
+    int64_t rx_us;          /* MQTT request received, 0 if the slot is free */
+} rpc_pending_t;
+
+/* Root: a preemption sent to the group and the nodes that acked it */
+typedef struct {
+    preempt_msg_t msg;
+    int64_t first_us;
+    int64_t due_us;         /* next resend, 0 for a free slot */
+    uint8_t tries;
+    int count;
+    int missing;
+    mesh_addr_t nodes[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    bool acked[CONFIG_MESH_ROUTE_TABLE_SIZE];
+} preempt_fanout_t;
+
+typedef struct {
+    uint8_t src[6];
+    uint8_t seq;
+    int64_t rx_us;          /* 0 for a free slot */
+} preempt_seen_t;
 
 /*******************************************************
  *                Constants
  *******************************************************/
 static const char *MESH_TAG = "mesh_main";
 static const uint8_t MESH_ID[6] = { 0x77, 0x77, 0x77, 0x77, 0x77, 0x76};
+// every node joins it: the root sends a frame for the whole mesh once, each link forwards it once
+static const mesh_addr_t MESH_GROUP_ID = { .addr = { 0x01, 0x00, 0x5e, 0x77, 0x77, 0x76 } };
 
 
 /*******************************************************
@@ -52,20 +232,88 @@ static const uint8_t MESH_ID[6] = { 0x77, 0x77, 0x77, 0x77, 0x77, 0x76};
 static mesh_addr_t mesh_parent_addr;
 static int mesh_layer = -1;
 static esp_ip4_addr_t s_current_ip;
-static mesh_addr_t s_route_table[CONFIG_MESH_ROUTE_TABLE_SIZE];
-static int s_route_table_size = 0;
-static SemaphoreHandle_t s_route_table_lock = NULL;
 static SemaphoreHandle_t s_traffic_button_lock = NULL;
 static bool button_pressed = false;
+static TaskHandle_t s_timing_plan_sync_task = NULL;
+static QueueHandle_t s_timing_plan_queue = NULL;
+static SemaphoreHandle_t s_timing_plan_lock = NULL;
+// root only: last timing_plan attribute, resent to nodes joining later
+static bool s_timing_plan_known = false;
+static timing_plan_t s_timing_plan;
+static uint8_t s_timing_plan_nodes[CONFIG_MESH_ROUTE_TABLE_SIZE][6];
+static int s_timing_plan_node_count = -1;   // -1: every node
+static TaskHandle_t s_traffic_control_task = NULL;
+static QueueHandle_t s_movement_queue = NULL;
+// telemetry leaves through the publisher task, one queue per producing task
+static mqtt_pub_queue_t *s_control_pub = NULL;
+static mqtt_pub_queue_t *s_button_pub = NULL;
+static mqtt_pub_queue_t *s_movement_pub = NULL;
+static mqtt_pub_queue_t *s_mesh_rx_pub = NULL;
+static mqtt_pub_queue_t *s_mqtt_rx_pub = NULL;
+static QueueHandle_t s_rpc_queue = NULL;
+static rpc_pending_t s_rpc_pending[RPC_PENDING_MAX];
+static portMUX_TYPE s_rpc_pending_lock = portMUX_INITIALIZER_UNLOCKED;
+#if CONFIG_APP_PREEMPT_ENABLE
+static QueueHandle_t s_preempt_tx_queue = NULL;
+static QueueHandle_t s_preempt_rx_queue = NULL;
+static SemaphoreHandle_t s_preempt_lock = NULL;
+// en el root: preferencias enviadas al grupo a la espera de los acks
+static preempt_fanout_t s_preempt_fanout[PREEMPT_FANOUTS];
+// última preferencia de cada detector, contra los duplicados de los reenvíos
+static preempt_seen_t s_preempt_seen[PREEMPT_SOURCES];
+// acks esperando su momento, solo los toca la tarea de preferencia
+static preempt_ack_t s_preempt_acks[PREEMPT_ACKS];
+static int64_t s_preempt_ack_due_us[PREEMPT_ACKS];
+#endif
+// esp_mesh_start() hasta el primer MESH_EVENT_PARENT_CONNECTED, 0 una vez unido
+static int64_t s_mesh_start_us = 0;
+#if CONFIG_MESH_FAST_REJOIN
+// red del último arranque, probada antes del escaneo completo
+static bool s_mesh_cached = false;
+static mesh_cache_t s_mesh_cache;
+#endif
+#if CONFIG_MESH_ROOT_HANDOVER
+// RSSI del router: escaneado al arrancar, en directo mientras se es root
+static int8_t s_router_rssi = ROOT_SCORE_RSSI_NONE;
+static uint16_t s_root_score = 0;
+static root_election_t s_root_election;
+static portMUX_TYPE s_root_election_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t s_root_score_task = NULL;
+// root: nodo al que se cede el papel de root
+static uint8_t s_root_successor[6];
+// candidato: conectado al router por orden del root, hasta que lo consigue o se rinde
+static int64_t s_root_taking_us = 0;
+#endif
+#if CONFIG_MESH_TOPOLOGY_ENABLE
+// hijos directos, llevados con MESH_EVENT_CHILD_(DIS)CONNECTED
+static volatile uint8_t s_children = 0;
+// en el root: último informe de cada nodo
+static topology_t s_topology;
+static topology_node_t s_topology_nodes[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static SemaphoreHandle_t s_topology_lock = NULL;
+static mqtt_pub_queue_t *s_topology_pub = NULL;
+#endif
+#if CONFIG_MESH_SIGNAL_TABLE_ENABLE
+// estado de todos los semáforos de la malla, el propio incluido
+static signal_table_t s_signal_table;
+static signal_table_entry_t s_signal_entries[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static SemaphoreHandle_t s_signal_lock = NULL;
+static TaskHandle_t s_signal_task = NULL;
+// estado propio, escrito por el control en cada paso
+static signal_packed_t s_signal_own;
+static portMUX_TYPE s_signal_own_lock = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_pub_queue_t *s_signal_pub = NULL;
+// en el root: numeración enviada al grupo por última vez, y nodos que la perdieron
+static uint32_t s_signal_map_gen = 0;
+static uint16_t s_signal_map_slots = 0;
+static mesh_addr_t s_signal_map_requests[SIGNAL_MAP_REQUESTS];
+static int s_signal_map_request_count = 0;
+#endif
 
 
 /*******************************************************
  *                Function Declarations
  *******************************************************/
-// interaction with public mqtt broker
-void mqtt_app_start(void);
-void mqtt_app_publish(char* topic, cJSON *json);
-
 //Ota control
 void ota_update(void);
 
@@ -77,27 +325,1017 @@ void print_current_time();
  *                Function Definitions
  *******************************************************/
 
+#if CONFIG_APP_PREEMPT_ENABLE
+static int64_t preempt_wall_clock_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < 1704067200) {
+        //Hora sin sincronizar (antes de 2024)
+        return 0;
+    }
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void preempt_deliver(const preempt_msg_t *msg)
+{
+    //Despertar al controlador sin esperar a su siguiente paso
+    if (xQueueSendToBack(s_preempt_rx_queue, msg, 0) != pdTRUE) {
+        ESP_LOGE(MESH_TAG, "Preemption queue full");
+        return;
+    }
+    if (s_traffic_control_task) {
+        xTaskNotifyGive(s_traffic_control_task);
+    }
+}
+
+/* Deliver a preemption once, @return false for a copy already delivered */
+static bool preempt_received(const preempt_msg_t *msg)
+{
+    int64_t now = esp_timer_get_time();
+    preempt_seen_t *slot = &s_preempt_seen[0];
+    bool fresh = true;
+
+    xSemaphoreTake(s_preempt_lock, portMAX_DELAY);
+    for (int i = 0; i < PREEMPT_SOURCES; ++i) {
+        preempt_seen_t *seen = &s_preempt_seen[i];
+        if (seen->rx_us && MAC_ADDR_EQUAL(seen->src, msg->src)) {
+            // a resend, or an older edge overtaken by a newer one
+            slot = seen;
+            fresh = now - seen->rx_us > PREEMPT_DEDUP_MS * 1000LL || (int8_t) (msg->seq - seen->seq) > 0;
+            break;
+        }
+        if (seen->rx_us < slot->rx_us) {
+            slot = seen;
+        }
+    }
+    if (fresh) {
+        memcpy(slot->src, msg->src, 6);
+        slot->seq = msg->seq;
+        slot->rx_us = now;
+    }
+    xSemaphoreGive(s_preempt_lock);
+
+    if (fresh) {
+        preempt_deliver(msg);
+    }
+    return fresh;
+}
+
+/* The acks of the whole mesh reach the root over this time */
+static int64_t preempt_ack_spread_us(void)
+{
+    return (int64_t) MAX(esp_mesh_get_total_node_num(), 1) * PREEMPT_ACK_US_PER_NODE;
+}
+
+/* Node: tell the root this preemption arrived */
+static void preempt_ack_send(const preempt_ack_t *ack)
+{
+    mesh_data_t data = {
+        .data = (uint8_t *) ack,
+        .size = sizeof(*ack),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    esp_err_t err = esp_mesh_send(NULL, &data, MESH_DATA_P2P, NULL, 0);
+
+    METRIC_INC(METRIC_MESH_TX);
+    if (err != ESP_OK) {
+        METRIC_INC(METRIC_MESH_TX_ERR);
+    }
+}
+
+/* Node: ack a preemption at a random moment of the spread, at once if too many are waiting */
+static void preempt_ack_schedule(const preempt_msg_t *msg)
+{
+    preempt_ack_t ack = { .cmd = CMD_PREEMPT_ACK, .seq = msg->seq };
+
+    memcpy(ack.src, msg->src, 6);
+    for (int i = 0; i < PREEMPT_ACKS; ++i) {
+        if (s_preempt_ack_due_us[i] == 0) {
+            s_preempt_acks[i] = ack;
+            s_preempt_ack_due_us[i] = esp_timer_get_time() + esp_random() % preempt_ack_spread_us();
+            return;
+        }
+    }
+    preempt_ack_send(&ack);
+}
+
+/* Node: send the acks due, @return next deadline, 0 for none */
+static int64_t preempt_ack_flush(void)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t next = 0;
+
+    for (int i = 0; i < PREEMPT_ACKS; ++i) {
+        if (s_preempt_ack_due_us[i] && s_preempt_ack_due_us[i] <= now) {
+            preempt_ack_send(&s_preempt_acks[i]);
+            s_preempt_ack_due_us[i] = 0;
+        } else if (s_preempt_ack_due_us[i] && (!next || s_preempt_ack_due_us[i] < next)) {
+            next = s_preempt_ack_due_us[i];
+        }
+    }
+    return next;
+}
+
+/* Root: a preemption to one node, or to the group with a NULL address */
+static void preempt_send(const mesh_addr_t *to, const preempt_msg_t *msg)
+{
+    mesh_data_t data = {
+        .data = (uint8_t *) msg,
+        .size = sizeof(*msg),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    esp_err_t err = to ? esp_mesh_send(to, &data, MESH_DATA_P2P, NULL, 0) :
+                    esp_mesh_send(&MESH_GROUP_ID, &data, MESH_DATA_GROUP, NULL, 0);
+
+    METRIC_INC(METRIC_MESH_TX);
+    if (err != ESP_OK) {
+        METRIC_INC(METRIC_MESH_TX_ERR);
+        ESP_LOGW(MESH_TAG, "Preemption to "MACSTR" failed: %s",
+                 MAC2STR(to ? to->addr : MESH_GROUP_ID.addr), esp_err_to_name(err));
+    }
+}
+
+/* Root: send a preemption to the group, every node of the routing table has to ack it */
+static void preempt_fanout_start(const preempt_msg_t *msg)
+{
+    int64_t now = esp_timer_get_time();
+    uint8_t *my_mac = mesh_netif_get_station_mac();
+    preempt_fanout_t *f = &s_preempt_fanout[0];
+
+    // a newer edge of the same detector supersedes its previous one, else a free slot or the oldest
+    xSemaphoreTake(s_preempt_lock, portMAX_DELAY);
+    for (int i = 0; i < PREEMPT_FANOUTS; ++i) {
+        preempt_fanout_t *other = &s_preempt_fanout[i];
+        if (other->due_us && MAC_ADDR_EQUAL(other->msg.src, msg->src)) {
+            f = other;
+            break;
+        }
+        if (f->due_us && (other->due_us == 0 || other->first_us < f->first_us)) {
+            f = other;
+        }
+    }
+    if (f->due_us && !MAC_ADDR_EQUAL(f->msg.src, msg->src)) {
+        ESP_LOGW(MESH_TAG, "Preemption %d from "MACSTR" still missing %d acks, replaced",
+                 f->msg.seq, MAC2STR(f->msg.src), f->missing);
+    }
+    f->msg = *msg;
+    f->first_us = now;
+    f->tries = 1;
+    esp_mesh_get_routing_table(f->nodes, CONFIG_MESH_ROUTE_TABLE_SIZE * 6, &f->count);
+    f->missing = 0;
+    for (int i = 0; i < f->count; ++i) {
+        f->acked[i] = MAC_ADDR_EQUAL(f->nodes[i].addr, my_mac) || MAC_ADDR_EQUAL(f->nodes[i].addr, msg->src);
+        f->missing += !f->acked[i];
+    }
+    int missing = f->missing;
+    f->due_us = missing ? now + preempt_ack_spread_us() + PREEMPT_RETRY_MS * 1000LL : 0;
+    xSemaphoreGive(s_preempt_lock);
+
+    if (missing) {
+        preempt_send(NULL, msg);
+    }
+    BLOGI(MESH_TAG, "Preemption %d from "MACSTR" sent to the group, %d nodes", msg->seq, MAC2STR(msg->src), missing);
+}
+
+static void preempt_acked(const mesh_addr_t *from, const preempt_ack_t *ack)
+{
+    int64_t done_ms = -1;
+
+    xSemaphoreTake(s_preempt_lock, portMAX_DELAY);
+    for (int k = 0; k < PREEMPT_FANOUTS; ++k) {
+        preempt_fanout_t *f = &s_preempt_fanout[k];
+        if (!f->due_us || f->msg.seq != ack->seq || !MAC_ADDR_EQUAL(f->msg.src, ack->src)) {
+            continue;
+        }
+        for (int i = 0; i < f->count; ++i) {
+            if (!f->acked[i] && MAC_ADDR_EQUAL(f->nodes[i].addr, from->addr)) {
+                f->acked[i] = true;
+                if (--f->missing == 0) {
+                    f->due_us = 0;
+                    done_ms = (esp_timer_get_time() - f->first_us) / 1000;
+                }
+                break;
+            }
+        }
+    }
+    xSemaphoreGive(s_preempt_lock);
+
+    if (done_ms >= 0) {
+        BLOGI(MESH_TAG, "Preemption %d acked by every node in %d ms", ack->seq, (int) done_ms);
+    }
+}
+
+/* Root: resend the preemptions due to the nodes missing, @return next deadline, 0 for none */
+static int64_t preempt_fanout_retry(void)
+{
+    static mesh_addr_t missing[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    int64_t now = esp_timer_get_time();
+    int64_t next = 0;
+
+    for (int k = 0; k < PREEMPT_FANOUTS; ++k) {
+        preempt_fanout_t *f = &s_preempt_fanout[k];
+        preempt_msg_t msg;
+        int count = 0;
+        bool group = false;
+
+        xSemaphoreTake(s_preempt_lock, portMAX_DELAY);
+        if (!f->due_us || f->due_us > now) {
+            next = f->due_us && (!next || f->due_us < next) ? f->due_us : next;
+            xSemaphoreGive(s_preempt_lock);
+            continue;
+        }
+        msg = f->msg;
+        if (f->tries >= PREEMPT_TRIES) {
+            count = f->missing;
+            f->due_us = 0;
+            xSemaphoreGive(s_preempt_lock);
+            METRIC_INC(METRIC_MESH_LOST);
+            ESP_LOGE(MESH_TAG, "Preemption %d from "MACSTR" not acked by %d nodes after %d tries, given up",
+                     msg.seq, MAC2STR(msg.src), count, PREEMPT_TRIES);
+            continue;
+        }
+        // backoff as for the reliable frames; the group costs one frame per link, a unicast one per hop
+        f->due_us = now + preempt_ack_spread_us() + ((int64_t) PREEMPT_RETRY_MS * 1000 << f->tries);
+        f->tries++;
+        next = !next || f->due_us < next ? f->due_us : next;
+        group = f->missing * 100 > f->count * PREEMPT_GROUP_PCT;
+        for (int i = 0; i < f->count && !group; ++i) {
+            if (!f->acked[i]) {
+                missing[count++] = f->nodes[i];
+            }
+        }
+        xSemaphoreGive(s_preempt_lock);
+
+        METRIC_INC(METRIC_MESH_RETX);
+        if (group) {
+            BLOGI(MESH_TAG, "Preemption %d resent to the group", msg.seq);
+            preempt_send(NULL, &msg);
+            continue;
+        }
+        BLOGI(MESH_TAG, "Preemption %d resent to %d nodes", msg.seq, count);
+        for (int i = 0; i < count; ++i) {
+            preempt_send(&missing[i], &msg);
+        }
+    }
+    return next;
+}
+#endif
+
+static void rpc_deliver(const rpc_msg_t *msg)
+{
+    rpc_job_t job = { .msg = *msg, .rx_us = esp_timer_get_time() };
+
+    if (s_rpc_queue == NULL || xQueueSendToBack(s_rpc_queue, &job, 0) != pdTRUE) {
+        ESP_LOGE(MESH_TAG, "RPC queue full, request %" PRIu32 " dropped", msg->id);
+        return;
+    }
+    if (s_traffic_control_task) {
+        xTaskNotifyGive(s_traffic_control_task);
+    }
+}
+
+static bool rpc_pending_add(uint32_t id, int64_t rx_us)
+{
+    int64_t now_us = esp_timer_get_time();
+    bool added = false;
+
+    portENTER_CRITICAL(&s_rpc_pending_lock);
+    for (int i = 0; i < RPC_PENDING_MAX && !added; ++i) {
+        rpc_pending_t *p = &s_rpc_pending[i];
+        if (p->rx_us == 0 || now_us - p->rx_us > RPC_PENDING_TIMEOUT_MS * 1000LL) {
+            p->id = id;
+            p->rx_us = rx_us;
+            added = true;
+        }
+    }
+    portEXIT_CRITICAL(&s_rpc_pending_lock);
+    return added;
+}
+
+/* MQTT request time of a pending id, 0 if unknown or already answered */
+static int64_t rpc_pending_take(uint32_t id)
+{
+    int64_t rx_us = 0;
+
+    portENTER_CRITICAL(&s_rpc_pending_lock);
+    for (int i = 0; i < RPC_PENDING_MAX; ++i) {
+        if (s_rpc_pending[i].rx_us && s_rpc_pending[i].id == id) {
+            rx_us = s_rpc_pending[i].rx_us;
+            s_rpc_pending[i].rx_us = 0;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_rpc_pending_lock);
+    return rx_us;
+}
+
+_Static_assert(RPC_REPLY_MAX <= MQTT_PUB_TEXT_MAX, "RPC reply does not fit a publisher record");
+
+static void rpc_publish(mqtt_pub_queue_t *pub, uint32_t id, const char *reply, int len)
+{
+    if (!mqtt_pub_text(pub, MQTT_PUB_RPC_RESPONSE, MQTT_PUB_CLASS_REPLY, id, reply, len)) {
+        ESP_LOGE(MESH_TAG, "RPC reply %" PRIu32 " not published", id);
+    }
+}
+
+/* Origin node: answer the request with the result of the target */
+static void rpc_reply(mqtt_pub_queue_t *pub, const rpc_msg_t *msg)
+{
+    char reply[RPC_REPLY_MAX];
+    int64_t rx_us = rpc_pending_take(msg->id);
+
+    if (rx_us == 0) {
+        //Respuesta tardia, el servidor ya dio la peticion por perdida
+        ESP_LOGW(MESH_TAG, "RPC result %" PRIu32 " without a pending request", msg->id);
+        return;
+    }
+    int64_t latency_us = esp_timer_get_time() - rx_us;
+    rpc_publish(pub, msg->id, reply, rpc_format_reply(reply, sizeof(reply), msg, latency_us));
+    // binlog arguments are 32-bit: the latency goes in ms
+    BLOGI(MESH_TAG, "RPC %" PRIu32 " done on "MACSTR" in %" PRId32 " ms", msg->id, MAC2STR(msg->target),
+          (int32_t) (latency_us / 1000));
+}
+
+#if CONFIG_MESH_ROOT_HANDOVER
+static uint16_t root_score_own(void)
+{
+    root_score_input_t in = {
+        .router_rssi = s_router_rssi,
+#if CONFIG_MESH_ENABLE_PS
+        .mains = false,
+#else
+        .mains = true,
+#endif
+        .free_heap = esp_get_free_heap_size(),
+        .uptime_s = esp_timer_get_time() / 1000000,
+    };
+    wifi_ap_record_t ap;
+
+    // el root oye al router en directo, los demás se quedan con el escaneo del arranque
+    if (esp_mesh_is_root() && esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        s_router_rssi = ap.rssi;
+        in.router_rssi = ap.rssi;
+    }
+    return root_score(&in);
+}
+
+/* Root: start over, no handover before the hold time */
+static void root_election_start(void)
+{
+    uint16_t score = root_score_own();
+
+    portENTER_CRITICAL(&s_root_election_lock);
+    root_election_init(&s_root_election, esp_timer_get_time(), (int64_t) ROOT_SCORE_INTERVAL_S * 1000000);
+    s_root_score = score;
+    portEXIT_CRITICAL(&s_root_election_lock);
+    ESP_LOGI(MESH_TAG, "Root with score %d, router rssi %d", score, s_router_rssi);
+}
+
+static void root_score_received(const root_score_msg_t *msg)
+{
+    uint16_t own;
+    bool handover;
+
+    if (!esp_mesh_is_root()) {
+        return;
+    }
+    portENTER_CRITICAL(&s_root_election_lock);
+    own = s_root_score;
+    handover = root_election_report(&s_root_election, msg->src, msg->score, own, esp_timer_get_time(),
+                                    s_root_successor);
+    portEXIT_CRITICAL(&s_root_election_lock);
+    BLOGI(MESH_TAG, "Root score %d (rssi %d) from "MACSTR", own %d", msg->score, msg->router_rssi,
+          MAC2STR(msg->src), own);
+    if (handover) {
+        // el relevo bloquea unos segundos, fuera del callback de recepción
+        xTaskNotifyGive(s_root_score_task);
+    }
+}
+
+/*
+ * Root: hand the role over to s_root_successor. ESP-MESH ignores the
+ * candidate of a vote (rc_addr is unimplemented) and votes on router RSSI
+ * alone, so the candidate is told to connect to the router as root and this
+ * node then gives the role up and looks for a parent like any other node.
+ */
+static void root_yield(void)
+{
+    uint8_t cmd = CMD_ROOT_YIELD;
+    mesh_addr_t to;
+
+    if (!esp_mesh_is_root()) {
+        return;
+    }
+    portENTER_CRITICAL(&s_root_election_lock);
+    memcpy(to.addr, s_root_successor, 6);
+    portEXIT_CRITICAL(&s_root_election_lock);
+    ESP_LOGW(MESH_TAG, "Handing the root over to "MACSTR", own score %d", MAC2STR(to.addr), s_root_score);
+    METRIC_INC(METRIC_ROOT_HANDOVER);
+    esp_err_t err = mesh_reliable_send(&to, &cmd, sizeof(cmd));
+    if (err != ESP_OK) {
+        ESP_LOGE(MESH_TAG, "Root handover failed: %s", esp_err_to_name(err));
+        return;
+    }
+    vTaskDelay(pdMS_TO_TICKS(ROOT_YIELD_DELAY_MS));
+    // el conflicto entre los dos roots puede haberse resuelto ya
+    if (!esp_mesh_is_root()) {
+        return;
+    }
+    err = esp_mesh_set_self_organized(true, true);
+    if (err != ESP_OK) {
+        ESP_LOGE(MESH_TAG, "Root handover failed: %s", esp_err_to_name(err));
+    }
+}
+
+/* Candidate: leave the parent for the router, as root */
+static void root_take(void)
+{
+    wifi_config_t parent = { 0 };
+    wifi_ap_record_t ap;
+
+    if (esp_mesh_is_root() || root_score_own() == 0 || esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    memcpy(parent.sta.ssid, CONFIG_MESH_ROUTER_SSID, strlen(CONFIG_MESH_ROUTER_SSID));
+    memcpy(parent.sta.password, CONFIG_MESH_ROUTER_PASSWD, strlen(CONFIG_MESH_ROUTER_PASSWD));
+    parent.sta.bssid_set = esp_mesh_get_router_bssid(parent.sta.bssid) == ESP_OK;
+    // toda la red comparte el canal del router
+    parent.sta.channel = ap.primary;
+    ESP_LOGW(MESH_TAG, "Taking the root over on channel %d", parent.sta.channel);
+    esp_err_t err = esp_mesh_set_parent(&parent, NULL, MESH_ROOT, MESH_ROOT_LAYER);
+    if (err != ESP_OK) {
+        ESP_LOGE(MESH_TAG, "Root take over failed: %s", esp_err_to_name(err));
+        return;
+    }
+    s_root_taking_us = esp_timer_get_time();
+}
+
+/* Candidate: esp_mesh_set_parent() stops parent selection, back to self-organized networking */
+static void root_taken(bool root)
+{
+    if (!s_root_taking_us) {
+        return;
+    }
+    s_root_taking_us = 0;
+    ESP_LOGW(MESH_TAG, "Root take over %s", root ? "done" : "given up");
+    esp_mesh_set_self_organized(true, !root);
+}
+
+/* Every node reports its score to the root; the root refreshes its own */
+static void root_score_report(void *args)
+{
+    root_score_msg_t msg = { .cmd = CMD_ROOT_SCORE };
+    mesh_data_t data = {
+        .data = (uint8_t *) &msg,
+        .size = sizeof(msg),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+
+    memcpy(msg.src, mesh_netif_get_station_mac(), 6);
+    while (true) {
+        // woken early by a handover decided in root_score_received()
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ROOT_SCORE_INTERVAL_S * 1000)) > 0) {
+            root_yield();
+            continue;
+        }
+        // un candidato que no llega al router en un intervalo vuelve a buscar padre
+        if (s_root_taking_us && !esp_mesh_is_root() &&
+            esp_timer_get_time() - s_root_taking_us > (int64_t) ROOT_SCORE_INTERVAL_S * 1000000) {
+            root_taken(false);
+        }
+        uint16_t score = root_score_own();
+        if (esp_mesh_is_root()) {
+            portENTER_CRITICAL(&s_root_election_lock);
+            s_root_score = score;
+            portEXIT_CRITICAL(&s_root_election_lock);
+            continue;
+        }
+        // un nodo que no puede ser root no gasta aire
+        if (score == 0) {
+            continue;
+        }
+        msg.score = score;
+        msg.router_rssi = s_router_rssi;
+        esp_err_t err = esp_mesh_send(NULL, &data, MESH_DATA_P2P, NULL, 0);
+        METRIC_INC(METRIC_MESH_TX);
+        if (err != ESP_OK) {
+            METRIC_INC(METRIC_MESH_TX_ERR);
+        }
+    }
+}
+
+/* Router RSSI before the mesh starts: once it runs, the application may not scan */
+static int8_t router_rssi_scan(uint8_t channel, const uint8_t *bssid)
+{
+    static const uint8_t zero[6] = { 0 };
+    wifi_scan_config_t scan = {
+        .ssid = (uint8_t *) CONFIG_MESH_ROUTER_SSID,
+        .bssid = memcmp(bssid, zero, 6) != 0 ? (uint8_t *) bssid : NULL,
+        .channel = channel,
+    };
+    wifi_ap_record_t ap[ROUTER_SCAN_RECORDS];
+    uint16_t count = ROUTER_SCAN_RECORDS;
+    int8_t rssi = ROOT_SCORE_RSSI_NONE;
+
+    if (esp_wifi_scan_start(&scan, true) != ESP_OK || esp_wifi_scan_get_ap_records(&count, ap) != ESP_OK) {
+        return ROOT_SCORE_RSSI_NONE;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (ap[i].rssi > rssi) {
+            rssi = ap[i].rssi;
+        }
+    }
+    return rssi;
+}
+#endif
+
+#if CONFIG_MESH_TOPOLOGY_ENABLE
+/* This node's report, mesh sends counted since the previous one */
+static void topology_own(topology_report_t *report)
+{
+    static uint32_t last_tx = 0, last_tx_err = 0;
+    uint32_t tx = METRIC_COUNTER(METRIC_MESH_TX);
+    uint32_t tx_err = METRIC_COUNTER(METRIC_MESH_TX_ERR);
+    mesh_addr_t parent = { 0 };
+    wifi_ap_record_t ap;
+
+    memset(report, 0, sizeof(*report));
+    report->cmd = CMD_TOPOLOGY;
+    memcpy(report->src, mesh_netif_get_station_mac(), 6);
+    if (esp_mesh_get_parent_bssid(&parent) == ESP_OK) {
+        memcpy(report->parent, parent.addr, 6);
+    }
+    report->layer = esp_mesh_get_layer();
+    report->parent_rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : TOPOLOGY_RSSI_NONE;
+    report->children = s_children;
+    report->subtree = MAX(esp_mesh_get_routing_table_size() - 1, 0);
+    report->tx = MIN(tx - last_tx, UINT16_MAX);
+    report->tx_err = MIN(tx_err - last_tx_err, UINT16_MAX);
+    last_tx = tx;
+    last_tx_err = tx_err;
+}
+
+static void topology_received(const topology_report_t *report)
+{
+    if (!esp_mesh_is_root() || s_topology_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_topology_lock, portMAX_DELAY);
+    bool kept = topology_update(&s_topology, report, esp_timer_get_time());
+    xSemaphoreGive(s_topology_lock);
+    if (!kept) {
+        ESP_LOGW(MESH_TAG, "Topology table full, "MACSTR" left out", MAC2STR(report->src));
+    }
+}
+
+/* Root: summary of the tree and its weakest links, through the publisher task */
+static void topology_publish(void)
+{
+    int64_t now = esp_timer_get_time();
+    topology_summary_t sum;
+    char text[MQTT_PUB_TEXT_MAX];
+
+    xSemaphoreTake(s_topology_lock, portMAX_DELAY);
+    topology_expire(&s_topology, now, (int64_t) TOPOLOGY_MISSED_REPORTS * TOPOLOGY_INTERVAL_S * 1000000);
+    topology_summary(&s_topology, &sum);
+    int len = topology_worst(&s_topology, TOPOLOGY_WORST, text, sizeof(text));
+    xSemaphoreGive(s_topology_lock);
+    ESP_LOGI(MESH_TAG, "Topology: %d nodes, %d layers, %d weak links, up to %d children",
+             sum.nodes, sum.layers, sum.weak_links, sum.max_children);
+
+    mqtt_pub_record_t *rec = mqtt_pub_begin(s_topology_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_SAMPLE);
+    if (rec) {
+        mqtt_pub_add(rec, "topology_nodes", sum.nodes);
+        mqtt_pub_add(rec, "topology_layers", sum.layers);
+        mqtt_pub_add(rec, "topology_weak_links", sum.weak_links);
+        mqtt_pub_add(rec, "topology_max_children", sum.max_children);
+        mqtt_pub_add(rec, "topology_tx_err", sum.tx_err);
+        mqtt_pub_commit(s_topology_pub);
+    }
+    if (len > 0) {
+        mqtt_pub_text(s_topology_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_SAMPLE, 0, text, len);
+    }
+}
+
+/* Nodes report to the root, the root adds its own report and publishes */
+static void topology_report(void *args)
+{
+    topology_report_t report;
+    mesh_data_t data = {
+        .data = (uint8_t *) &report,
+        .size = sizeof(report),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+
+    // repartir los informes por el intervalo según la MAC, no todos a la vez tras un arranque conjunto
+    const uint8_t *mac = mesh_netif_get_station_mac();
+    vTaskDelay(pdMS_TO_TICKS((mac[4] << 8 | mac[5]) % (TOPOLOGY_INTERVAL_S * 1000)));
+    while (true) {
+        topology_own(&report);
+        if (esp_mesh_is_root()) {
+            xSemaphoreTake(s_topology_lock, portMAX_DELAY);
+            topology_update(&s_topology, &report, esp_timer_get_time());
+            xSemaphoreGive(s_topology_lock);
+            topology_publish();
+        } else {
+            esp_err_t err = esp_mesh_send(NULL, &data, MESH_DATA_P2P, NULL, 0);
+            METRIC_INC(METRIC_MESH_TX);
+            if (err != ESP_OK) {
+                METRIC_INC(METRIC_MESH_TX_ERR);
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(TOPOLOGY_INTERVAL_S * 1000));
+    }
+}
+#endif
+
+#if CONFIG_MESH_SIGNAL_TABLE_ENABLE
+/* Control task: this node's head, the gossip task is only woken when it changes */
+static void signal_table_own(const traffic_controller_t *ctl)
+{
+    signal_packed_t head = signal_table_pack(ctl);
+    bool changed;
+
+    portENTER_CRITICAL(&s_signal_own_lock);
+    changed = head.flags != s_signal_own.flags;
+    s_signal_own = head;
+    portEXIT_CRITICAL(&s_signal_own_lock);
+    if (changed && s_signal_task) {
+        xTaskNotifyGive(s_signal_task);
+    }
+}
+
+_Static_assert(SIGNAL_DIGEST_SIZE(CONFIG_MESH_ROUTE_TABLE_SIZE) <= MESH_MPS, "Signal digest does not fit a mesh frame");
+
+/* Root: a node whose report shows it missed the last map gets it again on its own. With s_signal_lock held */
+static void signal_map_request(const signal_report_t *report)
+{
+    mesh_addr_t src;
+
+    if (s_signal_map_slots == 0 || s_signal_map_gen != s_signal_table.gen ||
+        (report->gen == s_signal_table.gen && report->mapped >= s_signal_map_slots)) {
+        return;
+    }
+    memcpy(src.addr, report->src, 6);
+    for (int i = 0; i < s_signal_map_request_count; ++i) {
+        if (MAC_ADDR_EQUAL(s_signal_map_requests[i].addr, src.addr)) {
+            return;
+        }
+    }
+    if (s_signal_map_request_count < SIGNAL_MAP_REQUESTS) {
+        s_signal_map_requests[s_signal_map_request_count++] = src;
+    }
+}
+
+static void signal_table_received(const signal_report_t *report)
+{
+    if (!esp_mesh_is_root() || s_signal_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+    bool kept = signal_table_update(&s_signal_table, report->src, report->head, esp_timer_get_time());
+    signal_map_request(report);
+    xSemaphoreGive(s_signal_lock);
+    if (!kept) {
+        ESP_LOGW(MESH_TAG, "Signal table full, "MACSTR" left out", MAC2STR(report->src));
+    }
+}
+
+/* Node: heads from the root, numbered by its last map */
+static void signal_digest_received(const uint8_t *data, uint16_t len)
+{
+    if (esp_mesh_is_root() || s_signal_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+    int applied = signal_table_decode(&s_signal_table, mesh_netif_get_station_mac(), data, len,
+                                      esp_timer_get_time());
+    xSemaphoreGive(s_signal_lock);
+    if (applied < 0) {
+        // el mapa nuevo llega con el siguiente resumen o con el próximo informe propio
+        BLOGD(MESH_TAG, "Signal digest of another numbering, dropped");
+    }
+}
+
+static void signal_map_received(const uint8_t *data, uint16_t len)
+{
+    if (esp_mesh_is_root() || s_signal_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+    int applied = signal_table_map_decode(&s_signal_table, data, len, esp_timer_get_time());
+    xSemaphoreGive(s_signal_lock);
+    if (applied < 0) {
+        ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+    }
+}
+
+/* Root: one frame to the whole mesh, or to a single node */
+static void signal_send(const mesh_addr_t *to, mesh_data_t *data)
+{
+    esp_err_t err = to ? esp_mesh_send(to, data, MESH_DATA_P2P, NULL, 0) :
+                    esp_mesh_send(&MESH_GROUP_ID, data, MESH_DATA_GROUP, NULL, 0);
+    METRIC_INC(METRIC_MESH_TX);
+    if (err != ESP_OK) {
+        METRIC_INC(METRIC_MESH_TX_ERR);
+    }
+}
+
+/* Root: the numbering of every slot, in pages */
+static void signal_map_send(const mesh_addr_t *to)
+{
+    static uint8_t tx_buf[MESH_MPS];
+    mesh_data_t data = {
+        .data = tx_buf,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    uint16_t first = 0;
+
+    while (true) {
+        xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+        data.size = signal_table_map_encode(&s_signal_table, first, tx_buf, sizeof(tx_buf));
+        xSemaphoreGive(s_signal_lock);
+        if (data.size == 0) {
+            break;
+        }
+        signal_send(to, &data);
+        first += SIGNAL_MAP_PAGE;
+    }
+    BLOGI(MESH_TAG, "Signal map of %d slots sent to %s", first, to ? "one node" : "the mesh");
+}
+
+/* Root: the heads changed since the last round, or all of them, to every node */
+static void signal_digest_send(bool full)
+{
+    static uint8_t tx_buf[SIGNAL_DIGEST_SIZE(CONFIG_MESH_ROUTE_TABLE_SIZE)];
+    mesh_data_t data = {
+        .data = tx_buf,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+
+    xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+    data.size = signal_table_encode(&s_signal_table, full, esp_timer_get_time(), tx_buf, sizeof(tx_buf));
+    xSemaphoreGive(s_signal_lock);
+    if (data.size == 0) {
+        return;
+    }
+    signal_send(NULL, &data);
+    BLOGI(MESH_TAG, "Signal %s of %d bytes sent", full ? "digest" : "delta", data.size);
+}
+
+/* Root: a few telemetry pages of the heads from slot on, the rest in the next rounds.
+ * Returns the slot to go on from, -1 once every head is out. */
+static int signal_table_publish(int slot)
+{
+    char text[MQTT_PUB_TEXT_MAX];
+
+    for (int i = 0; i < SIGNAL_PUBLISH_PAGES && slot >= 0; ++i) {
+        uint16_t next = slot;
+        xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+        int len = signal_table_page(&s_signal_table, &next, esp_timer_get_time(), text, sizeof(text));
+        xSemaphoreGive(s_signal_lock);
+        if (len == 0) {
+            return -1;
+        }
+        if (!mqtt_pub_text(s_signal_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_SAMPLE, 0, text, len)) {
+            //Cola llena: la misma página en la siguiente ronda
+            break;
+        }
+        slot = next;
+    }
+    return slot;
+}
+
+/* Nodes report their head on a change and every digest period. The root
+ * spreads the changes every SIGNAL_DELTA_MS and all heads every digest period,
+ * after the numbering if it changed. */
+static void signal_table_gossip(void *args)
+{
+    signal_report_t report = { .cmd = CMD_SIGNAL_REPORT };
+    mesh_data_t data = {
+        .data = (uint8_t *) &report,
+        .size = sizeof(report),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    mesh_addr_t requests[SIGNAL_MAP_REQUESTS];
+    int64_t next_digest_us = 0;
+    int publish_slot = -1;
+    bool pending = true;
+
+    memcpy(report.src, mesh_netif_get_station_mac(), 6);
+    while (true) {
+        pending |= ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SIGNAL_DELTA_MS)) > 0;
+        int64_t now = esp_timer_get_time();
+        bool due = now >= next_digest_us;
+        bool root = esp_mesh_is_root();
+        int request_count = 0;
+        if (due) {
+            next_digest_us = now + SIGNAL_DIGEST_S * 1000000LL;
+            pending = true;
+        }
+        portENTER_CRITICAL(&s_signal_own_lock);
+        report.head = s_signal_own;
+        portEXIT_CRITICAL(&s_signal_own_lock);
+        xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+        if (root && !s_signal_table.numbering) {
+            //Root nuevo: numeración propia, distinta de la del root anterior
+            signal_table_renumber(&s_signal_table, esp_random());
+            s_signal_map_slots = 0;
+        }
+        signal_table_update(&s_signal_table, report.src, report.head, now);
+        if (due) {
+            signal_table_expire(&s_signal_table, now, (int64_t) SIGNAL_MISSED_DIGESTS * SIGNAL_DIGEST_S * 1000000);
+        }
+        report.gen = s_signal_table.gen;
+        report.mapped = signal_table_mapped(&s_signal_table);
+        if (root) {
+            request_count = s_signal_map_request_count;
+            memcpy(requests, s_signal_map_requests, request_count * sizeof(mesh_addr_t));
+            s_signal_map_request_count = 0;
+        }
+        xSemaphoreGive(s_signal_lock);
+
+        if (root) {
+            if (due && (report.gen != s_signal_map_gen || report.mapped != s_signal_map_slots)) {
+                signal_map_send(NULL);
+                xSemaphoreTake(s_signal_lock, portMAX_DELAY);
+                s_signal_map_gen = report.gen;
+                s_signal_map_slots = report.mapped;
+                xSemaphoreGive(s_signal_lock);
+            }
+            for (int i = 0; i < request_count; ++i) {
+                signal_map_send(&requests[i]);
+            }
+            signal_digest_send(due);
+            publish_slot = signal_table_publish(due ? 0 : publish_slot);
+            pending = false;
+        } else if (pending) {
+            // sin padre todavía: se reintenta en la siguiente ronda
+            esp_err_t err = esp_mesh_send(NULL, &data, MESH_DATA_P2P, NULL, 0);
+            METRIC_INC(METRIC_MESH_TX);
+            if (err != ESP_OK) {
+                METRIC_INC(METRIC_MESH_TX_ERR);
+            }
+            pending = err != ESP_OK;
+        }
+    }
+}
+#endif
+
 void static recv_cb(mesh_addr_t *from, mesh_data_t *data)
 {
 	switch(data->data[0]){
-		case CMD_ROUTE_TABLE:
-			int size =  data->size - 1;
-        	if (s_route_table_lock == NULL || size%6 != 0) {
+		case CMD_BUTTON_PRESSED:
+			if (data->size < 6+1+1) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			BLOGW(MESH_TAG, "Keypressed detected on node: "
+					MACSTR, MAC2STR(data->data + 1));
+			//Traza de latencia opcional tras la cabecera
+			if (data->size >= 6+1+1 + sizeof(latency_trace_hdr_t)) {
+				latency_trace_hdr_t hdr;
+				memcpy(&hdr, data->data + 6+1+1, sizeof(hdr));
+				latency_trace_remote(s_mesh_rx_pub, data->data + 1, &hdr);
+			}
+			break;
+#if CONFIG_APP_PREEMPT_ENABLE
+		case CMD_PREEMPT:
+			if (data->size < sizeof(preempt_msg_t)) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			preempt_msg_t msg;
+			memcpy(&msg, data->data, sizeof(msg));
+			//El root la recibe del detector por la capa fiable y la reenvía al grupo
+			bool fresh = preempt_received(&msg);
+			preempt_msg_t job = msg;
+			if (!esp_mesh_is_root()) {
+				//Los duplicados también, el ack anterior puede ser el perdido; sin hueco, lo pide el reenvío
+				job.cmd = CMD_PREEMPT_ACK;
+				xQueueSendToBack(s_preempt_tx_queue, &job, 0);
+			} else if (fresh && xQueueSendToBack(s_preempt_tx_queue, &job, 0) != pdTRUE) {
+				ESP_LOGE(MESH_TAG, "Preemption queue full");
+			}
+			if (fresh) {
+				BLOGW(MESH_TAG, "Preemption %d of group %d from node "
+						MACSTR, msg.active, msg.group, MAC2STR(msg.src));
+			}
+			break;
+		case CMD_PREEMPT_ACK:
+			if (data->size < sizeof(preempt_ack_t)) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			preempt_ack_t preempt_ack;
+			memcpy(&preempt_ack, data->data, sizeof(preempt_ack));
+			preempt_acked(from, &preempt_ack);
+			break;
+#endif
+		case CMD_TIMING_PLAN:
+			if (data->size < 1 + sizeof(timing_plan_t) || s_timing_plan_queue == NULL) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			//Se aplica en el siguiente fin de ciclo, gana el ultimo recibido
+			timing_plan_t plan;
+			memcpy(&plan, data->data + 1, sizeof(plan));
+			xQueueOverwrite(s_timing_plan_queue, &plan);
+			break;
+		case CMD_MOVEMENT_DETECTED:
+			if (data->size < sizeof(movement_msg_t)) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			movement_msg_t movement;
+			memcpy(&movement, data->data, sizeof(movement));
+			BLOGI(MESH_TAG, "Movement on node "MACSTR" for %" PRIu32 " ms",
+					MAC2STR(movement.src), movement.duration_ms);
+			break;
+		case CMD_RPC:
+		case CMD_RPC_RESULT:
+			if (data->size < sizeof(rpc_msg_t)) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			rpc_msg_t rpc;
+			memcpy(&rpc, data->data, sizeof(rpc));
+			if (rpc.cmd == CMD_RPC) {
+				rpc_deliver(&rpc);
+			} else {
+				rpc_reply(s_mesh_rx_pub, &rpc);
+			}
+			break;
+#if CONFIG_MESH_ROOT_HANDOVER
+		case CMD_ROOT_SCORE:
+			if (data->size < sizeof(root_score_msg_t)) {
             	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
             	return;
-        	}
-        	xSemaphoreTake(s_route_table_lock, portMAX_DELAY);
-        	s_route_table_size = size / 6;
-        	for (int i=0; i < s_route_table_size; ++i) {
-            	ESP_LOGI(MESH_TAG, "Received Routing table [%d] "
-                    	MACSTR, i, MAC2STR(data->data + 6*i + 1));
-        	}
-        	memcpy(&s_route_table, data->data + 1, size);
-        	xSemaphoreGive(s_route_table_lock);
+			}
+			root_score_msg_t score;
+			memcpy(&score, data->data, sizeof(score));
+			root_score_received(&score);
+			break;
+		case CMD_ROOT_YIELD:
+			root_take();
+			break;
+#endif
+#if CONFIG_MESH_TOPOLOGY_ENABLE
+		case CMD_TOPOLOGY:
+			if (data->size < sizeof(topology_report_t)) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			topology_report_t report;
+			memcpy(&report, data->data, sizeof(report));
+			topology_received(&report);
+			break;
+#endif
+#if CONFIG_MESH_SIGNAL_TABLE_ENABLE
+		case CMD_SIGNAL_REPORT:
+			if (data->size < sizeof(signal_report_t)) {
+            	ESP_LOGE(MESH_TAG, "Error in receiving raw mesh data: Unexpected size");
+            	return;
+			}
+			signal_report_t signal;
+			memcpy(&signal, data->data, sizeof(signal));
+			signal_table_received(&signal);
+			break;
+		case CMD_SIGNAL_DIGEST:
+			signal_digest_received(data->data, data->size);
+			break;
+		case CMD_SIGNAL_MAP:
+			signal_map_received(data->data, data->size);
+			break;
+#endif
+		case CMD_RELIABLE:
+		case CMD_RELIABLE_ACK:
+			mesh_reliable_received(from, data->data, data->size);
 			break;
 	}
 }
 
+/* Frames of the reliable layer, handled like bare ones */
+static void reliable_deliver(mesh_addr_t *from, uint8_t *data, uint16_t len)
+{
+    mesh_data_t inner = {
+        .data = data,
+        .size = len,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+
+    recv_cb(from, &inner);
+}
+
 static void check_button(void* args)
 {
     bool level_bt;
@@ -115,197 +1353,682 @@ static void check_button(void* args)
 			xSemaphoreTake(s_traffic_button_lock, portMAX_DELAY);
 			button_pressed = true;
 			xSemaphoreGive(s_traffic_button_lock);
-            if (s_route_table_size && !esp_mesh_is_root()) {
+			latency_trace_begin();
+            if (!esp_mesh_is_root()) {
                 ESP_LOGW(MESH_TAG, "Button pressed!");
-                mesh_data_t data;
                 uint8_t *my_mac = mesh_netif_get_station_mac();
-                uint8_t data_to_send[6+1+1] = { CMD_BUTTON_PRESSED, };
+                uint8_t data_to_send[6+1+1+sizeof(latency_trace_hdr_t)] = { CMD_BUTTON_PRESSED, };
+                latency_trace_hdr_t hdr;
                 esp_err_t err;
                 memcpy(data_to_send + 1, my_mac, 6);
                 data_to_send[7] = 1;
-                data.size = sizeof(data_to_send);
-                data.proto = MESH_PROTO_BIN;
-                data.tos = MESH_TOS_P2P;
-                data.data = data_to_send;
-                xSemaphoreTake(s_route_table_lock, portMAX_DELAY);
+                latency_trace_fill(&hdr);
+                memcpy(data_to_send + 6+1+1, &hdr, sizeof(hdr));
 				
 				//enviar mensaje al maestro
-                err = esp_mesh_send(&s_route_table[0], &data, MESH_DATA_P2P, NULL, 0);
-                ESP_LOGI(MESH_TAG, "Sending to [%d] "
-                        MACSTR ": sent with err code: %d", 0, MAC2STR(s_route_table[0].addr), err);
-
-                xSemaphoreGive(s_route_table_lock);
+                err = mesh_reliable_send(NULL, data_to_send, sizeof(data_to_send));
+                latency_trace_stamp(TRACE_STAGE_MESH_SEND);
+                BLOGI(MESH_TAG, "Sending to the root: sent with err code: %d", err);
                 
                 //Publicar en thingsboard
-                cJSON *root = cJSON_CreateObject();
-        		if (root == NULL) {
-            		ESP_LOGE(MESH_TAG, "Failed to create JSON object");
-            		vTaskDelay(1000 / portTICK_PERIOD_MS);
-            		continue;
+                mqtt_pub_record_t *rec = mqtt_pub_begin(s_button_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_EVENT);
+        		if (rec != NULL) {
+        			mqtt_pub_add(rec, "button", level_bt);
+        			mqtt_pub_add(rec, "infrared", level_inf);
+        			mqtt_pub_commit(s_button_pub);
         		}
-
-        		cJSON_AddNumberToObject(root, "button", level_bt);
-        		cJSON_AddNumberToObject(root, "infrared", level_inf);
-        		
-				mqtt_app_publish("v1/devices/me/telemetry", root);
-
-        		cJSON_Delete(root);
             }
         }
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        mesh_power_wait_event(100);
     }
     vTaskDelete(NULL);
 }
 
+static void IRAM_ATTR movement_isr(void *arg)
+{
+    movement_edge_t edge = {
+        .level = gpio_get_level(MOVEMENT_PIN),
+        .at_us = esp_timer_get_time(),
+    };
+    BaseType_t woken = pdFALSE;
+
+    xQueueSendFromISR(s_movement_queue, &edge, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+/* One record per occupancy interval to the root, instead of one per sample */
+static void movement_report(const occupancy_interval_t *interval, int64_t now_us)
+{
+    movement_msg_t msg = {
+        .cmd = CMD_MOVEMENT_DETECTED,
+        .duration_ms = (interval->end_us - interval->start_us) / 1000,
+        .age_ms = (now_us - interval->end_us) / 1000,
+    };
+
+    if (esp_mesh_is_root()) {
+        return;
+    }
+    memcpy(msg.src, mesh_netif_get_station_mac(), 6);
+    //enviar mensaje al maestro
+    esp_err_t err = mesh_reliable_send(NULL, (uint8_t *) &msg, sizeof(msg));
+    BLOGI(MESH_TAG, "Movement of %" PRIu32 " ms sent to the root: %d", msg.duration_ms, err);
+}
+
+/* Telemetry of one window, skipped while the crossing stays empty */
+static void movement_publish(const occupancy_window_t *window)
+{
+    static bool s_idle = true;
+    bool idle = window->count == 0 && window->occupied_us == 0;
+
+    if (idle && s_idle) {
+        return;
+    }
+    s_idle = idle;
+    mqtt_pub_record_t *rec = mqtt_pub_begin(s_movement_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_SAMPLE);
+    if (rec == NULL) {
+        return;
+    }
+    mqtt_pub_add(rec, "movement", window->count);
+    mqtt_pub_add(rec, "movement_occupancy", 100.0 * window->occupied_us / window->length_us);
+    mqtt_pub_add(rec, "movement_longest_ms", window->longest_us / 1000);
+    mqtt_pub_commit(s_movement_pub);
+}
+
 static void check_movement_sensor(void* args)
 {
-	bool level;
+    occupancy_t occ;
+    occupancy_interval_t interval;
+    occupancy_window_t window;
+    movement_edge_t edge;
+
     movement_sensor_init();
-    
+    s_movement_queue = xQueueCreate(MOVEMENT_QUEUE_LEN, sizeof(movement_edge_t));
+    occupancy_init(&occ, MOVEMENT_HOLD_OFF_MS, MOVEMENT_WINDOW_S, esp_timer_get_time());
+    gpio_set_intr_type(MOVEMENT_PIN, GPIO_INTR_ANYEDGE);
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) {
+        gpio_isr_handler_add(MOVEMENT_PIN, movement_isr, NULL);
+    } else {
+        ESP_LOGE(MESH_TAG, "gpio_install_isr_service failed: %s", esp_err_to_name(err));
+    }
+
     while (true) {
-        level = gpio_get_level(MOVEMENT_PIN);
-        //ESP_LOGI(MESH_TAG, "Movimiento: %i", level);
-        if (level) {
-            if (s_route_table_size && !esp_mesh_is_root()) {
-                ESP_LOGW(MESH_TAG, "Movement detected!");
-                mesh_data_t data;
-                uint8_t *my_mac = mesh_netif_get_station_mac();
-                uint8_t data_to_send[6+1+1] = { CMD_MOVEMENT_DETECTED, };
-                esp_err_t err;
-                //char print[6*3+1]; // MAC addr size + terminator
-                memcpy(data_to_send + 1, my_mac, 6);
-                data_to_send[7] = 1;
-                data.size = sizeof(data_to_send);
-                data.proto = MESH_PROTO_BIN;
-                data.tos = MESH_TOS_P2P;
-                data.data = data_to_send;
-                //snprintf(print, sizeof(print),MACSTR, MAC2STR(my_mac));
-                //mqtt_app_publish("/topic/ip_mesh/key_pressed", print);
-                xSemaphoreTake(s_route_table_lock, portMAX_DELAY);
-				
-				//enviar mensaje al maestro
-                err = esp_mesh_send(&s_route_table[0], &data, MESH_DATA_P2P, NULL, 0);
-                ESP_LOGI(MESH_TAG, "Sending to [%d] "
-                        MACSTR ": sent with err code: %d", 0, MAC2STR(s_route_table[0].addr), err);
+        int64_t now_us = esp_timer_get_time();
+        int64_t wait_us = occupancy_next_us(&occ) - now_us;
+        TickType_t ticks = wait_us > 0 ? wait_us / 1000 / portTICK_PERIOD_MS + 1 : 0;
+        if (xQueueReceive(s_movement_queue, &edge, ticks) == pdTRUE) {
+            occupancy_input(&occ, edge.level, edge.at_us);
+            while (xQueueReceive(s_movement_queue, &edge, 0) == pdTRUE) {
+                occupancy_input(&occ, edge.level, edge.at_us);
+            }
+        } else {
+            //Sin flancos: se relee el nivel por si se perdio alguno
+            occupancy_input(&occ, gpio_get_level(MOVEMENT_PIN), esp_timer_get_time());
+        }
+        now_us = esp_timer_get_time();
+        if (occupancy_interval(&occ, now_us, &interval)) {
+            ESP_LOGW(MESH_TAG, "Movement detected for %" PRId64 " ms!", (interval.end_us - interval.start_us) / 1000);
+            movement_report(&interval, now_us);
+        }
+        if (occupancy_window(&occ, now_us, &window)) {
+            movement_publish(&window);
+        }
+    }
+    vTaskDelete(NULL);
+}
 
-                xSemaphoreGive(s_route_table_lock);
-                
-                //Publicar en thingsboard
-                cJSON *root = cJSON_CreateObject();
-        		if (root == NULL) {
-            		ESP_LOGE(MESH_TAG, "Failed to create JSON object");
-            		vTaskDelay(1000 / portTICK_PERIOD_MS);
-            		continue;
-        		}
-        		
-        		cJSON_AddNumberToObject(root, "movement", level);
-		
-				mqtt_app_publish("v1/devices/me/telemetry", root);
+static void traffic_light_apply(const traffic_step_t *step)
+{
+    for (int g = 0; g < TRAFFIC_GROUP_MAX; ++g) {
+        if (step->lamp[g] != TRAFFIC_LAMP_KEEP) {
+            signal_group_set(g, step->lamp[g]);
+        }
+    }
+}
 
-        		cJSON_Delete(root);
+#if CONFIG_APP_PREEMPT_ENABLE
+#if CONFIG_APP_PREEMPT_GPIO >= 0
+static void IRAM_ATTR preempt_detector_isr(void *arg)
+{
+    // the edge time is converted to wall clock by the sending task
+    preempt_msg_t msg = {
+        .cmd = CMD_PREEMPT,
+        .active = gpio_get_level(CONFIG_APP_PREEMPT_GPIO),
+        .group = CONFIG_APP_PREEMPT_GROUP,
+        .trigger_us = esp_timer_get_time(),
+    };
+    BaseType_t woken = pdFALSE;
+
+    xQueueSendFromISR(s_preempt_tx_queue, &msg, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+#endif
+
+static void preempt_tx(void* args)
+{
+    static const uint8_t own[6] = { 0 };
+    preempt_msg_t msg;
+    uint8_t active = 0;
+    uint8_t seq = esp_random();
+    TickType_t wait = portMAX_DELAY;
+
+    while (true) {
+        if (xQueueReceive(s_preempt_tx_queue, &msg, wait) != pdTRUE) {
+            //Vence un reenvío o un ack
+        } else if (msg.cmd == CMD_PREEMPT_ACK) {
+            //Preferencia recibida de la malla, pendiente de ack
+            preempt_ack_schedule(&msg);
+        } else if (!MAC_ADDR_EQUAL(msg.src, own)) {
+            //Preferencia de otro nodo, recibida por el root
+            preempt_fanout_start(&msg);
+        } else if (msg.active != active) {
+            //Si no, rebote del detector
+            active = msg.active;
+            int64_t wall_us = preempt_wall_clock_us();
+            msg.trigger_us = wall_us ? wall_us - (esp_timer_get_time() - msg.trigger_us) : 0;
+            memcpy(msg.src, mesh_netif_get_station_mac(), 6);
+            msg.seq = ++seq;
+            ESP_LOGW(MESH_TAG, "Emergency vehicle %s", active ? "approaching" : "passed");
+
+            //Primero el controlador propio, luego el resto de la malla a través del root
+            preempt_received(&msg);
+            if (esp_mesh_is_root()) {
+                preempt_fanout_start(&msg);
+            } else {
+                esp_err_t err = mesh_reliable_send(NULL, (uint8_t *) &msg, sizeof(msg));
+                if (err != ESP_OK) {
+                    ESP_LOGW(MESH_TAG, "Preemption to the root failed: %s", esp_err_to_name(err));
+                }
             }
         }
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        int64_t next = preempt_fanout_retry();
+        int64_t ack_us = preempt_ack_flush();
+        next = !next || (ack_us && ack_us < next) ? ack_us : next;
+        int64_t left_us = next - esp_timer_get_time();
+        wait = !next ? portMAX_DELAY : left_us <= 0 ? 0 : pdMS_TO_TICKS((left_us + 999) / 1000);
     }
     vTaskDelete(NULL);
 }
 
+static void preempt_init(void)
+{
+    s_preempt_tx_queue = xQueueCreate(PREEMPT_QUEUE_LEN, sizeof(preempt_msg_t));
+    s_preempt_rx_queue = xQueueCreate(PREEMPT_QUEUE_LEN, sizeof(preempt_msg_t));
+    s_preempt_lock = xSemaphoreCreateMutex();
+    xTaskCreate(preempt_tx, "preempt tx", 3072, NULL, PREEMPT_TX_PRIORITY, NULL);
+#if CONFIG_APP_PREEMPT_GPIO >= 0
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_APP_PREEMPT_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(MESH_TAG, "gpio_install_isr_service failed: %s", esp_err_to_name(err));
+        return;
+    }
+    gpio_isr_handler_add(CONFIG_APP_PREEMPT_GPIO, preempt_detector_isr, NULL);
+#endif
+}
+
+static bool traffic_light_preempt(traffic_controller_t *ctl, const preempt_msg_t *msg)
+{
+    traffic_step_t step;
+
+    if (!traffic_controller_preempt(ctl, msg->group, msg->active, &step)) {
+        return false;
+    }
+    traffic_light_apply(&step);
+    int64_t wall_us = preempt_wall_clock_us();
+    signal_state_save(&ctl->st, false);
+#if CONFIG_MESH_SIGNAL_TABLE_ENABLE
+    signal_table_own(ctl);
+#endif
+
+    //Publicar en thingsboard el retardo entre el detector y las luces
+    mqtt_pub_record_t *rec = mqtt_pub_begin(s_control_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_CONTROL);
+    if (rec == NULL) {
+        return true;
+    }
+    mqtt_pub_add(rec, "preferencia", msg->active);
+    mqtt_pub_add(rec, "preferencia_grupo", msg->group);
+    if (msg->active && msg->trigger_us && wall_us) {
+        mqtt_pub_add(rec, "preferencia_ms", (wall_us - msg->trigger_us) / 1000.0);
+    }
+    mqtt_pub_commit(s_control_pub);
+    return true;
+}
+#endif
+
+/* Run an RPC command on this node and hand the result to its origin.
+ * Commands go through the controller like the button and the detector do,
+ * never to the lamps directly, so the clearance intervals still hold. */
+static bool rpc_execute(traffic_controller_t *ctl, rpc_job_t *job)
+{
+    rpc_msg_t *msg = &job->msg;
+    bool changed = false;
+
+    msg->status = RPC_STATUS_OK;
+    switch (msg->method) {
+    case RPC_METHOD_PEDESTRIAN_REQUEST:
+        //Igual que el pulsador: el paso de peatones llega con el ciclo
+        xSemaphoreTake(s_traffic_button_lock, portMAX_DELAY);
+        button_pressed = true;
+        xSemaphoreGive(s_traffic_button_lock);
+        break;
+    case RPC_METHOD_PREEMPT: {
+#if CONFIG_APP_PREEMPT_ENABLE
+        preempt_msg_t preempt = {
+            .cmd = CMD_PREEMPT,
+            .active = msg->active,
+            .group = msg->group,
+        };
+        memcpy(preempt.src, msg->origin, 6);
+        changed = traffic_light_preempt(ctl, &preempt);
+        if (!changed) {
+            msg->status = RPC_STATUS_REJECTED;
+        }
+#else
+        msg->status = RPC_STATUS_UNSUPPORTED;
+#endif
+        break;
+    }
+    default:
+        break;
+    }
+
+    memcpy(msg->target, mesh_netif_get_station_mac(), 6);
+    msg->phase = ctl->st.phase;
+    msg->vehicles = traffic_controller_group_color(ctl, TRAFFIC_GROUP_VEHICLE);
+    msg->pedestrians = ctl->st.ped_color_pos;
+    msg->preempt = ctl->preempt;
+    msg->actuation_us = esp_timer_get_time() - job->rx_us;
+
+    if (MAC_ADDR_EQUAL(msg->origin, msg->target)) {
+        rpc_reply(s_control_pub, msg);
+        return changed;
+    }
+    mesh_data_t data = {
+        .data = (uint8_t *) msg,
+        .size = sizeof(*msg),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    mesh_addr_t origin;
+    memcpy(origin.addr, msg->origin, 6);
+    msg->cmd = CMD_RPC_RESULT;
+    esp_err_t err = esp_mesh_send(&origin, &data, MESH_DATA_P2P, NULL, 0);
+    METRIC_INC(METRIC_MESH_TX);
+    if (err != ESP_OK) {
+        METRIC_INC(METRIC_MESH_TX_ERR);
+        ESP_LOGW(MESH_TAG, "RPC result to "MACSTR" failed: %s", MAC2STR(msg->origin), esp_err_to_name(err));
+    }
+    return changed;
+}
+
+/* Wait for the next controller step, serving preemptions and RPC commands as they arrive */
+static bool traffic_light_wait(traffic_controller_t *ctl, int64_t deadline_us)
+{
+    rpc_job_t job;
+    bool changed = false;
+    int64_t now_us;
+
+    while ((now_us = esp_timer_get_time()) < deadline_us) {
+        TickType_t ticks = (deadline_us - now_us) / 1000 / portTICK_PERIOD_MS;
+        ulTaskNotifyTake(pdTRUE, ticks ? ticks : 1);
+#if CONFIG_APP_PREEMPT_ENABLE
+        preempt_msg_t msg;
+        while (xQueueReceive(s_preempt_rx_queue, &msg, 0) == pdTRUE) {
+            changed |= traffic_light_preempt(ctl, &msg);
+        }
+#endif
+        while (xQueueReceive(s_rpc_queue, &job, 0) == pdTRUE) {
+            changed |= rpc_execute(ctl, &job);
+        }
+    }
+    return changed;
+}
+
+#if CONFIG_APP_LAMP_NIGHT_DIMMING
+static void lamp_night_dimming(void)
+{
+    static int s_night = -1;
+    time_t now;
+    struct tm timeinfo;
+
+    time(&now);
+    localtime_r(&now, &timeinfo);
+    if (timeinfo.tm_year < (2024 - 1900)) {
+        //Hora sin sincronizar
+        return;
+    }
+    int night = CONFIG_APP_LAMP_NIGHT_START_HOUR > CONFIG_APP_LAMP_NIGHT_END_HOUR ?
+                (timeinfo.tm_hour >= CONFIG_APP_LAMP_NIGHT_START_HOUR || timeinfo.tm_hour < CONFIG_APP_LAMP_NIGHT_END_HOUR) :
+                (timeinfo.tm_hour >= CONFIG_APP_LAMP_NIGHT_START_HOUR && timeinfo.tm_hour < CONFIG_APP_LAMP_NIGHT_END_HOUR);
+    if (night != s_night) {
+        s_night = night;
+        signal_heads_dim(night ? CONFIG_APP_LAMP_NIGHT_DUTY_PCT : 100);
+    }
+}
+#endif
+
 static void traffic_light_control (void* args)
 {
-    uint8_t color_pos = 0; //0 = verde, 1 = cambio, 2 = rojo
-    bool ped_color_pos = 1; //0 = verde, 1 = rojo
+    traffic_controller_t ctl;
+    traffic_timing_t timing = TRAFFIC_TIMING_DEFAULT();
+    signal_state_t *st = &ctl.st;
+    traffic_step_t step;
     bool can_send = true;
+    bool persist = false;
+    timing_plan_t timing_plan;
+    bool has_timing_plan = false;
+    bool retime = false;
     
-    uint8_t minimum_green_timer = 10;
-    uint8_t yellow_timer = 3;
-    uint8_t red_timer = 10;
-    uint8_t change_red_timer = 5;
-    uint8_t timer = 0;
+    const traffic_plan_t *plan = signal_layout()->plan;
     
+#ifdef CONFIG_APP_SIGNAL_ALL_RED_S
+    timing.all_red = CONFIG_APP_SIGNAL_ALL_RED_S;
+#endif
+#ifdef CONFIG_APP_PREEMPT_MAX_S
+    timing.preempt_max = MIN(CONFIG_APP_PREEMPT_MAX_S, UINT8_MAX);
+#endif
+    const traffic_timing_t base_timing = timing;
+    //Plan de tiempos recibido del servidor antes del reinicio
+    if (timing_plan_load(&timing_plan) == ESP_OK) {
+        has_timing_plan = true;
+        timing_plan_apply(&timing_plan, &timing);
+        ESP_LOGI(MESH_TAG, "Timing plan from NVS: green %d, yellow %d, red %d, change %d, all-red %d",
+                 timing.minimum_green, timing.yellow, timing.red, timing.change_red, timing.all_red);
+    }
+    traffic_controller_init(&ctl, &timing, plan);
     
-    //Inicializar el semaforo
-    traffic_light_set(TRAFFIC_LIGHT_RED);
-	pedestrian_traffic_light_set(TRAFFIC_LIGHT_RED);
+    //Recuperar el estado anterior al reinicio (RTC o NVS)
+    esp_err_t err = signal_state_restore(st);
+    if (err == ESP_OK && st->phase >= plan->n_phases) {
+        //Estado de otra disposicion de semaforos
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err == ESP_OK) {
+        button_pressed = st->button_pressed;
+        traffic_controller_lamps(&ctl, &step);
+        traffic_light_apply(&step);
+    } else if (err == ESP_ERR_INVALID_CRC) {
+        //Datos corruptos: todo en rojo durante el despeje antes de arrancar el ciclo
+        ESP_LOGW(MESH_TAG, "Stored signal state corrupt, holding all-red");
+        traffic_controller_safe_hold(&ctl);
+        signal_heads_set_all(TRAFFIC_LIGHT_RED);
+    } else {
+        //Inicializar el semaforo
+        signal_heads_set_all(TRAFFIC_LIGHT_RED);
+    }
+    signal_state_save(st, true);
+
     while (true) {
-		if(button_pressed){
-			switch(color_pos){
-				case 0: //En verde
-					if (timer <= 0){
-						color_pos = 1;
-						ped_color_pos = 1;
-						timer = yellow_timer;
-						traffic_light_set(TRAFFIC_LIGHT_YELLOW);
-						can_send = true;
-					} else {
-						timer--;
-					}
-					break;
-				case 1://En amarillo
-					if (timer <= 0){
-						color_pos = 2;
-						ped_color_pos = 0;
-						timer = red_timer + change_red_timer;
-						traffic_light_set(TRAFFIC_LIGHT_RED);
-						pedestrian_traffic_light_set(TRAFFIC_LIGHT_GREEN);
-						can_send = true;
-					} else {
-						timer--;
-					}
-					break;
-				case 2://En rojo
-					if (timer <= 0){
-						color_pos = 0;
-						ped_color_pos = 1;
-						timer = minimum_green_timer;
-						traffic_light_set(TRAFFIC_LIGHT_GREEN);
-						pedestrian_traffic_light_set(TRAFFIC_LIGHT_RED);
-						xSemaphoreTake(s_traffic_button_lock, portMAX_DELAY);
-						button_pressed = false;
-						xSemaphoreGive(s_traffic_button_lock);
-						can_send = true;
-					} else {
-						if (timer <= change_red_timer){
-							if(ped_color_pos){
-								pedestrian_traffic_light_set(0);
-							} else {
-								pedestrian_traffic_light_set(TRAFFIC_LIGHT_GREEN);
-							}
-							ped_color_pos = !ped_color_pos;
-						}
-						timer--;
-					}
-					break;
-				default:
-					break;
+		bool request = button_pressed;
+		if (request) {
+			latency_trace_stamp(TRACE_STAGE_CTRL);
+		}
+#if CONFIG_APP_LAMP_NIGHT_DIMMING
+		lamp_night_dimming();
+#endif
+		//Plan de tiempos nuevo: se guarda ya y se aplica al terminar el ciclo en curso
+		timing_plan_t received;
+		if (xQueueReceive(s_timing_plan_queue, &received, 0) == pdTRUE && timing_plan_is_valid(&received) &&
+		    (!has_timing_plan || memcmp(&received, &timing_plan, sizeof(received)) != 0)) {
+			timing_plan = received;
+			has_timing_plan = true;
+			timing = base_timing;
+			timing_plan_apply(&timing_plan, &timing);
+			err = timing_plan_save(&timing_plan);
+			if (err != ESP_OK) {
+				ESP_LOGE(MESH_TAG, "Failed to persist timing plan: %s", esp_err_to_name(err));
 			}
-			
-		} else {
-			traffic_light_set(TRAFFIC_LIGHT_GREEN);
-			pedestrian_traffic_light_set(TRAFFIC_LIGHT_RED);
-			if(timer > 0){
-				timer--;
+			retime = true;
+		}
+		if (retime && traffic_controller_retime(&ctl, &timing)) {
+			retime = false;
+			ESP_LOGW(MESH_TAG, "Timing plan applied: green %d, yellow %d, red %d, change %d, all-red %d",
+					 timing.minimum_green, timing.yellow, timing.red, timing.change_red, timing.all_red);
+			mqtt_pub_record_t *rec = mqtt_pub_begin(s_control_pub, MQTT_PUB_ATTRIBUTES, MQTT_PUB_CLASS_CONTROL);
+			if (rec != NULL) {
+				rec->object = "timing_plan_applied";
+				timing_plan_to_record(&timing, rec);
+				mqtt_pub_commit(s_control_pub);
 			}
 		}
+		bool resting = st->phase == 0 && st->color_pos == 0;
+		traffic_controller_step(&ctl, request, &step);
+		traffic_light_apply(&step);
+#if CONFIG_MESH_SIGNAL_TABLE_ENABLE
+		signal_table_own(&ctl);
+#endif
+		if (resting && request && step.phase_changed) {
+			//Primer cambio de luces tras la peticion
+			latency_trace_stamp(TRACE_STAGE_LAMP);
+			latency_trace_finish();
+		}
+		if (step.request_served) {
+			xSemaphoreTake(s_traffic_button_lock, portMAX_DELAY);
+			button_pressed = false;
+			xSemaphoreGive(s_traffic_button_lock);
+		}
+		can_send |= step.phase_changed;
+
+		//Guardar el estado: RTC en cada tick, NVS al cambiar la peticion y si no cada pocos minutos
+		if (st->button_pressed != button_pressed) {
+			st->button_pressed = button_pressed;
+			persist = true;
+		}
+		signal_state_save(st, persist);
+		persist = false;
 		
 		//Publicar en thingsboard
 		if (can_send){
-			cJSON *root = cJSON_CreateObject();
-			if (root == NULL) {
-    			ESP_LOGE(MESH_TAG, "Failed to create JSON object");
-    			vTaskDelay(1000 / portTICK_PERIOD_MS);
-    			continue;
+			//Cola llena: se reintenta en el siguiente paso
+			mqtt_pub_record_t *rec = mqtt_pub_begin(s_control_pub, MQTT_PUB_TELEMETRY, MQTT_PUB_CLASS_CONTROL);
+			if (rec != NULL) {
+				METRIC_INC(METRIC_PHASE_CHANGE);
+				mqtt_pub_add(rec, "semaforo_coches", traffic_controller_group_color(&ctl, TRAFFIC_GROUP_VEHICLE));
+				mqtt_pub_add(rec, "semaforo_peaton", st->ped_color_pos);
+				if (plan->vehicle_groups & (1U << TRAFFIC_GROUP_SIDE_STREET)) {
+					mqtt_pub_add(rec, "semaforo_lateral", traffic_controller_group_color(&ctl, TRAFFIC_GROUP_SIDE_STREET));
+					mqtt_pub_add(rec, "fase", st->phase);
+				}
+				mqtt_pub_commit(s_control_pub);
+				can_send = false;
 			}
+		}
 
-			cJSON_AddNumberToObject(root, "semaforo_coches", color_pos);
-			cJSON_AddNumberToObject(root, "semaforo_peaton", ped_color_pos);
-        		
-			mqtt_app_publish("v1/devices/me/telemetry", root);
+		can_send |= traffic_light_wait(&ctl, esp_timer_get_time() + TRAFFIC_CONTROLLER_STEP_MS * 1000LL);
+    }
+    vTaskDelete(NULL);
+}
 
-			cJSON_Delete(root);
-			can_send = false;
-		}
+static bool timing_plan_selects(const uint8_t *addr)
+{
+    if (s_timing_plan_node_count < 0) {
+        return true;
+    }
+    for (int i = 0; i < s_timing_plan_node_count; ++i) {
+        if (MAC_ADDR_EQUAL(s_timing_plan_nodes[i], addr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Root: send the last timing plan to the nodes it selects, nodes drop a plan they already run */
+static void timing_plan_push(void)
+{
+    static mesh_addr_t targets[CONFIG_MESH_ROUTE_TABLE_SIZE];
+    uint8_t tx_buf[1 + sizeof(timing_plan_t)] = { CMD_TIMING_PLAN, };
+    mesh_data_t data = {
+        .data = tx_buf,
+        .size = sizeof(tx_buf),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    int count = 0;
+    int size = 0;
+    int sent = 0;
+
+    if (!esp_mesh_is_root() || s_timing_plan_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_timing_plan_lock, portMAX_DELAY);
+    if (!s_timing_plan_known) {
+        xSemaphoreGive(s_timing_plan_lock);
+        return;
+    }
+    memcpy(tx_buf + 1, &s_timing_plan, sizeof(s_timing_plan));
+    esp_mesh_get_routing_table(targets, CONFIG_MESH_ROUTE_TABLE_SIZE * 6, &size);
+    for (int i = 0; i < size; ++i) {
+        if (timing_plan_selects(targets[i].addr)) {
+            targets[count++] = targets[i];
+        }
+    }
+    xSemaphoreGive(s_timing_plan_lock);
+
+    uint8_t *my_mac = mesh_netif_get_station_mac();
+    for (int i = 0; i < count; ++i) {
+        if (MAC_ADDR_EQUAL(targets[i].addr, my_mac)) {
+            xQueueOverwrite(s_timing_plan_queue, tx_buf + 1);
+            continue;
+        }
+        esp_err_t err = esp_mesh_send(&targets[i], &data, MESH_DATA_P2P, NULL, 0);
+        METRIC_INC(METRIC_MESH_TX);
+        if (err != ESP_OK) {
+            METRIC_INC(METRIC_MESH_TX_ERR);
+            ESP_LOGW(MESH_TAG, "Timing plan to "MACSTR" failed: %s", MAC2STR(targets[i].addr), esp_err_to_name(err));
+            continue;
+        }
+        sent++;
+    }
+    BLOGI(MESH_TAG, "Timing plan sent to %d nodes", sent);
+}
+
+/* MQTT task: shared attribute update, or the answer to the request made on connection.
+ *   {"timing_plan": {"minimum_green": 12, "yellow": 3, "red": 10, "change_red": 5,
+ *                    "all_red": 2, "nodes": ["24:0a:c4:00:00:02"]}}
+ * Without "nodes" the plan goes to every node. */
+static void timing_plan_attributes(const char *data, int len)
+{
+    timing_plan_t plan;
+
+    if (!esp_mesh_is_root()) {
+        //Los nodos reciben el plan por la malla
+        return;
+    }
+    cJSON *root = cJSON_ParseWithLength(data, len);
+    if (root == NULL) {
+        ESP_LOGE(MESH_TAG, "Attributes are not JSON");
+        return;
+    }
+    cJSON *shared = cJSON_GetObjectItem(root, "shared");
+    cJSON *item = cJSON_GetObjectItem(shared ? shared : root, "timing_plan");
+    if (item == NULL) {
+        cJSON_Delete(root);
+        return;
+    }
+    if (timing_plan_from_json(item, &plan) != ESP_OK) {
+        ESP_LOGE(MESH_TAG, "timing_plan rejected: missing field or out of range");
+        cJSON_Delete(root);
+        return;
+    }
+
+    xSemaphoreTake(s_timing_plan_lock, portMAX_DELAY);
+    s_timing_plan = plan;
+    s_timing_plan_known = true;
+    s_timing_plan_node_count = -1;
+    cJSON *nodes = cJSON_GetObjectItem(item, "nodes");
+    if (cJSON_IsArray(nodes)) {
+        cJSON *node;
+        s_timing_plan_node_count = 0;
+        cJSON_ArrayForEach(node, nodes) {
+            uint8_t *mac = s_timing_plan_nodes[s_timing_plan_node_count];
+            const char *str = cJSON_GetStringValue(node);
+            if (s_timing_plan_node_count < CONFIG_MESH_ROUTE_TABLE_SIZE && str &&
+                sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2],
+                       &mac[3], &mac[4], &mac[5]) == 6) {
+                s_timing_plan_node_count++;
+            }
+        }
+    }
+    xSemaphoreGive(s_timing_plan_lock);
+    cJSON_Delete(root);
+
+    ESP_LOGW(MESH_TAG, "New timing plan: green %d, yellow %d, red %d, change %d",
+             plan.minimum_green, plan.yellow, plan.red, plan.change_red);
+    timing_plan_push();
+}
+
+/* MQTT task: ThingsBoard RPC request, run here or on the node params.node names.
+ *   v1/devices/me/rpc/request/7  {"method": "pedestrianRequest", "params": {"node": "24:0a:c4:00:00:02"}}
+ * The reply goes out on v1/devices/me/rpc/response/7 once the target confirms. */
+static void rpc_request(const char *topic, int topic_len, const char *data, int len)
+{
+    int64_t rx_us = esp_timer_get_time();
+    char reply[RPC_REPLY_MAX];
+    rpc_msg_t msg;
+    mesh_addr_t node;
+    bool has_node;
+
+    if (!esp_mesh_is_root()) {
+        //Los nodos reciben los comandos por la malla
+        return;
+    }
+    esp_err_t err = rpc_parse(topic, topic_len, data, len, &msg, node.addr, &has_node);
+    if (err != ESP_OK) {
+        ESP_LOGE(MESH_TAG, "RPC request rejected: %s", esp_err_to_name(err));
+        if (err != ESP_ERR_NOT_FOUND) {
+            rpc_publish(s_mqtt_rx_pub, msg.id, reply, rpc_format_error(reply, sizeof(reply),
+                        err == ESP_ERR_NOT_SUPPORTED ? "unknown method" : "invalid params"));
+        }
+        return;
+    }
+    uint8_t *my_mac = mesh_netif_get_station_mac();
+    msg.cmd = CMD_RPC;
+    memcpy(msg.origin, my_mac, 6);
+    if (!rpc_pending_add(msg.id, rx_us)) {
+        rpc_publish(s_mqtt_rx_pub, msg.id, reply, rpc_format_error(reply, sizeof(reply), "busy"));
+        return;
+    }
+    if (!has_node || MAC_ADDR_EQUAL(node.addr, my_mac)) {
+        rpc_deliver(&msg);
+        return;
+    }
+
+    mesh_data_t tx = {
+        .data = (uint8_t *) &msg,
+        .size = sizeof(msg),
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    err = esp_mesh_send(&node, &tx, MESH_DATA_P2P, NULL, 0);
+    METRIC_INC(METRIC_MESH_TX);
+    if (err != ESP_OK) {
+        METRIC_INC(METRIC_MESH_TX_ERR);
+        ESP_LOGW(MESH_TAG, "RPC to "MACSTR" failed: %s", MAC2STR(node.addr), esp_err_to_name(err));
+        rpc_pending_take(msg.id);
+        rpc_publish(s_mqtt_rx_pub, msg.id, reply, rpc_format_error(reply, sizeof(reply), "node unreachable"));
+    }
+}
 
-		vTaskDelay(1 * 1000 / portTICK_PERIOD_MS);
+/* Root: nodes joining get the timing plan in force once the routing table settles */
+static void timing_plan_sync(void* args)
+{
+    while (true) {
+        // woken on routing table changes, coalesced so a joining subtree costs one round
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(TIMING_PLAN_SYNC_DELAY_MS / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, 0);
+        timing_plan_push();
     }
     vTaskDelete(NULL);
 }
@@ -333,23 +2056,91 @@ void ota_task(void *pvParameters){
 esp_err_t esp_mesh_comm_mqtt_task_start(void)
 {
     static bool is_comm_mqtt_task_started = false;
-	
-    s_route_table_lock = xSemaphoreCreateMutex();
-    s_traffic_button_lock = xSemaphoreCreateMutex();
+
+    // Cada IP_EVENT_STA_GOT_IP pasa por aquí: tras un cambio de padre solo hay que reconectar MQTT
+    if (is_comm_mqtt_task_started) {
+        mqtt_app_start();
+        return ESP_OK;
+    }
+
+    if (s_timing_plan_lock == NULL) {
+        s_timing_plan_lock = xSemaphoreCreateMutex();
+    }
     
     obtain_time();
+    mqtt_app_on_attributes(timing_plan_attributes);
+    mqtt_app_on_rpc(rpc_request);
     mqtt_app_start();
 
-    if (!is_comm_mqtt_task_started) {
-		xTaskCreate(traffic_light_control, "traffic light control", 4096, NULL, 8, NULL);
-        xTaskCreate(check_button, "check button task", 3072, NULL, 20, NULL);
-        xTaskCreate(check_movement_sensor, "check movement task", 3072, NULL, 19, NULL);
-        xTaskCreate(ota_task, "ota update", 3072, NULL, 1, NULL);
-        is_comm_mqtt_task_started = true;
-    }
+    xTaskCreate(check_button, "check button task", 3072, NULL, 20, NULL);
+    xTaskCreate(check_movement_sensor, "check movement task", 3072, NULL, 19, NULL);
+    xTaskCreate(ota_task, "ota update", 3072, NULL, 1, NULL);
+    xTaskCreate(timing_plan_sync, "timing plan sync", 3072, NULL, 5, &s_timing_plan_sync_task);
+#if CONFIG_MESH_ROOT_HANDOVER
+    xTaskCreate(root_score_report, "root score", 2560, NULL, 2, &s_root_score_task);
+#endif
+#if CONFIG_MESH_TOPOLOGY_ENABLE
+    topology_init(&s_topology, s_topology_nodes, CONFIG_MESH_ROUTE_TABLE_SIZE);
+    s_topology_lock = xSemaphoreCreateMutex();
+    xTaskCreate(topology_report, "topology", 3072, NULL, 2, NULL);
+#endif
+#if CONFIG_MESH_SIGNAL_TABLE_ENABLE
+    signal_table_init(&s_signal_table, s_signal_entries, CONFIG_MESH_ROUTE_TABLE_SIZE);
+    s_signal_lock = xSemaphoreCreateMutex();
+    xTaskCreate(signal_table_gossip, "signal table", 3072, NULL, 6, &s_signal_task);
+#endif
+    mesh_power_report_start();
+    metrics_start();
+    task_stats_start();
+    is_comm_mqtt_task_started = true;
     return ESP_OK;
 }
 
+static void mesh_router_config(mesh_router_t *router)
+{
+    memset(router, 0, sizeof(*router));
+    router->ssid_len = strlen(CONFIG_MESH_ROUTER_SSID);
+    memcpy((uint8_t *) &router->ssid, CONFIG_MESH_ROUTER_SSID, router->ssid_len);
+    memcpy((uint8_t *) &router->password, CONFIG_MESH_ROUTER_PASSWD,
+           strlen(CONFIG_MESH_ROUTER_PASSWD));
+}
+
+#if CONFIG_MESH_FAST_REJOIN
+/* Guarda dónde se ha unido el nodo, para probarlo primero en el siguiente arranque */
+static void mesh_cache_joined(const mesh_event_connected_t *connected)
+{
+    mesh_cache_t cache = {
+        .channel = connected->connected.channel,
+        .layer = connected->self_layer,
+        .root = esp_mesh_is_root(),
+    };
+
+    memcpy(cache.parent_bssid, connected->connected.bssid, 6);
+    if (cache.root) {
+        memcpy(cache.router_bssid, connected->connected.bssid, 6);
+    } else if (esp_mesh_get_router_bssid(cache.router_bssid) != ESP_OK) {
+        memset(cache.router_bssid, 0, 6);
+    }
+    s_mesh_cache = cache;
+    esp_err_t err = mesh_cache_save(&cache);
+    if (err != ESP_OK) {
+        ESP_LOGW(MESH_TAG, "Failed to cache the network: %s", esp_err_to_name(err));
+    }
+}
+
+/* La red cacheada no aparece: se olvida y se busca el router por SSID en todos los canales */
+static void mesh_cache_forget(void)
+{
+    mesh_router_t router;
+
+    ESP_LOGW(MESH_TAG, "Cached network not found on channel %d, scanning every channel", s_mesh_cache.channel);
+    s_mesh_cached = false;
+    mesh_cache_erase();
+    mesh_router_config(&router);
+    esp_mesh_set_router(&router);
+}
+#endif
+
 void mesh_event_handler(void *arg, esp_event_base_t event_base,
                         int32_t event_id, void *event_data)
 {
@@ -373,6 +2164,9 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHILD_CONNECTED>aid:%d, "MACSTR"",
                  child_connected->aid,
                  MAC2STR(child_connected->mac));
+#if CONFIG_MESH_TOPOLOGY_ENABLE
+        s_children++;
+#endif
     }
     break;
     case MESH_EVENT_CHILD_DISCONNECTED: {
@@ -380,6 +2174,11 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHILD_DISCONNECTED>aid:%d, "MACSTR"",
                  child_disconnected->aid,
                  MAC2STR(child_disconnected->mac));
+#if CONFIG_MESH_TOPOLOGY_ENABLE
+        if (s_children) {
+            s_children--;
+        }
+#endif
     }
     break;
     case MESH_EVENT_ROUTING_TABLE_ADD: {
@@ -387,6 +2186,9 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGW(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_ADD>add %d, new:%d",
                  routing_table->rt_size_change,
                  routing_table->rt_size_new);
+        if (s_timing_plan_sync_task) {
+            xTaskNotifyGive(s_timing_plan_sync_task);
+        }
     }
     break;
     case MESH_EVENT_ROUTING_TABLE_REMOVE: {
@@ -400,6 +2202,12 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         mesh_event_no_parent_found_t *no_parent = (mesh_event_no_parent_found_t *)event_data;
         ESP_LOGI(MESH_TAG, "<MESH_EVENT_NO_PARENT_FOUND>scan times:%d",
                  no_parent->scan_times);
+#if CONFIG_MESH_FAST_REJOIN
+        // allow_channel_switch ya pasa al escaneo completo, falta quitar el BSSID del router
+        if (s_mesh_cached) {
+            mesh_cache_forget();
+        }
+#endif
     }
     /* TODO handler for the failure */
     break;
@@ -414,6 +2222,28 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  esp_mesh_is_root() ? "<ROOT>" :
                  (mesh_layer == 2) ? "<layer2>" : "", MAC2STR(id.addr));
         last_layer = mesh_layer;
+        if (s_mesh_start_us) {
+            uint32_t join_ms = (esp_timer_get_time() - s_mesh_start_us) / 1000;
+            s_mesh_start_us = 0;
+            METRIC_HIST(METRIC_MESH_JOIN_MS, join_ms);
+#if CONFIG_MESH_FAST_REJOIN
+            ESP_LOGW(MESH_TAG, "Joined in %" PRIu32 " ms, %s, layer %d%s", join_ms,
+                     s_mesh_cached ? "cached channel" : "full scan", mesh_layer,
+                     s_mesh_cached && memcmp(s_mesh_cache.parent_bssid, mesh_parent_addr.addr, 6) == 0 ?
+                     ", same parent" : "");
+#else
+            ESP_LOGW(MESH_TAG, "Joined in %" PRIu32 " ms, layer %d", join_ms, mesh_layer);
+#endif
+        }
+#if CONFIG_MESH_FAST_REJOIN
+        mesh_cache_joined(connected);
+#endif
+#if CONFIG_MESH_ROOT_HANDOVER
+        if (esp_mesh_is_root()) {
+            root_taken(true);
+            root_election_start();
+        }
+#endif
         mesh_netifs_start(esp_mesh_is_root());
         //ESP_ERROR_CHECK(esp_mesh_set_self_organized(true, false));
         //esp_mesh_fix_root(true);
@@ -425,6 +2255,8 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  "<MESH_EVENT_PARENT_DISCONNECTED>reason:%d",
                  disconnected->reason);
         mesh_layer = esp_mesh_get_layer();
+        // Dejar de publicar ya, sin esperar al keepalive; se reconecta con IP_EVENT_STA_GOT_IP
+        mqtt_app_suspend();
         mesh_netifs_stop();
     }
     break;
@@ -490,11 +2322,23 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  MAC2STR(root_conflict->addr),
                  root_conflict->rssi,
                  root_conflict->capacity);
+#if CONFIG_MESH_ROOT_HANDOVER
+        // ESP-MESH cede ante el otro root; si este nodo era claramente mejor, sus informes lo
+        // devolverán al nuevo root cuando acabe la espera, sin relevos de ida y vuelta
+        ESP_LOGW(MESH_TAG, "Yielding the root with score %d, router rssi %d against %d",
+                 s_root_score, s_router_rssi, root_conflict->rssi);
+#endif
     }
     break;
     case MESH_EVENT_CHANNEL_SWITCH: {
         mesh_event_channel_switch_t *channel_switch = (mesh_event_channel_switch_t *)event_data;
         ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHANNEL_SWITCH>new channel:%d", channel_switch->channel);
+#if CONFIG_MESH_FAST_REJOIN
+        if (s_mesh_cache.channel && s_mesh_cache.channel != channel_switch->channel) {
+            s_mesh_cache.channel = channel_switch->channel;
+            mesh_cache_save(&s_mesh_cache);
+        }
+#endif
     }
     break;
     case MESH_EVENT_SCAN_DONE: {
@@ -519,10 +2363,28 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  find_network->channel, MAC2STR(find_network->router_bssid));
     }
     break;
+    case MESH_EVENT_PS_PARENT_DUTY: {
+        mesh_event_ps_duty_changed_t *ps_duty = (mesh_event_ps_duty_changed_t *)event_data;
+        ESP_LOGI(MESH_TAG, "<MESH_EVENT_PS_PARENT_DUTY>duty:%d", ps_duty->duty);
+    }
+    break;
+    case MESH_EVENT_PS_CHILD_DUTY: {
+        mesh_event_ps_duty_changed_t *ps_duty = (mesh_event_ps_duty_changed_t *)event_data;
+        ESP_LOGI(MESH_TAG, "<MESH_EVENT_PS_CHILD_DUTY>cidx:%d, "MACSTR", duty:%d", ps_duty->child_connected.aid-1,
+                 MAC2STR(ps_duty->child_connected.mac), ps_duty->duty);
+    }
+    break;
     case MESH_EVENT_ROUTER_SWITCH: {
         mesh_event_router_switch_t *router_switch = (mesh_event_router_switch_t *)event_data;
         ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROUTER_SWITCH>new router:%s, channel:%d, "MACSTR"",
                  router_switch->ssid, router_switch->channel, MAC2STR(router_switch->bssid));
+#if CONFIG_MESH_FAST_REJOIN
+        if (s_mesh_cache.channel) {
+            s_mesh_cache.channel = router_switch->channel;
+            memcpy(s_mesh_cache.router_bssid, router_switch->bssid, 6);
+            mesh_cache_save(&s_mesh_cache);
+        }
+#endif
     }
     break;
     default:
@@ -549,21 +2411,46 @@ void ip_event_handler(void *arg, esp_event_base_t event_base,
 
 void app_main(void)
 {
+	binlog_start();
 	ESP_ERROR_CHECK(traffic_light_init());
+    latency_trace_init();
     ESP_ERROR_CHECK(nvs_flash_init());
+    /*  resume the signal cycle right away, without waiting for the network */
+    s_traffic_button_lock = xSemaphoreCreateMutex();
+    s_timing_plan_queue = xQueueCreate(1, sizeof(timing_plan_t));
+    s_rpc_queue = xQueueCreate(RPC_QUEUE_LEN, sizeof(rpc_job_t));
+    s_control_pub = mqtt_pub_queue_create("control", 8);
+    s_button_pub = mqtt_pub_queue_create("button", 4);
+    s_movement_pub = mqtt_pub_queue_create("movement", 4);
+    // RPC replies and the latency traces of button frames
+    s_mesh_rx_pub = mqtt_pub_queue_create("mesh rx", 8);
+    s_mqtt_rx_pub = mqtt_pub_queue_create("mqtt rx", 4);
+#if CONFIG_MESH_SIGNAL_TABLE_ENABLE
+    s_signal_pub = mqtt_pub_queue_create("signals", SIGNAL_PUBLISH_PAGES);
+#endif
+#if CONFIG_MESH_TOPOLOGY_ENABLE
+    s_topology_pub = mqtt_pub_queue_create("topology", 2);
+#endif
+#if CONFIG_APP_PREEMPT_ENABLE
+    preempt_init();
+#endif
+    xTaskCreate(traffic_light_control, "traffic light control", 4096, NULL, 8, &s_traffic_control_task);
     /*  tcpip initialization */
     ESP_ERROR_CHECK(esp_netif_init());
     /*  event initialization */
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     /*  crete network interfaces for mesh (only station instance saved for further manipulation, soft AP instance ignored */
     ESP_ERROR_CHECK(mesh_netifs_init(recv_cb));
+    ESP_ERROR_CHECK(mesh_reliable_init(reliable_deliver));
 
     /*  wifi initialization */
     wifi_init_config_t config = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&config));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &ip_event_handler, NULL));
     ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_FLASH));
+#if !CONFIG_MESH_ENABLE_PS
     ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+#endif
     ESP_ERROR_CHECK(esp_wifi_start());
     /*  mesh initialization */
     ESP_ERROR_CHECK(esp_mesh_init());
@@ -571,15 +2458,35 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_mesh_set_max_layer(CONFIG_MESH_MAX_LAYER));
     ESP_ERROR_CHECK(esp_mesh_set_vote_percentage(1));
     ESP_ERROR_CHECK(esp_mesh_set_ap_assoc_expire(10));
+    ESP_ERROR_CHECK(mesh_power_init());
     mesh_cfg_t cfg = MESH_INIT_CONFIG_DEFAULT();
     /* mesh ID */
     memcpy((uint8_t *) &cfg.mesh_id, MESH_ID, 6);
     /* router */
     cfg.channel = CONFIG_MESH_CHANNEL;
-    cfg.router.ssid_len = strlen(CONFIG_MESH_ROUTER_SSID);
-    memcpy((uint8_t *) &cfg.router.ssid, CONFIG_MESH_ROUTER_SSID, cfg.router.ssid_len);
-    memcpy((uint8_t *) &cfg.router.password, CONFIG_MESH_ROUTER_PASSWD,
-           strlen(CONFIG_MESH_ROUTER_PASSWD));
+    mesh_router_config(&cfg.router);
+#if CONFIG_MESH_FAST_REJOIN
+    /* the channel and router of the last join first, all channels if the network is not there */
+    if (mesh_cache_load(&s_mesh_cache) == ESP_OK) {
+        static const uint8_t zero[6] = { 0 };
+        cfg.channel = s_mesh_cache.channel;
+        cfg.allow_channel_switch = true;
+        if (memcmp(s_mesh_cache.router_bssid, zero, 6) != 0) {
+            memcpy(cfg.router.bssid, s_mesh_cache.router_bssid, 6);
+        }
+        s_mesh_cached = true;
+        ESP_LOGI(MESH_TAG, "Cached network: channel %d, router "MACSTR", layer %d%s",
+                 s_mesh_cache.channel, MAC2STR(s_mesh_cache.router_bssid), s_mesh_cache.layer,
+                 s_mesh_cache.root ? " <ROOT>" : "");
+    }
+#endif
+#if CONFIG_MESH_ROOT_HANDOVER
+    /* router RSSI for the root score, on a known channel only: all channels would hold the boot for seconds */
+    if (cfg.channel) {
+        s_router_rssi = router_rssi_scan(cfg.channel, cfg.router.bssid);
+    }
+    ESP_LOGI(MESH_TAG, "Router rssi %d, root score %d", s_router_rssi, root_score_own());
+#endif
     /* mesh softAP */
     ESP_ERROR_CHECK(esp_mesh_set_ap_authmode(CONFIG_MESH_AP_AUTHMODE));
     cfg.mesh_ap.max_connection = CONFIG_MESH_AP_CONNECTIONS;
@@ -588,8 +2495,10 @@ void app_main(void)
            strlen(CONFIG_MESH_AP_PASSWD));
       
     ESP_ERROR_CHECK(esp_mesh_set_config(&cfg));
+    ESP_ERROR_CHECK(esp_mesh_set_group_id(&MESH_GROUP_ID, 1));
     
     /* mesh start */
+    s_mesh_start_us = esp_timer_get_time();
     ESP_ERROR_CHECK(esp_mesh_start());
     
     ESP_LOGI(MESH_TAG, "mesh starts successfully, heap:%" PRId32 ", %s",  esp_get_free_heap_size(),
@@ -9,6 +9,7 @@
 #include "esp_wifi.h"
 #include "esp_netif.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <string.h>
 #include "esp_mesh.h"
 #include "esp_mac.h"
@@ -16,6 +17,8 @@
 #include "dhcpserver/dhcpserver.h"
 #include "esp_wifi_netif.h"
 #include "mesh_netif.h"
+#include "metrics.h"
+#include "binlog.h"
 
 /*******************************************************
  *                Macros
@@ -36,9 +39,17 @@ typedef struct mesh_netif_driver {
     uint8_t sta_mac_addr[MAC_ADDR_LEN];
 }* mesh_netif_driver_t;
 
+/* What netif_sta is bound to */
+typedef enum {
+    MESH_NETIF_STANDBY,     // wifi driver, waiting to become root or node
+    MESH_NETIF_ROOT,        // wifi driver to the router, mesh link AP for the nodes
+    MESH_NETIF_NODE,        // mesh link driver to the root
+} mesh_netif_role_t;
+
 /*******************************************************
  *                Constants
  *******************************************************/
+static const char *const s_role_names[] = { "standby", "root", "node" };
 static const char* TAG = "mesh_netif";
 const esp_netif_ip_info_t g_mesh_netif_subnet_ip = {        // mesh subnet IP info
         .ip = { .addr = ESP_IP4TOADDR( 10, 0, 0, 1) },
@@ -51,6 +62,11 @@ const esp_netif_ip_info_t g_mesh_netif_subnet_ip = {        // mesh subnet IP in
  *******************************************************/
 static esp_netif_t *netif_sta = NULL;
 static esp_netif_t *netif_ap = NULL;
+// created once, a role change only swaps the driver bound to the netif
+static mesh_netif_driver_t s_mesh_sta_driver = NULL;
+static mesh_netif_role_t s_role = MESH_NETIF_STANDBY;
+static bool s_ap_running = false;
+static uint32_t s_ap_dns = 0;
 static bool receive_task_is_running = false;
 static mesh_addr_t s_route_table[CONFIG_MESH_ROUTE_TABLE_SIZE] = { 0 };
 static mesh_raw_recv_cb_t *s_mesh_raw_recv_cb = NULL;
@@ -83,34 +99,36 @@ static void receive_task(void *arg)
     mesh_data_t data;
     static uint8_t rx_buf[RX_SIZE] = { 0, };
 
-    ESP_LOGD(TAG, "Receiving task started");
+    BLOGD(TAG, "Receiving task started");
     while (receive_task_is_running) {
         data.data = rx_buf;
         data.size = RX_SIZE;
         err = esp_mesh_recv(&from, &data, portMAX_DELAY, &flag, NULL, 0);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Received with err code %d %s", err, esp_err_to_name(err));
+            METRIC_INC(METRIC_MESH_RX_ERR);
+            BLOGE(TAG, "Received with err code %d %s", err, esp_err_to_name(err));
             continue;
         }
+        METRIC_INC(METRIC_MESH_RX);
         if (data.proto == MESH_PROTO_BIN && s_mesh_raw_recv_cb) {
             s_mesh_raw_recv_cb(&from, &data);
         }
         if (esp_mesh_is_root()) {
             if (data.proto == MESH_PROTO_AP) {
-                ESP_LOGD(TAG, "Root received: from: " MACSTR " to " MACSTR " size: %d",
+                BLOGD(TAG, "Root received: from: " MACSTR " to " MACSTR " size: %d",
                          MAC2STR((uint8_t*)data.data) ,MAC2STR((uint8_t*)(data.data+6)), data.size);
                 if (netif_ap) {
                     // actual receive to TCP/IP stack
                     esp_netif_receive(netif_ap, data.data, data.size, NULL);
                 }
             } else if (data.proto == MESH_PROTO_STA) {
-                ESP_LOGE(TAG, "Root station Should never receive data from mesh!");
+                BLOGE(TAG, "Root station Should never receive data from mesh!");
             }
         } else {
             if (data.proto == MESH_PROTO_AP) {
-                ESP_LOGD(TAG, "Node AP should never receive data from mesh");
+                BLOGD(TAG, "Node AP should never receive data from mesh");
             } else if (data.proto == MESH_PROTO_STA) {
-                ESP_LOGD(TAG, "Node received: from: " MACSTR " to " MACSTR " size: %d",
+                BLOGD(TAG, "Node received: from: " MACSTR " to " MACSTR " size: %d",
                          MAC2STR((uint8_t*)data.data) ,MAC2STR((uint8_t*)(data.data+6)), data.size);
                 if (netif_sta) {
                     // actual receive to TCP/IP stack
@@ -140,32 +158,36 @@ static esp_err_t mesh_netif_transmit_from_root_ap(void *h, void *buffer, size_t
     mesh_netif_driver_t mesh_driver = h;
     mesh_addr_t dest_addr;
     mesh_data_t data;
-    ESP_LOGD(TAG, "Sending to node: " MACSTR ", size: %d" ,MAC2STR((uint8_t*)buffer), len);
+    BLOGD(TAG, "Sending to node: " MACSTR ", size: %d" ,MAC2STR((uint8_t*)buffer), (int) len);
     memcpy(dest_addr.addr, buffer, MAC_ADDR_LEN);
     data.data = buffer;
     data.size = len;
     data.proto = MESH_PROTO_STA; // sending from root AP -> Node's STA
     data.tos = MESH_TOS_P2P;
     if (MAC_ADDR_EQUAL(dest_addr.addr, eth_broadcast)) {
-        ESP_LOGD(TAG, "Broadcasting!");
+        BLOGD(TAG, "Broadcasting!");
         esp_mesh_get_routing_table((mesh_addr_t *) &s_route_table,
                                    CONFIG_MESH_ROUTE_TABLE_SIZE * 6, &route_table_size);
         for (int i = 0; i < route_table_size; i++) {
             if (MAC_ADDR_EQUAL(s_route_table[i].addr, mesh_driver->sta_mac_addr)) {
-                ESP_LOGD(TAG, "That was me, skipping!");
+                BLOGD(TAG, "That was me, skipping!");
                 continue;
             }
-            ESP_LOGD(TAG, "Broadcast: Sending to [%d] " MACSTR, i, MAC2STR(s_route_table[i].addr));
+            BLOGD(TAG, "Broadcast: Sending to [%d] " MACSTR, i, MAC2STR(s_route_table[i].addr));
             esp_err_t err = esp_mesh_send(&s_route_table[i], &data, MESH_DATA_P2P, NULL, 0);
+            METRIC_INC(METRIC_MESH_TX);
             if (ESP_OK != err) {
-                ESP_LOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
+                METRIC_INC(METRIC_MESH_TX_ERR);
+                BLOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
             }
         }
     } else {
         // Standard P2P
         esp_err_t err = esp_mesh_send(&dest_addr, &data, MESH_DATA_P2P, NULL, 0);
+        METRIC_INC(METRIC_MESH_TX);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
+            METRIC_INC(METRIC_MESH_TX_ERR);
+            BLOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
             return err;
         }
     }
@@ -179,14 +201,16 @@ static esp_err_t mesh_netif_transmit_from_root_ap_wrap(void *h, void *buffer, si
 static esp_err_t mesh_netif_transmit_from_node_sta(void *h, void *buffer, size_t len)
 {
     mesh_data_t data;
-    ESP_LOGD(TAG, "Sending to root, dest addr: " MACSTR ", size: %d" ,MAC2STR((uint8_t*)buffer), len);
+    BLOGD(TAG, "Sending to root, dest addr: " MACSTR ", size: %d" ,MAC2STR((uint8_t*)buffer), (int) len);
     data.data = buffer;
     data.size = len;
     data.proto = MESH_PROTO_AP; // Node's station transmits data to root's AP
     data.tos = MESH_TOS_P2P;
     esp_err_t err = esp_mesh_send(NULL, &data, MESH_DATA_TODS, NULL, 0);
+    METRIC_INC(METRIC_MESH_TX);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
+        METRIC_INC(METRIC_MESH_TX_ERR);
+        BLOGE(TAG, "Send with err code %d %s", err, esp_err_to_name(err));
     }
     return err;
 }
@@ -351,37 +375,76 @@ static esp_netif_t* create_mesh_link_ap(void)
 }
 
 /**
- * @brief Creates esp-netif for station interface over mesh
- *
- * @note Interface needs to be started (later) using the above APIs
- * based on the actual configuration root/node,
- * since root connects normally over wifi
+ * @brief Takes the mesh link AP down, the netif and its driver are kept for the next root role
+ */
+static void stop_mesh_link_ap(void)
+{
+    if (!s_ap_running) {
+        return;
+    }
+    ip_napt_enable(g_mesh_netif_subnet_ip.ip.addr, 0);
+    esp_netif_action_disconnected(netif_ap, NULL, 0, NULL);
+    esp_netif_action_stop(netif_ap, NULL, 0, NULL);
+    s_ap_running = false;
+}
+
+/**
+ * @brief Binds netif_sta to the wifi driver (root and standby) or the mesh link one (node)
  *
- * @return Pointer to esp-netif instance
+ * The netif, its DHCP client and the mesh link driver are kept; only the wifi driver and
+ * its default handlers come and go, so that they do not act on a node's mesh link.
  */
-static esp_netif_t* create_mesh_link_sta(void)
+static esp_err_t bind_station(bool mesh_link)
 {
-    esp_netif_inherent_config_t base_cfg = ESP_NETIF_INHERENT_DEFAULT_WIFI_STA();
-    base_cfg.if_desc = "mesh_link_sta";
+    esp_err_t err;
 
-    esp_netif_config_t cfg = {
-        .base = &base_cfg,
-        .driver = NULL,
-        .stack = ESP_NETIF_NETSTACK_DEFAULT_WIFI_STA };
-    esp_netif_t * netif = esp_netif_new(&cfg);
-    assert(netif);
-    return netif;
+    if (mesh_link && s_mesh_sta_driver == NULL) {
+        s_mesh_sta_driver = mesh_create_if_driver(false, false);
+        if (s_mesh_sta_driver == NULL) {
+            ESP_LOGE(TAG, "Failed to create wifi interface handle");
+            return ESP_FAIL;
+        }
+    }
+    esp_netif_action_disconnected(netif_sta, NULL, 0, NULL);
+    esp_netif_action_stop(netif_sta, NULL, 0, NULL);
+    if (mesh_link == (s_role == MESH_NETIF_NODE)) {
+        // same driver, a restart is enough
+        err = ESP_OK;
+    } else if (mesh_link) {
+        esp_wifi_clear_default_wifi_driver_and_handlers(netif_sta);
+        err = esp_netif_attach(netif_sta, s_mesh_sta_driver);
+    } else {
+        err = esp_netif_attach_wifi_station(netif_sta);
+        if (err == ESP_OK) {
+            err = esp_wifi_set_default_wifi_sta_handlers();
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to attach the %s driver: %s", mesh_link ? "mesh link" : "wifi", esp_err_to_name(err));
+        return err;
+    }
+    return mesh_link ? start_mesh_link_sta() : start_wifi_link_sta();
+}
+
+static void role_switched(mesh_netif_role_t role, int64_t start_us)
+{
+    uint32_t us = (uint32_t) (esp_timer_get_time() - start_us);
+
+    METRIC_HIST(METRIC_NETIF_SWITCH_US, us);
+    ESP_LOGI(TAG, "Netifs %s -> %s in %" PRIu32 " us", s_role_names[s_role], s_role_names[role], us);
+    s_role = role;
 }
 
 esp_err_t mesh_netif_start_root_ap(bool is_root, uint32_t addr)
 {
-    if (is_root) {
-        if (netif_ap) {
-            esp_netif_action_disconnected(netif_ap, NULL, 0, NULL);
-            mesh_delete_if_driver(esp_netif_get_io_driver(netif_ap));
-            esp_netif_destroy(netif_ap);
-            netif_ap = NULL;
-        }
+    if (!is_root) {
+        return ESP_OK;
+    }
+    // every IP_EVENT_STA_GOT_IP lands here, only a new DNS server touches a running AP
+    if (s_ap_running && addr == s_ap_dns) {
+        return ESP_OK;
+    }
+    if (netif_ap == NULL) {
         netif_ap = create_mesh_link_ap();
         mesh_netif_driver_t driver = mesh_create_if_driver(true, true);
         if (driver == NULL) {
@@ -389,106 +452,72 @@ esp_err_t mesh_netif_start_root_ap(bool is_root, uint32_t addr)
             return ESP_FAIL;
         }
         esp_netif_attach(netif_ap, driver);
-        set_dhcps_dns(netif_ap, addr);
+    }
+    set_dhcps_dns(netif_ap, addr);
+    s_ap_dns = addr;
+    if (!s_ap_running) {
         start_mesh_link_ap();
         ip_napt_enable(g_mesh_netif_subnet_ip.ip.addr, 1);
+        s_ap_running = true;
     }
     return ESP_OK;
 }
 
 esp_err_t mesh_netifs_start(bool is_root)
 {
+    mesh_netif_role_t role = is_root ? MESH_NETIF_ROOT : MESH_NETIF_NODE;
+    int64_t start = esp_timer_get_time();
+
+    if (role == s_role) {
+        ESP_LOGD(TAG, "Already %s, no need to do anything", s_role_names[role]);
+        return ESP_OK;
+    }
     if (is_root) {
-        // ROOT: need both sta should use standard wifi, AP mesh link netif
-
-        // Root: Station
-        if (netif_sta && strcmp(esp_netif_get_desc(netif_sta), "sta") == 0) {
-            ESP_LOGI(TAG, "Already wifi station, no need to do anything");
-        } else if (netif_sta && strcmp(esp_netif_get_desc(netif_sta), "mesh_link_sta") == 0) {
-            esp_netif_action_disconnected(netif_sta, NULL, 0, NULL);
-            mesh_delete_if_driver(esp_netif_get_io_driver(netif_sta));
-            esp_netif_destroy(netif_sta);
-            mesh_netif_init_station();
-        } else if (netif_sta == NULL) {
-            mesh_netif_init_station();
+        // ROOT: station on the standard wifi driver, AP mesh link netif
+        if (s_role == MESH_NETIF_NODE && bind_station(false) != ESP_OK) {
+            return ESP_FAIL;
         }
 
         // Root: AP is initialized only if GLOBAL DNS configured
         // (otherwise have to wait until the actual DNS record received from the router)
 #if CONFIG_MESH_USE_GLOBAL_DNS_IP
-         mesh_netif_start_root_ap(true, htonl(DNS_IP_ADDR));
+        mesh_netif_start_root_ap(true, htonl(DNS_IP_ADDR));
 #endif
-
     } else {
-        // NODE: create only STA in form of mesh link
-        if (netif_sta && strcmp(esp_netif_get_desc(netif_sta), "mesh_link_sta") == 0) {
-            ESP_LOGI(TAG, "Already mesh link station, no need to do anything");
-            return ESP_OK;
-        }
-        if (netif_sta) {
-            esp_netif_action_disconnected(netif_sta, NULL, 0, NULL);
-            // should remove the actual driver
-            if (strcmp(esp_netif_get_desc(netif_sta), "sta") == 0) {
-                ESP_LOGI(TAG, "It was a wifi station removing stuff");
-                esp_wifi_clear_default_wifi_driver_and_handlers(netif_sta);
-            }
-            esp_netif_destroy(netif_sta);
-
-        }
-        netif_sta = create_mesh_link_sta();
-        // now we create a mesh driver and attach it to the existing netif
-        mesh_netif_driver_t driver = mesh_create_if_driver(false, false);
-        if (driver == NULL) {
-            ESP_LOGE(TAG, "Failed to create wifi interface handle");
+        // NODE: only the STA, on the mesh link driver
+        if (bind_station(true) != ESP_OK) {
             return ESP_FAIL;
         }
-        esp_netif_attach(netif_sta, driver);
-        start_mesh_link_sta();
-        // If we have a AP on NODE -> stop and remove it!
-        if (netif_ap) {
-            esp_netif_action_disconnected(netif_ap, NULL, 0, NULL);
-            mesh_delete_if_driver(esp_netif_get_io_driver(netif_ap));
-            esp_netif_destroy(netif_ap);
-            netif_ap = NULL;
-        }
-
+        stop_mesh_link_ap();
     }
+    role_switched(role, start);
     return ESP_OK;
 }
 
 esp_err_t mesh_netifs_stop(void)
 {
-    if (netif_sta && strcmp(esp_netif_get_desc(netif_sta), "sta") == 0 && netif_ap == NULL) {
-        return ESP_OK;
-    }
+    int64_t start = esp_timer_get_time();
 
-    if (netif_sta) {
-        if (strcmp(esp_netif_get_desc(netif_sta), "sta") == 0) {
-            esp_netif_action_disconnected(netif_sta, NULL, 0, NULL);
-            esp_netif_action_stop(netif_sta, NULL, 0, NULL);
-            esp_wifi_clear_default_wifi_driver_and_handlers(netif_sta);
-        } else {
-            esp_netif_action_disconnected(netif_sta, NULL, 0, NULL);
-            mesh_delete_if_driver(esp_netif_get_io_driver(netif_sta));
-        }
-        esp_netif_destroy(netif_sta);
-        netif_sta = NULL;
+    if (s_role == MESH_NETIF_STANDBY) {
+        return ESP_OK;
     }
-
-    if (netif_ap) {
-        esp_netif_action_disconnected(netif_ap, NULL, 0, NULL);
-        mesh_delete_if_driver(esp_netif_get_io_driver(netif_ap));
-        esp_netif_destroy(netif_ap);
-        netif_ap = NULL;
+    stop_mesh_link_ap();
+    // back to the wifi driver, ready to become root; a fresh start drops the old lease
+    if (bind_station(false) != ESP_OK) {
+        return ESP_FAIL;
     }
-    // reserve the default (STA gets ready to become root)
-    mesh_netif_init_station();
-    start_wifi_link_sta();
+    role_switched(MESH_NETIF_STANDBY, start);
     return ESP_OK;
 }
 
 uint8_t* mesh_netif_get_station_mac(void)
 {
-    mesh_netif_driver_t mesh =  esp_netif_get_io_driver(netif_sta);
-    return mesh->sta_mac_addr;
+    // same for both drivers, read once
+    static uint8_t mac[MAC_ADDR_LEN];
+    static bool read = false;
+
+    if (!read) {
+        read = esp_wifi_get_mac(WIFI_IF_STA, mac) == ESP_OK;
+    }
+    return mac;
 }
@@ -0,0 +1,164 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+
+#include "traffic_light.h"
+#include "mesh_power.h"
+#include "mqtt_app.h"
+#include "latency_trace.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#if CONFIG_MESH_ENABLE_PS
+static const char *TAG = "mesh_power";
+#endif
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+#if CONFIG_MESH_ENABLE_PS
+static TaskHandle_t s_wait_task = NULL;
+static volatile uint32_t s_gpio_wakeups = 0;
+#endif
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+#if CONFIG_MESH_ENABLE_PS
+static void IRAM_ATTR sensor_isr_handler(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    gpio_num_t pin = (gpio_num_t) (uintptr_t) arg;
+    int level = gpio_get_level(pin);
+
+    // wait for the opposite level, the pin fires once per change and not for as long as it is held
+    gpio_wakeup_enable(pin, level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    s_gpio_wakeups++;
+    if (pin == BUTTON_PIN && level) {
+        latency_trace_press_from_isr();
+    }
+    if (s_wait_task) {
+        vTaskNotifyGiveFromISR(s_wait_task, &woken);
+    }
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static esp_err_t sensor_wakeup_init(void)
+{
+    // The same level interrupt wakes the chip from light sleep and the sensor task
+    // without waiting for the next poll, the handler arms it for the other level
+    ESP_ERROR_CHECK(traffic_button_init());
+    ESP_ERROR_CHECK(infrared_sensor_init());
+    ESP_ERROR_CHECK(gpio_wakeup_enable(BUTTON_PIN, GPIO_INTR_HIGH_LEVEL));
+    ESP_ERROR_CHECK(gpio_wakeup_enable(INFRA_SENSOR_PIN, GPIO_INTR_LOW_LEVEL));
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+
+    // the service may already be installed for the preemption detector
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(BUTTON_PIN, sensor_isr_handler, (void *) BUTTON_PIN));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(INFRA_SENSOR_PIN, sensor_isr_handler, (void *) INFRA_SENSOR_PIN));
+    ESP_ERROR_CHECK(gpio_intr_enable(BUTTON_PIN));
+    ESP_ERROR_CHECK(gpio_intr_enable(INFRA_SENSOR_PIN));
+    return ESP_OK;
+}
+
+static void mesh_power_report_task(void *args)
+{
+    while (true) {
+        vTaskDelay(CONFIG_MESH_PS_REPORT_INTERVAL_S * 1000 / portTICK_PERIOD_MS);
+
+        int dev_duty = 0, nwk_duty = 0, beacon_ms = 0;
+        esp_mesh_get_running_active_duty_cycle(&dev_duty, &nwk_duty);
+        esp_mesh_get_beacon_interval(&beacon_ms);
+        // A sleeping device is reachable only during the active part of each beacon
+        // interval, so a downlink frame waits up to the inactive part of it
+        int latency_ms = dev_duty > 0 ? beacon_ms * (100 - dev_duty) / 100 : beacon_ms;
+        ESP_LOGI(TAG, "duty dev:%d%% nwk:%d%%, beacon:%dms, downlink latency <= %dms, gpio wakeups:%" PRIu32,
+                 dev_duty, nwk_duty, beacon_ms, latency_ms, s_gpio_wakeups);
+
+        cJSON *root = cJSON_CreateObject();
+        if (root == NULL) {
+            ESP_LOGE(TAG, "Failed to create JSON object");
+            continue;
+        }
+        cJSON_AddNumberToObject(root, "ps_dev_duty", dev_duty);
+        cJSON_AddNumberToObject(root, "ps_nwk_duty", nwk_duty);
+        cJSON_AddNumberToObject(root, "ps_latency_ms", latency_ms);
+        cJSON_AddNumberToObject(root, "ps_poll_ms", CONFIG_MESH_PS_POLL_PERIOD_MS);
+        cJSON_AddNumberToObject(root, "ps_gpio_wakeups", s_gpio_wakeups);
+        mqtt_app_publish("v1/devices/me/telemetry", root);
+        cJSON_Delete(root);
+    }
+    vTaskDelete(NULL);
+}
+#endif /* CONFIG_MESH_ENABLE_PS */
+
+esp_err_t mesh_power_init(void)
+{
+#if CONFIG_MESH_ENABLE_PS
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+        .light_sleep_enable = true,
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+    ESP_ERROR_CHECK(sensor_wakeup_init());
+
+    /* battery nodes only ever hang off a mains powered parent */
+    ESP_ERROR_CHECK(esp_mesh_set_type(MESH_LEAF));
+    ESP_ERROR_CHECK(esp_mesh_enable_ps());
+    /* better to increase the associate expired time, if a small duty cycle is set. */
+    ESP_ERROR_CHECK(esp_mesh_set_ap_assoc_expire(60));
+    /* better to increase the announce interval to avoid too much management traffic, if a small duty cycle is set. */
+    ESP_ERROR_CHECK(esp_mesh_set_announce_interval(600, 3300));
+    ESP_ERROR_CHECK(esp_mesh_set_active_duty_cycle(CONFIG_MESH_PS_DEV_DUTY, CONFIG_MESH_PS_DEV_DUTY_TYPE));
+    ESP_ERROR_CHECK(esp_mesh_set_network_duty_cycle(CONFIG_MESH_PS_NWK_DUTY, CONFIG_MESH_PS_NWK_DUTY_DURATION,
+                                                    MESH_PS_NETWORK_DUTY_APPLIED_ENTIRE));
+    ESP_LOGI(TAG, "Low-power role: dev duty %d%%, nwk duty %d%%, poll %dms",
+             CONFIG_MESH_PS_DEV_DUTY, CONFIG_MESH_PS_NWK_DUTY, CONFIG_MESH_PS_POLL_PERIOD_MS);
+#else
+    ESP_ERROR_CHECK(esp_mesh_disable_ps());
+#endif
+    return ESP_OK;
+}
+
+void mesh_power_wait_event(uint32_t idle_ms)
+{
+#if CONFIG_MESH_ENABLE_PS
+    s_wait_task = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, CONFIG_MESH_PS_POLL_PERIOD_MS / portTICK_PERIOD_MS);
+#else
+    vTaskDelay(idle_ms / portTICK_PERIOD_MS);
+#endif
+}
+
+void mesh_power_report_start(void)
+{
+#if CONFIG_MESH_ENABLE_PS
+    static bool is_report_started = false;
+
+    if (!is_report_started) {
+        xTaskCreate(mesh_power_report_task, "power report", 3072, NULL, 2, NULL);
+        is_report_started = true;
+    }
+#endif
+}
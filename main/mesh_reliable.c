@@ -0,0 +1,396 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "mesh_reliable.h"
+#include "metrics.h"
+#include "binlog.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define RELIABLE_RX_PEERS       (CONFIG_MESH_ROUTE_TABLE_SIZE)  /* the root hears from every node */
+#define RELIABLE_TX_PEERS       (4)                             /* destinations with a round trip estimate */
+#define RELIABLE_IDLE_MS        (1000)
+
+static const char *TAG = "mesh_reliable";
+// destination of the frames sent to the root, whichever node it is
+static const mesh_addr_t ROOT_ADDR = { 0 };
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    mesh_addr_t to;
+    uint16_t seq;
+    uint8_t tries;              /* 0 for a free slot */
+    uint16_t len;
+    int64_t first_us;
+    int64_t due_us;
+    uint8_t data[sizeof(mesh_reliable_hdr_t) + MESH_RELIABLE_PAYLOAD_MAX];
+} reliable_pending_t;
+
+/* RFC 6298 estimate, per destination */
+typedef struct {
+    mesh_addr_t addr;
+    int64_t used_us;            /* 0 for a free slot */
+    int32_t srtt_us;            /* 0 until the first sample */
+    int32_t rttvar_us;
+    int32_t rto_us;
+} reliable_tx_peer_t;
+
+/* Dedup window, per sender */
+typedef struct {
+    mesh_addr_t addr;
+    int64_t used_us;            /* 0 for a free slot */
+    uint8_t epoch;
+    bool ack_due;
+    uint16_t top;
+    uint32_t bitmap;
+} reliable_rx_peer_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static SemaphoreHandle_t s_lock = NULL;
+static TaskHandle_t s_task = NULL;
+static mesh_reliable_deliver_t *s_deliver = NULL;
+static uint8_t s_epoch;
+static uint16_t s_seq = 0;
+static reliable_pending_t s_pending[MESH_RELIABLE_WINDOW];
+static reliable_tx_peer_t s_tx_peer[RELIABLE_TX_PEERS];
+static reliable_rx_peer_t s_rx_peer[RELIABLE_RX_PEERS];
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static esp_err_t reliable_tx(const mesh_addr_t *to, uint8_t *data, uint16_t len)
+{
+    mesh_data_t tx = {
+        .data = data,
+        .size = len,
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+    bool root = memcmp(to->addr, ROOT_ADDR.addr, 6) == 0;
+    esp_err_t err = esp_mesh_send(root ? NULL : to, &tx, MESH_DATA_P2P, NULL, 0);
+
+    METRIC_INC(METRIC_MESH_TX);
+    if (err != ESP_OK) {
+        METRIC_INC(METRIC_MESH_TX_ERR);
+    }
+    return err;
+}
+
+/* Entry of addr, else the least recently used one, reset */
+static reliable_tx_peer_t *tx_peer_find(const uint8_t addr[6], int64_t now_us)
+{
+    reliable_tx_peer_t *lru = &s_tx_peer[0];
+
+    for (int i = 0; i < RELIABLE_TX_PEERS; ++i) {
+        if (s_tx_peer[i].used_us && memcmp(s_tx_peer[i].addr.addr, addr, 6) == 0) {
+            s_tx_peer[i].used_us = now_us;
+            return &s_tx_peer[i];
+        }
+        if (s_tx_peer[i].used_us < lru->used_us) {
+            lru = &s_tx_peer[i];
+        }
+    }
+    memset(lru, 0, sizeof(*lru));
+    memcpy(lru->addr.addr, addr, 6);
+    lru->used_us = now_us;
+    return lru;
+}
+
+static reliable_rx_peer_t *rx_peer_find(const uint8_t addr[6], int64_t now_us)
+{
+    reliable_rx_peer_t *lru = &s_rx_peer[0];
+
+    for (int i = 0; i < RELIABLE_RX_PEERS; ++i) {
+        if (s_rx_peer[i].used_us && memcmp(s_rx_peer[i].addr.addr, addr, 6) == 0) {
+            s_rx_peer[i].used_us = now_us;
+            return &s_rx_peer[i];
+        }
+        if (s_rx_peer[i].used_us < lru->used_us) {
+            lru = &s_rx_peer[i];
+        }
+    }
+    memset(lru, 0, sizeof(*lru));
+    memcpy(lru->addr.addr, addr, 6);
+    lru->used_us = now_us;
+    return lru;
+}
+
+static int32_t tx_peer_rto(const uint8_t addr[6], int64_t now_us)
+{
+    reliable_tx_peer_t *peer = tx_peer_find(addr, now_us);
+
+    return peer->rto_us ? peer->rto_us : MESH_RELIABLE_RTO_INIT_MS * 1000;
+}
+
+static void tx_peer_sample(const uint8_t addr[6], int32_t rtt_us, int64_t now_us)
+{
+    reliable_tx_peer_t *peer = tx_peer_find(addr, now_us);
+
+    if (peer->srtt_us == 0) {
+        peer->srtt_us = rtt_us;
+        peer->rttvar_us = rtt_us / 2;
+    } else {
+        int32_t delta = peer->srtt_us - rtt_us;
+        peer->rttvar_us += ((delta < 0 ? -delta : delta) - peer->rttvar_us) / 4;
+        peer->srtt_us += (rtt_us - peer->srtt_us) / 8;
+    }
+    peer->rto_us = MIN(MAX(peer->srtt_us + 4 * peer->rttvar_us, MESH_RELIABLE_RTO_MIN_MS * 1000),
+                       MESH_RELIABLE_RTO_MAX_MS * 1000);
+}
+
+esp_err_t mesh_reliable_send(const mesh_addr_t *to, const uint8_t *data, uint16_t len)
+{
+    reliable_pending_t *slot = NULL;
+    mesh_reliable_hdr_t hdr = { .cmd = CMD_RELIABLE, .epoch = s_epoch };
+    uint8_t frame[sizeof(s_pending[0].data)];
+    int64_t now = esp_timer_get_time();
+
+    if (len > MESH_RELIABLE_PAYLOAD_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (s_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_RELIABLE_WINDOW && slot == NULL; ++i) {
+        if (s_pending[i].tries == 0) {
+            slot = &s_pending[i];
+        }
+    }
+    if (slot == NULL) {
+        xSemaphoreGive(s_lock);
+        METRIC_INC(METRIC_MESH_LOST);
+        ESP_LOGE(TAG, "%d frames awaiting their ack, frame dropped", MESH_RELIABLE_WINDOW);
+        return ESP_ERR_NO_MEM;
+    }
+    hdr.seq = s_seq++;
+    slot->to = to ? *to : ROOT_ADDR;
+    to = &slot->to;
+    slot->seq = hdr.seq;
+    slot->tries = 1;
+    slot->len = sizeof(hdr) + len;
+    slot->first_us = now;
+    slot->due_us = now + tx_peer_rto(to->addr, now);
+    memcpy(slot->data, &hdr, sizeof(hdr));
+    memcpy(slot->data + sizeof(hdr), data, len);
+    memcpy(frame, slot->data, slot->len);
+    len = slot->len;
+    mesh_addr_t dest = slot->to;
+    xSemaphoreGive(s_lock);
+
+    // a failed first transmission is retried on the timeout like a lost one
+    esp_err_t err = reliable_tx(&dest, frame, len);
+    BLOGD(TAG, "Frame %d sent to "MACSTR": %d", hdr.seq, MAC2STR(dest.addr), err);
+    xTaskNotifyGive(s_task);
+    return ESP_OK;
+}
+
+static void ack_received(mesh_addr_t *from, const mesh_reliable_ack_t *ack)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (ack->epoch != s_epoch) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_RELIABLE_WINDOW; ++i) {
+        reliable_pending_t *p = &s_pending[i];
+        uint16_t behind = ack->top - p->seq;
+        // the root acks from its own address, which the sender need not know
+        bool to_root = memcmp(p->to.addr, ROOT_ADDR.addr, 6) == 0;
+        if (p->tries == 0 || (!to_root && memcmp(p->to.addr, from->addr, 6) != 0) ||
+            behind >= MESH_RELIABLE_DEDUP || !(ack->bitmap & (1u << behind))) {
+            continue;
+        }
+        // Karn: a retransmitted frame does not tell which copy was acked
+        if (p->tries == 1) {
+            tx_peer_sample(p->to.addr, (int32_t) (now - p->first_us), now);
+        }
+        METRIC_HIST(METRIC_MESH_DELIVERY_MS, (uint32_t) ((now - p->first_us) / 1000));
+        p->tries = 0;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+/* @return true if the frame is new */
+static bool window_accept(reliable_rx_peer_t *peer, const mesh_reliable_hdr_t *hdr)
+{
+    int16_t ahead = (int16_t) (hdr->seq - peer->top);
+
+    if (peer->bitmap == 0 || hdr->epoch != peer->epoch) {
+        // first frame from this boot of the sender
+        peer->epoch = hdr->epoch;
+        peer->top = hdr->seq;
+        peer->bitmap = 1;
+        return true;
+    }
+    if (ahead > 0) {
+        peer->bitmap = ahead >= MESH_RELIABLE_DEDUP ? 1 : peer->bitmap << ahead | 1;
+        peer->top = hdr->seq;
+        return true;
+    }
+    // older than the window: taken for a duplicate, the sender gives up on it
+    if (-ahead >= MESH_RELIABLE_DEDUP || (peer->bitmap & (1u << -ahead))) {
+        return false;
+    }
+    peer->bitmap |= 1u << -ahead;
+    return true;
+}
+
+void mesh_reliable_received(mesh_addr_t *from, uint8_t *data, uint16_t len)
+{
+    mesh_reliable_hdr_t hdr;
+    bool fresh;
+
+    if (s_task == NULL) {
+        return;
+    }
+    if (data[0] == CMD_RELIABLE_ACK) {
+        mesh_reliable_ack_t ack;
+        if (len < sizeof(ack)) {
+            ESP_LOGE(TAG, "Ack of %d bytes", len);
+            return;
+        }
+        memcpy(&ack, data, sizeof(ack));
+        ack_received(from, &ack);
+        return;
+    }
+    if (len <= sizeof(hdr)) {
+        ESP_LOGE(TAG, "Frame of %d bytes", len);
+        return;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    reliable_rx_peer_t *peer = rx_peer_find(from->addr, esp_timer_get_time());
+    fresh = window_accept(peer, &hdr);
+    // duplicates are acked too, the previous ack may be the one lost
+    peer->ack_due = true;
+    xSemaphoreGive(s_lock);
+    xTaskNotifyGive(s_task);
+
+    if (!fresh) {
+        METRIC_INC(METRIC_MESH_DUP);
+        BLOGD(TAG, "Duplicate %d from "MACSTR, hdr.seq, MAC2STR(from->addr));
+        return;
+    }
+    if (s_deliver) {
+        s_deliver(from, data + sizeof(hdr), len - sizeof(hdr));
+    }
+}
+
+/* Acks and retransmissions; the frames are copied out so the mesh is not called under the lock */
+static void reliable_task(void *args)
+{
+    static struct {
+        mesh_addr_t to;
+        uint16_t len;
+        uint8_t data[sizeof(s_pending[0].data)];
+    } retx[MESH_RELIABLE_WINDOW];
+    static struct {
+        mesh_addr_t to;
+        mesh_reliable_ack_t ack;
+    } acks[8];
+    TickType_t wait = pdMS_TO_TICKS(RELIABLE_IDLE_MS);
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        int64_t now = esp_timer_get_time();
+        int64_t next = now + RELIABLE_IDLE_MS * 1000;
+        int n_retx = 0, n_acks = 0;
+        bool more_acks = false;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < RELIABLE_RX_PEERS; ++i) {
+            reliable_rx_peer_t *peer = &s_rx_peer[i];
+            if (!peer->ack_due) {
+                continue;
+            }
+            if (n_acks == sizeof(acks) / sizeof(acks[0])) {
+                more_acks = true;
+                break;
+            }
+            acks[n_acks].to = peer->addr;
+            acks[n_acks].ack = (mesh_reliable_ack_t) {
+                .cmd = CMD_RELIABLE_ACK, .epoch = peer->epoch, .top = peer->top, .bitmap = peer->bitmap,
+            };
+            peer->ack_due = false;
+            n_acks++;
+        }
+        for (int i = 0; i < MESH_RELIABLE_WINDOW; ++i) {
+            reliable_pending_t *p = &s_pending[i];
+            if (p->tries == 0) {
+                continue;
+            }
+            if (p->due_us > now) {
+                next = MIN(next, p->due_us);
+                continue;
+            }
+            if (p->tries >= MESH_RELIABLE_TRIES) {
+                METRIC_INC(METRIC_MESH_LOST);
+                ESP_LOGE(TAG, "Frame %d (cmd 0x%02x) to "MACSTR" not acked after %d tries, given up",
+                         p->seq, p->data[sizeof(mesh_reliable_hdr_t)], MAC2STR(p->to.addr), p->tries);
+                p->tries = 0;
+                continue;
+            }
+            // exponential backoff from the estimate, capped
+            int64_t rto = (int64_t) tx_peer_rto(p->to.addr, now) << p->tries;
+            p->tries++;
+            p->due_us = now + MIN(rto, MESH_RELIABLE_RTO_MAX_MS * 1000);
+            next = MIN(next, p->due_us);
+            retx[n_retx].to = p->to;
+            retx[n_retx].len = p->len;
+            memcpy(retx[n_retx].data, p->data, p->len);
+            n_retx++;
+        }
+        xSemaphoreGive(s_lock);
+
+        for (int i = 0; i < n_acks; ++i) {
+            reliable_tx(&acks[i].to, (uint8_t *) &acks[i].ack, sizeof(acks[i].ack));
+        }
+        for (int i = 0; i < n_retx; ++i) {
+            METRIC_INC(METRIC_MESH_RETX);
+            BLOGI(TAG, "Retransmitting to "MACSTR, MAC2STR(retx[i].to.addr));
+            reliable_tx(&retx[i].to, retx[i].data, retx[i].len);
+        }
+        // the sends may have blocked past the next deadline
+        int64_t left_us = next - esp_timer_get_time();
+        wait = more_acks || left_us <= 0 ? 0 : pdMS_TO_TICKS((left_us + 999) / 1000);
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t mesh_reliable_init(mesh_reliable_deliver_t *deliver)
+{
+    if (s_task) {
+        return ESP_OK;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_deliver = deliver;
+    s_epoch = esp_random();
+    if (xTaskCreate(reliable_task, "mesh reliable", 3072, NULL, 9, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,141 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "metrics.h"
+
+#if CONFIG_APP_METRICS_ENABLE
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+
+#include "mqtt_app.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+static const char *TAG = "metrics";
+
+static const char *const s_counter_names[METRIC_COUNTER_MAX] = {
+    [METRIC_MESH_TX]          = "mesh_tx",
+    [METRIC_MESH_TX_ERR]      = "mesh_tx_err",
+    [METRIC_MESH_RX]          = "mesh_rx",
+    [METRIC_MESH_RX_ERR]      = "mesh_rx_err",
+    [METRIC_MQTT_PUB]         = "mqtt_pub",
+    [METRIC_MQTT_PUB_ERR]     = "mqtt_pub_err",
+    [METRIC_MQTT_DROP]        = "mqtt_drop",
+    [METRIC_MQTT_COALESCE]    = "mqtt_coalesce",
+    [METRIC_TLS_RESUME_OFFER] = "tls_resume_offer",
+    [METRIC_MQTT_RECONNECT]   = "mqtt_reconnect",
+    [METRIC_ROOT_HANDOVER]    = "root_handover",
+    [METRIC_PHASE_CHANGE]     = "phase_changes",
+    [METRIC_MESH_RETX]        = "mesh_retx",
+    [METRIC_MESH_DUP]         = "mesh_dup",
+    [METRIC_MESH_LOST]        = "mesh_lost",
+};
+
+static const char *const s_gauge_names[METRIC_GAUGE_MAX] = {
+    [METRIC_HEAP_FREE]     = "heap_free",
+    [METRIC_HEAP_MIN_FREE] = "heap_min_free",
+};
+
+static const char *const s_hist_names[METRIC_HIST_MAX] = {
+    [METRIC_MQTT_PUB_US]      = "mqtt_pub_us",
+    [METRIC_MQTT_QUEUE_US]    = "mqtt_queue_us",
+    [METRIC_MQTT_QUEUE_DEPTH] = "mqtt_queue_depth",
+    [METRIC_TLS_HANDSHAKE_MS] = "tls_handshake_ms",
+    [METRIC_TLS_HEAP_PEAK]    = "tls_heap_peak",
+    [METRIC_MQTT_OUTAGE_MS]   = "mqtt_outage_ms",
+    [METRIC_MESH_JOIN_MS]     = "mesh_join_ms",
+    [METRIC_NETIF_SWITCH_US]  = "netif_switch_us",
+    [METRIC_MESH_DELIVERY_MS] = "mesh_delivery_ms",
+};
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+uint32_t g_metric_counters[METRIC_COUNTER_MAX];
+uint32_t g_metric_gauges[METRIC_GAUGE_MAX];
+uint32_t g_metric_hists[METRIC_HIST_MAX][METRIC_HIST_BUCKETS];
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+// Upper bound of the bucket holding the given quantile (per mille)
+static uint32_t hist_quantile(const uint32_t *buckets, uint32_t count, uint32_t permille)
+{
+    uint32_t rank = (count * permille + 999) / 1000;
+    uint32_t seen = 0;
+    for (int i = 0; i < METRIC_HIST_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return i ? (1u << i) - 1 : 0;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static void metrics_task(void *args)
+{
+    char name[32];
+
+    while (true) {
+        vTaskDelay(CONFIG_APP_METRICS_INTERVAL_S * 1000 / portTICK_PERIOD_MS);
+
+        METRIC_GAUGE_SET(METRIC_HEAP_FREE, esp_get_free_heap_size());
+        METRIC_GAUGE_SET(METRIC_HEAP_MIN_FREE, esp_get_minimum_free_heap_size());
+
+        cJSON *root = cJSON_CreateObject();
+        if (root == NULL) {
+            ESP_LOGE(TAG, "Failed to create JSON object");
+            continue;
+        }
+        for (int i = 0; i < METRIC_COUNTER_MAX; ++i) {
+            cJSON_AddNumberToObject(root, s_counter_names[i],
+                                    __atomic_load_n(&g_metric_counters[i], __ATOMIC_RELAXED));
+        }
+        for (int i = 0; i < METRIC_GAUGE_MAX; ++i) {
+            cJSON_AddNumberToObject(root, s_gauge_names[i],
+                                    __atomic_load_n(&g_metric_gauges[i], __ATOMIC_RELAXED));
+        }
+        for (int i = 0; i < METRIC_HIST_MAX; ++i) {
+            uint32_t buckets[METRIC_HIST_BUCKETS];
+            uint32_t count = 0;
+            for (int b = 0; b < METRIC_HIST_BUCKETS; ++b) {
+                buckets[b] = __atomic_exchange_n(&g_metric_hists[i][b], 0, __ATOMIC_RELAXED);
+                count += buckets[b];
+            }
+            if (count == 0) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "%s_n", s_hist_names[i]);
+            cJSON_AddNumberToObject(root, name, count);
+            snprintf(name, sizeof(name), "%s_p50", s_hist_names[i]);
+            cJSON_AddNumberToObject(root, name, hist_quantile(buckets, count, 500));
+            snprintf(name, sizeof(name), "%s_p99", s_hist_names[i]);
+            cJSON_AddNumberToObject(root, name, hist_quantile(buckets, count, 990));
+        }
+        mqtt_app_publish("v1/devices/me/telemetry", root);
+        cJSON_Delete(root);
+    }
+    vTaskDelete(NULL);
+}
+
+void metrics_start(void)
+{
+    static bool is_metrics_started = false;
+
+    if (!is_metrics_started) {
+        xTaskCreate(metrics_task, "metrics", 3072, NULL, 2, NULL);
+        is_metrics_started = true;
+    }
+}
+
+#endif /* CONFIG_APP_METRICS_ENABLE */
@@ -11,25 +11,130 @@
 #include "esp_system.h"
 #include "esp_netif.h"
 #include "esp_tls.h"
+#include "esp_timer.h"
 #include "cJSON.h"
+#include "freertos/FreeRTOS.h"
 
 #include "mqtt_client.h"
+#include "metrics.h"
+#include "binlog.h"
+#include "rpc.h"
+#include "mqtt_pub.h"
+#include "mqtt_app.h"
+#if CONFIG_APP_MQTT_TLS
+#include "mqtt_tls.h"
+#endif
+
+#ifdef CONFIG_APP_MQTT_BROKER_URI
+#define MQTT_APP_BROKER_URI         CONFIG_APP_MQTT_BROKER_URI
+#else
+#define MQTT_APP_BROKER_URI         "mqtt://demo.thingsboard.io"
+#endif
+#ifdef CONFIG_APP_MQTT_ACCESS_TOKEN
+#define MQTT_APP_ACCESS_TOKEN       CONFIG_APP_MQTT_ACCESS_TOKEN
+#else
+#define MQTT_APP_ACCESS_TOKEN       "4mSOQMbrVFFp6uOXhz4k"
+#endif
+
+#define ATTRIBUTES_TOPIC            "v1/devices/me/attributes"
+#define ATTRIBUTES_RESPONSE_TOPIC   "v1/devices/me/attributes/response/+"
+#define ATTRIBUTES_REQUEST_TOPIC    "v1/devices/me/attributes/request/1"
+// shared attributes fetched on every connection, later changes are pushed by the server
+#define ATTRIBUTES_REQUEST          "{\"sharedKeys\":\"timing_plan\"}"
+// bytes of QoS 1 publishes awaiting their ack, past it publishing returns -2
+#define MQTT_APP_OUTBOX_LIMIT       (4096)
 
 static const char *TAG = "mesh_mqtt";
 static esp_mqtt_client_handle_t s_client = NULL;
+static void (*s_attributes_cb)(const char *data, int len) = NULL;
+static void (*s_rpc_cb)(const char *topic, int topic_len, const char *data, int len) = NULL;
+// link lost (mqtt_app_suspend() or a client disconnect) to the first publish through again
+static portMUX_TYPE s_outage_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_outage_start_us = 0;
+static int64_t s_reconnected_us = 0;
+
+#if CONFIG_APP_MQTT_TLS
+// server_certs/ca_cert.pem, embedded by main/CMakeLists.txt
+extern const uint8_t ca_cert_pem_start[] asm("_binary_ca_cert_pem_start");
+extern const uint8_t ca_cert_pem_end[] asm("_binary_ca_cert_pem_end");
+#endif
+
+/* Start of an outage, an outage already running keeps its start */
+static void outage_begin(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_outage_lock);
+    if (s_outage_start_us == 0) {
+        s_outage_start_us = now;
+        s_reconnected_us = 0;
+    }
+    portEXIT_CRITICAL(&s_outage_lock);
+}
+
+static void outage_reconnected(void)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t start;
+
+    portENTER_CRITICAL(&s_outage_lock);
+    start = s_outage_start_us;
+    if (start) {
+        s_reconnected_us = now;
+    }
+    portEXIT_CRITICAL(&s_outage_lock);
+    if (start) {
+        METRIC_INC(METRIC_MQTT_RECONNECT);
+        ESP_LOGI(TAG, "Reconnected %" PRId64 " ms after the link was lost", (now - start) / 1000);
+    }
+}
+
+/* A publish went through, ends the outage if the client reconnected since */
+static void outage_end(void)
+{
+    int64_t now, start, reconnected;
+
+    if (s_outage_start_us == 0) {
+        return;
+    }
+    now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_outage_lock);
+    start = s_outage_start_us;
+    reconnected = s_reconnected_us;
+    if (start && reconnected) {
+        s_outage_start_us = 0;
+    }
+    portEXIT_CRITICAL(&s_outage_lock);
+    if (start && reconnected) {
+        METRIC_HIST(METRIC_MQTT_OUTAGE_MS, (uint32_t) ((now - start) / 1000));
+        ESP_LOGI(TAG, "Telemetry resumed %" PRId64 " ms after the link was lost, %" PRId64 " ms after reconnecting",
+                 (now - start) / 1000, (now - reconnected) / 1000);
+    }
+}
 
 static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
 {
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED:
-            ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-            if (esp_mqtt_client_subscribe(s_client, "/topic/ip_mesh/key_pressed", 0) < 0) {
+            ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED, session_present=%d", event->session_present);
+            outage_reconnected();
+            // a persistent session kept by the broker still holds the subscriptions
+            if (!event->session_present &&
+                (esp_mqtt_client_subscribe(s_client, "/topic/ip_mesh/key_pressed", 0) < 0 ||
+                 esp_mqtt_client_subscribe(s_client, ATTRIBUTES_TOPIC, 1) < 0 ||
+                 esp_mqtt_client_subscribe(s_client, ATTRIBUTES_RESPONSE_TOPIC, 1) < 0 ||
+                 esp_mqtt_client_subscribe(s_client, RPC_REQUEST_TOPIC "+", 1) < 0)) {
                 // Disconnect to retry the subscribe after auto-reconnect timeout
                 esp_mqtt_client_disconnect(s_client);
+                break;
             }
+            esp_mqtt_client_publish(s_client, ATTRIBUTES_REQUEST_TOPIC, ATTRIBUTES_REQUEST, 0, 1, 0);
+            mqtt_pub_set_connected(true);
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+            outage_begin();
+            mqtt_pub_set_connected(false);
             break;
 
         case MQTT_EVENT_SUBSCRIBED:
@@ -45,6 +150,23 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
             ESP_LOGI(TAG, "MQTT_EVENT_DATA");
             ESP_LOGI(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
             ESP_LOGI(TAG, "DATA=%.*s", event->data_len, event->data);
+            if (s_attributes_cb && event->topic_len >= sizeof(ATTRIBUTES_TOPIC) - 1 &&
+                strncmp(event->topic, ATTRIBUTES_TOPIC, sizeof(ATTRIBUTES_TOPIC) - 1) == 0) {
+                if (event->data_len != event->total_data_len) {
+                    ESP_LOGE(TAG, "Attributes of %d bytes split over several messages, ignored",
+                             event->total_data_len);
+                    break;
+                }
+                s_attributes_cb(event->data, event->data_len);
+            } else if (s_rpc_cb && event->topic_len >= sizeof(RPC_REQUEST_TOPIC) - 1 &&
+                       strncmp(event->topic, RPC_REQUEST_TOPIC, sizeof(RPC_REQUEST_TOPIC) - 1) == 0) {
+                if (event->data_len != event->total_data_len) {
+                    ESP_LOGE(TAG, "RPC request of %d bytes split over several messages, ignored",
+                             event->total_data_len);
+                    break;
+                }
+                s_rpc_cb(event->topic, event->topic_len, event->data, event->data_len);
+            }
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -61,6 +183,30 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     mqtt_event_handler_cb(event_data);
 }
 
+int mqtt_app_send(const char *topic, const char *data, int len, int qos, int retain)
+{
+    if (s_client == NULL) {
+        return -1;
+    }
+    int64_t start = esp_timer_get_time();
+    int msg_id = esp_mqtt_client_publish(s_client, topic, data, len, qos, retain);
+    METRIC_HIST(METRIC_MQTT_PUB_US, (uint32_t) (esp_timer_get_time() - start));
+    if (msg_id == -2) {
+        // outbox full, the caller retries
+        return msg_id;
+    }
+    METRIC_INC(METRIC_MQTT_PUB);
+    if (msg_id < 0) {
+        METRIC_INC(METRIC_MQTT_PUB_ERR);
+    } else {
+        outage_end();
+    }
+    BLOGI(TAG, "sent publish returned msg_id=%d", msg_id);
+    return msg_id;
+}
+
+/* Synchronous, for the periodic reporters; sensor and control tasks go through mqtt_pub.
+ * QoS 0: the next report supersedes a lost one, none is stored while disconnected. */
 void mqtt_app_publish(char* topic, cJSON *json)
 {
     if (s_client) {
@@ -72,22 +218,65 @@ void mqtt_app_publish(char* topic, cJSON *json)
         }
 
         // Publicar la cadena JSON
-        int msg_id = esp_mqtt_client_publish(s_client, topic, json_string, 0, 1, 0);
-        ESP_LOGI(TAG, "sent publish returned msg_id=%d", msg_id);
+        mqtt_app_send(topic, json_string, 0, 0, 0);
 
         // Liberar la memoria de la cadena JSON
         cJSON_free(json_string);
     }
 }
 
+void mqtt_app_on_rpc(void (*cb)(const char *topic, int topic_len, const char *data, int len))
+{
+    s_rpc_cb = cb;
+}
+
+void mqtt_app_on_attributes(void (*cb)(const char *data, int len))
+{
+    s_attributes_cb = cb;
+}
+
+/* The station netif goes away with the mesh parent: stop publishing now
+ * instead of finding out through the keepalive. The client waits to
+ * reconnect until mqtt_app_start() or its reconnect timeout. */
+void mqtt_app_suspend(void)
+{
+    if (s_client == NULL) {
+        return;
+    }
+    outage_begin();
+    mqtt_pub_set_connected(false);
+    esp_mqtt_client_disconnect(s_client);
+}
+
+/* Called on every IP_EVENT_STA_GOT_IP: the first call creates the client,
+ * later ones reconnect it at once and resume the persistent session. */
 void mqtt_app_start(void)
 {
+    if (s_client) {
+        if (esp_mqtt_client_reconnect(s_client) != ESP_OK) {
+            ESP_LOGD(TAG, "Client not waiting to reconnect");
+        }
+        return;
+    }
+
     esp_mqtt_client_config_t mqtt_cfg = {
-            .broker.address.uri = "mqtt://demo.thingsboard.io",
-            .credentials.username = "4mSOQMbrVFFp6uOXhz4k",
+            .broker.address.uri = MQTT_APP_BROKER_URI,
+            .credentials.username = MQTT_APP_ACCESS_TOKEN,
+            .session.disable_clean_session = true,
+            .outbox.limit = MQTT_APP_OUTBOX_LIMIT,
     };
+#if CONFIG_APP_MQTT_TLS
+    // the transport verifies the broker against the CA and keeps the session for the next connection
+    mqtt_cfg.network.transport = mqtt_tls_transport((const char *) ca_cert_pem_start,
+                                                    ca_cert_pem_end - ca_cert_pem_start);
+    if (mqtt_cfg.network.transport == NULL) {
+        ESP_LOGE(TAG, "No memory for the TLS transport");
+        return;
+    }
+#endif
 
     s_client = esp_mqtt_client_init(&mqtt_cfg);
     esp_mqtt_client_register_event(s_client, ESP_EVENT_ANY_ID, mqtt_event_handler, s_client);
     esp_mqtt_client_start(s_client);
+    mqtt_pub_start(mqtt_app_send);
 }
@@ -0,0 +1,366 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "mqtt_pub.h"
+#include "metrics.h"
+#include "binlog.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+// below the control task, above the periodic reporters
+#define MQTT_PUB_PRIORITY       (4)
+// a missed notification only delays records by this much
+#define MQTT_PUB_POLL_MS        (1000)
+// client outbox full, waiting for acks
+#define MQTT_PUB_RETRY_MS       (100)
+
+// records held per class while the broker is away
+#define MQTT_PUB_REPLY_BUDGET   (4)
+#define MQTT_PUB_CONTROL_BUDGET (4)
+#define MQTT_PUB_EVENT_BUDGET   (8)
+#define MQTT_PUB_SAMPLE_BUDGET  (2)
+#define MQTT_PUB_OUTBOX_RECORDS (MQTT_PUB_REPLY_BUDGET + MQTT_PUB_CONTROL_BUDGET + \
+                                 MQTT_PUB_EVENT_BUDGET + MQTT_PUB_SAMPLE_BUDGET)
+
+static const char *TAG = "mqtt_pub";
+
+static const char *const s_topics[] = {
+    [MQTT_PUB_TELEMETRY] = "v1/devices/me/telemetry",
+    [MQTT_PUB_ATTRIBUTES] = "v1/devices/me/attributes",
+    [MQTT_PUB_RPC_RESPONSE] = "v1/devices/me/rpc/response/",
+};
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    uint8_t qos;
+    uint8_t retain;
+    uint8_t policy;         /* mqtt_pub_policy_t */
+    uint8_t budget;
+} mqtt_pub_class_cfg_t;
+
+/* Records of one class waiting to be sent, oldest first */
+typedef struct {
+    mqtt_pub_record_t *slot;
+    uint8_t first;
+    uint8_t count;
+} mqtt_pub_outbox_t;
+
+// ThingsBoard does not keep retained messages, no class sets the flag
+static const mqtt_pub_class_cfg_t s_classes[MQTT_PUB_CLASS_MAX] = {
+    [MQTT_PUB_CLASS_REPLY]   = { 1, 0, MQTT_PUB_NEVER_DROP,      MQTT_PUB_REPLY_BUDGET },
+    [MQTT_PUB_CLASS_CONTROL] = { 1, 0, MQTT_PUB_COALESCE_LATEST, MQTT_PUB_CONTROL_BUDGET },
+    [MQTT_PUB_CLASS_EVENT]   = { 1, 0, MQTT_PUB_DROP_OLDEST,     MQTT_PUB_EVENT_BUDGET },
+    [MQTT_PUB_CLASS_SAMPLE]  = { 0, 0, MQTT_PUB_COALESCE_LATEST, MQTT_PUB_SAMPLE_BUDGET },
+};
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_pub_queue_t *s_queues[MQTT_PUB_QUEUES_MAX];
+static uint32_t s_queue_count = 0;
+static TaskHandle_t s_task = NULL;
+static mqtt_pub_send_t s_send = NULL;
+static bool s_connected = false;
+// publisher task only
+static mqtt_pub_record_t s_outbox_records[MQTT_PUB_OUTBOX_RECORDS];
+static mqtt_pub_outbox_t s_outbox[MQTT_PUB_CLASS_MAX];
+static uint32_t s_reported[MQTT_PUB_QUEUES_MAX];
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+mqtt_pub_queue_t *mqtt_pub_queue_create(const char *name, uint32_t depth)
+{
+    uint32_t size = 1;
+
+    while (size < depth) {
+        size <<= 1;
+    }
+    mqtt_pub_queue_t *queue = calloc(1, sizeof(*queue));
+    mqtt_pub_record_t *ring = calloc(size, sizeof(*ring));
+    if (queue == NULL || ring == NULL) {
+        free(queue);
+        free(ring);
+        return NULL;
+    }
+    queue->name = name;
+    queue->mask = size - 1;
+    queue->ring = ring;
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_queue_count == MQTT_PUB_QUEUES_MAX) {
+        portEXIT_CRITICAL(&s_lock);
+        ESP_LOGE(TAG, "No queue left for %s", name);
+        free(ring);
+        free(queue);
+        return NULL;
+    }
+    s_queues[s_queue_count] = queue;
+    __atomic_store_n(&s_queue_count, s_queue_count + 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&s_lock);
+    return queue;
+}
+
+mqtt_pub_record_t *mqtt_pub_begin(mqtt_pub_queue_t *queue, mqtt_pub_topic_t topic, mqtt_pub_class_t cls)
+{
+    if (queue == NULL) {
+        return NULL;
+    }
+    uint32_t head = queue->head;
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) > queue->mask) {
+        __atomic_store_n(&queue->dropped, queue->dropped + 1, __ATOMIC_RELAXED);
+        METRIC_INC(METRIC_MQTT_DROP);
+        return NULL;
+    }
+    mqtt_pub_record_t *rec = &queue->ring[head & queue->mask];
+    rec->topic = topic;
+    rec->cls = cls;
+    rec->n_fields = 0;
+    rec->text_len = 0;
+    rec->id = 0;
+    rec->object = NULL;
+    return rec;
+}
+
+void mqtt_pub_add(mqtt_pub_record_t *rec, const char *key, double value)
+{
+    if (rec->n_fields < MQTT_PUB_FIELDS_MAX) {
+        rec->field[rec->n_fields].key = key;
+        rec->field[rec->n_fields].value = value;
+        rec->n_fields++;
+    }
+}
+
+void mqtt_pub_commit(mqtt_pub_queue_t *queue)
+{
+    queue->ring[queue->head & queue->mask].enqueue_us = esp_timer_get_time();
+    // the record is complete before the publisher can see the new head
+    __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+    if (s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+bool mqtt_pub_text(mqtt_pub_queue_t *queue, mqtt_pub_topic_t topic, mqtt_pub_class_t cls,
+                   uint32_t id, const char *data, int len)
+{
+    if (len < 0 || len > MQTT_PUB_TEXT_MAX) {
+        return false;
+    }
+    mqtt_pub_record_t *rec = mqtt_pub_begin(queue, topic, cls);
+    if (rec == NULL) {
+        return false;
+    }
+    rec->id = id;
+    rec->text_len = len;
+    memcpy(rec->text, data, len);
+    mqtt_pub_commit(queue);
+    return true;
+}
+
+static int format_value(char *buf, size_t size, double value)
+{
+    // same output as cJSON_PrintUnformatted() for the values published here
+    if (!isfinite(value)) {
+        return snprintf(buf, size, "null");
+    }
+    if (fabs(value) < INT32_MAX && value == (double) (int32_t) value) {
+        return snprintf(buf, size, "%" PRId32, (int32_t) value);
+    }
+    return snprintf(buf, size, "%1.15g", value);
+}
+
+int mqtt_pub_format(const mqtt_pub_record_t *rec, char *topic, char *buf, size_t size)
+{
+    size_t len = 0;
+
+    if (rec->topic == MQTT_PUB_RPC_RESPONSE) {
+        snprintf(topic, MQTT_PUB_TOPIC_MAX, "%s%" PRIu32, s_topics[rec->topic], rec->id);
+    } else {
+        snprintf(topic, MQTT_PUB_TOPIC_MAX, "%s", s_topics[rec->topic]);
+    }
+    if (rec->n_fields == 0) {
+        if (rec->text_len >= size) {
+            return 0;
+        }
+        memcpy(buf, rec->text, rec->text_len);
+        buf[rec->text_len] = '\0';
+        return rec->text_len;
+    }
+
+    len += snprintf(buf + len, size - len, rec->object ? "{\"%s\":{" : "{", rec->object);
+    for (int i = 0; i < rec->n_fields && len < size; ++i) {
+        len += snprintf(buf + len, size - len, "%s\"%s\":", i ? "," : "", rec->field[i].key);
+        if (len < size) {
+            len += format_value(buf + len, size - len, rec->field[i].value);
+        }
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, rec->object ? "}}" : "}");
+    }
+    return len < size ? len : 0;
+}
+
+static mqtt_pub_record_t *outbox_at(const mqtt_pub_outbox_t *box, uint8_t budget, int i)
+{
+    return &box->slot[(box->first + i) % budget];
+}
+
+/* Same topic, object and first key: a newer state of the same thing */
+static bool same_kind(const mqtt_pub_record_t *a, const mqtt_pub_record_t *b)
+{
+    return a->n_fields && b->n_fields && a->topic == b->topic && a->object == b->object &&
+           strcmp(a->field[0].key, b->field[0].key) == 0;
+}
+
+/* Copy a record into its class outbox, false if it has to stay in the producer queue */
+static bool outbox_put(const mqtt_pub_record_t *rec)
+{
+    const mqtt_pub_class_cfg_t *cfg = &s_classes[rec->cls];
+    mqtt_pub_outbox_t *box = &s_outbox[rec->cls];
+
+    if (cfg->policy == MQTT_PUB_COALESCE_LATEST) {
+        for (int i = 0; i < box->count; ++i) {
+            mqtt_pub_record_t *held = outbox_at(box, cfg->budget, i);
+            if (same_kind(held, rec)) {
+                // takes the place in line of the record it replaces
+                *held = *rec;
+                METRIC_INC(METRIC_MQTT_COALESCE);
+                return true;
+            }
+        }
+    }
+    if (box->count == cfg->budget) {
+        if (cfg->policy == MQTT_PUB_NEVER_DROP) {
+            return false;
+        }
+        box->first = (box->first + 1) % cfg->budget;
+        box->count--;
+        METRIC_INC(METRIC_MQTT_DROP);
+        BLOGW(TAG, "Outbox of class %d full, oldest record dropped", rec->cls);
+    }
+    *outbox_at(box, cfg->budget, box->count) = *rec;
+    box->count++;
+    return true;
+}
+
+/* One record of every producer queue into the outboxes, one per queue so a busy producer cannot starve the others */
+static bool outbox_fill(void)
+{
+    bool moved = false;
+    uint32_t count = __atomic_load_n(&s_queue_count, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; ++i) {
+        mqtt_pub_queue_t *queue = s_queues[i];
+        uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (queue->tail == head) {
+            continue;
+        }
+        const mqtt_pub_record_t *rec = &queue->ring[queue->tail & queue->mask];
+        if (rec->cls < MQTT_PUB_CLASS_MAX && !outbox_put(rec)) {
+            continue;
+        }
+        METRIC_HIST(METRIC_MQTT_QUEUE_DEPTH, head - queue->tail);
+        // the record is copied out, the producer may reuse the slot
+        __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+        moved = true;
+
+        uint32_t dropped = __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED);
+        if (dropped != s_reported[i]) {
+            ESP_LOGW(TAG, "%" PRIu32 " records of %s dropped, queue full", dropped - s_reported[i], queue->name);
+            s_reported[i] = dropped;
+        }
+    }
+    return moved;
+}
+
+/* Send the oldest record of the highest class, 1 if one went, 0 if none waits, -1 to retry later */
+static int outbox_send(void)
+{
+    static char topic[MQTT_PUB_TOPIC_MAX];
+    static char json[MQTT_PUB_JSON_MAX];
+
+    for (int cls = 0; cls < MQTT_PUB_CLASS_MAX; ++cls) {
+        const mqtt_pub_class_cfg_t *cfg = &s_classes[cls];
+        mqtt_pub_outbox_t *box = &s_outbox[cls];
+        if (box->count == 0) {
+            continue;
+        }
+        const mqtt_pub_record_t *rec = outbox_at(box, cfg->budget, 0);
+        int len = mqtt_pub_format(rec, topic, json, sizeof(json));
+        if (len == 0) {
+            ESP_LOGE(TAG, "Record of class %d too long, dropped", cls);
+        } else {
+            int64_t queued_us = esp_timer_get_time() - rec->enqueue_us;
+            if (s_send(topic, json, len, cfg->qos, cfg->retain) == -2) {
+                return -1;
+            }
+            METRIC_HIST(METRIC_MQTT_QUEUE_US, (uint32_t) queued_us);
+        }
+        box->first = (box->first + 1) % cfg->budget;
+        box->count--;
+        return 1;
+    }
+    return 0;
+}
+
+static void mqtt_pub_task(void *args)
+{
+    bool busy = false;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, (busy ? MQTT_PUB_RETRY_MS : MQTT_PUB_POLL_MS) / portTICK_PERIOD_MS);
+        bool more;
+        do {
+            // while the broker is away records only move into the outboxes
+            more = outbox_fill();
+            busy = false;
+            if (__atomic_load_n(&s_connected, __ATOMIC_RELAXED)) {
+                int sent = outbox_send();
+                more |= sent > 0;
+                busy = sent < 0;
+            }
+        } while (more && !busy);
+    }
+    vTaskDelete(NULL);
+}
+
+void mqtt_pub_start(mqtt_pub_send_t send)
+{
+    s_send = send;
+    if (s_task == NULL) {
+        mqtt_pub_record_t *slot = s_outbox_records;
+        for (int cls = 0; cls < MQTT_PUB_CLASS_MAX; ++cls) {
+            s_outbox[cls].slot = slot;
+            slot += s_classes[cls].budget;
+        }
+        xTaskCreate(mqtt_pub_task, "mqtt publisher", 4096, NULL, MQTT_PUB_PRIORITY, &s_task);
+    }
+}
+
+void mqtt_pub_set_connected(bool connected)
+{
+    __atomic_store_n(&s_connected, connected, __ATOMIC_RELAXED);
+    if (connected && s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
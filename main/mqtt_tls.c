@@ -0,0 +1,221 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <inttypes.h>
+#include <sys/select.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_tls.h"
+#include "esp_transport.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "mqtt_tls.h"
+#include "metrics.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    esp_tls_t *tls;
+    const char *ca;
+    size_t ca_len;
+} mqtt_tls_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *TAG = "mqtt_tls";
+#if CONFIG_APP_MQTT_TLS_SESSION_REUSE
+// outlives the client: the one started after a root switch resumes it
+static esp_tls_client_session_t *s_session = NULL;
+#endif
+static SemaphoreHandle_t s_session_lock = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int mqtt_tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+
+    ctx->tls = esp_tls_init();
+    if (ctx->tls == NULL) {
+        return -1;
+    }
+    // the session is only replaced under the lock, never while a handshake uses it
+    xSemaphoreTake(s_session_lock, portMAX_DELAY);
+    esp_tls_cfg_t cfg = {
+        .cacert_buf = (const unsigned char *) ctx->ca,
+        .cacert_bytes = ctx->ca_len,
+        .timeout_ms = timeout_ms,
+    };
+    bool offered = false;
+#if CONFIG_APP_MQTT_TLS_SESSION_REUSE
+    cfg.client_session = s_session;
+    offered = s_session != NULL;
+#endif
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    heap_caps_monitor_local_minimum_free_size_start();
+    int64_t start = esp_timer_get_time();
+    int ret = esp_tls_conn_new_sync(host, strlen(host), port, &cfg, ctx->tls);
+    uint32_t handshake_ms = (esp_timer_get_time() - start) / 1000;
+    uint32_t heap_peak = free_before - heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    heap_caps_monitor_local_minimum_free_size_stop();
+
+    if (ret <= 0) {
+#if CONFIG_APP_MQTT_TLS_SESSION_REUSE
+        // a rejected or expired ticket is not offered again
+        if (s_session) {
+            esp_tls_free_client_session(s_session);
+            s_session = NULL;
+        }
+#endif
+        xSemaphoreGive(s_session_lock);
+        ESP_LOGE(TAG, "TLS connection to %s:%d failed after %" PRIu32 " ms", host, port, handshake_ms);
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+        return -1;
+    }
+#if CONFIG_APP_MQTT_TLS_SESSION_REUSE
+    // the broker may have issued a new ticket, even on a resumed handshake
+    esp_tls_client_session_t *session = esp_tls_get_client_session(ctx->tls);
+    if (session != NULL) {
+        if (s_session) {
+            esp_tls_free_client_session(s_session);
+        }
+        s_session = session;
+    }
+#endif
+    xSemaphoreGive(s_session_lock);
+
+    METRIC_HIST(METRIC_TLS_HANDSHAKE_MS, handshake_ms);
+    METRIC_HIST(METRIC_TLS_HEAP_PEAK, heap_peak);
+    if (offered) {
+        METRIC_INC(METRIC_TLS_RESUME_OFFER);
+    }
+    ESP_LOGI(TAG, "TLS handshake with %s in %" PRIu32 " ms, %" PRIu32 " bytes of heap, %s",
+             host, handshake_ms, heap_peak, offered ? "session offered" : "full");
+    return 0;
+}
+
+static int mqtt_tls_poll(esp_transport_handle_t t, int timeout_ms, bool write)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    int fd;
+
+    if (ctx->tls == NULL || esp_tls_get_conn_sockfd(ctx->tls, &fd) != ESP_OK) {
+        return -1;
+    }
+    fd_set fds;
+    fd_set errfds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    FD_ZERO(&errfds);
+    FD_SET(fd, &errfds);
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    int ret = select(fd + 1, write ? NULL : &fds, write ? &fds : NULL, &errfds, timeout_ms < 0 ? NULL : &timeout);
+    if (ret > 0 && FD_ISSET(fd, &errfds)) {
+        return -1;
+    }
+    return ret;
+}
+
+static int mqtt_tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+
+    // records already decrypted by mbedTLS are not seen by select()
+    if (ctx->tls && esp_tls_get_bytes_avail(ctx->tls) > 0) {
+        return 1;
+    }
+    return mqtt_tls_poll(t, timeout_ms, false);
+}
+
+static int mqtt_tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return mqtt_tls_poll(t, timeout_ms, true);
+}
+
+static int mqtt_tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    int poll = mqtt_tls_poll_read(t, timeout_ms);
+
+    if (poll <= 0) {
+        return poll == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    int ret = esp_tls_conn_read(ctx->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_TIMEOUT) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0) {
+        // readable but nothing to read: the broker closed the connection
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret;
+}
+
+static int mqtt_tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    int poll = mqtt_tls_poll_write(t, timeout_ms);
+
+    if (poll <= 0) {
+        ESP_LOGW(TAG, "Socket not writable within %d ms", timeout_ms);
+        return poll;
+    }
+    int ret = esp_tls_conn_write(ctx->tls, buffer, len);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "TLS write error 0x%x", -ret);
+    }
+    return ret;
+}
+
+static int mqtt_tls_close(esp_transport_handle_t t)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+
+    if (ctx->tls) {
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+    }
+    return 0;
+}
+
+static int mqtt_tls_destroy(esp_transport_handle_t t)
+{
+    mqtt_tls_close(t);
+    free(esp_transport_get_context_data(t));
+    return 0;
+}
+
+esp_transport_handle_t mqtt_tls_transport(const char *ca, size_t ca_len)
+{
+    if (s_session_lock == NULL) {
+        s_session_lock = xSemaphoreCreateMutex();
+    }
+    mqtt_tls_t *ctx = calloc(1, sizeof(*ctx));
+    esp_transport_handle_t t = esp_transport_init();
+    if (ctx == NULL || t == NULL || s_session_lock == NULL) {
+        free(ctx);
+        if (t) {
+            esp_transport_destroy(t);
+        }
+        return NULL;
+    }
+    ctx->ca = ca;
+    ctx->ca_len = ca_len;
+    esp_transport_set_context_data(t, ctx);
+    esp_transport_set_func(t, mqtt_tls_connect, mqtt_tls_read, mqtt_tls_write, mqtt_tls_close,
+                           mqtt_tls_poll_read, mqtt_tls_poll_write, mqtt_tls_destroy);
+    esp_transport_set_default_port(t, MQTT_TLS_DEFAULT_PORT);
+    return t;
+}
@@ -0,0 +1,89 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "occupancy.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Part of [start_us, end_us) inside the current window */
+static int64_t window_part(const occupancy_t *occ, int64_t start_us, int64_t end_us)
+{
+    if (start_us < occ->window.start_us) {
+        start_us = occ->window.start_us;
+    }
+    return end_us > start_us ? end_us - start_us : 0;
+}
+
+void occupancy_init(occupancy_t *occ, uint32_t hold_off_ms, uint32_t window_s, int64_t now_us)
+{
+    memset(occ, 0, sizeof(*occ));
+    occ->hold_off_us = hold_off_ms * 1000;
+    occ->window_us = window_s * 1000000;
+    occ->window.start_us = now_us;
+}
+
+void occupancy_input(occupancy_t *occ, bool level, int64_t at_us)
+{
+    if (level == occ->high) {
+        return;
+    }
+    occ->high = level;
+    if (!level) {
+        occ->open.end_us = at_us;
+        return;
+    }
+    if (!occ->occupied) {
+        occ->occupied = true;
+        occ->open.start_us = at_us;
+        occ->window.count++;
+    }
+}
+
+bool occupancy_interval(occupancy_t *occ, int64_t now_us, occupancy_interval_t *out)
+{
+    if (!occ->occupied || occ->high || now_us - occ->open.end_us < occ->hold_off_us) {
+        return false;
+    }
+    occ->occupied = false;
+    *out = occ->open;
+
+    uint32_t duration_us = out->end_us - out->start_us;
+    occ->window.occupied_us += window_part(occ, out->start_us, out->end_us);
+    if (duration_us > occ->window.longest_us) {
+        occ->window.longest_us = duration_us;
+    }
+    return true;
+}
+
+bool occupancy_window(occupancy_t *occ, int64_t now_us, occupancy_window_t *out)
+{
+    if (now_us - occ->window.start_us < occ->window_us) {
+        return false;
+    }
+    if (occ->occupied) {
+        occ->window.occupied_us += window_part(occ, occ->open.start_us, occ->high ? now_us : occ->open.end_us);
+    }
+    occ->window.length_us = now_us - occ->window.start_us;
+    *out = occ->window;
+
+    memset(&occ->window, 0, sizeof(occ->window));
+    occ->window.start_us = now_us;
+    return true;
+}
+
+int64_t occupancy_next_us(const occupancy_t *occ)
+{
+    int64_t next_us = occ->window.start_us + occ->window_us;
+
+    if (occ->occupied && !occ->high && occ->open.end_us + occ->hold_off_us < next_us) {
+        next_us = occ->open.end_us + occ->hold_off_us;
+    }
+    return next_us;
+}
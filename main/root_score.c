@@ -0,0 +1,106 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "root_score.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+uint16_t root_score(const root_score_input_t *in)
+{
+    int rssi = in->router_rssi;
+    uint32_t uptime_s = in->uptime_s;
+
+    // hard limits: heap only gates, the root role itself takes heap and must not lower its score
+    if (!in->mains || rssi == ROOT_SCORE_RSSI_NONE || in->free_heap < ROOT_SCORE_HEAP_MIN) {
+        return 0;
+    }
+    if (rssi < ROOT_SCORE_RSSI_FLOOR) {
+        rssi = ROOT_SCORE_RSSI_FLOOR;
+    } else if (rssi > ROOT_SCORE_RSSI_CEIL) {
+        rssi = ROOT_SCORE_RSSI_CEIL;
+    }
+    if (uptime_s > ROOT_SCORE_UPTIME_MAX_S) {
+        uptime_s = ROOT_SCORE_UPTIME_MAX_S;
+    }
+    return 1 + (rssi - ROOT_SCORE_RSSI_FLOOR) * 10 + uptime_s / 60;
+}
+
+void root_election_init(root_election_t *el, int64_t now_us, int64_t report_us)
+{
+    memset(el, 0, sizeof(*el));
+    el->hold_until_us = now_us + (int64_t) ROOT_SCORE_HOLD_S * 1000000;
+    el->report_us = report_us;
+}
+
+static root_candidate_t *candidate_slot(root_election_t *el, const uint8_t addr[6], bool add)
+{
+    root_candidate_t *stalest = &el->candidate[0];
+
+    for (int i = 0; i < ROOT_SCORE_CANDIDATES; ++i) {
+        root_candidate_t *c = &el->candidate[i];
+        if (c->seen_us && memcmp(c->addr, addr, 6) == 0) {
+            return c;
+        }
+        if (c->seen_us < stalest->seen_us) {
+            stalest = c;
+        }
+    }
+    if (!add) {
+        return NULL;
+    }
+    memset(stalest, 0, sizeof(*stalest));
+    memcpy(stalest->addr, addr, 6);
+    return stalest;
+}
+
+bool root_election_report(root_election_t *el, const uint8_t addr[6], uint16_t score,
+                          uint16_t root_score, int64_t now_us, uint8_t out[6])
+{
+    bool ahead = score >= root_score + ROOT_SCORE_HYSTERESIS;
+    // only nodes ahead of the root take a slot
+    root_candidate_t *c = candidate_slot(el, addr, ahead);
+    root_candidate_t *best = NULL;
+
+    if (c == NULL) {
+        return false;
+    }
+    c->score = score;
+    c->seen_us = now_us;
+    c->ahead = ahead ? c->ahead + (c->ahead < UINT8_MAX) : 0;
+    if (now_us < el->hold_until_us) {
+        return false;
+    }
+    // of the candidates ahead long enough, the best one
+    for (int i = 0; i < ROOT_SCORE_CANDIDATES; ++i) {
+        root_candidate_t *other = &el->candidate[i];
+        if (!other->seen_us) {
+            continue;
+        }
+        // gone quiet: left the mesh, or scores 0 and stopped reporting
+        if (now_us - other->seen_us > ROOT_SCORE_STALE * el->report_us) {
+            memset(other, 0, sizeof(*other));
+            continue;
+        }
+        // the root may have gained since the candidate's last report
+        if (other->score < root_score + ROOT_SCORE_HYSTERESIS) {
+            other->ahead = 0;
+            continue;
+        }
+        if (other->ahead >= ROOT_SCORE_REPORTS && (!best || other->score > best->score)) {
+            best = other;
+        }
+    }
+    if (best == NULL) {
+        return false;
+    }
+    memcpy(out, best->addr, 6);
+    root_election_init(el, now_us, el->report_us);
+    return true;
+}
@@ -0,0 +1,283 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+/* RPC requests arrive on the MQTT task, possibly in bursts, so they are
+ * scanned in place instead of being built into a cJSON tree. */
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "rpc.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define RPC_TOKEN_MAX   (24)    /* longest method name, MAC or number accepted */
+#define RPC_DEPTH_MAX   (32)    /* nesting of objects and arrays, one bit each */
+
+static const char *const s_methods[] = {
+    [RPC_METHOD_PEDESTRIAN_REQUEST] = "pedestrianRequest",
+    [RPC_METHOD_PREEMPT] = "preempt",
+    [RPC_METHOD_GET_STATE] = "getState",
+};
+
+static const char *const s_status[] = {
+    [RPC_STATUS_OK] = "ok",
+    [RPC_STATUS_REJECTED] = "rejected",
+    [RPC_STATUS_UNSUPPORTED] = "unsupported",
+};
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static const char *skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+/* p at the opening quote, returns past the closing one */
+static const char *skip_string(const char *p, const char *end)
+{
+    for (p++; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        } else if (*p == '"') {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Past the value at p, NULL if it is truncated or its brackets do not match */
+static const char *skip_value(const char *p, const char *end)
+{
+    uint32_t arrays = 0;    // bit n set: level n + 1 is an array
+    int depth = 0;
+
+    if (p < end && *p == '"') {
+        return skip_string(p, end);
+    }
+    while (p < end) {
+        if (*p == '"') {
+            p = skip_string(p, end);
+            if (p == NULL) {
+                return NULL;
+            }
+            continue;
+        }
+        if (*p == '{' || *p == '[') {
+            if (depth == RPC_DEPTH_MAX) {
+                return NULL;
+            }
+            arrays = (arrays & ~(1U << depth)) | ((uint32_t) (*p == '[') << depth);
+            depth++;
+        } else if (*p == '}' || *p == ']') {
+            if (depth == 0) {
+                return p;
+            }
+            depth--;
+            if (((arrays >> depth) & 1) != (*p == ']')) {
+                return NULL;
+            }
+            if (depth == 0) {
+                return p + 1;
+            }
+        } else if (depth == 0 && (*p == ',' || *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            return p;
+        }
+        p++;
+    }
+    return depth == 0 ? p : NULL;
+}
+
+/* Member of the object starting at p, top level only */
+static bool json_member(const char *p, const char *end, const char *key, const char **val, const char **val_end)
+{
+    size_t key_len = strlen(key);
+
+    p = skip_ws(p, end);
+    if (p >= end || *p != '{') {
+        return false;
+    }
+    p = skip_ws(p + 1, end);
+    while (p < end && *p == '"') {
+        const char *name = p + 1;
+        p = skip_string(p, end);
+        if (p == NULL) {
+            return false;
+        }
+        size_t name_len = p - 1 - name;
+        p = skip_ws(p, end);
+        if (p >= end || *p != ':') {
+            return false;
+        }
+        const char *v = skip_ws(p + 1, end);
+        p = skip_value(v, end);
+        if (p == NULL || p == v) {
+            return false;
+        }
+        if (name_len == key_len && memcmp(name, key, key_len) == 0) {
+            *val = v;
+            *val_end = p;
+            return true;
+        }
+        p = skip_ws(p, end);
+        if (p >= end || *p != ',') {
+            break;
+        }
+        p = skip_ws(p + 1, end);
+    }
+    return false;
+}
+
+/* Unquoted copy of a short scalar value */
+static bool json_token(const char *val, const char *val_end, char *out)
+{
+    if (val < val_end && *val == '"') {
+        val++;
+        val_end--;
+    }
+    size_t len = val_end - val;
+    if (len >= RPC_TOKEN_MAX) {
+        return false;
+    }
+    memcpy(out, val, len);
+    out[len] = '\0';
+    return true;
+}
+
+/* Decimal digits only: strtoul() alone takes signs, blanks and wraps on overflow */
+static bool token_uint(const char *token, uint32_t max, uint32_t *out)
+{
+    char *tail;
+
+    if (!isdigit((unsigned char) token[0])) {
+        return false;
+    }
+    errno = 0;
+    unsigned long value = strtoul(token, &tail, 10);
+    if (*tail != '\0' || errno == ERANGE || value > max) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+static bool json_uint(const char *val, const char *val_end, uint32_t max, uint32_t *out)
+{
+    char token[RPC_TOKEN_MAX];
+
+    if (!json_token(val, val_end, token)) {
+        return false;
+    }
+    if (strcmp(token, "true") == 0 || strcmp(token, "false") == 0) {
+        *out = token[0] == 't';
+        return true;
+    }
+    return token_uint(token, max, out);
+}
+
+esp_err_t rpc_parse(const char *topic, int topic_len, const char *data, int data_len,
+                    rpc_msg_t *msg, uint8_t node[6], bool *has_node)
+{
+    const size_t prefix_len = sizeof(RPC_REQUEST_TOPIC) - 1;
+    const char *end = data + data_len;
+    const char *val, *val_end;
+    const char *params = NULL, *params_end = NULL;
+    char token[RPC_TOKEN_MAX];
+    uint32_t value;
+
+    memset(msg, 0, sizeof(*msg));
+    *has_node = false;
+
+    // request id from the topic
+    if (topic_len <= prefix_len || memcmp(topic, RPC_REQUEST_TOPIC, prefix_len) != 0 ||
+        topic_len - prefix_len >= RPC_TOKEN_MAX) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(token, topic + prefix_len, topic_len - prefix_len);
+    token[topic_len - prefix_len] = '\0';
+    if (!token_uint(token, UINT32_MAX, &value)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    msg->id = value;
+
+    // the whole document first: nothing in a truncated or unbalanced one is acted on
+    const char *doc = skip_ws(data, end);
+    const char *doc_end = doc < end && *doc == '{' ? skip_value(doc, end) : NULL;
+    if (doc_end == NULL || skip_ws(doc_end, end) != end) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!json_member(data, end, "method", &val, &val_end) || *val != '"' || !json_token(val, val_end, token)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int m = RPC_METHOD_NONE + 1; m < sizeof(s_methods) / sizeof(s_methods[0]); ++m) {
+        if (strcmp(token, s_methods[m]) == 0) {
+            msg->method = m;
+        }
+    }
+    if (msg->method == RPC_METHOD_NONE) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    bool has_active = false;
+    json_member(data, end, "params", &params, &params_end);
+    if (params && *params == '{') {
+        if (json_member(params, params_end, "node", &val, &val_end)) {
+            int n = 0;
+            if (!json_token(val, val_end, token) ||
+                sscanf(token, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n", &node[0], &node[1], &node[2],
+                       &node[3], &node[4], &node[5], &n) != 6 || token[n] != '\0') {
+                return ESP_ERR_INVALID_ARG;
+            }
+            *has_node = true;
+        }
+        // a parameter given but out of range is an error, not a default
+        if (json_member(params, params_end, "group", &val, &val_end)) {
+            if (!json_uint(val, val_end, UINT8_MAX, &value)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            msg->group = value;
+        }
+        if (json_member(params, params_end, "active", &val, &val_end)) {
+            if (!json_uint(val, val_end, 1, &value)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            msg->active = value;
+            has_active = true;
+        }
+    }
+    if (msg->method == RPC_METHOD_PREEMPT && !has_active) {
+        // a missing "active" would silently end a preemption
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+int rpc_format_reply(char *buf, size_t size, const rpc_msg_t *msg, int64_t latency_us)
+{
+    const char *status = msg->status < sizeof(s_status) / sizeof(s_status[0]) ? s_status[msg->status] : "error";
+    int len = snprintf(buf, size, "{\"status\":\"%s\",\"node\":\"%02x:%02x:%02x:%02x:%02x:%02x\","
+                       "\"latency_ms\":%.1f,\"actuation_ms\":%.1f,\"fase\":%d,\"semaforo_coches\":%d,"
+                       "\"semaforo_peaton\":%d,\"preferencia\":%d}",
+                       status, msg->target[0], msg->target[1], msg->target[2], msg->target[3],
+                       msg->target[4], msg->target[5], latency_us / 1000.0, msg->actuation_us / 1000.0,
+                       msg->phase, msg->vehicles, msg->pedestrians, msg->preempt);
+    return len < size ? len : size - 1;
+}
+
+int rpc_format_error(char *buf, size_t size, const char *error)
+{
+    int len = snprintf(buf, size, "{\"status\":\"error\",\"error\":\"%s\"}", error);
+    return len < size ? len : size - 1;
+}
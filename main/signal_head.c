@@ -0,0 +1,523 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#if CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_I2C
+#include "driver/i2c_master.h"
+#endif
+#include "traffic_light.h"
+#include "signal_head.h"
+#include "binlog.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIGNAL_CHANNELS         (24)    /* three 74HC595 or three PCF8574 */
+#define SIGNAL_I2C_TIMEOUT_MS   (20)
+#define SIGNAL_HEADS_MAX        (8)
+
+/* GPIO lamps run on LEDC channels: steady lamps on the PWM timer, blinking
+ * lamps on a 1 Hz timer at 50% duty, so the flashing needs no CPU */
+#define LAMP_LEDC_MODE          LEDC_LOW_SPEED_MODE
+#define LAMP_PWM_TIMER          LEDC_TIMER_0
+#define LAMP_PWM_HZ             (1000)
+#define LAMP_BLINK_TIMER        LEDC_TIMER_1
+#define LAMP_BLINK_HZ           (1)
+#define LAMP_DUTY_RES           LEDC_TIMER_10_BIT
+#define LAMP_DUTY_FULL          (1 << 10)
+#define LAMP_FADE_MS            (2000)
+
+#define N   SIGNAL_LAMP_NONE
+
+static const char *TAG = "signal_head";
+
+#if CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_SR || CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_I2C
+/* Same channel map on the shift register chain and on the expanders */
+static const signal_head_t s_heads_four_way[] = {
+    { "north", SIGNAL_HEAD_VEHICLE, TRAFFIC_GROUP_VEHICLE, { 0, 1, 2 } },
+    { "south", SIGNAL_HEAD_VEHICLE, TRAFFIC_GROUP_VEHICLE, { 3, 4, 5 } },
+    { "east", SIGNAL_HEAD_VEHICLE, TRAFFIC_GROUP_SIDE_STREET, { 6, 7, 8 } },
+    { "west", SIGNAL_HEAD_VEHICLE, TRAFFIC_GROUP_SIDE_STREET, { 9, 10, 11 } },
+    { "ped_north", SIGNAL_HEAD_PEDESTRIAN, TRAFFIC_GROUP_PEDESTRIAN, { 12, N, 13 } },
+    { "ped_south", SIGNAL_HEAD_PEDESTRIAN, TRAFFIC_GROUP_PEDESTRIAN, { 14, N, 15 } },
+    { "ped_east", SIGNAL_HEAD_PEDESTRIAN, TRAFFIC_GROUP_PEDESTRIAN, { 16, N, 17 } },
+    { "ped_west", SIGNAL_HEAD_PEDESTRIAN, TRAFFIC_GROUP_PEDESTRIAN, { 18, N, 19 } },
+};
+#else
+/* RGB configuration on ESP-WROVER-KIT board */
+static const signal_head_t s_heads_single[] = {
+    { "vehicle", SIGNAL_HEAD_VEHICLE, TRAFFIC_GROUP_VEHICLE, { GPIO_NUM_0, GPIO_NUM_2, GPIO_NUM_4 } },
+    { "pedestrian", SIGNAL_HEAD_PEDESTRIAN, TRAFFIC_GROUP_PEDESTRIAN, { GPIO_NUM_16, N, GPIO_NUM_17 } },
+};
+#endif
+
+#if CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_SR
+static const signal_layout_t s_layout = {
+    .name = "4-way, 74HC595",
+    .bus = SIGNAL_BUS_SHIFT_REG,
+    .n_heads = sizeof(s_heads_four_way) / sizeof(s_heads_four_way[0]),
+    .heads = s_heads_four_way,
+    .plan = &traffic_plan_four_way,
+};
+#elif CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_I2C
+static const signal_layout_t s_layout = {
+    .name = "4-way, PCF8574",
+    .bus = SIGNAL_BUS_I2C_EXP,
+    .active_low = true,
+    .n_heads = sizeof(s_heads_four_way) / sizeof(s_heads_four_way[0]),
+    .heads = s_heads_four_way,
+    .plan = &traffic_plan_four_way,
+};
+#else
+static const signal_layout_t s_layout = {
+    .name = "single crossing, GPIO",
+    .bus = SIGNAL_BUS_GPIO,
+    .n_heads = sizeof(s_heads_single) / sizeof(s_heads_single[0]),
+    .heads = s_heads_single,
+    .plan = &traffic_plan_single,
+};
+#endif
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    LAMP_OFF,
+    LAMP_ON,
+    LAMP_BLINK,
+} lamp_mode_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static bool s_inited = false;
+static SemaphoreHandle_t s_lock;
+static bool s_sw_lamps = false;             /* some lamps blink from the esp_timer */
+static uint8_t s_lamp_mode[SIGNAL_HEADS_MAX][SIGNAL_LAMP_MAX];
+static int8_t s_lamp_pwm[SIGNAL_HEADS_MAX][SIGNAL_LAMP_MAX];   /* LEDC channel, -1 for none */
+static int8_t s_dim_pwm = -1;               /* LEDC channel on the 74HC595 OE pin */
+static uint32_t s_duty = LAMP_DUTY_FULL;
+static bool s_hw_blinking = false;
+static bool s_blink_changed = false;
+static bool s_sw_blinking = false;
+static bool s_sw_blink_on = true;
+static esp_timer_handle_t s_sw_blink_timer;
+static int s_group_color[TRAFFIC_GROUP_MAX];
+static uint8_t s_shadow[SIGNAL_CHANNELS / 8];
+#if CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_I2C
+static i2c_master_dev_handle_t s_expander[SIGNAL_CHANNELS / 8];
+#endif
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+const signal_layout_t *signal_layout(void)
+{
+    return &s_layout;
+}
+
+/* Only the esp_timer blink shares the outputs with the callers */
+static void lamps_lock(void)
+{
+    if (s_sw_lamps) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+}
+
+static void lamps_unlock(void)
+{
+    if (s_sw_lamps) {
+        xSemaphoreGive(s_lock);
+    }
+}
+
+static void output_write(int8_t channel, bool on)
+{
+    int level = on != s_layout.active_low;
+
+    if (s_layout.bus == SIGNAL_BUS_GPIO) {
+        gpio_set_level(channel, level);
+    } else if (level) {
+        s_shadow[channel / 8] |= 1 << (channel % 8);
+    } else {
+        s_shadow[channel / 8] &= ~(1 << (channel % 8));
+    }
+}
+
+static void lamp_set(int h, int l, lamp_mode_t mode)
+{
+    int8_t channel = s_layout.heads[h].lamp[l];
+    int8_t pwm = s_lamp_pwm[h][l];
+
+    if (channel == SIGNAL_LAMP_NONE) {
+        return;
+    }
+    s_blink_changed |= (mode == LAMP_BLINK) != (s_lamp_mode[h][l] == LAMP_BLINK);
+    if (pwm < 0) {
+        s_lamp_mode[h][l] = mode;
+        output_write(channel, mode == LAMP_ON || (mode == LAMP_BLINK && s_sw_blink_on));
+        return;
+    }
+    if (s_lamp_mode[h][l] == mode) {
+        return;
+    }
+    if (mode == LAMP_BLINK) {
+        ledc_bind_channel_timer(LAMP_LEDC_MODE, pwm, LAMP_BLINK_TIMER);
+        ledc_set_duty_and_update(LAMP_LEDC_MODE, pwm, LAMP_DUTY_FULL / 2, 0);
+    } else {
+        if (s_lamp_mode[h][l] == LAMP_BLINK) {
+            ledc_bind_channel_timer(LAMP_LEDC_MODE, pwm, LAMP_PWM_TIMER);
+        }
+        ledc_set_duty_and_update(LAMP_LEDC_MODE, pwm, mode == LAMP_ON ? s_duty : 0, 0);
+    }
+    s_lamp_mode[h][l] = mode;
+}
+
+static esp_err_t bus_flush(void)
+{
+#if CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_SR
+    // last register of the chain first, MSB first, then latch all outputs at once
+    for (int i = sizeof(s_shadow) - 1; i >= 0; --i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            gpio_set_level(CONFIG_APP_SIGNAL_SR_DATA_GPIO, (s_shadow[i] >> bit) & 1);
+            gpio_set_level(CONFIG_APP_SIGNAL_SR_CLOCK_GPIO, 1);
+            gpio_set_level(CONFIG_APP_SIGNAL_SR_CLOCK_GPIO, 0);
+        }
+    }
+    gpio_set_level(CONFIG_APP_SIGNAL_SR_LATCH_GPIO, 1);
+    gpio_set_level(CONFIG_APP_SIGNAL_SR_LATCH_GPIO, 0);
+#elif CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_I2C
+    for (int i = 0; i < sizeof(s_shadow); ++i) {
+        esp_err_t err = i2c_master_transmit(s_expander[i], &s_shadow[i], 1, SIGNAL_I2C_TIMEOUT_MS);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Expander 0x%02x write failed: %s", CONFIG_APP_SIGNAL_I2C_ADDR + i, esp_err_to_name(err));
+            return err;
+        }
+    }
+#endif
+    return ESP_OK;
+}
+
+static void head_set(int h, int color)
+{
+    lamp_mode_t red = LAMP_OFF, yellow = LAMP_OFF, green = LAMP_OFF;
+
+    if (s_layout.heads[h].kind == SIGNAL_HEAD_VEHICLE) {
+        switch (color) {
+        case TRAFFIC_LIGHT_RED:
+            red = LAMP_ON;
+            break;
+        case TRAFFIC_LIGHT_YELLOW:
+            yellow = LAMP_ON;
+            break;
+        case TRAFFIC_LIGHT_GREEN:
+            green = LAMP_ON;
+            break;
+        case TRAFFIC_LIGHT_GREEN_BLINK:
+            green = LAMP_BLINK;
+            break;
+        case TRAFFIC_LIGHT_INIT:
+            /* can't say */
+            red = yellow = green = LAMP_ON;
+            break;
+        case TRAFFIC_LIGHT_WARNING:
+            red = yellow = LAMP_BLINK;
+            break;
+        default:
+            /* off */
+            break;
+        }
+    } else {
+        switch (color) {
+        case TRAFFIC_LIGHT_RED:
+        case TRAFFIC_LIGHT_INIT:
+            red = LAMP_ON;
+            break;
+        case TRAFFIC_LIGHT_GREEN:
+            green = LAMP_ON;
+            break;
+        case TRAFFIC_LIGHT_GREEN_BLINK:
+            green = LAMP_BLINK;
+            break;
+        case TRAFFIC_LIGHT_WARNING:
+            red = green = LAMP_BLINK;
+            break;
+        default:
+            /* off */
+            break;
+        }
+    }
+    lamp_set(h, SIGNAL_LAMP_RED, red);
+    lamp_set(h, SIGNAL_LAMP_YELLOW, yellow);
+    lamp_set(h, SIGNAL_LAMP_GREEN, green);
+}
+
+static void sw_blink_cb(void *arg)
+{
+    lamps_lock();
+    s_sw_blink_on = !s_sw_blink_on;
+    for (int h = 0; h < s_layout.n_heads; ++h) {
+        for (int l = 0; l < SIGNAL_LAMP_MAX; ++l) {
+            if (s_lamp_mode[h][l] == LAMP_BLINK && s_lamp_pwm[h][l] < 0) {
+                output_write(s_layout.heads[h].lamp[l], s_sw_blink_on);
+            }
+        }
+    }
+    bus_flush();
+    lamps_unlock();
+}
+
+/* Lamps without an LEDC channel blink from a timer; blinking LEDC lamps
+ * start together at the beginning of an on period */
+static void blink_update(void)
+{
+    bool hw = false, sw = false;
+
+    if (!s_blink_changed) {
+        return;
+    }
+    s_blink_changed = false;
+    for (int h = 0; h < s_layout.n_heads; ++h) {
+        for (int l = 0; l < SIGNAL_LAMP_MAX; ++l) {
+            if (s_lamp_mode[h][l] == LAMP_BLINK) {
+                hw |= s_lamp_pwm[h][l] >= 0;
+                sw |= s_lamp_pwm[h][l] < 0;
+            }
+        }
+    }
+    if (hw && !s_hw_blinking) {
+        ledc_timer_rst(LAMP_LEDC_MODE, LAMP_BLINK_TIMER);
+    }
+    s_hw_blinking = hw;
+    if (sw && !s_sw_blinking) {
+        esp_timer_start_periodic(s_sw_blink_timer, 500000 / LAMP_BLINK_HZ);
+    } else if (!sw && s_sw_blinking) {
+        esp_timer_stop(s_sw_blink_timer);
+        s_sw_blink_on = true;
+    }
+    s_sw_blinking = sw;
+}
+
+static esp_err_t pwm_init(void)
+{
+    ledc_timer_config_t pwm_timer = {
+        .speed_mode = LAMP_LEDC_MODE,
+        .duty_resolution = LAMP_DUTY_RES,
+        .timer_num = LAMP_PWM_TIMER,
+        .freq_hz = LAMP_PWM_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    ledc_timer_config_t blink_timer = {
+        .speed_mode = LAMP_LEDC_MODE,
+        .duty_resolution = LAMP_DUTY_RES,
+        .timer_num = LAMP_BLINK_TIMER,
+        .freq_hz = LAMP_BLINK_HZ,
+        .clk_cfg = LEDC_USE_REF_TICK,
+    };
+    int next = LEDC_CHANNEL_0;
+
+    memset(s_lamp_pwm, -1, sizeof(s_lamp_pwm));
+    ESP_ERROR_CHECK(ledc_timer_config(&pwm_timer));
+    ESP_ERROR_CHECK(ledc_timer_config(&blink_timer));
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+
+    if (s_layout.bus == SIGNAL_BUS_GPIO) {
+        for (int h = 0; h < s_layout.n_heads; ++h) {
+            for (int l = 0; l < SIGNAL_LAMP_MAX && next < LEDC_CHANNEL_MAX; ++l) {
+                if (s_layout.heads[h].lamp[l] == SIGNAL_LAMP_NONE) {
+                    continue;
+                }
+                ledc_channel_config_t ch = {
+                    .gpio_num = s_layout.heads[h].lamp[l],
+                    .speed_mode = LAMP_LEDC_MODE,
+                    .channel = next,
+                    .timer_sel = LAMP_PWM_TIMER,
+                    .duty = 0,
+                    .flags.output_invert = s_layout.active_low,
+                };
+                ESP_ERROR_CHECK(ledc_channel_config(&ch));
+                s_lamp_pwm[h][l] = next++;
+            }
+        }
+    }
+    for (int h = 0; h < s_layout.n_heads; ++h) {
+        for (int l = 0; l < SIGNAL_LAMP_MAX; ++l) {
+            s_sw_lamps |= s_layout.heads[h].lamp[l] != SIGNAL_LAMP_NONE && s_lamp_pwm[h][l] < 0;
+        }
+    }
+#if CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_SR && CONFIG_APP_SIGNAL_SR_OE_GPIO >= 0
+    // OE is active low: the inverted output is high (lamps enabled) for the duty
+    ledc_channel_config_t oe = {
+        .gpio_num = CONFIG_APP_SIGNAL_SR_OE_GPIO,
+        .speed_mode = LAMP_LEDC_MODE,
+        .channel = next,
+        .timer_sel = LAMP_PWM_TIMER,
+        .duty = s_duty,
+        .flags.output_invert = 1,
+    };
+    ESP_ERROR_CHECK(ledc_channel_config(&oe));
+    s_dim_pwm = next++;
+#endif
+    ESP_LOGI(TAG, "%d LEDC channels", next);
+    return ESP_OK;
+}
+
+static esp_err_t bus_init(void)
+{
+    if (s_layout.bus == SIGNAL_BUS_GPIO) {
+        for (int h = 0; h < s_layout.n_heads; ++h) {
+            for (int l = 0; l < SIGNAL_LAMP_MAX; ++l) {
+                int8_t pin = s_layout.heads[h].lamp[l];
+                if (pin != SIGNAL_LAMP_NONE) {
+                    gpio_reset_pin(pin);
+                    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+                }
+            }
+        }
+        return ESP_OK;
+    }
+    memset(s_shadow, s_layout.active_low ? 0xff : 0x00, sizeof(s_shadow));
+#if CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_SR
+    gpio_config_t io_conf = {
+        .pin_bit_mask = BIT64(CONFIG_APP_SIGNAL_SR_DATA_GPIO) | BIT64(CONFIG_APP_SIGNAL_SR_CLOCK_GPIO) |
+                        BIT64(CONFIG_APP_SIGNAL_SR_LATCH_GPIO),
+        .mode = GPIO_MODE_OUTPUT,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    gpio_set_level(CONFIG_APP_SIGNAL_SR_CLOCK_GPIO, 0);
+    gpio_set_level(CONFIG_APP_SIGNAL_SR_LATCH_GPIO, 0);
+#elif CONFIG_APP_SIGNAL_LAYOUT_FOUR_WAY_I2C
+    i2c_master_bus_config_t bus_conf = {
+        .i2c_port = I2C_NUM_0,
+        .sda_io_num = CONFIG_APP_SIGNAL_I2C_SDA_GPIO,
+        .scl_io_num = CONFIG_APP_SIGNAL_I2C_SCL_GPIO,
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .glitch_ignore_cnt = 7,
+        .flags.enable_internal_pullup = true,
+    };
+    i2c_master_bus_handle_t bus;
+    esp_err_t err = i2c_new_master_bus(&bus_conf, &bus);
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (int i = 0; i < sizeof(s_shadow); ++i) {
+        i2c_device_config_t dev_conf = {
+            .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+            .device_address = CONFIG_APP_SIGNAL_I2C_ADDR + i,
+            .scl_speed_hz = 100000,
+        };
+        err = i2c_master_bus_add_device(bus, &dev_conf, &s_expander[i]);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+#endif
+    return bus_flush();
+}
+
+esp_err_t signal_head_init(void)
+{
+    if (s_inited) {
+        return ESP_OK;
+    }
+    esp_err_t err = bus_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Output bus init failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    pwm_init();
+    const esp_timer_create_args_t blink_args = {
+        .callback = &sw_blink_cb,
+        .name = "lamp_blink",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&blink_args, &s_sw_blink_timer));
+    s_lock = xSemaphoreCreateMutex();
+    s_inited = true;
+    ESP_LOGI(TAG, "%s: %d heads, %d phases", s_layout.name, s_layout.n_heads, s_layout.plan->n_phases);
+    return signal_heads_set_all(TRAFFIC_LIGHT_INIT);
+}
+
+esp_err_t signal_group_set(uint8_t group, int color)
+{
+    if (!s_inited) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lamps_lock();
+    for (int h = 0; h < s_layout.n_heads; ++h) {
+        if (s_layout.heads[h].group == group) {
+            head_set(h, color);
+        }
+    }
+    if (group < TRAFFIC_GROUP_MAX) {
+        s_group_color[group] = color;
+    }
+    blink_update();
+    esp_err_t err = bus_flush();
+    lamps_unlock();
+    BLOGI(TAG, "Semaforo establecido: grupo %d, %i", group, color);
+    return err;
+}
+
+esp_err_t signal_heads_set_all(int color)
+{
+    if (!s_inited) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lamps_lock();
+    for (int h = 0; h < s_layout.n_heads; ++h) {
+        head_set(h, color);
+    }
+    for (int g = 0; g < TRAFFIC_GROUP_MAX; ++g) {
+        s_group_color[g] = color;
+    }
+    blink_update();
+    esp_err_t err = bus_flush();
+    lamps_unlock();
+    return err;
+}
+
+esp_err_t signal_heads_dim(uint8_t duty_pct)
+{
+    uint32_t duty = LAMP_DUTY_FULL * (duty_pct > 100 ? 100 : duty_pct) / 100;
+
+    if (!s_inited) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lamps_lock();
+    if (duty != s_duty) {
+        s_duty = duty;
+        for (int h = 0; h < s_layout.n_heads; ++h) {
+            for (int l = 0; l < SIGNAL_LAMP_MAX; ++l) {
+                if (s_lamp_mode[h][l] == LAMP_ON && s_lamp_pwm[h][l] >= 0) {
+                    ledc_set_fade_with_time(LAMP_LEDC_MODE, s_lamp_pwm[h][l], s_duty, LAMP_FADE_MS);
+                    ledc_fade_start(LAMP_LEDC_MODE, s_lamp_pwm[h][l], LEDC_FADE_NO_WAIT);
+                }
+            }
+        }
+        if (s_dim_pwm >= 0) {
+            ledc_set_fade_with_time(LAMP_LEDC_MODE, s_dim_pwm, s_duty, LAMP_FADE_MS);
+            ledc_fade_start(LAMP_LEDC_MODE, s_dim_pwm, LEDC_FADE_NO_WAIT);
+        }
+        ESP_LOGI(TAG, "Lamp duty %d%%", duty_pct);
+    }
+    lamps_unlock();
+    return ESP_OK;
+}
+
+int signal_group_get(uint8_t group)
+{
+    return group < TRAFFIC_GROUP_MAX ? s_group_color[group] : 0;
+}
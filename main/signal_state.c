@@ -0,0 +1,143 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stddef.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "signal_state.h"
+#include "traffic_controller.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIGNAL_STATE_MAGIC      (0x53454d42)   /* bumped with every signal_state_t change */
+#define SIGNAL_STATE_NAMESPACE  "signal"
+#define SIGNAL_STATE_KEY        "state"
+// Phase and timer only reach flash this often: NVS also holds the WiFi, PHY and mesh data
+#define SIGNAL_STATE_NVS_PERIOD_US  (10 * 60 * 1000 * 1000LL)
+
+static const char *TAG = "signal_state";
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    uint32_t magic;
+    signal_state_t state;
+    uint32_t crc;
+} signal_state_record_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+// Not cleared by the startup code, so it survives any reset but a power loss
+RTC_NOINIT_ATTR static signal_state_record_t s_rtc_record;
+static nvs_handle_t s_nvs = 0;
+static int64_t s_nvs_us = 0;    // last NVS write, 0 before the first one
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static uint32_t record_crc(const signal_state_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *) record, offsetof(signal_state_record_t, crc));
+}
+
+static bool record_is_sane(const signal_state_record_t *record)
+{
+    return record->crc == record_crc(record) &&
+           record->state.color_pos <= 2 &&
+           record->state.ped_color_pos <= 1 &&
+           record->state.button_pressed <= 1 &&
+           record->state.phase < TRAFFIC_PHASE_MAX;
+}
+
+static esp_err_t open_nvs(void)
+{
+    if (s_nvs) {
+        return ESP_OK;
+    }
+    return nvs_open(SIGNAL_STATE_NAMESPACE, NVS_READWRITE, &s_nvs);
+}
+
+esp_err_t signal_state_restore(signal_state_t *state)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool rtc_valid = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT &&
+                     reason != ESP_RST_UNKNOWN;
+
+    if (rtc_valid && s_rtc_record.magic == SIGNAL_STATE_MAGIC) {
+        if (!record_is_sane(&s_rtc_record)) {
+            ESP_LOGE(TAG, "RTC state corrupt (reset reason %d)", reason);
+            s_rtc_record.magic = 0;
+            return ESP_ERR_INVALID_CRC;
+        }
+        *state = s_rtc_record.state;
+        ESP_LOGI(TAG, "Restored from RTC: phase %d/%d, ped %d, timer %d, request %d",
+                 state->phase, state->color_pos, state->ped_color_pos, state->timer, state->button_pressed);
+        return ESP_OK;
+    }
+
+    // Power loss (or the RTC copy was never written): fall back to flash
+    signal_state_record_t record;
+    size_t len = sizeof(record);
+    esp_err_t err = open_nvs();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs_open failed: %s", esp_err_to_name(err));
+        return ESP_ERR_NOT_FOUND;
+    }
+    err = nvs_get_blob(s_nvs, SIGNAL_STATE_KEY, &record, &len);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (err == ESP_OK && (len != sizeof(record) || record.magic != SIGNAL_STATE_MAGIC)) {
+        // written by a firmware with another record layout, not damaged
+        ESP_LOGW(TAG, "NVS state from another firmware version, ignored");
+        nvs_erase_key(s_nvs, SIGNAL_STATE_KEY);
+        nvs_commit(s_nvs);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (err != ESP_OK || !record_is_sane(&record)) {
+        ESP_LOGE(TAG, "NVS state corrupt: %s", esp_err_to_name(err));
+        nvs_erase_key(s_nvs, SIGNAL_STATE_KEY);
+        nvs_commit(s_nvs);
+        return ESP_ERR_INVALID_CRC;
+    }
+    *state = record.state;
+    ESP_LOGI(TAG, "Restored from NVS: phase %d/%d, ped %d, timer %d, request %d",
+             state->phase, state->color_pos, state->ped_color_pos, state->timer, state->button_pressed);
+    return ESP_OK;
+}
+
+void signal_state_save(const signal_state_t *state, bool persist)
+{
+    s_rtc_record.magic = SIGNAL_STATE_MAGIC;
+    s_rtc_record.state = *state;
+    s_rtc_record.crc = record_crc(&s_rtc_record);
+
+    int64_t now = esp_timer_get_time();
+    if (!persist && s_nvs_us && now - s_nvs_us < SIGNAL_STATE_NVS_PERIOD_US) {
+        return;
+    }
+    if (open_nvs() != ESP_OK) {
+        return;
+    }
+    s_nvs_us = now;
+    esp_err_t err = nvs_set_blob(s_nvs, SIGNAL_STATE_KEY, &s_rtc_record, sizeof(s_rtc_record));
+    if (err == ESP_OK) {
+        err = nvs_commit(s_nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to persist state: %s", esp_err_to_name(err));
+    }
+}
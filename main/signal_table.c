@@ -0,0 +1,349 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "signal_table.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+signal_packed_t signal_table_pack(const traffic_controller_t *ctl)
+{
+    const signal_state_t *st = &ctl->st;
+    bool preempt = ctl->preempt != TRAFFIC_PREEMPT_NONE;
+    signal_packed_t head = {
+        .flags = (st->phase & SIGNAL_PACKED_PHASE) |
+                 (st->color_pos << SIGNAL_INTERVAL_SHIFT & SIGNAL_PACKED_INTERVAL),
+        // the preemption green holds until the release, its timer stays 0
+        .remaining = preempt ? ctl->preempt_timer : st->timer,
+    };
+
+    if (traffic_controller_walk(ctl)) {
+        head.flags |= SIGNAL_PACKED_WALK;
+    }
+    if (st->button_pressed) {
+        head.flags |= SIGNAL_PACKED_REQUEST;
+    }
+    if (preempt) {
+        head.flags |= SIGNAL_PACKED_PREEMPT;
+    }
+    return head;
+}
+
+void signal_table_init(signal_table_t *t, signal_table_entry_t *entries, uint16_t max)
+{
+    memset(entries, 0, max * sizeof(*entries));
+    t->entry = entries;
+    t->max = max;
+    t->count = 0;
+    t->gen = 0;
+    t->numbering = false;
+}
+
+static signal_table_entry_t *entry_find(const signal_table_t *t, const uint8_t addr[6])
+{
+    for (int i = 0; i < t->count; ++i) {
+        if (t->entry[i].used && memcmp(t->entry[i].addr, addr, 6) == 0) {
+            return &t->entry[i];
+        }
+    }
+    return NULL;
+}
+
+static void entry_free(signal_table_t *t, signal_table_entry_t *e)
+{
+    memset(e, 0, sizeof(*e));
+    while (t->count && !t->entry[t->count - 1].used) {
+        t->count--;
+    }
+}
+
+const signal_table_entry_t *signal_table_get(const signal_table_t *t, const uint8_t addr[6])
+{
+    return entry_find(t, addr);
+}
+
+uint8_t signal_table_remaining(const signal_table_entry_t *e, int64_t now_us)
+{
+    int64_t elapsed_s = (now_us - e->seen_us) / 1000000;
+
+    return e->head.remaining > elapsed_s ? e->head.remaining - elapsed_s : 0;
+}
+
+static void entry_set(signal_table_entry_t *e, signal_packed_t head, int64_t now_us)
+{
+    // a countdown going on as expected is no news
+    int drift = signal_table_remaining(e, now_us) - head.remaining;
+    if (e->head.flags != head.flags || drift > 1 || drift < -1) {
+        e->dirty = true;
+    }
+    e->head = head;
+    e->seen_us = now_us;
+}
+
+bool signal_table_update(signal_table_t *t, const uint8_t addr[6], signal_packed_t head, int64_t now_us)
+{
+    signal_table_entry_t *e = entry_find(t, addr);
+
+    if (e == NULL) {
+        int slot = 0;
+        while (slot < t->count && t->entry[slot].used) {
+            slot++;
+        }
+        if (slot == t->max) {
+            return false;
+        }
+        // a slot freed in this generation is free on the nodes too, taking it needs no new one
+        e = &t->entry[slot];
+        memcpy(e->addr, addr, 6);
+        e->used = true;
+        e->mapped = t->numbering;
+        e->dirty = true;
+        t->count = slot < t->count ? t->count : slot + 1;
+    }
+    entry_set(e, head, now_us);
+    return true;
+}
+
+int signal_table_expire(signal_table_t *t, int64_t now_us, int64_t max_age_us)
+{
+    int removed = 0;
+
+    for (int i = 0; i < t->count; ++i) {
+        if (t->entry[i].used && now_us - t->entry[i].seen_us > max_age_us) {
+            entry_free(t, &t->entry[i]);
+            removed++;
+        }
+    }
+    if (removed && t->numbering) {
+        // the slot may go to another head, nodes must not take its heads for the old one
+        t->gen++;
+    }
+    return removed;
+}
+
+void signal_table_renumber(signal_table_t *t, uint32_t gen)
+{
+    t->gen = gen;
+    t->numbering = true;
+    for (int i = 0; i < t->count; ++i) {
+        t->entry[i].mapped = t->entry[i].used;
+        t->entry[i].dirty = t->entry[i].used;
+    }
+}
+
+uint16_t signal_table_mapped(const signal_table_t *t)
+{
+    uint16_t mapped = 0;
+
+    for (int i = 0; i < t->count; ++i) {
+        mapped += t->entry[i].used && t->entry[i].mapped;
+    }
+    return mapped;
+}
+
+size_t signal_table_encode(signal_table_t *t, bool full, int64_t now_us, uint8_t *out, size_t size)
+{
+    signal_digest_hdr_t hdr = {
+        .cmd = CMD_SIGNAL_DIGEST,
+        .full = full,
+        .gen = t->gen,
+        .entries = t->count,
+    };
+    uint8_t *bitset = out + sizeof(hdr);
+    uint8_t *p = bitset + (t->count + 7) / 8;
+    int count = 0;
+
+    // checked up front, so no head is marked sent without being sent
+    if (size < SIGNAL_DIGEST_SIZE(t->count)) {
+        return 0;
+    }
+    memset(bitset, 0, (t->count + 7) / 8);
+    for (int i = 0; i < t->count; ++i) {
+        signal_table_entry_t *e = &t->entry[i];
+        if (!e->used || !e->mapped || (!full && !e->dirty)) {
+            continue;
+        }
+        signal_packed_t head = { .flags = e->head.flags, .remaining = signal_table_remaining(e, now_us) };
+        bitset[i / 8] |= 1 << (i % 8);
+        memcpy(p, &head, sizeof(head));
+        p += sizeof(head);
+        e->dirty = false;
+        count++;
+    }
+    if (!full && count == 0) {
+        return 0;
+    }
+    memcpy(out, &hdr, sizeof(hdr));
+    return p - out;
+}
+
+int signal_table_decode(signal_table_t *t, const uint8_t *self, const uint8_t *data, size_t len, int64_t now_us)
+{
+    signal_digest_hdr_t hdr;
+    const uint8_t *bitset = data + sizeof(hdr);
+    const uint8_t *p;
+    int count = 0, applied = 0;
+
+    if (len < sizeof(hdr)) {
+        return -1;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.gen != t->gen || t->numbering || len < sizeof(hdr) + (hdr.entries + 7) / 8) {
+        return -1;
+    }
+    p = bitset + (hdr.entries + 7) / 8;
+    for (int i = 0; i < (hdr.entries + 7) / 8; ++i) {
+        count += __builtin_popcount(bitset[i]);
+    }
+    if (p + count * sizeof(signal_packed_t) != data + len) {
+        return -1;
+    }
+    for (int i = 0; i < hdr.entries; ++i) {
+        signal_packed_t head;
+        if (!(bitset[i / 8] & (1 << (i % 8)))) {
+            continue;
+        }
+        memcpy(&head, p, sizeof(head));
+        p += sizeof(head);
+        // slots not known yet come with the next map
+        signal_table_entry_t *e = i < t->count ? &t->entry[i] : NULL;
+        if (e == NULL || !e->used || !e->mapped || (self && memcmp(e->addr, self, 6) == 0)) {
+            continue;
+        }
+        entry_set(e, head, now_us);
+        applied++;
+    }
+    return applied;
+}
+
+size_t signal_table_map_encode(const signal_table_t *t, uint16_t first, uint8_t *out, size_t size)
+{
+    signal_map_hdr_t hdr = {
+        .cmd = CMD_SIGNAL_MAP,
+        .gen = t->gen,
+        .slots = t->count,
+        .first = first,
+    };
+    uint8_t *p = out + sizeof(hdr);
+
+    if (first >= t->count) {
+        return 0;
+    }
+    hdr.count = t->count - first < SIGNAL_MAP_PAGE ? t->count - first : SIGNAL_MAP_PAGE;
+    if (size < sizeof(hdr) + hdr.count * 6) {
+        return 0;
+    }
+    for (int i = first; i < first + hdr.count; ++i) {
+        if (t->entry[i].used) {
+            memcpy(p, t->entry[i].addr, 6);
+        } else {
+            memset(p, 0, 6);
+        }
+        p += 6;
+    }
+    memcpy(out, &hdr, sizeof(hdr));
+    return p - out;
+}
+
+int signal_table_map_decode(signal_table_t *t, const uint8_t *data, size_t len, int64_t now_us)
+{
+    static const uint8_t zero[6] = { 0 };
+    signal_map_hdr_t hdr;
+    const uint8_t *p = data + sizeof(hdr);
+    int applied = 0;
+
+    if (len < sizeof(hdr)) {
+        return -1;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+    if (len != sizeof(hdr) + hdr.count * 6 || hdr.first + hdr.count > hdr.slots || hdr.slots > t->max) {
+        return -1;
+    }
+    if (hdr.gen != t->gen || t->numbering) {
+        // the heads stay, unknown slots are skipped until their map arrives
+        t->gen = hdr.gen;
+        t->numbering = false;
+        for (int i = 0; i < t->count; ++i) {
+            t->entry[i].mapped = false;
+        }
+    }
+    for (int i = hdr.first; i < hdr.first + hdr.count; ++i, p += 6) {
+        signal_table_entry_t *e = &t->entry[i];
+        if (memcmp(p, zero, 6) == 0) {
+            e->mapped = false;
+            continue;
+        }
+        if (!e->used || memcmp(e->addr, p, 6) != 0) {
+            signal_table_entry_t held = *e;
+            signal_table_entry_t *other = entry_find(t, p);
+            // a head already held moves to its slot with its state
+            signal_table_entry_t moved = other ? *other : (signal_table_entry_t) { .seen_us = now_us };
+            if (other) {
+                entry_free(t, other);
+            }
+            memset(e, 0, sizeof(*e));
+            memcpy(e->addr, p, 6);
+            e->head = moved.head;
+            e->seen_us = moved.seen_us;
+            e->used = true;
+            t->count = i < t->count ? t->count : i + 1;
+            // and the one it pushes out takes a free slot until a map holds it
+            if (held.used) {
+                signal_table_update(t, held.addr, held.head, held.seen_us);
+            }
+        }
+        e->mapped = true;
+        applied++;
+    }
+    return applied;
+}
+
+int signal_table_page(const signal_table_t *t, uint16_t *slot, int64_t now_us, char *out, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+    int heads = 0, written = 0;
+    int len;
+
+    for (int i = 0; i < t->count; ++i) {
+        heads += t->entry[i].used;
+    }
+    while (*slot < t->count && !t->entry[*slot].used) {
+        (*slot)++;
+    }
+    if (*slot >= t->count) {
+        return 0;
+    }
+    len = snprintf(out, size, "{\"signal_heads\":%d,\"signals_slot\":%d,\"signals\":\"", heads, *slot);
+    for (; *slot < t->count; ++*slot) {
+        const signal_table_entry_t *e = &t->entry[*slot];
+        if (!e->used) {
+            continue;
+        }
+        // the head, its separator and the closing of the page must fit
+        if (len < 0 || (size_t) len + 1 + 16 + 3 > size) {
+            break;
+        }
+        const uint8_t bytes[8] = { e->addr[0], e->addr[1], e->addr[2], e->addr[3], e->addr[4], e->addr[5],
+                                   e->head.flags, signal_table_remaining(e, now_us) };
+        if (written) {
+            out[len++] = ',';
+        }
+        for (int i = 0; i < sizeof(bytes); ++i) {
+            out[len++] = hex[bytes[i] >> 4];
+            out[len++] = hex[bytes[i] & 0x0f];
+        }
+        written++;
+    }
+    if (written == 0) {
+        return 0;
+    }
+    len += snprintf(out + len, size - len, "\"}");
+    return len;
+}
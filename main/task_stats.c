@@ -0,0 +1,129 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+
+#include "task_stats.h"
+#include "mqtt_app.h"
+
+#if CONFIG_APP_TASK_STATS_ENABLE
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TASK_STATS_MAX_TASKS (32)
+
+static const char *TAG = "task_stats";
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    UBaseType_t task_number;
+    configRUN_TIME_COUNTER_TYPE run_time;
+} task_sample_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static TaskStatus_t s_status[TASK_STATS_MAX_TASKS];
+// the last sample and the one being taken, swapped once it is complete
+static task_sample_t s_samples[2][TASK_STATS_MAX_TASKS];
+static task_sample_t *s_prev = s_samples[0];
+static UBaseType_t s_prev_count = 0;
+static configRUN_TIME_COUNTER_TYPE s_prev_total = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static configRUN_TIME_COUNTER_TYPE prev_run_time(UBaseType_t task_number)
+{
+    for (UBaseType_t i = 0; i < s_prev_count; ++i) {
+        if (s_prev[i].task_number == task_number) {
+            return s_prev[i].run_time;
+        }
+    }
+    return 0;
+}
+
+// "traffic light control" -> "traffic_light_control", to keep telemetry keys readable
+static void key_name(char *out, size_t size, const char *prefix, const char *task_name)
+{
+    int len = snprintf(out, size, "%s%s", prefix, task_name);
+    for (int i = strlen(prefix); i < len && i < (int) size; ++i) {
+        if (out[i] == ' ') {
+            out[i] = '_';
+        }
+    }
+}
+
+static void task_stats_task(void *args)
+{
+    char key[configMAX_TASK_NAME_LEN + 8];
+
+    while (true) {
+        vTaskDelay(CONFIG_APP_TASK_STATS_INTERVAL_S * 1000 / portTICK_PERIOD_MS);
+
+        configRUN_TIME_COUNTER_TYPE total = 0;
+        UBaseType_t count = uxTaskGetSystemState(s_status, TASK_STATS_MAX_TASKS, &total);
+        if (count == 0) {
+            ESP_LOGE(TAG, "More than %d tasks, increase TASK_STATS_MAX_TASKS", TASK_STATS_MAX_TASKS);
+            continue;
+        }
+        // Run-time counters are per core, the total is wall time
+        uint64_t elapsed = (uint64_t) (total - s_prev_total) * CONFIG_FREERTOS_NUMBER_OF_CORES;
+
+        task_sample_t *next = s_prev == s_samples[0] ? s_samples[1] : s_samples[0];
+        cJSON *root = cJSON_CreateObject();
+        for (UBaseType_t i = 0; i < count; ++i) {
+            const TaskStatus_t *task = &s_status[i];
+            configRUN_TIME_COUNTER_TYPE ran = task->ulRunTimeCounter - prev_run_time(task->xTaskNumber);
+            uint32_t cpu_permille = elapsed ? (uint32_t) ((uint64_t) ran * 1000 / elapsed) : 0;
+            uint32_t stack_free = task->usStackHighWaterMark;  // bytes on ESP-IDF
+
+            ESP_LOGI(TAG, "%-16s prio:%2d cpu:%3" PRIu32 ".%" PRIu32 "%% stack free:%5" PRIu32,
+                     task->pcTaskName, (int) task->uxCurrentPriority,
+                     cpu_permille / 10, cpu_permille % 10, stack_free);
+            if (root) {
+                key_name(key, sizeof(key), "cpu_", task->pcTaskName);
+                cJSON_AddNumberToObject(root, key, cpu_permille / 10.0);
+                key_name(key, sizeof(key), "stack_", task->pcTaskName);
+                cJSON_AddNumberToObject(root, key, stack_free);
+            }
+            next[i].task_number = task->xTaskNumber;
+            next[i].run_time = task->ulRunTimeCounter;
+        }
+        s_prev = next;
+        s_prev_count = count;
+        s_prev_total = total;
+
+        if (root == NULL) {
+            ESP_LOGE(TAG, "Failed to create JSON object");
+            continue;
+        }
+        mqtt_app_publish("v1/devices/me/telemetry", root);
+        cJSON_Delete(root);
+    }
+    vTaskDelete(NULL);
+}
+#endif /* CONFIG_APP_TASK_STATS_ENABLE */
+
+void task_stats_start(void)
+{
+#if CONFIG_APP_TASK_STATS_ENABLE
+    static bool is_task_stats_started = false;
+
+    if (!is_task_stats_started) {
+        xTaskCreate(task_stats_task, "task stats", 3072, NULL, 1, NULL);
+        is_task_stats_started = true;
+    }
+#endif
+}
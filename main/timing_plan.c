@@ -0,0 +1,147 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "timing_plan.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define TIMING_PLAN_MAGIC       (0x504c4e31)   /* bumped with every timing_plan_t change */
+#define TIMING_PLAN_NAMESPACE   "signal"
+#define TIMING_PLAN_KEY         "timing"
+
+static const char *TAG = "timing_plan";
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef struct {
+    uint32_t magic;
+    timing_plan_t plan;
+    uint32_t crc;
+} timing_plan_record_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static uint32_t record_crc(const timing_plan_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *) record, offsetof(timing_plan_record_t, crc));
+}
+
+static bool in_range(uint8_t value, uint8_t min, uint8_t max)
+{
+    return value >= min && value <= max;
+}
+
+bool timing_plan_is_valid(const timing_plan_t *plan)
+{
+    return in_range(plan->minimum_green, TIMING_PLAN_GREEN_MIN, TIMING_PLAN_GREEN_MAX) &&
+           in_range(plan->yellow, TIMING_PLAN_YELLOW_MIN, TIMING_PLAN_YELLOW_MAX) &&
+           in_range(plan->red, TIMING_PLAN_RED_MIN, TIMING_PLAN_RED_MAX) &&
+           in_range(plan->change_red, TIMING_PLAN_CHANGE_RED_MIN, TIMING_PLAN_CHANGE_RED_MAX) &&
+           (plan->all_red == TIMING_PLAN_KEEP || plan->all_red <= TIMING_PLAN_ALL_RED_MAX);
+}
+
+esp_err_t timing_plan_load(timing_plan_t *plan)
+{
+    timing_plan_record_t record;
+    size_t len = sizeof(record);
+    nvs_handle_t nvs;
+
+    if (nvs_open(TIMING_PLAN_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = nvs_get_blob(nvs, TIMING_PLAN_KEY, &record, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (len != sizeof(record) || record.magic != TIMING_PLAN_MAGIC ||
+        record.crc != record_crc(&record) || !timing_plan_is_valid(&record.plan)) {
+        // the firmware defaults are always safe, no reason to stop
+        ESP_LOGW(TAG, "Stored timing plan unusable, using the firmware defaults");
+        return ESP_ERR_NOT_FOUND;
+    }
+    *plan = record.plan;
+    return ESP_OK;
+}
+
+esp_err_t timing_plan_save(const timing_plan_t *plan)
+{
+    timing_plan_record_t record = { .magic = TIMING_PLAN_MAGIC, .plan = *plan };
+    nvs_handle_t nvs;
+
+    record.crc = record_crc(&record);
+    esp_err_t err = nvs_open(TIMING_PLAN_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs, TIMING_PLAN_KEY, &record, sizeof(record));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+static bool json_seconds(const cJSON *json, const char *name, uint8_t *out)
+{
+    const cJSON *item = cJSON_GetObjectItem(json, name);
+
+    if (!cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble > UINT8_MAX - 1) {
+        return false;
+    }
+    *out = (uint8_t) item->valuedouble;
+    return true;
+}
+
+esp_err_t timing_plan_from_json(const cJSON *json, timing_plan_t *plan)
+{
+    timing_plan_t parsed = { .all_red = TIMING_PLAN_KEEP };
+
+    if (!json_seconds(json, "minimum_green", &parsed.minimum_green) ||
+        !json_seconds(json, "yellow", &parsed.yellow) ||
+        !json_seconds(json, "red", &parsed.red) ||
+        !json_seconds(json, "change_red", &parsed.change_red)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (cJSON_GetObjectItem(json, "all_red") && !json_seconds(json, "all_red", &parsed.all_red)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!timing_plan_is_valid(&parsed)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *plan = parsed;
+    return ESP_OK;
+}
+
+void timing_plan_apply(const timing_plan_t *plan, traffic_timing_t *timing)
+{
+    timing->minimum_green = plan->minimum_green;
+    timing->yellow = plan->yellow;
+    timing->red = plan->red;
+    timing->change_red = plan->change_red;
+    if (plan->all_red != TIMING_PLAN_KEEP) {
+        timing->all_red = plan->all_red;
+    }
+}
+
+void timing_plan_to_record(const traffic_timing_t *timing, mqtt_pub_record_t *rec)
+{
+    mqtt_pub_add(rec, "minimum_green", timing->minimum_green);
+    mqtt_pub_add(rec, "yellow", timing->yellow);
+    mqtt_pub_add(rec, "red", timing->red);
+    mqtt_pub_add(rec, "change_red", timing->change_red);
+    mqtt_pub_add(rec, "all_red", timing->all_red);
+}
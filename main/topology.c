@@ -0,0 +1,119 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "topology.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void topology_init(topology_t *t, topology_node_t *nodes, uint16_t max)
+{
+    t->node = nodes;
+    t->max = max;
+    t->count = 0;
+}
+
+bool topology_update(topology_t *t, const topology_report_t *report, int64_t now_us)
+{
+    topology_node_t *n = NULL;
+
+    for (int i = 0; i < t->count; ++i) {
+        if (memcmp(t->node[i].report.src, report->src, 6) == 0) {
+            n = &t->node[i];
+            break;
+        }
+    }
+    if (n == NULL) {
+        if (t->count == t->max) {
+            return false;
+        }
+        n = &t->node[t->count++];
+    }
+    n->report = *report;
+    n->seen_us = now_us;
+    return true;
+}
+
+int topology_expire(topology_t *t, int64_t now_us, int64_t max_age_us)
+{
+    int removed = 0;
+
+    for (int i = 0; i < t->count;) {
+        if (now_us - t->node[i].seen_us > max_age_us) {
+            // order does not matter, the last one takes the slot
+            t->node[i] = t->node[--t->count];
+            removed++;
+        } else {
+            ++i;
+        }
+    }
+    return removed;
+}
+
+void topology_summary(const topology_t *t, topology_summary_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->nodes = t->count;
+    for (int i = 0; i < t->count; ++i) {
+        const topology_report_t *r = &t->node[i].report;
+        if (r->layer > out->layers) {
+            out->layers = r->layer;
+        }
+        if (r->parent_rssi != TOPOLOGY_RSSI_NONE && r->parent_rssi < TOPOLOGY_RSSI_WEAK) {
+            out->weak_links++;
+        }
+        if (r->children > out->max_children) {
+            out->max_children = r->children;
+        }
+        out->tx_err += r->tx_err;
+    }
+}
+
+/* Orders links weakest first, more failed sends first on the same RSSI */
+static bool link_weaker(const topology_report_t *a, const topology_report_t *b)
+{
+    return a->parent_rssi != b->parent_rssi ? a->parent_rssi < b->parent_rssi : a->tx_err > b->tx_err;
+}
+
+int topology_worst(const topology_t *t, int n, char *out, size_t size)
+{
+    const topology_report_t *worst[TOPOLOGY_WORST_MAX];
+    int found = 0;
+    int len;
+
+    if (n > TOPOLOGY_WORST_MAX) {
+        n = TOPOLOGY_WORST_MAX;
+    }
+    // insertion into the n kept so far, the table is a few hundred nodes at most
+    for (int i = 0; i < t->count && n > 0; ++i) {
+        const topology_report_t *r = &t->node[i].report;
+        if (r->parent_rssi == TOPOLOGY_RSSI_NONE || (found == n && !link_weaker(r, worst[n - 1]))) {
+            continue;
+        }
+        int j = found < n ? found++ : n - 1;
+        for (; j > 0 && link_weaker(r, worst[j - 1]); --j) {
+            worst[j] = worst[j - 1];
+        }
+        worst[j] = r;
+    }
+    if (found == 0) {
+        return 0;
+    }
+    len = snprintf(out, size, "{\"topology_worst\":\"");
+    for (int i = 0; i < found && (size_t) len < size; ++i) {
+        const uint8_t *mac = worst[i]->src;
+        len += snprintf(out + len, size - len, "%s%02x%02x%02x%02x%02x%02x:%d:%u", i ? "," : "",
+                        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], worst[i]->parent_rssi, worst[i]->tx_err);
+    }
+    if ((size_t) len < size) {
+        len += snprintf(out + len, size - len, "\"}");
+    }
+    return (size_t) len < size ? len : 0;
+}
@@ -0,0 +1,357 @@
+/* Mesh Internal Communication Example
+
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <sys/param.h>
+#include "esp_mesh.h"
+#include "traffic_light.h"
+#include "traffic_controller.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define GROUP_BIT(g)    (1U << (g))
+
+#define INTERVAL_GREEN      (0)
+#define INTERVAL_YELLOW     (1)
+#define INTERVAL_ALL_RED    (2)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+const traffic_plan_t traffic_plan_single = {
+    .n_phases = 2,
+    .vehicle_groups = GROUP_BIT(TRAFFIC_GROUP_VEHICLE),
+    .pedestrian_groups = GROUP_BIT(TRAFFIC_GROUP_PEDESTRIAN),
+    .phase = {
+        { .green_groups = GROUP_BIT(TRAFFIC_GROUP_VEHICLE) },
+        { .walk_groups = GROUP_BIT(TRAFFIC_GROUP_PEDESTRIAN) },
+    },
+};
+
+const traffic_plan_t traffic_plan_four_way = {
+    .n_phases = 3,
+    .vehicle_groups = GROUP_BIT(TRAFFIC_GROUP_VEHICLE) | GROUP_BIT(TRAFFIC_GROUP_SIDE_STREET),
+    .pedestrian_groups = GROUP_BIT(TRAFFIC_GROUP_PEDESTRIAN),
+    .phase = {
+        { .green_groups = GROUP_BIT(TRAFFIC_GROUP_VEHICLE) },
+        { .green_groups = GROUP_BIT(TRAFFIC_GROUP_SIDE_STREET) },
+        { .walk_groups = GROUP_BIT(TRAFFIC_GROUP_PEDESTRIAN) },
+    },
+};
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void traffic_controller_init(traffic_controller_t *ctl, const traffic_timing_t *timing,
+                             const traffic_plan_t *plan)
+{
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->timing = *timing;
+    ctl->plan = plan;
+    ctl->st.phase = 0;
+    ctl->st.color_pos = INTERVAL_GREEN;     //color_pos: 0 = verde, 1 = cambio, 2 = rojo
+    ctl->st.ped_color_pos = 1;
+}
+
+void traffic_controller_safe_hold(traffic_controller_t *ctl)
+{
+    ctl->st = (signal_state_t) { .phase = 0, .color_pos = INTERVAL_ALL_RED, .ped_color_pos = 1, .timer = 0 };
+    ctl->safe_hold = ctl->timing.change_red;
+}
+
+bool traffic_controller_retime(traffic_controller_t *ctl, const traffic_timing_t *timing)
+{
+    if (ctl->preempt != TRAFFIC_PREEMPT_NONE || ctl->safe_hold > 0 ||
+        ctl->st.phase != 0 || ctl->st.color_pos != INTERVAL_GREEN) {
+        return false;
+    }
+    ctl->timing = *timing;
+    if (ctl->st.timer > timing->minimum_green) {
+        ctl->st.timer = timing->minimum_green;
+    }
+    return true;
+}
+
+void traffic_controller_lamps(const traffic_controller_t *ctl, traffic_step_t *out)
+{
+    const traffic_plan_t *plan = ctl->plan;
+    const traffic_phase_t *ph = &plan->phase[ctl->st.phase];
+
+    for (int g = 0; g < TRAFFIC_GROUP_MAX; ++g) {
+        if (plan->vehicle_groups & GROUP_BIT(g)) {
+            static const int vehicle[] = { TRAFFIC_LIGHT_GREEN, TRAFFIC_LIGHT_YELLOW, TRAFFIC_LIGHT_RED };
+            out->lamp[g] = vehicle[traffic_controller_group_color(ctl, g)];
+        } else if (plan->pedestrian_groups & GROUP_BIT(g)) {
+            bool walk = ctl->st.color_pos == INTERVAL_GREEN && (ph->walk_groups & GROUP_BIT(g));
+            if (ctl->preempt != TRAFFIC_PREEMPT_NONE) {
+                bool clearing = ctl->preempt == TRAFFIC_PREEMPT_ENTRY_YELLOW && (ctl->preempt_clear & GROUP_BIT(g));
+                out->lamp[g] = clearing ? TRAFFIC_LIGHT_GREEN_BLINK : TRAFFIC_LIGHT_RED;
+            } else if (!walk) {
+                out->lamp[g] = TRAFFIC_LIGHT_RED;
+            } else if (ctl->st.timer < ctl->timing.change_red) {
+                out->lamp[g] = TRAFFIC_LIGHT_GREEN_BLINK;
+            } else {
+                out->lamp[g] = TRAFFIC_LIGHT_GREEN;
+            }
+        } else {
+            out->lamp[g] = TRAFFIC_LAMP_KEEP;
+        }
+    }
+}
+
+uint8_t traffic_controller_group_color(const traffic_controller_t *ctl, uint8_t group)
+{
+    const traffic_phase_t *ph = &ctl->plan->phase[ctl->st.phase];
+
+    switch (ctl->preempt) {
+    case TRAFFIC_PREEMPT_NONE:
+        break;
+    case TRAFFIC_PREEMPT_ENTRY_YELLOW:
+        return (ctl->preempt_clear & GROUP_BIT(group)) ? 1 : 2;
+    case TRAFFIC_PREEMPT_GREEN:
+        return group == ctl->preempt_group ? 0 : 2;
+    case TRAFFIC_PREEMPT_EXIT_YELLOW:
+        return group == ctl->preempt_group ? 1 : 2;
+    default:
+        return 2;
+    }
+    if (!(ph->green_groups & GROUP_BIT(group)) || ctl->st.color_pos == INTERVAL_ALL_RED) {
+        return 2;
+    }
+    return ctl->st.color_pos;
+}
+
+bool traffic_controller_walk(const traffic_controller_t *ctl)
+{
+    const traffic_phase_t *ph = &ctl->plan->phase[ctl->st.phase];
+
+    return ctl->preempt == TRAFFIC_PREEMPT_NONE && ph->walk_groups && ctl->st.color_pos == INTERVAL_GREEN && ctl->st.phase != 0 &&
+           ctl->st.timer >= ctl->timing.change_red;
+}
+
+static void enter_phase(traffic_controller_t *ctl, uint8_t phase, traffic_step_t *out)
+{
+    signal_state_t *st = &ctl->st;
+    const traffic_timing_t *t = &ctl->timing;
+
+    st->phase = phase;
+    st->color_pos = INTERVAL_GREEN;
+    st->ped_color_pos = ctl->plan->phase[phase].walk_groups ? 0 : 1;
+    if (phase == 0) {
+        st->timer = t->minimum_green;
+        out->request_served = true;
+    } else {
+        st->timer = t->red + t->change_red;
+    }
+    traffic_controller_lamps(ctl, out);
+    out->phase_changed = true;
+}
+
+static void leave_phase(traffic_controller_t *ctl, traffic_step_t *out)
+{
+    signal_state_t *st = &ctl->st;
+    const traffic_timing_t *t = &ctl->timing;
+
+    // vehicles get yellow, then everybody red for the clearance, then the next phase
+    if (st->color_pos == INTERVAL_GREEN && ctl->plan->phase[st->phase].green_groups) {
+        st->color_pos = INTERVAL_YELLOW;
+        st->ped_color_pos = 1;
+        st->timer = t->yellow;
+    } else if (st->color_pos != INTERVAL_ALL_RED && t->all_red > 0) {
+        st->color_pos = INTERVAL_ALL_RED;
+        st->ped_color_pos = 1;
+        st->timer = t->all_red;
+    } else {
+        enter_phase(ctl, (st->phase + 1) % ctl->plan->n_phases, out);
+        return;
+    }
+    traffic_controller_lamps(ctl, out);
+    out->phase_changed = true;
+}
+
+static void preempt_enter(traffic_controller_t *ctl, traffic_preempt_t stage, uint8_t steps,
+                          traffic_step_t *out)
+{
+    ctl->preempt = stage;
+    ctl->preempt_timer = steps;
+    traffic_controller_lamps(ctl, out);
+    out->phase_changed = true;
+}
+
+static uint8_t preempt_all_red(const traffic_controller_t *ctl)
+{
+    return MAX(ctl->timing.all_red, TRAFFIC_PREEMPT_ALL_RED_MIN);
+}
+
+static void preempt_resume(traffic_controller_t *ctl, traffic_step_t *out)
+{
+    signal_state_t *st = &ctl->st;
+
+    // back to the rest phase; a request made during the preemption is served next
+    ctl->preempt = TRAFFIC_PREEMPT_NONE;
+    st->phase = 0;
+    st->color_pos = INTERVAL_GREEN;
+    st->ped_color_pos = 1;
+    st->timer = ctl->timing.minimum_green;
+    traffic_controller_lamps(ctl, out);
+    out->phase_changed = true;
+}
+
+/* extra is 1 outside traffic_controller_step(), the next step may be just after */
+static void preempt_release(traffic_controller_t *ctl, uint8_t extra, traffic_step_t *out)
+{
+    if (ctl->plan->phase[0].green_groups & GROUP_BIT(ctl->preempt_group)) {
+        preempt_resume(ctl, out);
+    } else {
+        preempt_enter(ctl, TRAFFIC_PREEMPT_EXIT_YELLOW, ctl->timing.yellow + extra, out);
+    }
+}
+
+static void preempt_step(traffic_controller_t *ctl, traffic_step_t *out)
+{
+    if (ctl->preempt == TRAFFIC_PREEMPT_GREEN) {
+        if (ctl->preempt_hold > 0) {
+            ctl->preempt_hold--;
+        }
+        if (ctl->preempt_hold == 0) {
+            preempt_release(ctl, 0, out);
+        }
+        return;
+    }
+    if (ctl->preempt_timer > 1) {
+        ctl->preempt_timer--;
+        return;
+    }
+    switch (ctl->preempt) {
+    case TRAFFIC_PREEMPT_ENTRY_YELLOW:
+        preempt_enter(ctl, TRAFFIC_PREEMPT_ENTRY_RED, preempt_all_red(ctl), out);
+        break;
+    case TRAFFIC_PREEMPT_ENTRY_RED:
+        if (ctl->preempt_hold > 0) {
+            preempt_enter(ctl, TRAFFIC_PREEMPT_GREEN, 0, out);
+        } else {
+            preempt_resume(ctl, out);
+        }
+        break;
+    case TRAFFIC_PREEMPT_EXIT_YELLOW:
+        preempt_enter(ctl, TRAFFIC_PREEMPT_EXIT_RED, preempt_all_red(ctl), out);
+        break;
+    default:
+        preempt_resume(ctl, out);
+        break;
+    }
+}
+
+bool traffic_controller_preempt(traffic_controller_t *ctl, uint8_t group, bool active,
+                                traffic_step_t *out)
+{
+    const traffic_plan_t *plan = ctl->plan;
+    traffic_step_t now;
+
+    memset(out, 0, sizeof(*out));
+    for (int g = 0; g < TRAFFIC_GROUP_MAX; ++g) {
+        out->lamp[g] = TRAFFIC_LAMP_KEEP;
+    }
+    if (group >= TRAFFIC_GROUP_MAX || !(plan->vehicle_groups & GROUP_BIT(group))) {
+        return false;
+    }
+
+    if (!active) {
+        if (ctl->preempt == TRAFFIC_PREEMPT_NONE || group != ctl->preempt_group) {
+            return false;
+        }
+        ctl->preempt_hold = 0;
+        if (ctl->preempt == TRAFFIC_PREEMPT_GREEN) {
+            preempt_release(ctl, 1, out);
+        }
+        return true;
+    }
+
+    ctl->preempt_hold = ctl->timing.preempt_max;
+    if (group == ctl->preempt_group &&
+        (ctl->preempt == TRAFFIC_PREEMPT_ENTRY_YELLOW || ctl->preempt == TRAFFIC_PREEMPT_ENTRY_RED ||
+         ctl->preempt == TRAFFIC_PREEMPT_GREEN)) {
+        // same vehicle, or the next one on the same approach
+        return true;
+    }
+
+    // groups that are not red now have to clear first
+    uint8_t moving = 0;
+    traffic_controller_lamps(ctl, &now);
+    for (int g = 0; g < TRAFFIC_GROUP_MAX; ++g) {
+        if (now.lamp[g] != TRAFFIC_LAMP_KEEP && now.lamp[g] != TRAFFIC_LIGHT_RED) {
+            moving |= GROUP_BIT(g);
+        }
+    }
+
+    // the cycle restarts from a safe state, which is also what gets persisted
+    ctl->st = (signal_state_t) { .phase = 0, .color_pos = INTERVAL_ALL_RED, .ped_color_pos = 1, .timer = 0,
+                                 .button_pressed = ctl->st.button_pressed };
+    ctl->safe_hold = 0;
+    ctl->preempt_group = group;
+    ctl->preempt_clear = moving;
+    if (moving == GROUP_BIT(group) && now.lamp[group] == TRAFFIC_LIGHT_GREEN) {
+        preempt_enter(ctl, TRAFFIC_PREEMPT_GREEN, 0, out);
+    } else if (moving) {
+        preempt_enter(ctl, TRAFFIC_PREEMPT_ENTRY_YELLOW, ctl->timing.yellow + 1, out);
+    } else {
+        preempt_enter(ctl, TRAFFIC_PREEMPT_ENTRY_RED, preempt_all_red(ctl) + 1, out);
+    }
+    return true;
+}
+
+void traffic_controller_step(traffic_controller_t *ctl, bool request, traffic_step_t *out)
+{
+    signal_state_t *st = &ctl->st;
+    const traffic_timing_t *t = &ctl->timing;
+    const traffic_phase_t *ph = &ctl->plan->phase[st->phase];
+
+    memset(out, 0, sizeof(*out));
+    for (int g = 0; g < TRAFFIC_GROUP_MAX; ++g) {
+        out->lamp[g] = TRAFFIC_LAMP_KEEP;
+    }
+
+    if (ctl->preempt != TRAFFIC_PREEMPT_NONE) {
+        preempt_step(ctl, out);
+    } else if (ctl->safe_hold > 0) {
+        if (--ctl->safe_hold == 0) {
+            st->phase = 0;
+            st->color_pos = INTERVAL_GREEN;
+            st->timer = t->minimum_green;
+            traffic_controller_lamps(ctl, out);
+            out->phase_changed = true;
+        }
+    } else if (request) {
+        if (st->timer <= 0) {
+            leave_phase(ctl, out);
+        } else {
+            //Parpadeo del verde peatonal al final de la fase servida, lo hace el hardware
+            if (st->color_pos == INTERVAL_GREEN && st->phase != 0 && ph->walk_groups &&
+                st->timer == t->change_red) {
+                for (int g = 0; g < TRAFFIC_GROUP_MAX; ++g) {
+                    if (ph->walk_groups & GROUP_BIT(g)) {
+                        out->lamp[g] = TRAFFIC_LIGHT_GREEN_BLINK;
+                    }
+                }
+            }
+            st->timer--;
+        }
+    } else {
+        if (st->phase != 0 || st->color_pos != INTERVAL_GREEN) {
+            st->phase = 0;
+            st->color_pos = INTERVAL_GREEN;
+            st->ped_color_pos = 1;
+            out->phase_changed = true;
+        }
+        traffic_controller_lamps(ctl, out);
+        if (st->timer > 0) {
+            st->timer--;
+        }
+    }
+}
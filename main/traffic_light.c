@@ -12,18 +12,9 @@
 #include "esp_err.h"
 #include "esp_mesh.h"
 #include "traffic_light.h"
+#include "signal_head.h"
+#include "binlog.h"
 #include "driver/gpio.h"
-#include "driver/ledc.h"
-
-/*******************************************************
- *                Constants
- *******************************************************/
-/* RGB configuration on ESP-WROVER-KIT board */
-#define LED_PIN_1 GPIO_NUM_0 
-#define LED_PIN_2 GPIO_NUM_2
-#define LED_PIN_3 GPIO_NUM_4
-#define PED_LED_PIN_1 GPIO_NUM_16 
-#define PED_LED_PIN_2 GPIO_NUM_17
 
 /*******************************************************
  *                Variable Definitions
@@ -31,8 +22,6 @@
 static bool s_light_inited = false;
 static bool s_button_inited = false;
 static bool s_infra_inited = false;
-static uint8_t state[2] = {0x00, 0x00};
-static const char *TAG = "traffic_light";
 
 /*******************************************************
  *                Function Definitions
@@ -42,21 +31,11 @@ esp_err_t traffic_light_init(void)
     if (s_light_inited == true) {
         return ESP_OK;
     }
+    esp_err_t err = signal_head_init();
+    if (err != ESP_OK) {
+        return err;
+    }
     s_light_inited = true;
-    
-    gpio_reset_pin(LED_PIN_1);
-    gpio_reset_pin(LED_PIN_2);
-    gpio_reset_pin(LED_PIN_3);
-    gpio_reset_pin(PED_LED_PIN_1);
-    gpio_reset_pin(PED_LED_PIN_2);
-
-    gpio_set_direction(LED_PIN_1, GPIO_MODE_OUTPUT);
-    gpio_set_direction(LED_PIN_2, GPIO_MODE_OUTPUT);
-    gpio_set_direction(LED_PIN_3, GPIO_MODE_OUTPUT);
-    gpio_set_direction(PED_LED_PIN_1, GPIO_MODE_OUTPUT);
-    gpio_set_direction(PED_LED_PIN_2, GPIO_MODE_OUTPUT);
-
-    traffic_light_set(TRAFFIC_LIGHT_INIT);
     return ESP_OK;
 }
 
@@ -114,83 +93,16 @@ esp_err_t movement_sensor_init(void)
     return ESP_OK;
 }
 
+/* Main street heads */
 esp_err_t traffic_light_set(int color)
 {
-    switch (color) {
-    case TRAFFIC_LIGHT_RED:
-        /* Red */
-        gpio_set_level(LED_PIN_1, 1);
-        gpio_set_level(LED_PIN_2, 0);
-        gpio_set_level(LED_PIN_3, 0);
-        break;
-    case TRAFFIC_LIGHT_YELLOW:
-        /* Yellow */
-        gpio_set_level(LED_PIN_1, 0);
-        gpio_set_level(LED_PIN_2, 1);
-        gpio_set_level(LED_PIN_3, 0);
-        break;
-    case TRAFFIC_LIGHT_GREEN:
-        /* Green */
-        gpio_set_level(LED_PIN_1, 0);
-        gpio_set_level(LED_PIN_2, 0);
-        gpio_set_level(LED_PIN_3, 1);
-        break;
-    case TRAFFIC_LIGHT_INIT:
-        /* can't say */
-        gpio_set_level(LED_PIN_1, 1);
-        gpio_set_level(LED_PIN_2, 1);
-        gpio_set_level(LED_PIN_3, 1);
-        break;
-    case TRAFFIC_LIGHT_WARNING:
-        /* warning */
-        gpio_set_level(LED_PIN_1, 1);
-        gpio_set_level(LED_PIN_2, 1);
-        gpio_set_level(LED_PIN_3, 0);
-        break;
-    default:
-        /* off */
-        gpio_set_level(LED_PIN_1, 0);
-        gpio_set_level(LED_PIN_2, 0);
-        gpio_set_level(LED_PIN_3, 0);
-    }
-	
-	state[0] = color;
-	ESP_LOGI(TAG, "Semaforo establecido: %i", color);
-    return ESP_OK;
+    return signal_group_set(TRAFFIC_GROUP_VEHICLE, color);
 }
 
+/* Crosswalk heads */
 esp_err_t pedestrian_traffic_light_set(int color)
 {
-    switch (color) {
-    case TRAFFIC_LIGHT_RED:
-        /* Red */
-        gpio_set_level(PED_LED_PIN_1, 1);
-        gpio_set_level(PED_LED_PIN_2, 0);
-        break;
-    case TRAFFIC_LIGHT_GREEN:
-        /* Green */
-        gpio_set_level(PED_LED_PIN_1, 0);
-        gpio_set_level(PED_LED_PIN_2, 1);
-        break;
-    case TRAFFIC_LIGHT_INIT:
-        /* can't say */
-        gpio_set_level(PED_LED_PIN_1, 1);
-        gpio_set_level(PED_LED_PIN_2, 0);
-        break;
-    case TRAFFIC_LIGHT_WARNING:
-        /* warning */
-        gpio_set_level(PED_LED_PIN_1, 1);
-        gpio_set_level(PED_LED_PIN_2, 1);
-        break;
-    default:
-        /* off */
-        gpio_set_level(PED_LED_PIN_1, 0);
-        gpio_set_level(PED_LED_PIN_2, 0);
-    }
-	
-	state[1] = color;
-	ESP_LOGI(TAG, "Semaforo establecido: %i", color);
-    return ESP_OK;
+    return signal_group_set(TRAFFIC_GROUP_PEDESTRIAN, color);
 }
 
 void traffic_light_state(int state)